@@ -18,12 +18,46 @@
 #include "MQTTClient.h"
 #include "aws_iot_config.h"
 
-static Client c;
+#ifndef AWS_IOT_MQTT_NUM_TOPIC_TRIE_NODES
+#define AWS_IOT_MQTT_NUM_TOPIC_TRIE_NODES (AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS * 8)
+#endif
 
-static iot_disconnect_handler clientDisconnectHandler;
+#ifndef AWS_IOT_MQTT_MAX_CLIENT_INSTANCES
+#define AWS_IOT_MQTT_MAX_CLIENT_INSTANCES 1
+#endif
 
-static unsigned char writebuf[AWS_IOT_MQTT_TX_BUF_LEN];
-static unsigned char readbuf[AWS_IOT_MQTT_RX_BUF_LEN];
+/**
+ * @brief Everything one MQTT connection needs, instance 0 is the default connection
+ */
+typedef struct {
+	Client c;
+	unsigned char writebuf[AWS_IOT_MQTT_TX_BUF_LEN];
+	unsigned char readbuf[AWS_IOT_MQTT_RX_BUF_LEN];
+	struct MessageHandlers subscriptionHandlers[AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS];
+	MQTTTopicTrieNode subscriptionTrieNodes[AWS_IOT_MQTT_NUM_TOPIC_TRIE_NODES];
+	iot_message_chunk_handler messageChunkHandler;	///< Kept here as the MQTT client is reset on a clean session connect
+	MQTTOfflineQueueConfig offlineQueueConfig;	///< Likewise, pStorage is NULL without an offline queue
+	iot_publish_complete_handler offlineCompleteHandler;
+	MQTTReconnectPolicyConfig reconnectConfig;	///< Likewise, applied when the MQTT client is set up
+	bool isReconnectConfigSet;
+	bool isPowerCycle;	///< Set until the MQTT client of this instance has been initialized
+	bool isInUse;
+} ClientInstance;
+
+static ClientInstance instances[AWS_IOT_MQTT_MAX_CLIENT_INSTANCES] = {
+		[0] = {.isPowerCycle = true, .isInUse = true}
+};
+
+static MQTTClient_t defaultClient = {
+		.pInstance = &instances[0]
+};
+
+static ClientInstance *getInstance(MQTTClient_t *pClient) {
+	if(NULL == pClient) {
+		return NULL;
+	}
+	return (ClientInstance *)(pClient->pInstance);
+}
 
 const MQTTConnectParams MQTTConnectParamsDefault = {
 		.enableAutoReconnect = 0,
@@ -32,6 +66,12 @@ const MQTTConnectParams MQTTConnectParamsDefault = {
 		.pRootCALocation = NULL,
 		.pDeviceCertLocation = NULL,
 		.pDevicePrivateKeyLocation = NULL,
+		.pRootCADer = NULL,
+		.RootCADerLen = 0,
+		.pDeviceCertDer = NULL,
+		.DeviceCertDerLen = 0,
+		.pDevicePrivateKeyDer = NULL,
+		.DevicePrivateKeyDerLen = 0,
 		.pClientID = NULL,
 		.pUserName = NULL,
 		.pPassword = NULL,
@@ -48,7 +88,8 @@ const MQTTConnectParams MQTTConnectParamsDefault = {
 
 const MQTTPublishParams MQTTPublishParamsDefault={
 		.pTopic = NULL,
-		.MessageParams = {.qos = QOS_0, .isRetained=false, .isDuplicate = false, .id = 0, .pPayload = NULL, .PayloadLen = 0}
+		.MessageParams = {.qos = QOS_0, .isRetained=false, .isDuplicate = false, .id = 0, .pPayload = NULL, .PayloadLen = 0,
+				.OfflineTTL_sec = 0}
 };
 const MQTTSubscribeParams MQTTSubscribeParamsDefault={
 		.pTopic = NULL,
@@ -58,7 +99,8 @@ const MQTTSubscribeParams MQTTSubscribeParamsDefault={
 const MQTTCallbackParams MQTTCallbackParamsDefault={
 		.pTopicName = NULL,
 		.TopicNameLen = 0,
-		.MessageParams = {.qos = QOS_0, .isRetained=false, .isDuplicate = false, .id = 0, .pPayload = NULL, .PayloadLen = 0}
+		.MessageParams = {.qos = QOS_0, .isRetained=false, .isDuplicate = false, .id = 0, .pPayload = NULL, .PayloadLen = 0,
+				.OfflineTTL_sec = 0}
 };
 const MQTTMessageParams MQTTMessageParamsDefault={
 		.qos = QOS_0,
@@ -66,7 +108,25 @@ const MQTTMessageParams MQTTMessageParamsDefault={
 		.isDuplicate = false,
 		.id = 0,
 		.pPayload = NULL,
-		.PayloadLen = 0
+		.PayloadLen = 0,
+		.OfflineTTL_sec = 0
+};
+const MQTTOfflineQueueParams MQTTOfflineQueueParamsDefault={
+		.pStorage = NULL,
+		.StorageLen = 0,
+		.DropPolicy = OFFLINE_DROP_NEWEST,
+		.DefaultTTL_sec = 0,
+		.getTimeSec = NULL,
+		.completeHandler = NULL
+};
+const MQTTReconnectParams MQTTReconnectParamsDefault={
+		.Strategy = RECONNECT_DECORRELATED_JITTER,
+		.MinDelay_ms = AWS_IOT_MQTT_MIN_RECONNECT_WAIT_INTERVAL,
+		.MaxDelay_ms = AWS_IOT_MQTT_MAX_RECONNECT_WAIT_INTERVAL,
+		.MaxAttempts = 0,
+		.Seed = 0,
+		.getDelay = NULL,
+		.pContext = NULL
 };
 const MQTTwillOptions MQTTwillOptionsDefault={
 		.pTopicName = NULL,
@@ -101,19 +161,52 @@ void pahoMessageCallback(MessageData* md) {
 	((iot_message_handler)(md->applicationHandler))(params);
 }
 
-void pahoDisconnectHandler(void) {
-	if(NULL != clientDisconnectHandler) {
-		clientDisconnectHandler();
+void pahoMessageChunkCallback(MessageChunkData *mcd) {
+	MQTTMessage* message = mcd->message;
+	MQTTChunkCallbackParams params;
+
+	if (mcd->applicationHandler == NULL) {
+		return;
 	}
+
+	params.pTopicName = mcd->topicName->lenstring.data;
+	params.TopicNameLen = (uint16_t)(mcd->topicName->lenstring.len);
+	params.MessageParams.PayloadLen = mcd->chunkLen;
+	params.MessageParams.pPayload = (char*) mcd->chunk;
+	params.MessageParams.isDuplicate = message->dup;
+	params.MessageParams.qos = (QoSLevel)message->qos;
+	params.MessageParams.isRetained = message->retained;
+	params.MessageParams.id = message->id;
+	params.Offset = mcd->offset;
+	params.TotalPayloadLen = message->payloadlen & GETLOWER4BYTES;
+	params.isFinal = mcd->isFinal;
+
+	((iot_message_chunk_handler)(mcd->applicationHandler))(params);
 }
 
-static bool isPowerCycle = true;
+void pahoPublishCompleteCallback(PublishCompleteData *pcd) {
+	IoT_Error_t status = NONE_ERROR;
 
-IoT_Error_t aws_iot_mqtt_connect(MQTTConnectParams *pParams) {
+	if (NULL == pcd->applicationHandler) {
+		return;
+	}
+
+	if (MQTT_NETWORK_DISCONNECTED_ERROR == pcd->rc) {
+		status = NETWORK_DISCONNECTED;
+	} else if (SUCCESS != pcd->rc) {
+		status = PUBLISH_ERROR;
+	}
+
+	((iot_publish_complete_handler)(pcd->applicationHandler))(pcd->packetId, status, pcd->pApplicationContext);
+}
+
+IoT_Error_t aws_iot_mqtt_client_connect(MQTTClient_t *pClient, MQTTConnectParams *pParams) {
 	IoT_Error_t rc = NONE_ERROR;
 	MQTTReturnCode pahoRc = SUCCESS;
+	ClientInstance *pInstance = getInstance(pClient);
+	MQTTSubscriptionPool subscriptionPool;
 
-	if(NULL == pParams || NULL == pParams->pClientID || NULL == pParams->pHostURL) {
+	if(NULL == pInstance || NULL == pParams || NULL == pParams->pClientID || NULL == pParams->pHostURL) {
 		return NULL_VALUE_ERROR;
 	}
 
@@ -125,19 +218,46 @@ IoT_Error_t aws_iot_mqtt_connect(MQTTConnectParams *pParams) {
 	TLSParams.pRootCALocation = pParams->pRootCALocation;
 	TLSParams.timeout_ms = pParams->tlsHandshakeTimeout_ms;
 	TLSParams.ServerVerificationFlag = pParams->isSSLHostnameVerify;
+	TLSParams.pRootCADer = pParams->pRootCADer;
+	TLSParams.RootCADerLen = pParams->RootCADerLen;
+	TLSParams.pDeviceCertDer = pParams->pDeviceCertDer;
+	TLSParams.DeviceCertDerLen = pParams->DeviceCertDerLen;
+	TLSParams.pDevicePrivateKeyDer = pParams->pDevicePrivateKeyDer;
+	TLSParams.DevicePrivateKeyDerLen = pParams->DevicePrivateKeyDerLen;
 
 	// This implementation assumes you are not going to switch between cleansession 1 to 0
 	// As we don't have a default subscription handler support in the MQTT client every time 
 	// a device power cycles it has to re-subscribe to let the MQTT client to pass the message up to the application callback.
 	// The default message handler will be implemented in the future revisions.
-	if(pParams->isCleansession || isPowerCycle){
-		pahoRc = MQTTClient(&c, (unsigned int)(pParams->mqttCommandTimeout_ms), writebuf,
-				   AWS_IOT_MQTT_TX_BUF_LEN, readbuf, AWS_IOT_MQTT_RX_BUF_LEN,
+	if(pParams->isCleansession || pInstance->isPowerCycle){
+		subscriptionPool.pHandlers = pInstance->subscriptionHandlers;
+		subscriptionPool.handlerCount = AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS;
+		subscriptionPool.pTrieNodes = pInstance->subscriptionTrieNodes;
+		subscriptionPool.trieNodeCount = AWS_IOT_MQTT_NUM_TOPIC_TRIE_NODES;
+		if(!pInstance->isPowerCycle) {
+			MQTTClientFree(&(pInstance->c));
+		}
+		pahoRc = MQTTClient(&(pInstance->c), (unsigned int)(pParams->mqttCommandTimeout_ms), pInstance->writebuf,
+				   AWS_IOT_MQTT_TX_BUF_LEN, pInstance->readbuf, AWS_IOT_MQTT_RX_BUF_LEN, &subscriptionPool,
 				   pParams->enableAutoReconnect, iot_tls_init, &TLSParams);
 		if(SUCCESS != pahoRc) {
+			pInstance->isPowerCycle = true;
 			return CONNECTION_ERROR;
 		}
-		isPowerCycle = false;
+		pInstance->isPowerCycle = false;
+
+		if(NULL != pInstance->messageChunkHandler) {
+			setMessageChunkHandler(&(pInstance->c), pahoMessageChunkCallback,
+					(void (*)(void))(pInstance->messageChunkHandler));
+		}
+		if(NULL != pInstance->offlineQueueConfig.pStorage) {
+			// The queue picks up the messages already in its storage
+			MQTTSetOfflineQueue(&(pInstance->c), &(pInstance->offlineQueueConfig), pahoPublishCompleteCallback,
+					(void (*)(void))(pInstance->offlineCompleteHandler));
+		}
+		if(pInstance->isReconnectConfigSet) {
+			MQTTSetReconnectPolicy(&(pInstance->c), &(pInstance->reconnectConfig));
+		}
 	}
 
 	MQTTPacket_connectData data = MQTTPacket_connectData_initializer;
@@ -155,9 +275,9 @@ IoT_Error_t aws_iot_mqtt_connect(MQTTConnectParams *pParams) {
 		data.MQTTVersion = (unsigned char) (4); // default MQTT version = 3.1.1
 	}
 
-	// register our disconnect handler, save customer's handler
-	setDisconnectHandler(&c, pahoDisconnectHandler);
-	clientDisconnectHandler = pParams->disconnectHandler;
+	// the customer's handler has the same signature as the MQTT client's, register it directly.
+	// Every connect replaces it, a NULL one included, so a handler never outlives its connect
+	setDisconnectHandler(&(pInstance->c), pParams->disconnectHandler);
 
 	data.clientID.cstring = pParams->pClientID;
 	data.username.cstring = pParams->pUserName;
@@ -169,7 +289,7 @@ IoT_Error_t aws_iot_mqtt_connect(MQTTConnectParams *pParams) {
 	data.keepAliveInterval = pParams->KeepAliveInterval_sec;
 	data.cleansession = pParams->isCleansession;
 
-	pahoRc = MQTTConnect(&c, &data);
+	pahoRc = MQTTConnect(&(pInstance->c), &data);
 	if(MQTT_NETWORK_ALREADY_CONNECTED_ERROR == pahoRc) {
 		rc = NETWORK_ALREADY_CONNECTED;
 	} else if(SUCCESS != pahoRc) {
@@ -179,17 +299,70 @@ IoT_Error_t aws_iot_mqtt_connect(MQTTConnectParams *pParams) {
 	return rc;
 }
 
-IoT_Error_t aws_iot_mqtt_subscribe(MQTTSubscribeParams *pParams) {
+IoT_Error_t aws_iot_mqtt_client_subscribe(MQTTClient_t *pClient, MQTTSubscribeParams *pParams) {
 	IoT_Error_t rc = NONE_ERROR;
+	ClientInstance *pInstance = getInstance(pClient);
 
-	if (0 != MQTTSubscribe(&c, pParams->pTopic, (enum QoS)pParams->qos, pahoMessageCallback, (void (*)(void))(pParams->mHandler))) {
+	if(NULL == pInstance || NULL == pParams) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if (0 != MQTTSubscribe(&(pInstance->c), pParams->pTopic, (enum QoS)pParams->qos, pahoMessageCallback, (void (*)(void))(pParams->mHandler))) {
 			rc = SUBSCRIBE_ERROR;
 	}
 	return rc;
 }
 
-IoT_Error_t aws_iot_mqtt_publish(MQTTPublishParams *pParams) {
+IoT_Error_t aws_iot_mqtt_client_subscribe_many(MQTTClient_t *pClient, MQTTSubscribeParams *pParams, uint32_t count) {
+	IoT_Error_t rc = NONE_ERROR;
+	ClientInstance *pInstance = getInstance(pClient);
+	const char *topicFilters[MAX_SUBSCRIBE_BATCH];
+	QoS qos[MAX_SUBSCRIBE_BATCH];
+	QoS grantedQoS[MAX_SUBSCRIBE_BATCH];
+	pApplicationHandler_t applicationHandlers[MAX_SUBSCRIBE_BATCH];
+	uint32_t first;
+	uint32_t batchCount;
+	uint32_t i;
+
+	if(NULL == pInstance || NULL == pParams) {
+		return NULL_VALUE_ERROR;
+	}
+
+	for(first = 0; first < count; first += batchCount) {
+		batchCount = count - first;
+		if(MAX_SUBSCRIBE_BATCH < batchCount) {
+			batchCount = MAX_SUBSCRIBE_BATCH;
+		}
+
+		for(i = 0; i < batchCount; i++) {
+			topicFilters[i] = pParams[first + i].pTopic;
+			qos[i] = (enum QoS)pParams[first + i].qos;
+			applicationHandlers[i] = (void (*)(void))(pParams[first + i].mHandler);
+		}
+
+		if(0 != MQTTSubscribeMany(&(pInstance->c), batchCount, topicFilters, qos, pahoMessageCallback,
+				applicationHandlers, grantedQoS)) {
+			return SUBSCRIBE_ERROR;
+		}
+
+		for(i = 0; i < batchCount; i++) {
+			if(MQTT_SUBACK_FAILURE == (uint8_t)grantedQoS[i]) {
+				rc = SUBSCRIBE_ERROR;
+			}
+		}
+	}
+
+	return rc;
+}
+
+IoT_Error_t aws_iot_mqtt_client_publish(MQTTClient_t *pClient, MQTTPublishParams *pParams) {
 	IoT_Error_t rc = NONE_ERROR;
+	MQTTReturnCode pahoRc = SUCCESS;
+	ClientInstance *pInstance = getInstance(pClient);
+
+	if(NULL == pInstance || NULL == pParams) {
+		return NULL_VALUE_ERROR;
+	}
 
 	MQTTMessage Message;
 	Message.dup = pParams->MessageParams.isDuplicate;
@@ -198,36 +371,277 @@ IoT_Error_t aws_iot_mqtt_publish(MQTTPublishParams *pParams) {
 	Message.payloadlen = pParams->MessageParams.PayloadLen;
 	Message.qos = (enum QoS)pParams->MessageParams.qos;
 	Message.retained = pParams->MessageParams.isRetained;
+	Message.ttlSec = pParams->MessageParams.OfflineTTL_sec;
 
-	if(0 != MQTTPublish(&c, pParams->pTopic, &Message)){
+	pahoRc = MQTTPublish(&(pInstance->c), pParams->pTopic, &Message);
+	if(MQTT_PUBLISH_QUEUED == pahoRc) {
+		rc = PUBLISH_QUEUED;
+	} else if(MQTT_OFFLINE_QUEUE_FULL_ERROR == pahoRc) {
+		rc = OFFLINE_QUEUE_FULL_ERROR;
+	} else if(SUCCESS != pahoRc) {
 		rc = PUBLISH_ERROR;
 	}
 
 	return rc;
 }
 
-IoT_Error_t aws_iot_mqtt_unsubscribe(char *pTopic) {
+IoT_Error_t aws_iot_mqtt_client_publish_async(MQTTClient_t *pClient, MQTTPublishParams *pParams,
+		iot_publish_complete_handler handler, void *pContext) {
+	IoT_Error_t rc = NONE_ERROR;
+	MQTTReturnCode pahoRc = SUCCESS;
+	ClientInstance *pInstance = getInstance(pClient);
+
+	if(NULL == pInstance || NULL == pParams) {
+		return NULL_VALUE_ERROR;
+	}
+
+	MQTTMessage Message;
+	Message.dup = pParams->MessageParams.isDuplicate;
+	Message.id = pParams->MessageParams.id;
+	Message.payload = pParams->MessageParams.pPayload;
+	Message.payloadlen = pParams->MessageParams.PayloadLen;
+	Message.qos = (enum QoS)pParams->MessageParams.qos;
+	Message.retained = pParams->MessageParams.isRetained;
+	Message.ttlSec = pParams->MessageParams.OfflineTTL_sec;
+
+	pahoRc = MQTTPublishAsync(&(pInstance->c), pParams->pTopic, &Message, pahoPublishCompleteCallback,
+			(void (*)(void))handler, pContext);
+	if(MQTT_PUBLISH_WINDOW_FULL_ERROR == pahoRc) {
+		rc = PUBLISH_WINDOW_FULL_ERROR;
+	} else if(MQTT_PUBLISH_QUEUED == pahoRc) {
+		rc = PUBLISH_QUEUED;
+	} else if(MQTT_OFFLINE_QUEUE_FULL_ERROR == pahoRc) {
+		rc = OFFLINE_QUEUE_FULL_ERROR;
+	} else if(SUCCESS != pahoRc) {
+		rc = PUBLISH_ERROR;
+	}
+
+	return rc;
+}
+
+IoT_Error_t aws_iot_mqtt_client_publish_from_fd(MQTTClient_t *pClient, MQTTPublishParams *pParams, int fd,
+		int64_t offset) {
+	MQTTReturnCode pahoRc = SUCCESS;
+	ClientInstance *pInstance = getInstance(pClient);
+
+	if(NULL == pInstance || NULL == pParams) {
+		return NULL_VALUE_ERROR;
+	}
+
+	MQTTMessage Message;
+	Message.dup = pParams->MessageParams.isDuplicate;
+	Message.id = pParams->MessageParams.id;
+	Message.payload = NULL;
+	Message.payloadlen = pParams->MessageParams.PayloadLen;
+	Message.qos = (enum QoS)pParams->MessageParams.qos;
+	Message.retained = pParams->MessageParams.isRetained;
+	Message.ttlSec = 0;
+
+	pahoRc = MQTTPublishFromFd(&(pInstance->c), pParams->pTopic, &Message, fd, offset);
+	if(SUCCESS != pahoRc) {
+		return PUBLISH_ERROR;
+	}
+
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_mqtt_client_set_publish_window(MQTTClient_t *pClient, uint32_t windowSize) {
+	ClientInstance *pInstance = getInstance(pClient);
+	MQTTReturnCode pahoRc;
+
+	if(NULL == pInstance) {
+		return NULL_VALUE_ERROR;
+	}
+
+	pahoRc = MQTTSetPublishWindow(&(pInstance->c), windowSize);
+	if(MQTT_NULL_VALUE_ERROR == pahoRc) {
+		return NULL_VALUE_ERROR;
+	} else if(SUCCESS != pahoRc) {
+		return GENERIC_ERROR;
+	}
+
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_mqtt_client_set_adaptive_keepalive(MQTTClient_t *pClient, uint16_t minIntervalSec) {
+	ClientInstance *pInstance = getInstance(pClient);
+
+	if(NULL == pInstance) {
+		return NULL_VALUE_ERROR;
+	}
+
+	MQTTSetAdaptiveKeepalive(&(pInstance->c), minIntervalSec);
+	return NONE_ERROR;
+}
+
+static uint32_t pahoReconnectDelayCallback(void *pContext, uint32_t attempt, uint32_t previousDelayMs) {
+	MQTTReconnectParams *pParams = (MQTTReconnectParams *)pContext;
+
+	return pParams->getDelay(attempt, previousDelayMs, pParams->pContext);
+}
+
+IoT_Error_t aws_iot_mqtt_client_set_reconnect_policy(MQTTClient_t *pClient, MQTTReconnectParams *pParams) {
+	ClientInstance *pInstance = getInstance(pClient);
+	MQTTReconnectPolicyConfig *pConfig;
+
+	if(NULL == pInstance) {
+		return NULL_VALUE_ERROR;
+	}
+
+	pConfig = &(pInstance->reconnectConfig);
+	if(NULL == pParams) {
+		MQTTReconnectPolicy_legacyConfig(pConfig, MIN_RECONNECT_WAIT_INTERVAL, MAX_RECONNECT_WAIT_INTERVAL);
+	} else {
+		pConfig->strategy = (RECONNECT_DECORRELATED_JITTER == pParams->Strategy) ?
+				MQTT_RECONNECT_DECORRELATED_JITTER : MQTT_RECONNECT_EXPONENTIAL;
+		pConfig->minDelayMs = pParams->MinDelay_ms;
+		pConfig->maxDelayMs = pParams->MaxDelay_ms;
+		pConfig->maxAttempts = pParams->MaxAttempts;
+		pConfig->seed = pParams->Seed;
+		pConfig->customHandler = NULL;
+		pConfig->pCustomContext = NULL;
+		if(NULL != pParams->getDelay) {
+			// The handler is called with the caller's parameters, which must stay valid
+			pConfig->strategy = MQTT_RECONNECT_CUSTOM;
+			pConfig->customHandler = pahoReconnectDelayCallback;
+			pConfig->pCustomContext = pParams;
+		}
+	}
+	pInstance->isReconnectConfigSet = true;
+
+	// Before the first connect the MQTT client does not exist yet, connect applies the policy then
+	if(!pInstance->isPowerCycle) {
+		MQTTSetReconnectPolicy(&(pInstance->c), pConfig);
+	}
+
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_mqtt_client_set_reconnect_hint(MQTTClient_t *pClient, uint32_t delay_ms) {
+	ClientInstance *pInstance = getInstance(pClient);
+
+	if(NULL == pInstance) {
+		return NULL_VALUE_ERROR;
+	}
+
+	// Without a connection there is nothing to reconnect yet
+	if(!pInstance->isPowerCycle) {
+		MQTTSetReconnectHint(&(pInstance->c), delay_ms);
+	}
+
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_mqtt_client_set_flush_delay(MQTTClient_t *pClient, uint32_t delayMs) {
+	ClientInstance *pInstance = getInstance(pClient);
+
+	if(NULL == pInstance) {
+		return NULL_VALUE_ERROR;
+	}
+
+	MQTTSetFlushDelay(&(pInstance->c), delayMs);
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_mqtt_client_flush(MQTTClient_t *pClient) {
+	ClientInstance *pInstance = getInstance(pClient);
+
+	if(NULL == pInstance) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if(SUCCESS != MQTTFlush(&(pInstance->c))) {
+		return SSL_WRITE_ERROR;
+	}
+
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_mqtt_client_set_offline_queue(MQTTClient_t *pClient, MQTTOfflineQueueParams *pParams) {
+	ClientInstance *pInstance = getInstance(pClient);
+	MQTTReturnCode pahoRc = SUCCESS;
+
+	if(NULL == pInstance || (NULL != pParams && NULL == pParams->pStorage)) {
+		return NULL_VALUE_ERROR;
+	}
+
+	pInstance->offlineQueueConfig.pStorage = NULL;
+	if(NULL != pParams) {
+		pInstance->offlineQueueConfig.pStorage = pParams->pStorage;
+		pInstance->offlineQueueConfig.storageLen = pParams->StorageLen;
+		pInstance->offlineQueueConfig.dropPolicy = (OFFLINE_DROP_OLDEST == pParams->DropPolicy) ?
+				MQTT_OFFLINE_DROP_OLDEST : MQTT_OFFLINE_DROP_NEWEST;
+		pInstance->offlineQueueConfig.defaultTtlSec = pParams->DefaultTTL_sec;
+		pInstance->offlineQueueConfig.getTimeSec = pParams->getTimeSec;
+		pInstance->offlineCompleteHandler = pParams->completeHandler;
+	}
+
+	// Before the first connect the MQTT client does not exist yet, connect sets the queue up then
+	if(!pInstance->isPowerCycle) {
+		pahoRc = MQTTSetOfflineQueue(&(pInstance->c), (NULL == pParams) ? NULL : &(pInstance->offlineQueueConfig),
+				pahoPublishCompleteCallback, (void (*)(void))(pInstance->offlineCompleteHandler));
+	}
+	if(SUCCESS != pahoRc) {
+		pInstance->offlineQueueConfig.pStorage = NULL;
+		return GENERIC_ERROR;
+	}
+
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_mqtt_client_set_message_chunk_handler(MQTTClient_t *pClient, iot_message_chunk_handler handler) {
+	ClientInstance *pInstance = getInstance(pClient);
+	MQTTReturnCode pahoRc;
+
+	if(NULL == pInstance) {
+		return NULL_VALUE_ERROR;
+	}
+
+	pInstance->messageChunkHandler = handler;
+	if(NULL == handler) {
+		pahoRc = setMessageChunkHandler(&(pInstance->c), NULL, NULL);
+	} else {
+		pahoRc = setMessageChunkHandler(&(pInstance->c), pahoMessageChunkCallback, (void (*)(void))handler);
+	}
+	if(SUCCESS != pahoRc) {
+		return GENERIC_ERROR;
+	}
+
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_mqtt_client_unsubscribe(MQTTClient_t *pClient, char *pTopic) {
 	IoT_Error_t rc = NONE_ERROR;
+	ClientInstance *pInstance = getInstance(pClient);
+
+	if(NULL == pInstance) {
+		return NULL_VALUE_ERROR;
+	}
 
-	if(0 != MQTTUnsubscribe(&c, pTopic)){
+	if(0 != MQTTUnsubscribe(&(pInstance->c), pTopic)){
 		rc = UNSUBSCRIBE_ERROR;
 	}
 	return rc;
 }
 
-IoT_Error_t aws_iot_mqtt_disconnect(void) {
+IoT_Error_t aws_iot_mqtt_client_disconnect(MQTTClient_t *pClient) {
 	IoT_Error_t rc = NONE_ERROR;
+	ClientInstance *pInstance = getInstance(pClient);
 
-	if(0 != MQTTDisconnect(&c)){
+	if(NULL == pInstance) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if(0 != MQTTDisconnect(&(pInstance->c))){
 		rc = DISCONNECT_ERROR;
 	}
 
 	return rc;
 }
 
-IoT_Error_t aws_iot_mqtt_yield(int timeout) {
-	MQTTReturnCode pahoRc = MQTTYield(&c, timeout);
+static IoT_Error_t parseYieldReturnCode(MQTTReturnCode pahoRc) {
 	IoT_Error_t rc = NONE_ERROR;
+
 	if(MQTT_NETWORK_RECONNECTED == pahoRc){
 		rc = RECONNECT_SUCCESSFUL;
 	} else if(SUCCESS == pahoRc){
@@ -251,9 +665,66 @@ IoT_Error_t aws_iot_mqtt_yield(int timeout) {
 	return rc;
 }
 
-IoT_Error_t aws_iot_mqtt_attempt_reconnect() {
-	MQTTReturnCode pahoRc = MQTTAttemptReconnect(&c);
+IoT_Error_t aws_iot_mqtt_client_yield(MQTTClient_t *pClient, int timeout) {
+	ClientInstance *pInstance = getInstance(pClient);
+
+	if(NULL == pInstance) {
+		return NULL_VALUE_ERROR;
+	}
+
+	return parseYieldReturnCode(MQTTYield(&(pInstance->c), timeout));
+}
+
+int aws_iot_mqtt_client_get_socket(MQTTClient_t *pClient) {
+	ClientInstance *pInstance = getInstance(pClient);
+
+	if(NULL == pInstance) {
+		return -1;
+	}
+
+	return MQTTGetSocket(&(pInstance->c));
+}
+
+uint32_t aws_iot_mqtt_client_get_next_timeout(MQTTClient_t *pClient) {
+	ClientInstance *pInstance = getInstance(pClient);
+
+	if(NULL == pInstance) {
+		return AWS_IOT_MQTT_NO_PENDING_TIMEOUT;
+	}
+
+	return MQTTGetNextTimeout(&(pInstance->c));
+}
+
+IoT_Error_t aws_iot_mqtt_client_process_readable(MQTTClient_t *pClient) {
+	ClientInstance *pInstance = getInstance(pClient);
+
+	if(NULL == pInstance) {
+		return NULL_VALUE_ERROR;
+	}
+
+	return parseYieldReturnCode(MQTTProcessReadable(&(pInstance->c)));
+}
+
+IoT_Error_t aws_iot_mqtt_client_process_timers(MQTTClient_t *pClient) {
+	ClientInstance *pInstance = getInstance(pClient);
+
+	if(NULL == pInstance) {
+		return NULL_VALUE_ERROR;
+	}
+
+	return parseYieldReturnCode(MQTTProcessTimers(&(pInstance->c)));
+}
+
+IoT_Error_t aws_iot_mqtt_client_attempt_reconnect(MQTTClient_t *pClient) {
+	ClientInstance *pInstance = getInstance(pClient);
+	MQTTReturnCode pahoRc;
 	IoT_Error_t rc = RECONNECT_SUCCESSFUL;
+
+	if(NULL == pInstance) {
+		return NULL_VALUE_ERROR;
+	}
+
+	pahoRc = MQTTAttemptReconnect(&(pInstance->c));
 	if(MQTT_NETWORK_RECONNECTED == pahoRc){
 		rc = RECONNECT_SUCCESSFUL;
 	} else if(MQTT_NULL_VALUE_ERROR == pahoRc) {
@@ -271,9 +742,15 @@ IoT_Error_t aws_iot_mqtt_attempt_reconnect() {
 	return rc;
 }
 
-IoT_Error_t aws_iot_mqtt_autoreconnect_set_status(bool value) {
-	MQTTReturnCode rc = setAutoReconnectEnabled(&c, (uint8_t) value);
+IoT_Error_t aws_iot_mqtt_client_autoreconnect_set_status(MQTTClient_t *pClient, bool value) {
+	ClientInstance *pInstance = getInstance(pClient);
+	MQTTReturnCode rc;
 
+	if(NULL == pInstance) {
+		return NULL_VALUE_ERROR;
+	}
+
+	rc = setAutoReconnectEnabled(&(pInstance->c), (uint8_t) value);
 	if(MQTT_NULL_VALUE_ERROR == rc) {
 		return NULL_VALUE_ERROR;
 	}
@@ -281,23 +758,217 @@ IoT_Error_t aws_iot_mqtt_autoreconnect_set_status(bool value) {
 	return NONE_ERROR;
 }
 
+bool aws_iot_mqtt_client_is_connected(MQTTClient_t *pClient) {
+	ClientInstance *pInstance = getInstance(pClient);
+
+	if(NULL == pInstance) {
+		return false;
+	}
+
+	return MQTTIsConnected(&(pInstance->c));
+}
+
+bool aws_iot_mqtt_client_is_autoreconnect_enabled(MQTTClient_t *pClient) {
+	ClientInstance *pInstance = getInstance(pClient);
+
+	if(NULL == pInstance) {
+		return false;
+	}
+
+	return MQTTIsAutoReconnectEnabled(&(pInstance->c));
+}
+
+bool aws_iot_mqtt_client_is_tls_session_resumed(MQTTClient_t *pClient) {
+	ClientInstance *pInstance = getInstance(pClient);
+
+	if(NULL == pInstance || pInstance->isPowerCycle) {
+		return false;
+	}
+
+	return MQTTIsTlsSessionResumed(&(pInstance->c));
+}
+
+void aws_iot_mqtt_client_invalidate_credentials(MQTTClient_t *pClient) {
+	ClientInstance *pInstance = getInstance(pClient);
+
+	if(NULL == pInstance) {
+		return;
+	}
+
+	iot_tls_invalidate_credentials(&(pInstance->c.networkStack));
+}
+
+IoT_Error_t aws_iot_mqtt_connect(MQTTConnectParams *pParams) {
+	return aws_iot_mqtt_client_connect(&defaultClient, pParams);
+}
+
+IoT_Error_t aws_iot_mqtt_publish(MQTTPublishParams *pParams) {
+	return aws_iot_mqtt_client_publish(&defaultClient, pParams);
+}
+
+IoT_Error_t aws_iot_mqtt_publish_async(MQTTPublishParams *pParams, iot_publish_complete_handler handler,
+		void *pContext) {
+	return aws_iot_mqtt_client_publish_async(&defaultClient, pParams, handler, pContext);
+}
+
+IoT_Error_t aws_iot_mqtt_publish_from_fd(MQTTPublishParams *pParams, int fd, int64_t offset) {
+	return aws_iot_mqtt_client_publish_from_fd(&defaultClient, pParams, fd, offset);
+}
+
+IoT_Error_t aws_iot_mqtt_set_publish_window(uint32_t windowSize) {
+	return aws_iot_mqtt_client_set_publish_window(&defaultClient, windowSize);
+}
+
+IoT_Error_t aws_iot_mqtt_set_adaptive_keepalive(uint16_t minIntervalSec) {
+	return aws_iot_mqtt_client_set_adaptive_keepalive(&defaultClient, minIntervalSec);
+}
+
+IoT_Error_t aws_iot_mqtt_set_reconnect_policy(MQTTReconnectParams *pParams) {
+	return aws_iot_mqtt_client_set_reconnect_policy(&defaultClient, pParams);
+}
+
+IoT_Error_t aws_iot_mqtt_set_reconnect_hint(uint32_t delay_ms) {
+	return aws_iot_mqtt_client_set_reconnect_hint(&defaultClient, delay_ms);
+}
+
+IoT_Error_t aws_iot_mqtt_set_flush_delay(uint32_t delayMs) {
+	return aws_iot_mqtt_client_set_flush_delay(&defaultClient, delayMs);
+}
+
+IoT_Error_t aws_iot_mqtt_flush(void) {
+	return aws_iot_mqtt_client_flush(&defaultClient);
+}
+
+IoT_Error_t aws_iot_mqtt_subscribe(MQTTSubscribeParams *pParams) {
+	return aws_iot_mqtt_client_subscribe(&defaultClient, pParams);
+}
+
+IoT_Error_t aws_iot_mqtt_subscribe_many(MQTTSubscribeParams *pParams, uint32_t count) {
+	return aws_iot_mqtt_client_subscribe_many(&defaultClient, pParams, count);
+}
+
+IoT_Error_t aws_iot_mqtt_set_offline_queue(MQTTOfflineQueueParams *pParams) {
+	return aws_iot_mqtt_client_set_offline_queue(&defaultClient, pParams);
+}
+
+IoT_Error_t aws_iot_mqtt_set_message_chunk_handler(iot_message_chunk_handler handler) {
+	return aws_iot_mqtt_client_set_message_chunk_handler(&defaultClient, handler);
+}
+
+IoT_Error_t aws_iot_mqtt_unsubscribe(char *pTopic) {
+	return aws_iot_mqtt_client_unsubscribe(&defaultClient, pTopic);
+}
+
+IoT_Error_t aws_iot_mqtt_disconnect(void) {
+	return aws_iot_mqtt_client_disconnect(&defaultClient);
+}
+
+IoT_Error_t aws_iot_mqtt_yield(int timeout) {
+	return aws_iot_mqtt_client_yield(&defaultClient, timeout);
+}
+
+int aws_iot_mqtt_get_socket(void) {
+	return aws_iot_mqtt_client_get_socket(&defaultClient);
+}
+
+uint32_t aws_iot_mqtt_get_next_timeout(void) {
+	return aws_iot_mqtt_client_get_next_timeout(&defaultClient);
+}
+
+IoT_Error_t aws_iot_mqtt_process_readable(void) {
+	return aws_iot_mqtt_client_process_readable(&defaultClient);
+}
+
+IoT_Error_t aws_iot_mqtt_process_timers(void) {
+	return aws_iot_mqtt_client_process_timers(&defaultClient);
+}
+
+IoT_Error_t aws_iot_mqtt_attempt_reconnect() {
+	return aws_iot_mqtt_client_attempt_reconnect(&defaultClient);
+}
+
+IoT_Error_t aws_iot_mqtt_autoreconnect_set_status(bool value) {
+	return aws_iot_mqtt_client_autoreconnect_set_status(&defaultClient, value);
+}
+
 bool aws_iot_is_mqtt_connected(void) {
-	return MQTTIsConnected(&c);
+	return aws_iot_mqtt_client_is_connected(&defaultClient);
 }
 
 bool aws_iot_is_autoreconnect_enabled(void) {
-	return MQTTIsAutoReconnectEnabled(&c);
+	return aws_iot_mqtt_client_is_autoreconnect_enabled(&defaultClient);
+}
+
+bool aws_iot_is_tls_session_resumed(void) {
+	return aws_iot_mqtt_client_is_tls_session_resumed(&defaultClient);
+}
+
+void aws_iot_mqtt_invalidate_credentials(void) {
+	aws_iot_mqtt_client_invalidate_credentials(&defaultClient);
+}
+
+static void setClientFunctions(MQTTClient_t *pClient) {
+	pClient->connect = aws_iot_mqtt_client_connect;
+	pClient->disconnect = aws_iot_mqtt_client_disconnect;
+	pClient->isConnected = aws_iot_mqtt_client_is_connected;
+	pClient->reconnect = aws_iot_mqtt_client_attempt_reconnect;
+	pClient->publish = aws_iot_mqtt_client_publish;
+	pClient->subscribe = aws_iot_mqtt_client_subscribe;
+	pClient->unsubscribe = aws_iot_mqtt_client_unsubscribe;
+	pClient->yield = aws_iot_mqtt_client_yield;
+	pClient->isAutoReconnectEnabled = aws_iot_mqtt_client_is_autoreconnect_enabled;
+	pClient->setAutoReconnectStatus = aws_iot_mqtt_client_autoreconnect_set_status;
 }
 
 void aws_iot_mqtt_init(MQTTClient_t *pClient){
-	pClient->connect = aws_iot_mqtt_connect;
-	pClient->disconnect = aws_iot_mqtt_disconnect;
-	pClient->isConnected = aws_iot_is_mqtt_connected;
-	pClient->reconnect = aws_iot_mqtt_attempt_reconnect;
-	pClient->publish = aws_iot_mqtt_publish;
-	pClient->subscribe = aws_iot_mqtt_subscribe;
-	pClient->unsubscribe = aws_iot_mqtt_unsubscribe;
-	pClient->yield = aws_iot_mqtt_yield;
-	pClient->isAutoReconnectEnabled = aws_iot_is_autoreconnect_enabled;
-	pClient->setAutoReconnectStatus = aws_iot_mqtt_autoreconnect_set_status;
+	setClientFunctions(pClient);
+	pClient->pInstance = &instances[0];
+}
+
+IoT_Error_t aws_iot_mqtt_init_instance(MQTTClient_t *pClient) {
+	uint32_t i;
+
+	if(NULL == pClient) {
+		return NULL_VALUE_ERROR;
+	}
+
+	for(i = 1; i < AWS_IOT_MQTT_MAX_CLIENT_INSTANCES; i++) {
+		if(!instances[i].isInUse) {
+			instances[i].isInUse = true;
+			instances[i].isPowerCycle = true;
+			setClientFunctions(pClient);
+			pClient->pInstance = &instances[i];
+			return NONE_ERROR;
+		}
+	}
+
+	return MAX_CLIENT_INSTANCES_REACHED_ERROR;
+}
+
+IoT_Error_t aws_iot_mqtt_free_instance(MQTTClient_t *pClient) {
+	ClientInstance *pInstance = getInstance(pClient);
+
+	if(NULL == pInstance) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if(&instances[0] == pInstance) {
+		return GENERIC_ERROR;
+	}
+
+	if(!pInstance->isPowerCycle) {
+		if(MQTTIsConnected(&(pInstance->c))) {
+			MQTTDisconnect(&(pInstance->c));
+		}
+		MQTTClientFree(&(pInstance->c));
+	}
+	// The next client of this connection must not resume the TLS sessions of this one
+	iot_tls_invalidate_credentials(&(pInstance->c.networkStack));
+	pInstance->isInUse = false;
+	pInstance->messageChunkHandler = NULL;
+	pInstance->offlineQueueConfig.pStorage = NULL;
+	pInstance->isReconnectConfigSet = false;
+	pClient->pInstance = NULL;
+
+	return NONE_ERROR;
 }
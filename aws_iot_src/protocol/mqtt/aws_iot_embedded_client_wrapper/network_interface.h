@@ -24,6 +24,12 @@
 #ifndef __NETWORK_INTERFACE_H_
 #define __NETWORK_INTERFACE_H_
 
+#include <stdint.h>
+
+// Include a platform-specific TLS state definition file
+// Which implementation is selected is defined by your include paths
+#include <network_platform.h>
+
 /**
  * @brief Network Type
  *
@@ -45,21 +51,43 @@ typedef struct{
 	int DestinationPort;				///< Integer defining the connection port of the MQTT service.
 	unsigned int timeout_ms;			///< Unsigned integer defining the TLS handshake timeout value in milliseconds.
 	unsigned char ServerVerificationFlag;	///< Boolean.  True = perform server certificate hostname validation.  False = skip validation \b NOT recommended.
+	const unsigned char *pRootCADer;	///< Root CA in DER form, used instead of pRootCALocation when not NULL.  Must stay valid while connecting.
+	unsigned int RootCADerLen;			///< Number of bytes at pRootCADer.
+	const unsigned char *pDeviceCertDer;	///< Device certificate in DER form, used instead of pDeviceCertLocation when not NULL.
+	unsigned int DeviceCertDerLen;		///< Number of bytes at pDeviceCertDer.
+	const unsigned char *pDevicePrivateKeyDer;	///< Device private key in DER form, used instead of pDevicePrivateKeyLocation when not NULL.
+	unsigned int DevicePrivateKeyDerLen;	///< Number of bytes at pDevicePrivateKeyDer.
 }TLSConnectParams;
 
+/**
+ * @brief Network Write Segment
+ *
+ * Describes one contiguous piece of memory in a vectored write.  The segments of a
+ * vectored write are sent in order as if they were a single buffer.
+ */
+typedef struct{
+	unsigned char *pData;	///< Pointer to the first byte of the segment
+	int len;				///< Number of bytes in the segment
+}NetworkIoVec;
+
 /**
  * @brief Network Structure
  *
  * Structure for defining a network connection.
  */
 struct Network{
-	int my_socket;	///< Integer holding the socket file descriptor
+	int my_socket;	///< Integer holding the socket file descriptor while connected, -1 if there is none
+	unsigned char isSessionResumed;	///< Set by connect.  True if the TLS handshake resumed the session of an earlier connection to the same endpoint
 	int (*connect) (Network *, TLSConnectParams);
 	int (*mqttread) (Network*, unsigned char*, int, int);	///< Function pointer pointing to the network function to read from the network
+	int (*mqttreadsome) (Network*, unsigned char*, int, int);	///< Function pointer pointing to the network function to read whatever is available from the network. Optional, may be NULL. Required by MQTTProcessReadable to notice a closed connection
 	int (*mqttwrite) (Network*, unsigned char*, int, int);	///< Function pointer pointing to the network function to write to the network
+	int (*mqttwritev) (Network*, NetworkIoVec*, int, int);	///< Function pointer pointing to the network function to write several segments to the network. Optional, may be NULL
+	int (*mqttsendfile) (Network*, int, int64_t, int, int);	///< Function pointer pointing to the network function to write bytes of a file to the network. Optional, may be NULL. Required by MQTTPublishFromFd
 	void (*disconnect) (Network*);		///< Function pointer pointing to the network function to disconnect from the network
 	int (*isConnected) (Network*);     ///< Function pointer pointing to the network function to check if physical layer is connected
 	int (*destroy) (Network*);		///< Function pointer pointing to the network function to destroy the network object
+	TLSDataParams tlsDataParams;	///< State of the TLS connection, and what the TLS layer keeps for the next one.  Platform dependent, defined in "network_platform.h"
 };
 
 /**
@@ -68,16 +96,37 @@ struct Network{
  * Perform any initialization required by the TLS layer.
  * Connects the interface to implementation by setting up
  * the network layer function pointers to platform implementations.
+ * The MQTT client calls this before every connect.  Each Network holds the state of its own
+ * connection, so a process can keep several connections open at once.  The Network must be
+ * zeroed before the first call, as a static one is; later calls keep what the TLS layer
+ * kept from the previous connect.
  *
  * @param pNetwork - Pointer to a Network struct defining the network interface.
  * @return integer defining successful initialization or TLS error
  */
 int iot_tls_init(Network *pNetwork);
 
+/**
+ * @brief Load the credentials again on the next connect
+ *
+ * The TLS layer parses the root CA, the device certificate and the private key on the first
+ * connect and keeps them, together with the TLS context, for every later connect and
+ * reconnect.  They are parsed again when a connect names other files or buffers.  Call this
+ * after a file or buffer was changed in place, for example when the device certificate was
+ * rotated.  Cached sessions are dropped as well, so that none of them is resumed with the
+ * old identity.  Must not be called while a connect of this Network is in progress.
+ *
+ * @param pNetwork - Pointer to a Network struct defining the network interface.
+ */
+void iot_tls_invalidate_credentials(Network *pNetwork);
+
 /**
  * @brief Create a TLS socket and open the connection
  *
- * Creates an open socket connection including TLS handshake.
+ * Creates an open socket connection including TLS handshake.  The session of the last
+ * connection to the same endpoint is offered for resumption, which saves the certificate
+ * exchange and key agreement of a full handshake.  isSessionResumed of the Network tells
+ * whether the server accepted it.
  *
  * @param pNetwork - Pointer to a Network struct defining the network interface.
  * @param TLSParams - TLSConnectParams defines the properties of the TLS connection.
@@ -96,6 +145,37 @@ int iot_tls_connect(Network *pNetwork, TLSConnectParams TLSParams);
  */
 int iot_tls_write(Network*, unsigned char*, int, int);
 
+/**
+ * @brief Write several segments to the network socket
+ *
+ * Sends the segments in order as one contiguous stream, so that a packet header and a
+ * payload held in different buffers can be written without first copying them together.
+ *
+ * @param Network - Pointer to a Network struct defining the network interface.
+ * @param NetworkIoVec pointer - array of segments to write
+ * @param integer - number of segments in the array
+ * @param integer - write timeout value in milliseconds for the whole call
+ * @return integer - total number of bytes written or TLS error
+ */
+int iot_tls_writev(Network*, NetworkIoVec*, int, int);
+
+/**
+ * @brief Write bytes of a file to the network socket
+ *
+ * Sends len bytes of the file, starting at offset, without changing the file offset.  Where
+ * the platform can, they go from the file to the socket without passing through a buffer
+ * of the application, for example with sendfile once the kernel does the TLS encryption.
+ * A file that ends before len bytes is an error, as the receiver expects all of them.
+ *
+ * @param Network - Pointer to a Network struct defining the network interface.
+ * @param integer - file descriptor of the file to read from
+ * @param int64_t - offset in the file of the first byte to write
+ * @param integer - number of bytes to write
+ * @param integer - write timeout value in milliseconds for the whole call
+ * @return integer - number of bytes written or TLS error
+ */
+int iot_tls_sendfile(Network*, int, int64_t, int, int);
+
 /**
  * @brief Read bytes from the network socket
  *
@@ -107,6 +187,23 @@ int iot_tls_write(Network*, unsigned char*, int, int);
  */
 int iot_tls_read(Network*, unsigned char*, int, int);
 
+/**
+ * @brief Read the bytes currently available from the network socket
+ *
+ * Unlike iot_tls_read this returns as soon as any data has been received instead
+ * of waiting for the requested number of bytes.  This lets the MQTT client drain a
+ * whole TLS record with a single call.  With a timeout of 0 it must not wait at all,
+ * but still return data the TLS layer has already decrypted.
+ *
+ * @param Network - Pointer to a Network struct defining the network interface.
+ * @param unsigned char pointer - pointer to buffer where read bytes should be copied
+ * @param integer - maximum number of bytes to read
+ * @param integer - time in milliseconds to wait for data to arrive
+ * @return integer - number of bytes read, SSL_READ_TIMEOUT_ERROR if nothing arrived in time,
+ *         any other value if the connection failed
+ */
+int iot_tls_read_some(Network*, unsigned char*, int, int);
+
 /**
  * @brief Disconnect from network socket
  *
@@ -117,7 +214,8 @@ void iot_tls_disconnect(Network *pNetwork);
 /**
  * @brief Perform any tear-down or cleanup of TLS layer
  *
- * Called to cleanup any resources required for the TLS layer.
+ * Called to cleanup any resources required for the TLS layer.  The loaded credentials and the
+ * TLS context are kept for the next connect, see iot_tls_invalidate_credentials.
  *
  * @param Network - Pointer to a Network struct defining the network interface.
  * @return integer - successful cleanup or TLS error
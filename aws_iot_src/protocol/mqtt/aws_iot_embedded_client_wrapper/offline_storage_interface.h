@@ -0,0 +1,69 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file offline_storage_interface.h
+ * @brief Persistent storage interface for the MQTT offline queue.
+ *
+ * Defines an interface to storage that outlives the application, such as a memory mapped
+ * file, which can be given to aws_iot_mqtt_set_offline_queue so that queued messages are
+ * still sent after a restart.  The offline queue works on plain memory as well, so a
+ * platform without persistent storage does not need to implement this interface.
+ */
+
+#ifndef __OFFLINE_STORAGE_INTERFACE_H_
+#define __OFFLINE_STORAGE_INTERFACE_H_
+
+#include <stddef.h>
+
+#include "aws_iot_error.h"
+
+/**
+ * @brief Open the storage of an offline queue
+ *
+ * Maps len bytes of the storage named pPath into memory, creating it if needed.  Storage
+ * that already exists keeps its contents, the offline queue checks them when it is set up.
+ *
+ * @param pPath - name of the storage, a file path on Linux
+ * @param len - size of the storage in bytes
+ * @param ppStorage - set to the storage, aligned to 4 bytes
+ * @return NONE_ERROR, or OFFLINE_STORAGE_ERROR if the storage could not be opened
+ */
+IoT_Error_t aws_iot_offline_storage_open(const char *pPath, size_t len, unsigned char **ppStorage);
+
+/**
+ * @brief Write the storage of an offline queue back
+ *
+ * Every change to the queue reaches the storage by itself when the application exits or
+ * crashes.  Only a power loss can lose changes made since the last sync.
+ *
+ * @param pStorage - storage from aws_iot_offline_storage_open
+ * @param len - size of the storage in bytes
+ * @return NONE_ERROR, or OFFLINE_STORAGE_ERROR if the storage could not be written
+ */
+IoT_Error_t aws_iot_offline_storage_sync(unsigned char *pStorage, size_t len);
+
+/**
+ * @brief Close the storage of an offline queue
+ *
+ * Turn the offline queue off with aws_iot_mqtt_set_offline_queue before closing its storage.
+ *
+ * @param pStorage - storage from aws_iot_offline_storage_open
+ * @param len - size of the storage in bytes
+ * @return NONE_ERROR, or OFFLINE_STORAGE_ERROR if the storage could not be closed
+ */
+IoT_Error_t aws_iot_offline_storage_close(unsigned char *pStorage, size_t len);
+
+#endif //__OFFLINE_STORAGE_INTERFACE_H_
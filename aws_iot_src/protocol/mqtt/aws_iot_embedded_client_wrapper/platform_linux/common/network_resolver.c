@@ -0,0 +1,424 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file network_resolver.c
+ * @brief Host name lookup and TCP connect for the Linux TLS wrappers
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_log.h"
+#include "network_resolver.h"
+#include "timer_interface.h"
+#include "threads_interface.h"
+
+#ifndef AWS_IOT_DNS_CACHE_LEN
+#define AWS_IOT_DNS_CACHE_LEN 4
+#endif
+#ifndef AWS_IOT_DNS_CACHE_TTL_SEC
+#define AWS_IOT_DNS_CACHE_TTL_SEC 60
+#endif
+#ifndef AWS_IOT_CONNECT_ATTEMPT_DELAY_MS
+#define AWS_IOT_CONNECT_ATTEMPT_DELAY_MS 250
+#endif
+#define RESOLVER_HOST_LEN 128 ///< Endpoints with longer names are looked up for every connect
+#define RESOLVER_MAX_ADDRESSES 8 ///< Addresses of an endpoint that are kept and tried
+
+typedef struct {
+	struct sockaddr_storage addr;
+	socklen_t len;
+} ResolvedAddress;
+
+/**
+ * @brief Addresses of one endpoint
+ */
+typedef struct {
+	char host[RESOLVER_HOST_LEN];
+	int port;
+	bool isUsed;			///< host and port name an endpoint
+	bool isLookupRunning;	///< A lookup fills in the entry, which must not be given to another endpoint meanwhile
+	int addressCount;		///< 0 until a lookup succeeded
+	ResolvedAddress addresses[RESOLVER_MAX_ADDRESSES];
+	Timer expiry;			///< A new lookup is started once it expires, the addresses are used until it is done
+	unsigned int lastUsed;
+} ResolverCacheEntry;
+
+static ResolverCacheEntry cache[AWS_IOT_DNS_CACHE_LEN];
+static unsigned int cacheUseCount;
+static bool isInitialized;
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+static IoT_Mutex_t cacheLock;
+static IoT_Cond_t lookupDone;	///< Broadcast whenever a lookup finishes
+#endif
+
+static void lockCache(void) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	aws_iot_thread_mutex_lock(&cacheLock);
+#endif
+}
+
+static void unlockCache(void) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	aws_iot_thread_mutex_unlock(&cacheLock);
+#endif
+}
+
+/* Returns the number of addresses found. getaddrinfo sorts them by RFC 6724, the connect race
+ * wants the families to take turns, starting with the first one in that order */
+static int lookup(const char *pHost, int port, ResolvedAddress *pAddresses) {
+	ResolvedAddress firstFamily[RESOLVER_MAX_ADDRESSES];
+	ResolvedAddress otherFamily[RESOLVER_MAX_ADDRESSES];
+	int firstCount = 0;
+	int otherCount = 0;
+	int count = 0;
+	int family = AF_UNSPEC;
+	int i;
+	char portString[6];
+	struct addrinfo hints;
+	struct addrinfo *pResult = NULL;
+	struct addrinfo *pInfo;
+	ResolvedAddress *pAddress;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_ADDRCONFIG | AI_NUMERICSERV;
+	snprintf(portString, sizeof(portString), "%d", port);
+
+	if (0 != getaddrinfo(pHost, portString, &hints, &pResult)) {
+		return 0;
+	}
+
+	for (pInfo = pResult; NULL != pInfo; pInfo = pInfo->ai_next) {
+		if (sizeof(struct sockaddr_storage) < pInfo->ai_addrlen) {
+			continue;
+		}
+		if (AF_UNSPEC == family) {
+			family = pInfo->ai_family;
+		}
+		if (family == pInfo->ai_family && firstCount < RESOLVER_MAX_ADDRESSES) {
+			pAddress = &firstFamily[firstCount++];
+		} else if (family != pInfo->ai_family && otherCount < RESOLVER_MAX_ADDRESSES) {
+			pAddress = &otherFamily[otherCount++];
+		} else {
+			continue;
+		}
+		memcpy(&(pAddress->addr), pInfo->ai_addr, pInfo->ai_addrlen);
+		pAddress->len = pInfo->ai_addrlen;
+	}
+	freeaddrinfo(pResult);
+
+	for (i = 0; count < RESOLVER_MAX_ADDRESSES && (i < firstCount || i < otherCount); i++) {
+		if (i < firstCount) {
+			pAddresses[count++] = firstFamily[i];
+		}
+		if (i < otherCount && count < RESOLVER_MAX_ADDRESSES) {
+			pAddresses[count++] = otherFamily[i];
+		}
+	}
+
+	return count;
+}
+
+static ResolverCacheEntry *findEntry(const char *pHost, int port) {
+	int i;
+
+	for (i = 0; i < AWS_IOT_DNS_CACHE_LEN; i++) {
+		if (cache[i].isUsed && port == cache[i].port && 0 == strcmp(pHost, cache[i].host)) {
+			return &cache[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* Gives an unused entry, or the least recently used one, to an endpoint. NULL if the name is
+ * too long or every entry waits for a lookup */
+static ResolverCacheEntry *claimEntry(const char *pHost, int port) {
+	ResolverCacheEntry *pVictim = NULL;
+	ResolverCacheEntry *pEntry;
+	int i;
+
+	if (RESOLVER_HOST_LEN <= strlen(pHost)) {
+		return NULL;
+	}
+
+	for (i = 0; i < AWS_IOT_DNS_CACHE_LEN; i++) {
+		pEntry = &cache[i];
+		if (pEntry->isLookupRunning) {
+			continue;
+		}
+		if (NULL == pVictim || (!pEntry->isUsed && pVictim->isUsed)
+				|| (pEntry->isUsed == pVictim->isUsed && pEntry->lastUsed < pVictim->lastUsed)) {
+			pVictim = pEntry;
+		}
+	}
+
+	if (NULL != pVictim) {
+		strcpy(pVictim->host, pHost);
+		pVictim->port = port;
+		pVictim->isUsed = true;
+		pVictim->addressCount = 0;
+		pVictim->lastUsed = ++cacheUseCount;
+	}
+
+	return pVictim;
+}
+
+/* Called with the cache locked. A failed lookup keeps the addresses found before, they are
+ * only dropped once none of them can be reached */
+static void finishLookup(ResolverCacheEntry *pEntry, ResolvedAddress *pAddresses, int count) {
+	if (0 < count) {
+		memcpy(pEntry->addresses, pAddresses, count * sizeof(ResolvedAddress));
+		pEntry->addressCount = count;
+	}
+	InitTimer(&(pEntry->expiry));
+	countdown(&(pEntry->expiry), AWS_IOT_DNS_CACHE_TTL_SEC);
+	pEntry->isLookupRunning = false;
+#ifdef _ENABLE_THREAD_SUPPORT_
+	aws_iot_thread_cond_broadcast(&lookupDone);
+#endif
+}
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+static void *lookupThread(void *pArg) {
+	ResolverCacheEntry *pEntry = (ResolverCacheEntry *) pArg;
+	ResolvedAddress addresses[RESOLVER_MAX_ADDRESSES];
+	int count;
+
+	/* host and port do not change while the lookup runs */
+	count = lookup(pEntry->host, pEntry->port, addresses);
+
+	lockCache();
+	finishLookup(pEntry, addresses, count);
+	unlockCache();
+
+	return NULL;
+}
+#endif
+
+/* Called with the cache locked. Returns at once if the lookup runs on a thread of its own */
+static void startLookup(ResolverCacheEntry *pEntry) {
+	ResolvedAddress addresses[RESOLVER_MAX_ADDRESSES];
+	int count;
+
+	pEntry->isLookupRunning = true;
+#ifdef _ENABLE_THREAD_SUPPORT_
+	if (NONE_ERROR == aws_iot_thread_create_detached(lookupThread, pEntry)) {
+		return;
+	}
+	WARN(" Looking up %s on the calling thread", pEntry->host);
+#endif
+
+	unlockCache();
+	count = lookup(pEntry->host, pEntry->port, addresses);
+	lockCache();
+	finishLookup(pEntry, addresses, count);
+}
+
+/* Returns the socket of a new connect attempt, -1 if the attempt failed at once */
+static int startAttempt(ResolvedAddress *pAddress) {
+	int noDelay = 1;
+	int flags;
+	int fd = socket(pAddress->addr.ss_family, SOCK_STREAM, 0);
+
+	if (-1 == fd) {
+		return -1;
+	}
+
+	/* The client coalesces its own writes. Left to Nagle, the CONNECT that follows the last
+	 * flight of a resumed handshake would wait for the server's delayed ACK */
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+	flags = fcntl(fd, F_GETFL, 0);
+	if (0 > flags || 0 > fcntl(fd, F_SETFL, flags | O_NONBLOCK)
+			|| (0 != connect(fd, (struct sockaddr *) &(pAddress->addr), pAddress->len) && EINPROGRESS != errno)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* RFC 8305: a new attempt starts every AWS_IOT_CONNECT_ATTEMPT_DELAY_MS, or as soon as the
+ * last one failed, without giving up on the earlier ones. The first to connect wins */
+static int raceConnect(ResolvedAddress *pAddresses, int count, Timer *pDeadline) {
+	struct pollfd attempts[RESOLVER_MAX_ADDRESSES];
+	int attemptCount = 0;
+	int next = 0;
+	int winner = -1;
+	int waitMs;
+	int fd;
+	int soError;
+	socklen_t soErrorLen;
+	int i;
+	Timer nextAttempt;
+
+	InitTimer(&nextAttempt);
+	while (-1 == winner) {
+		/* the MQTT client may have cached the time, which would never let the timers expire */
+		TimerRefreshNow();
+		if (expired(pDeadline)) {
+			break;
+		}
+
+		if (next < count && (0 == attemptCount || expired(&nextAttempt))) {
+			fd = startAttempt(&pAddresses[next++]);
+			if (-1 != fd) {
+				attempts[attemptCount].fd = fd;
+				attempts[attemptCount].events = POLLOUT;
+				attempts[attemptCount].revents = 0;
+				attemptCount++;
+				countdown_ms(&nextAttempt, AWS_IOT_CONNECT_ATTEMPT_DELAY_MS);
+			}
+			continue;
+		}
+		if (0 == attemptCount) {
+			/* every address failed */
+			break;
+		}
+
+		waitMs = left_ms(pDeadline);
+		if (next < count && left_ms(&nextAttempt) < waitMs) {
+			waitMs = left_ms(&nextAttempt);
+		}
+		if (0 > poll(attempts, attemptCount, waitMs) && EINTR != errno) {
+			break;
+		}
+
+		for (i = 0; i < attemptCount && -1 == winner;) {
+			if (0 == attempts[i].revents) {
+				i++;
+				continue;
+			}
+			soError = 0;
+			soErrorLen = sizeof(soError);
+			if ((attempts[i].revents & POLLOUT) && 0 == getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, &soError, &soErrorLen)
+					&& 0 == soError) {
+				winner = attempts[i].fd;
+			} else {
+				close(attempts[i].fd);
+				countdown_ms(&nextAttempt, 0);
+			}
+			attempts[i] = attempts[--attemptCount];
+		}
+	}
+
+	for (i = 0; i < attemptCount; i++) {
+		close(attempts[i].fd);
+	}
+
+	return (-1 == winner) ? TCP_CONNECT_ERROR : winner;
+}
+
+IoT_Error_t iot_resolver_init(void) {
+	if (isInitialized) {
+		return NONE_ERROR;
+	}
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+	if (NONE_ERROR != aws_iot_thread_mutex_init(&cacheLock)) {
+		return MUTEX_INIT_ERROR;
+	}
+	if (NONE_ERROR != aws_iot_thread_cond_init(&lookupDone)) {
+		aws_iot_thread_mutex_destroy(&cacheLock);
+		return MUTEX_INIT_ERROR;
+	}
+#endif
+	isInitialized = true;
+
+	return NONE_ERROR;
+}
+
+int iot_resolver_connect(const char *pHost, int port, uint32_t timeout_ms) {
+	ResolvedAddress addresses[RESOLVER_MAX_ADDRESSES];
+	ResolverCacheEntry *pEntry;
+	int count = 0;
+	int fd;
+	Timer deadline;
+
+	if (NULL == pHost) {
+		return HOST_RESOLVE_ERROR;
+	}
+
+	TimerRefreshNow();
+	InitTimer(&deadline);
+	countdown_ms(&deadline, timeout_ms);
+
+	lockCache();
+	pEntry = findEntry(pHost, port);
+	if (NULL == pEntry) {
+		pEntry = claimEntry(pHost, port);
+	}
+
+	if (NULL == pEntry) {
+		unlockCache();
+		count = lookup(pHost, port, addresses);
+	} else {
+		if (!pEntry->isLookupRunning && (0 == pEntry->addressCount || expired(&(pEntry->expiry)))) {
+			startLookup(pEntry);
+		}
+#ifdef _ENABLE_THREAD_SUPPORT_
+		/* Only the first connect to an endpoint waits, later ones use what they have */
+		while (0 == pEntry->addressCount && pEntry->isLookupRunning && !expired(&deadline)) {
+			aws_iot_thread_cond_wait(&lookupDone, &cacheLock, left_ms(&deadline));
+			TimerRefreshNow();
+		}
+#endif
+		if (pEntry->isUsed && port == pEntry->port && 0 == strcmp(pHost, pEntry->host)) {
+			count = pEntry->addressCount;
+			memcpy(addresses, pEntry->addresses, count * sizeof(ResolvedAddress));
+			pEntry->lastUsed = ++cacheUseCount;
+		}
+		unlockCache();
+	}
+
+	if (0 == count) {
+		ERROR(" Unable to resolve %s", pHost);
+		return HOST_RESOLVE_ERROR;
+	}
+
+	fd = raceConnect(addresses, count, &deadline);
+	if (0 > fd) {
+		/* The endpoint may have moved, look it up again next time */
+		iot_resolver_forget(pHost, port);
+	}
+
+	return fd;
+}
+
+void iot_resolver_forget(const char *pHost, int port) {
+	ResolverCacheEntry *pEntry;
+
+	lockCache();
+	pEntry = findEntry(pHost, port);
+	if (NULL != pEntry) {
+		pEntry->addressCount = 0;
+	}
+	unlockCache();
+}
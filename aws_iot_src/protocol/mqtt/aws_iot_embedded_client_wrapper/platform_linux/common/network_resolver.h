@@ -0,0 +1,70 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_COMMON_NETWORK_RESOLVER_H_
+#define SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_COMMON_NETWORK_RESOLVER_H_
+
+/**
+ * @file network_resolver.h
+ * @brief Host name lookup and TCP connect for the Linux TLS wrappers
+ *
+ * Host names are looked up with getaddrinfo, for IPv6 and IPv4 addresses, and the result is
+ * kept for AWS_IOT_DNS_CACHE_TTL_SEC so that a reconnect does not wait for DNS.  An expired
+ * result is still used while a new lookup runs.  With _ENABLE_THREAD_SUPPORT_ lookups run on
+ * a thread of their own, so a slow DNS server holds up a connect for at most its timeout and
+ * a reconnect not at all.  Without it the lookup blocks the connect.
+ *
+ * The connect races the addresses of the endpoint as in RFC 8305 ("Happy Eyeballs"): the
+ * families take turns, starting with the one getaddrinfo put first, and a new attempt starts
+ * every AWS_IOT_CONNECT_ATTEMPT_DELAY_MS, or as soon as one fails, while the earlier ones are
+ * still running.  The first to connect is used.
+ */
+
+#include <stdint.h>
+
+#include "aws_iot_error.h"
+
+/**
+ * @brief Set up the resolver
+ *
+ * Called by iot_tls_init, does nothing after the first call.
+ *
+ * @return NONE_ERROR or MUTEX_INIT_ERROR
+ */
+IoT_Error_t iot_resolver_init(void);
+
+/**
+ * @brief Open a TCP connection to an endpoint
+ *
+ * @param pHost - host name or address of the endpoint
+ * @param port - TCP port of the endpoint
+ * @param timeout_ms - longest time for the lookup and the connect together
+ * @return The connected socket, non-blocking and with TCP_NODELAY set, or HOST_RESOLVE_ERROR
+ *         if the name could not be resolved in time, or TCP_CONNECT_ERROR
+ */
+int iot_resolver_connect(const char *pHost, int port, uint32_t timeout_ms);
+
+/**
+ * @brief Drop the addresses kept for an endpoint
+ *
+ * The next connect to it looks the name up again.  iot_resolver_connect does this itself
+ * when none of the addresses could be reached.
+ *
+ * @param pHost - host name of the endpoint
+ * @param port - TCP port of the endpoint
+ */
+void iot_resolver_forget(const char *pHost, int port);
+
+#endif /* SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_COMMON_NETWORK_RESOLVER_H_ */
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file offline_storage_mmap.c
+ * @brief Linux implementation of the offline storage interface using a memory mapped file.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "offline_storage_interface.h"
+
+IoT_Error_t aws_iot_offline_storage_open(const char *pPath, size_t len, unsigned char **ppStorage) {
+	struct stat st;
+	void *pMap;
+	int fd;
+
+	if(NULL == pPath || NULL == ppStorage || 0 == len) {
+		return NULL_VALUE_ERROR;
+	}
+
+	fd = open(pPath, O_RDWR | O_CREAT, 0600);
+	if(0 > fd) {
+		return OFFLINE_STORAGE_ERROR;
+	}
+
+	// A new file reads as zeros, which the offline queue formats
+	if(0 != fstat(fd, &st) || ((size_t)st.st_size != len && 0 != ftruncate(fd, (off_t)len))) {
+		close(fd);
+		return OFFLINE_STORAGE_ERROR;
+	}
+
+	// The mapping stays valid once the file is closed
+	pMap = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(MAP_FAILED == pMap) {
+		return OFFLINE_STORAGE_ERROR;
+	}
+
+	*ppStorage = (unsigned char *)pMap;
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_offline_storage_sync(unsigned char *pStorage, size_t len) {
+	if(NULL == pStorage) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if(0 != msync(pStorage, len, MS_SYNC)) {
+		return OFFLINE_STORAGE_ERROR;
+	}
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_offline_storage_close(unsigned char *pStorage, size_t len) {
+	if(NULL == pStorage) {
+		return NULL_VALUE_ERROR;
+	}
+
+	if(0 != munmap(pStorage, len)) {
+		return OFFLINE_STORAGE_ERROR;
+	}
+	return NONE_ERROR;
+}
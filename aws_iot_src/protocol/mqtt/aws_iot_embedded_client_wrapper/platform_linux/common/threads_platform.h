@@ -0,0 +1,49 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_COMMON_THREADS_PLATFORM_H_
+#define SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_COMMON_THREADS_PLATFORM_H_
+
+/**
+ * @file threads_platform.h
+ */
+#ifdef _ENABLE_THREAD_SUPPORT_
+
+#include <pthread.h>
+
+/**
+ * definition of the mutex struct. Platform specific
+ */
+struct IoT_Mutex{
+	pthread_mutex_t lock;
+};
+
+/**
+ * definition of the condition variable struct. Platform specific
+ */
+struct IoT_Cond{
+	pthread_cond_t cond;	///< Waits are timed against CLOCK_MONOTONIC
+};
+
+/**
+ * definition of the thread identifier struct. Platform specific
+ */
+struct IoT_Thread_Id{
+	pthread_t thread;
+};
+
+#endif /* _ENABLE_THREAD_SUPPORT_ */
+
+#endif /* SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_COMMON_THREADS_PLATFORM_H_ */
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file threads_pthread_wrapper.c
+ * @brief Linux implementation of the threads interface using POSIX threads.
+ */
+
+#include "threads_interface.h"
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+
+#include <errno.h>
+#include <time.h>
+
+IoT_Error_t aws_iot_thread_mutex_init(IoT_Mutex_t *pMutex) {
+	if(0 != pthread_mutex_init(&(pMutex->lock), NULL)) {
+		return MUTEX_INIT_ERROR;
+	}
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_thread_mutex_lock(IoT_Mutex_t *pMutex) {
+	if(0 != pthread_mutex_lock(&(pMutex->lock))) {
+		return MUTEX_LOCK_ERROR;
+	}
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_thread_mutex_trylock(IoT_Mutex_t *pMutex) {
+	if(0 != pthread_mutex_trylock(&(pMutex->lock))) {
+		return MUTEX_LOCK_ERROR;
+	}
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_thread_mutex_unlock(IoT_Mutex_t *pMutex) {
+	if(0 != pthread_mutex_unlock(&(pMutex->lock))) {
+		return MUTEX_UNLOCK_ERROR;
+	}
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_thread_mutex_destroy(IoT_Mutex_t *pMutex) {
+	if(0 != pthread_mutex_destroy(&(pMutex->lock))) {
+		return MUTEX_DESTROY_ERROR;
+	}
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_thread_cond_init(IoT_Cond_t *pCond) {
+	pthread_condattr_t attr;
+	int rc;
+
+	// The MQTT timers count down in relative time, so should waits
+	if(0 != pthread_condattr_init(&attr)) {
+		return MUTEX_INIT_ERROR;
+	}
+	rc = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	if(0 == rc) {
+		rc = pthread_cond_init(&(pCond->cond), &attr);
+	}
+	pthread_condattr_destroy(&attr);
+
+	return (0 == rc) ? NONE_ERROR : MUTEX_INIT_ERROR;
+}
+
+IoT_Error_t aws_iot_thread_cond_wait(IoT_Cond_t *pCond, IoT_Mutex_t *pMutex, uint32_t timeout_ms) {
+	struct timespec deadline;
+	int rc;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+	if(1000000000L <= deadline.tv_nsec) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	rc = pthread_cond_timedwait(&(pCond->cond), &(pMutex->lock), &deadline);
+	if(0 != rc && ETIMEDOUT != rc) {
+		return MUTEX_LOCK_ERROR;
+	}
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_thread_cond_broadcast(IoT_Cond_t *pCond) {
+	if(0 != pthread_cond_broadcast(&(pCond->cond))) {
+		return MUTEX_UNLOCK_ERROR;
+	}
+	return NONE_ERROR;
+}
+
+IoT_Error_t aws_iot_thread_cond_destroy(IoT_Cond_t *pCond) {
+	if(0 != pthread_cond_destroy(&(pCond->cond))) {
+		return MUTEX_DESTROY_ERROR;
+	}
+	return NONE_ERROR;
+}
+
+void aws_iot_thread_id_get(IoT_Thread_Id_t *pThreadId) {
+	pThreadId->thread = pthread_self();
+}
+
+bool aws_iot_thread_id_is_current(const IoT_Thread_Id_t *pThreadId) {
+	return (0 != pthread_equal(pThreadId->thread, pthread_self())) ? true : false;
+}
+
+IoT_Error_t aws_iot_thread_create_detached(void *(*pRoutine)(void *), void *pArg) {
+	pthread_t thread;
+	pthread_attr_t attr;
+	int rc;
+
+	if(0 != pthread_attr_init(&attr)) {
+		return THREAD_CREATE_ERROR;
+	}
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	rc = pthread_create(&thread, &attr, pRoutine, pArg);
+	pthread_attr_destroy(&attr);
+
+	return (0 == rc) ? NONE_ERROR : THREAD_CREATE_ERROR;
+}
+
+#endif //_ENABLE_THREAD_SUPPORT_
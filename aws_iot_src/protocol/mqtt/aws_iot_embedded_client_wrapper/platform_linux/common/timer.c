@@ -19,38 +19,75 @@
  */
 
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
+#include <time.h>
 
 #include "timer_linux.h"
 
+/**
+ * Build with _ENABLE_COARSE_TIMER_ to read CLOCK_MONOTONIC_COARSE. It is served
+ * from the vDSO without touching the clock hardware, at the cost of tick
+ * (typically 1-4ms) resolution, which is well below any MQTT timeout.
+ */
+#if defined(_ENABLE_COARSE_TIMER_) && defined(CLOCK_MONOTONIC_COARSE)
+#define TIMER_CLOCK_ID CLOCK_MONOTONIC_COARSE
+#else
+#define TIMER_CLOCK_ID CLOCK_MONOTONIC
+#endif
+
+#define NS_PER_MS 1000000ULL
+#define NS_PER_SEC 1000000000ULL
+
+static __thread char isNowCached = 0;	///< set between TimerCacheNow and TimerClearNow on this thread
+static __thread uint64_t cachedNow = 0;	///< clock reading used while isNowCached is set
+
+static uint64_t readClock(void) {
+	struct timespec ts;
+	clock_gettime(TIMER_CLOCK_ID, &ts);
+	return (uint64_t) ts.tv_sec * NS_PER_SEC + (uint64_t) ts.tv_nsec;
+}
+
+static uint64_t now(void) {
+	return isNowCached ? cachedNow : readClock();
+}
+
+void TimerCacheNow(void) {
+	cachedNow = readClock();
+	isNowCached = 1;
+}
+
+void TimerRefreshNow(void) {
+	if(isNowCached) {
+		cachedNow = readClock();
+	}
+}
+
+void TimerClearNow(void) {
+	isNowCached = 0;
+}
+
+char TimerIsNowCached(void) {
+	return isNowCached;
+}
+
 char expired(Timer* timer) {
-	struct timeval now, res;
-	gettimeofday(&now, NULL);
-	timersub(&timer->end_time, &now, &res);
-	return res.tv_sec < 0 || (res.tv_sec == 0 && res.tv_usec <= 0);
+	return now() >= timer->end_time_ns;
 }
 
 void countdown_ms(Timer* timer, unsigned int timeout) {
-	struct timeval now;
-	gettimeofday(&now, NULL);
-	struct timeval interval = { timeout / 1000, (timeout % 1000) * 1000 };
-	timeradd(&now, &interval, &timer->end_time);
+	timer->end_time_ns = now() + (uint64_t) timeout * NS_PER_MS;
 }
 
 void countdown(Timer* timer, unsigned int timeout) {
-	struct timeval now;
-	gettimeofday(&now, NULL);
-	struct timeval interval = { timeout, 0 };
-	timeradd(&now, &interval, &timer->end_time);
+	timer->end_time_ns = now() + (uint64_t) timeout * NS_PER_SEC;
 }
 
 int left_ms(Timer* timer) {
-	struct timeval now, res;
-	gettimeofday(&now, NULL);
-	timersub(&timer->end_time, &now, &res);
-	return (res.tv_sec < 0) ? 0 : res.tv_sec * 1000 + res.tv_usec / 1000;
+	uint64_t current = now();
+	return (timer->end_time_ns <= current) ? 0 : (int) ((timer->end_time_ns - current) / NS_PER_MS);
 }
 
 void InitTimer(Timer* timer) {
-	timer->end_time = (struct timeval ) { 0, 0 };
+	timer->end_time_ns = 0;
 }
@@ -19,6 +19,7 @@
 /**
  * @file timer_linux.h
  */
+#include <stdint.h>
 #include <sys/time.h>
 #include <sys/select.h>
 #include "timer_interface.h"
@@ -27,7 +28,7 @@
  * definition of the Timer struct. Platform specific
  */
 struct Timer{
-	struct timeval end_time;
+	uint64_t end_time_ns;	///< CLOCK_MONOTONIC time the timer expires at, so it is not moved by changes to the wall clock
 };
 
 
@@ -0,0 +1,655 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/*
+ * The network interface to a broker stub in the same process.  For measuring the MQTT client
+ * without a network, nothing leaves the Network structure.
+ *
+ * The stub answers CONNECT, SUBSCRIBE, UNSUBSCRIBE, PINGREQ and both QoS1 and QoS2 publish
+ * flows, and sends every publish back once if it matches a subscription of the connection.
+ * It keeps no retained messages and no session across instances, and grants every QoS asked
+ * for.  Its buffers must each hold the largest packet in either direction.
+ *
+ * A packet is handled only once the broker has room for its answer, so a client that does
+ * not read stalls the writes like a full socket would.  Without thread support nothing else
+ * can drain the buffers while a read or write waits, the wait only lets the timeout pass.
+ * There is no socket to wait on: my_socket stays -1.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_error.h"
+#include "aws_iot_log.h"
+#include "network_interface.h"
+#include "timer_interface.h"
+#include "MQTTPacket.h"
+
+#define LOOPBACK_MAX_HEADER_LEN 5 ///< Bytes of a fixed header: the type and up to 4 of remaining length
+#define LOOPBACK_SUBACK_FAILURE 0x80 ///< SUBACK return code of a refused topic filter
+#define LOOPBACK_SENDFILE_CHUNK_LEN 4096 ///< Bytes of a file read and handed to the broker at a time
+
+static void loopbackLock(TLSDataParams *pTLSData) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	aws_iot_thread_mutex_lock(&(pTLSData->lock));
+#endif
+}
+
+static void loopbackUnlock(TLSDataParams *pTLSData) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	aws_iot_thread_mutex_unlock(&(pTLSData->lock));
+#endif
+}
+
+/* Wakes whoever waits for data to move */
+static void loopbackSignal(TLSDataParams *pTLSData) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	aws_iot_thread_cond_broadcast(&(pTLSData->changed));
+#endif
+}
+
+/* Waits, with the lock held, for another thread to move data or until the deadline */
+static void loopbackWait(TLSDataParams *pTLSData, Timer *pDeadline) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	aws_iot_thread_cond_wait(&(pTLSData->changed), &(pTLSData->lock), (uint32_t) left_ms(pDeadline));
+#else
+	struct timespec wait;
+	int waitMs = left_ms(pDeadline);
+
+	if(0 < waitMs){
+		wait.tv_sec = waitMs / 1000;
+		wait.tv_nsec = (waitMs % 1000) * 1000000L;
+		nanosleep(&wait, NULL);
+	}
+#endif
+	// The MQTT client may have cached the time, which would never let the deadline pass
+	TimerRefreshNow();
+}
+
+static size_t clientPending(TLSDataParams *pTLSData) {
+	return pTLSData->toClientTail - pTLSData->toClientHead;
+}
+
+/* Makes len bytes at the end of toClient contiguous and returns where they start, or NULL
+ * if the client has not read enough to make room */
+static unsigned char *clientReserve(TLSDataParams *pTLSData, size_t len) {
+	if(AWS_IOT_LOOPBACK_BUF_LEN - clientPending(pTLSData) < len){
+		return NULL;
+	}
+	if(AWS_IOT_LOOPBACK_BUF_LEN - pTLSData->toClientTail < len){
+		memmove(pTLSData->toClient, pTLSData->toClient + pTLSData->toClientHead, clientPending(pTLSData));
+		pTLSData->toClientTail -= pTLSData->toClientHead;
+		pTLSData->toClientHead = 0;
+	}
+	return pTLSData->toClient + pTLSData->toClientTail;
+}
+
+/* Sends a packet with a packet identifier as its only content */
+static void brokerAck(TLSDataParams *pTLSData, MessageTypes type, uint16_t packetId) {
+	unsigned char *pOut = clientReserve(pTLSData, 4);
+
+	// PUBREL has flag bits of 0010, the other acks 0000
+	pOut[0] = (unsigned char) ((type << 4) | ((PUBREL == type) ? 0x02 : 0x00));
+	pOut[1] = 2;
+	pOut[2] = (unsigned char) (packetId >> 8);
+	pOut[3] = (unsigned char) (packetId & 0xFF);
+	pTLSData->toClientTail += 4;
+}
+
+static uint16_t brokerNextPacketId(TLSDataParams *pTLSData) {
+	if(0 == pTLSData->nextPacketId){
+		pTLSData->nextPacketId = 1;
+	}
+	return pTLSData->nextPacketId++;
+}
+
+/* Whether the topic filter, with the + and # wildcards, matches the topic name */
+static bool isFilterMatched(const char *pFilter, const char *pTopic, size_t topicLen) {
+	size_t pos = 0;
+
+	while('\0' != *pFilter){
+		if('#' == *pFilter){
+			return true;
+		}
+		if('+' == *pFilter){
+			while(pos < topicLen && '/' != pTopic[pos]){
+				pos++;
+			}
+			pFilter++;
+			continue;
+		}
+		if(pos >= topicLen || *pFilter != pTopic[pos]){
+			// "a/#" also matches "a"
+			return pos == topicLen && 0 == strcmp(pFilter, "/#");
+		}
+		pFilter++;
+		pos++;
+	}
+	return pos == topicLen;
+}
+
+static void clearSubscriptions(TLSDataParams *pTLSData) {
+	memset(pTLSData->subscriptions, 0, sizeof(pTLSData->subscriptions));
+}
+
+/* Stores the subscription, replacing one to the same filter. Returns the SUBACK return code */
+static unsigned char brokerSubscribe(TLSDataParams *pTLSData, const unsigned char *pFilter, size_t filterLen,
+									 unsigned char qos) {
+	LoopbackSubscription *pFree = NULL;
+	LoopbackSubscription *pSubscription;
+	size_t i;
+
+	if(LOOPBACK_TOPIC_FILTER_LEN <= filterLen || QOS2 < qos){
+		return LOOPBACK_SUBACK_FAILURE;
+	}
+	for(i = 0; i < LOOPBACK_MAX_SUBSCRIPTIONS; i++){
+		pSubscription = &(pTLSData->subscriptions[i]);
+		if(!pSubscription->isUsed){
+			if(NULL == pFree){
+				pFree = pSubscription;
+			}
+		}else if(strlen(pSubscription->filter) == filterLen && 0 == memcmp(pSubscription->filter, pFilter, filterLen)){
+			pSubscription->qos = qos;
+			return qos;
+		}
+	}
+	if(NULL == pFree){
+		return LOOPBACK_SUBACK_FAILURE;
+	}
+
+	memcpy(pFree->filter, pFilter, filterLen);
+	pFree->filter[filterLen] = '\0';
+	pFree->qos = qos;
+	pFree->isUsed = true;
+	return qos;
+}
+
+static void brokerUnsubscribe(TLSDataParams *pTLSData, const unsigned char *pFilter, size_t filterLen) {
+	LoopbackSubscription *pSubscription;
+	size_t i;
+
+	for(i = 0; i < LOOPBACK_MAX_SUBSCRIPTIONS; i++){
+		pSubscription = &(pTLSData->subscriptions[i]);
+		if(pSubscription->isUsed && strlen(pSubscription->filter) == filterLen
+		   && 0 == memcmp(pSubscription->filter, pFilter, filterLen)){
+			pSubscription->isUsed = false;
+		}
+	}
+}
+
+/* Reads the next length-prefixed string of a packet. Returns false if it overruns the packet */
+static bool readString(const unsigned char **ppPos, const unsigned char *pEnd, const unsigned char **ppString,
+					   size_t *pLen) {
+	if(2 > pEnd - *ppPos){
+		return false;
+	}
+	*pLen = ((size_t) (*ppPos)[0] << 8) | (*ppPos)[1];
+	*ppPos += 2;
+	if((size_t) (pEnd - *ppPos) < *pLen){
+		return false;
+	}
+	*ppString = *ppPos;
+	*ppPos += *pLen;
+	return true;
+}
+
+/* SUBSCRIBE and UNSUBSCRIBE: the packet identifier, then the topic filters */
+static bool brokerSubscriptions(TLSDataParams *pTLSData, unsigned char *pVariable, const unsigned char *pEnd,
+								bool isSubscribe) {
+	const unsigned char *pPos = pVariable + 2;
+	const unsigned char *pFilter;
+	size_t filterLen;
+	size_t filterCount = 0;
+	uint16_t packetId;
+	unsigned char *pOut;
+	uint32_t headerLen;
+
+	if(2 > pEnd - pVariable){
+		return false;
+	}
+	packetId = (uint16_t) ((pVariable[0] << 8) | pVariable[1]);
+
+	// Checked completely before anything is stored or answered
+	while(pPos < pEnd){
+		if(!readString(&pPos, pEnd, &pFilter, &filterLen) || 0 == filterLen){
+			return false;
+		}
+		if(isSubscribe){
+			if(pPos == pEnd){
+				return false;
+			}
+			pPos++;
+		}
+		filterCount++;
+	}
+	if(0 == filterCount){
+		return false;
+	}
+
+	if(!isSubscribe){
+		pPos = pVariable + 2;
+		while(pPos < pEnd){
+			readString(&pPos, pEnd, &pFilter, &filterLen);
+			brokerUnsubscribe(pTLSData, pFilter, filterLen);
+		}
+		brokerAck(pTLSData, UNSUBACK, packetId);
+		return true;
+	}
+
+	// Each filter took at least 4 bytes of the packet and takes 1 of the SUBACK, which fits
+	pOut = clientReserve(pTLSData, LOOPBACK_MAX_HEADER_LEN + 2 + filterCount);
+	pOut[0] = SUBACK << 4;
+	headerLen = 1 + MQTTPacket_encode(pOut + 1, 2 + filterCount);
+	pOut[headerLen] = (unsigned char) (packetId >> 8);
+	pOut[headerLen + 1] = (unsigned char) (packetId & 0xFF);
+	pOut += headerLen + 2;
+
+	pPos = pVariable + 2;
+	while(pPos < pEnd){
+		readString(&pPos, pEnd, &pFilter, &filterLen);
+		*pOut++ = brokerSubscribe(pTLSData, pFilter, filterLen, *pPos++);
+	}
+	pTLSData->toClientTail += headerLen + 2 + filterCount;
+	return true;
+}
+
+/* Acknowledges a publish of the client and sends it back if it matches a subscription */
+static bool brokerPublish(TLSDataParams *pTLSData, unsigned char *pPacket, size_t packetLen) {
+	unsigned char dup;
+	unsigned char retained;
+	QoS qos;
+	uint16_t packetId;
+	MQTTString topicName;
+	unsigned char *pPayload;
+	uint32_t payloadLen;
+	QoS echoQos = QOS0;
+	bool isEchoed = false;
+	uint32_t echoLen;
+	unsigned char *pOut;
+	LoopbackSubscription *pSubscription;
+	size_t i;
+
+	if(SUCCESS != MQTTDeserialize_publish(&dup, &qos, &retained, &packetId, &topicName, &pPayload, &payloadLen,
+										  pPacket, packetLen)){
+		return false;
+	}
+
+	if(QOS1 == qos){
+		brokerAck(pTLSData, PUBACK, packetId);
+	}else if(QOS2 == qos){
+		brokerAck(pTLSData, PUBREC, packetId);
+	}
+
+	// Sent once, at the highest QoS granted to a matching filter but not above that of the publish
+	for(i = 0; i < LOOPBACK_MAX_SUBSCRIPTIONS; i++){
+		pSubscription = &(pTLSData->subscriptions[i]);
+		if(pSubscription->isUsed && (!isEchoed || echoQos < (QoS) pSubscription->qos)
+		   && isFilterMatched(pSubscription->filter, topicName.lenstring.data, topicName.lenstring.len)){
+			echoQos = (QoS) pSubscription->qos;
+			isEchoed = true;
+		}
+	}
+	if(!isEchoed){
+		return true;
+	}
+	if(echoQos > qos){
+		echoQos = qos;
+	}
+
+	// The publish goes back no larger than it came, the room for it was checked
+	pOut = clientReserve(pTLSData, packetLen);
+	if(SUCCESS != MQTTSerialize_publish(pOut, packetLen, 0, echoQos, 0,
+										(QOS0 == echoQos) ? 0 : brokerNextPacketId(pTLSData), topicName, pPayload,
+										payloadLen, &echoLen)){
+		return false;
+	}
+	pTLSData->toClientTail += echoLen;
+	return true;
+}
+
+/* Acts on one complete packet. Returns false if it breaks the protocol */
+static bool brokerHandle(TLSDataParams *pTLSData, unsigned char *pPacket, size_t headerLen, size_t packetLen) {
+	unsigned char *pVariable = pPacket + headerLen;
+	const unsigned char *pEnd = pPacket + packetLen;
+	const unsigned char *pPos = pVariable;
+	const unsigned char *pProtocolName;
+	size_t protocolNameLen;
+	unsigned char *pOut;
+
+	switch(pPacket[0] >> 4){
+	case CONNECT:
+		// The protocol name, its level, then the flags
+		if(!readString(&pPos, pEnd, &pProtocolName, &protocolNameLen) || 2 > pEnd - pPos){
+			return false;
+		}
+		if(pPos[1] & 0x02){
+			clearSubscriptions(pTLSData);
+		}
+		pOut = clientReserve(pTLSData, 4);
+		pOut[0] = CONNACK << 4;
+		pOut[1] = 2;
+		pOut[2] = 0;
+		pOut[3] = 0;
+		pTLSData->toClientTail += 4;
+		return true;
+	case PUBLISH:
+		return brokerPublish(pTLSData, pPacket, packetLen);
+	case PUBACK:
+	case PUBCOMP:
+		return true;
+	case PUBREC:
+	case PUBREL:
+		if(2 > pEnd - pVariable){
+			return false;
+		}
+		brokerAck(pTLSData, (PUBREC == (pPacket[0] >> 4)) ? PUBREL : PUBCOMP,
+				  (uint16_t) ((pVariable[0] << 8) | pVariable[1]));
+		return true;
+	case SUBSCRIBE:
+		return brokerSubscriptions(pTLSData, pVariable, pEnd, true);
+	case UNSUBSCRIBE:
+		return brokerSubscriptions(pTLSData, pVariable, pEnd, false);
+	case PINGREQ:
+		pOut = clientReserve(pTLSData, 2);
+		pOut[0] = PINGRESP << 4;
+		pOut[1] = 0;
+		pTLSData->toClientTail += 2;
+		return true;
+	case DISCONNECT:
+		pTLSData->isOpen = false;
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Handles the complete packets written so far, as long as their answers fit */
+static void brokerParse(TLSDataParams *pTLSData) {
+	size_t offset = 0;
+	size_t pos;
+	size_t remLen;
+	size_t multiplier;
+
+	while(pTLSData->isOpen){
+		pos = offset + 1;
+		remLen = 0;
+		multiplier = 1;
+		do{
+			if(pos >= pTLSData->toBrokerLen){
+				goto done;
+			}
+			if(offset + LOOPBACK_MAX_HEADER_LEN <= pos){
+				ERROR(" Loopback broker dropped the client: malformed remaining length");
+				pTLSData->isOpen = false;
+				goto done;
+			}
+			remLen += (pTLSData->toBroker[pos] & 127u) * multiplier;
+			multiplier *= 128;
+		}while(pTLSData->toBroker[pos++] & 128u);
+
+		// Every answer fits in the size of the packet plus an ack
+		if(pos - offset + remLen + 4 > AWS_IOT_LOOPBACK_BUF_LEN){
+			ERROR(" Loopback broker dropped the client: packet longer than AWS_IOT_LOOPBACK_BUF_LEN");
+			pTLSData->isOpen = false;
+			break;
+		}
+		if(pTLSData->toBrokerLen < pos + remLen){
+			break;
+		}
+		if(NULL == clientReserve(pTLSData, pos - offset + remLen + 4)){
+			break;
+		}
+		if(!brokerHandle(pTLSData, pTLSData->toBroker + offset, pos - offset, pos - offset + remLen)){
+			ERROR(" Loopback broker dropped the client: malformed or unexpected packet 0x%02x", pTLSData->toBroker[offset]);
+			pTLSData->isOpen = false;
+		}
+		offset = pos + remLen;
+	}
+
+done:
+	if(!pTLSData->isOpen){
+		offset = pTLSData->toBrokerLen;
+	}
+	memmove(pTLSData->toBroker, pTLSData->toBroker + offset, pTLSData->toBrokerLen - offset);
+	pTLSData->toBrokerLen -= offset;
+}
+
+/* Hands as much of the bytes to the broker as it takes. Returns how many that were */
+static size_t brokerTake(TLSDataParams *pTLSData, const unsigned char *pData, size_t len) {
+	size_t takenLen = 0;
+	size_t chunkLen;
+
+	while(pTLSData->isOpen && takenLen < len){
+		chunkLen = AWS_IOT_LOOPBACK_BUF_LEN - pTLSData->toBrokerLen;
+		if(0 == chunkLen){
+			break;
+		}
+		if(chunkLen > len - takenLen){
+			chunkLen = len - takenLen;
+		}
+		memcpy(pTLSData->toBroker + pTLSData->toBrokerLen, pData + takenLen, chunkLen);
+		pTLSData->toBrokerLen += chunkLen;
+		takenLen += chunkLen;
+		brokerParse(pTLSData);
+	}
+
+	return takenLen;
+}
+
+/* Writes all bytes of the segments, in order. Returns how many that were,
+ * SSL_WRITE_TIMEOUT_ERROR at the deadline or SSL_WRITE_ERROR */
+static int writeSegments(TLSDataParams *pTLSData, NetworkIoVec *pIov, int iovcnt, int timeout_ms) {
+	Timer deadline;
+	int writtenLen = 0;
+	int segmentLen = 0;
+	int rc;
+
+	InitTimer(&deadline);
+	countdown_ms(&deadline, timeout_ms);
+
+	loopbackLock(pTLSData);
+	while(0 < iovcnt){
+		if(!pTLSData->isOpen){
+			rc = SSL_WRITE_ERROR;
+			goto unlock;
+		}
+		segmentLen += brokerTake(pTLSData, pIov->pData + segmentLen, (size_t) (pIov->len - segmentLen));
+		loopbackSignal(pTLSData);
+		if(segmentLen < pIov->len){
+			if(expired(&deadline)){
+				rc = SSL_WRITE_TIMEOUT_ERROR;
+				goto unlock;
+			}
+			// Room comes when the client reads the answers
+			loopbackWait(pTLSData, &deadline);
+			continue;
+		}
+		writtenLen += segmentLen;
+		segmentLen = 0;
+		pIov++;
+		iovcnt--;
+	}
+	rc = writtenLen;
+
+unlock:
+	loopbackUnlock(pTLSData);
+	return rc;
+}
+
+/* Reads what the broker sent, waiting until the deadline for at least minLen bytes. Returns
+ * the number of bytes, SSL_READ_TIMEOUT_ERROR at the deadline or SSL_READ_ERROR */
+static int readFromBroker(TLSDataParams *pTLSData, unsigned char *pMsg, int minLen, int len, int timeout_ms) {
+	Timer deadline;
+	size_t rxLen;
+
+	InitTimer(&deadline);
+	countdown_ms(&deadline, timeout_ms);
+
+	loopbackLock(pTLSData);
+	// What the broker sent is read even after the connection closed, as from a socket
+	while(clientPending(pTLSData) < (size_t) minLen && pTLSData->isOpen && !expired(&deadline)){
+		loopbackWait(pTLSData, &deadline);
+	}
+	if(clientPending(pTLSData) < (size_t) minLen){
+		loopbackUnlock(pTLSData);
+		return pTLSData->isOpen ? SSL_READ_TIMEOUT_ERROR : SSL_READ_ERROR;
+	}
+
+	rxLen = clientPending(pTLSData);
+	if(rxLen > (size_t) len){
+		rxLen = (size_t) len;
+	}
+	memcpy(pMsg, pTLSData->toClient + pTLSData->toClientHead, rxLen);
+	pTLSData->toClientHead += rxLen;
+	// Packets waiting for room for their answers may have it now
+	brokerParse(pTLSData);
+	loopbackSignal(pTLSData);
+	loopbackUnlock(pTLSData);
+
+	return (int) rxLen;
+}
+
+void iot_tls_invalidate_credentials(Network *pNetwork) {
+	// No credentials are loaded
+}
+
+int iot_tls_init(Network *pNetwork) {
+	TLSDataParams *pTLSData = &(pNetwork->tlsDataParams);
+
+	if(!pTLSData->isInitialized){
+#ifdef _ENABLE_THREAD_SUPPORT_
+		if(NONE_ERROR != aws_iot_thread_mutex_init(&(pTLSData->lock))){
+			return MUTEX_INIT_ERROR;
+		}
+		if(NONE_ERROR != aws_iot_thread_cond_init(&(pTLSData->changed))){
+			aws_iot_thread_mutex_destroy(&(pTLSData->lock));
+			return MUTEX_INIT_ERROR;
+		}
+#endif
+		pTLSData->isInitialized = true;
+	}
+
+	pNetwork->my_socket = -1;
+	pNetwork->isSessionResumed = 0;
+	pNetwork->connect = iot_tls_connect;
+	pNetwork->mqttread = iot_tls_read;
+	pNetwork->mqttreadsome = iot_tls_read_some;
+	pNetwork->mqttwrite = iot_tls_write;
+	pNetwork->mqttwritev = iot_tls_writev;
+	pNetwork->mqttsendfile = iot_tls_sendfile;
+	pNetwork->disconnect = iot_tls_disconnect;
+	pNetwork->isConnected = iot_tls_is_connected;
+	pNetwork->destroy = iot_tls_destroy;
+
+	return NONE_ERROR;
+}
+
+int iot_tls_is_connected(Network *pNetwork) {
+	/* Use this to add implementation which can check for physical layer disconnect */
+	return 1;
+}
+
+int iot_tls_connect(Network *pNetwork, TLSConnectParams params) {
+	TLSDataParams *pTLSData = &(pNetwork->tlsDataParams);
+
+	// Neither the endpoint nor the credentials in params are used
+	loopbackLock(pTLSData);
+	pTLSData->toBrokerLen = 0;
+	pTLSData->toClientHead = 0;
+	pTLSData->toClientTail = 0;
+	pTLSData->isOpen = true;
+	loopbackUnlock(pTLSData);
+
+	pNetwork->isSessionResumed = 0;
+
+	return NONE_ERROR;
+}
+
+int iot_tls_write(Network *pNetwork, unsigned char *pMsg, int len, int timeout_ms) {
+	NetworkIoVec iov;
+
+	iov.pData = pMsg;
+	iov.len = len;
+
+	return writeSegments(&(pNetwork->tlsDataParams), &iov, 1, timeout_ms);
+}
+
+int iot_tls_writev(Network *pNetwork, NetworkIoVec *pIov, int iovcnt, int timeout_ms) {
+	// The broker copies the segments in one after the other, as a single buffer
+	return writeSegments(&(pNetwork->tlsDataParams), pIov, iovcnt, timeout_ms);
+}
+
+int iot_tls_sendfile(Network *pNetwork, int fd, int64_t offset, int len, int timeout_ms) {
+	unsigned char chunk[LOOPBACK_SENDFILE_CHUNK_LEN];
+	NetworkIoVec iov;
+	ssize_t chunkLen = 0;
+	int writtenLen = 0;
+	int rc = 0;
+	Timer deadline;
+
+	InitTimer(&deadline);
+	countdown_ms(&deadline, timeout_ms);
+
+	while(writtenLen < len){
+		chunkLen = (LOOPBACK_SENDFILE_CHUNK_LEN < len - writtenLen) ? LOOPBACK_SENDFILE_CHUNK_LEN : len - writtenLen;
+		chunkLen = pread(fd, chunk, (size_t) chunkLen, (off_t) (offset + writtenLen));
+		if(0 > chunkLen && EINTR == errno){
+			continue;
+		}
+		if(0 >= chunkLen){
+			// A read error, or the file ends early
+			return SSL_WRITE_ERROR;
+		}
+
+		iov.pData = chunk;
+		iov.len = (int) chunkLen;
+		rc = writeSegments(&(pNetwork->tlsDataParams), &iov, 1, left_ms(&deadline));
+		if(0 > rc){
+			return rc;
+		}
+		writtenLen += rc;
+	}
+
+	return writtenLen;
+}
+
+int iot_tls_read(Network *pNetwork, unsigned char *pMsg, int len, int timeout_ms) {
+	return readFromBroker(&(pNetwork->tlsDataParams), pMsg, len, len, timeout_ms);
+}
+
+int iot_tls_read_some(Network *pNetwork, unsigned char *pMsg, int len, int timeout_ms) {
+	return readFromBroker(&(pNetwork->tlsDataParams), pMsg, 1, len, timeout_ms);
+}
+
+void iot_tls_disconnect(Network *pNetwork) {
+	TLSDataParams *pTLSData = &(pNetwork->tlsDataParams);
+
+	// The subscriptions stay for a connect without a clean session, as on a broker
+	loopbackLock(pTLSData);
+	pTLSData->isOpen = false;
+	pTLSData->toBrokerLen = 0;
+	pTLSData->toClientHead = 0;
+	pTLSData->toClientTail = 0;
+	loopbackSignal(pTLSData);
+	loopbackUnlock(pTLSData);
+}
+
+int iot_tls_destroy(Network *pNetwork) {
+	// The lock and the condition stay for the next iot_tls_init
+	return 0;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_LOOPBACK_NETWORK_PLATFORM_H_
+#define SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_LOOPBACK_NETWORK_PLATFORM_H_
+
+/**
+ * @file network_platform.h
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "aws_iot_config.h"
+#include "threads_interface.h"
+
+#ifndef AWS_IOT_LOOPBACK_BUF_LEN
+#define AWS_IOT_LOOPBACK_BUF_LEN 16384
+#endif
+#define LOOPBACK_TOPIC_FILTER_LEN 128 ///< Subscriptions to longer topic filters are refused
+#define LOOPBACK_MAX_SUBSCRIPTIONS 8 ///< Topic filters the broker stub keeps for a connection
+
+/**
+ * @brief A topic filter the client subscribed to
+ */
+typedef struct {
+	bool isUsed;
+	unsigned char qos;	///< Granted QoS, what the client asked for
+	char filter[LOOPBACK_TOPIC_FILTER_LEN];
+} LoopbackSubscription;
+
+/**
+ * definition of the TLS state of a Network. Platform specific
+ *
+ * The connection is a pair of buffers in memory with a broker stub at the other end.  What
+ * the client writes is handed to the broker as soon as a packet is complete, and whatever
+ * the broker answers is ready for the next read.  The Network must be zeroed before its
+ * first iot_tls_init, as a static one is.
+ */
+typedef struct {
+	bool isInitialized;
+	bool isOpen;	///< From connect to disconnect, or until the broker drops a client that broke the protocol
+	unsigned char toBroker[AWS_IOT_LOOPBACK_BUF_LEN];	///< Written by the client, not yet a complete packet or waiting for room in toClient
+	size_t toBrokerLen;
+	unsigned char toClient[AWS_IOT_LOOPBACK_BUF_LEN];	///< Sent by the broker, not yet read by the client
+	size_t toClientHead;
+	size_t toClientTail;
+	LoopbackSubscription subscriptions[LOOPBACK_MAX_SUBSCRIPTIONS];
+	uint16_t nextPacketId;	///< Of the next QoS1 or QoS2 publish the broker sends
+#ifdef _ENABLE_THREAD_SUPPORT_
+	IoT_Mutex_t lock;	///< The client and the broker stub run on whichever threads read and write
+	IoT_Cond_t changed;	///< Broadcast whenever data moved or the connection closed
+#endif
+} TLSDataParams;
+
+#endif /* SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_LOOPBACK_NETWORK_PLATFORM_H_ */
@@ -15,10 +15,17 @@
 
 #include <stdbool.h>
 #include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
 
+#include "aws_iot_config.h"
 #include "aws_iot_error.h"
 #include "aws_iot_log.h"
 #include "network_interface.h"
+#include "timer_interface.h"
+#include "threads_interface.h"
+#include "network_resolver.h"
 #include "mbedtls/config.h"
 
 #include "mbedtls/net.h"
@@ -31,6 +38,11 @@
 #include "mbedtls/debug.h"
 #include "mbedtls/timing.h"
 
+#define TLS_WRITEV_GATHER_LEN 1024 ///< Segments of a vectored write are coalesced up to this many bytes so they share a TLS record
+#define TLS_SENDFILE_CHUNK_LEN 4096 ///< Bytes of a file read and written at a time
+
+#define TLS_CLOSE_NOTIFY_TIMEOUT_MS 100 ///< Longest wait for the socket to take the close_notify alert
+
 /*
  * This is a function to do further verification if needed on the cert received
  */
@@ -52,127 +64,376 @@ static int myCertVerify(void *data, mbedtls_x509_crt *crt, int depth, uint32_t *
 	return (0);
 }
 
-static int ret = 0, i;
-static mbedtls_entropy_context entropy;
-static mbedtls_ctr_drbg_context ctr_drbg;
-static mbedtls_ssl_context ssl;
-static mbedtls_ssl_config conf;
-static uint32_t flags;
-static mbedtls_x509_crt cacert;
-static mbedtls_x509_crt clicert;
-static mbedtls_pk_context pkey;
-static mbedtls_net_context server_fd;
+/* Waits until the socket is ready for events or the deadline has passed. Returns what poll
+ * does: more than 0 if ready, 0 at the deadline, less than 0 on error */
+static int waitForSocket(TLSDataParams *pTLSData, short events, Timer *pDeadline) {
+	struct pollfd pollFd;
+	int rc;
 
-int iot_tls_init(Network *pNetwork) {
-	IoT_Error_t ret_val = NONE_ERROR;
-	const char *pers = "aws_iot_tls_wrapper";
-	unsigned char buf[MBEDTLS_SSL_MAX_CONTENT_LEN + 1];
+	pollFd.fd = pTLSData->server_fd.fd;
+	pollFd.events = events;
+	do {
+		pollFd.revents = 0;
+		rc = poll(&pollFd, 1, left_ms(pDeadline));
+		/* the MQTT client may have cached the time, which would never let the deadline pass */
+		TimerRefreshNow();
+	} while (0 > rc && EINTR == errno && !expired(pDeadline));
 
-	mbedtls_net_init(&server_fd);
-	mbedtls_ssl_init(&ssl);
-	mbedtls_ssl_config_init(&conf);
-	mbedtls_ctr_drbg_init(&ctr_drbg);
-	mbedtls_x509_crt_init(&cacert);
-	mbedtls_x509_crt_init(&clicert);
-	mbedtls_pk_init(&pkey);
-
-	DEBUG("\n  . Seeding the random number generator...");
-	mbedtls_entropy_init(&entropy);
-	if ((ret_val = mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy, (const unsigned char *) pers,
-			strlen(pers))) != 0) {
-		ERROR(" failed\n  ! mbedtls_ctr_drbg_seed returned -0x%x\n", -ret);
-		return ret;
-	} DEBUG("ok\n");
+	return rc;
+}
 
-	pNetwork->my_socket = 0;
-	pNetwork->connect = iot_tls_connect;
-	pNetwork->mqttread = iot_tls_read;
-	pNetwork->mqttwrite = iot_tls_write;
-	pNetwork->disconnect = iot_tls_disconnect;
-	pNetwork->isConnected = iot_tls_is_connected;
-	pNetwork->destroy = iot_tls_destroy;
+/* What mbedTLS asks for before the call can go on */
+static short eventsWanted(int sslRet) {
+	return (MBEDTLS_ERR_SSL_WANT_WRITE == sslRet) ? POLLOUT : POLLIN;
+}
 
-	return ret_val;
+/* The socket is non-blocking, so the lock is never held while waiting for it */
+static void lockSSL(TLSDataParams *pTLSData) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	aws_iot_thread_mutex_lock(&(pTLSData->sslLock));
+#endif
 }
 
-int iot_tls_is_connected(Network *pNetwork) {
-	/* Use this to add implementation which can check for physical layer disconnect */
-	return 1;
+static void unlockSSL(TLSDataParams *pTLSData) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	aws_iot_thread_mutex_unlock(&(pTLSData->sslLock));
+#endif
 }
 
-int iot_tls_connect(Network *pNetwork, TLSConnectParams params) {
-	const char *pers = "aws_iot_tls_wrapper";
-	unsigned char buf[MBEDTLS_SSL_MAX_CONTENT_LEN + 1];
+/*
+ * Returns the entry of an endpoint. With isForInsert an endpoint without one gets an unused
+ * entry or the least recently used one. NULL if there is none or the name is too long
+ */
+static TLSSessionCacheEntry *findCachedSession(TLSDataParams *pTLSData, const char *pHost, int port, bool isForInsert) {
+	TLSSessionCacheEntry *pVictim = &(pTLSData->sessionCache[0]);
+	TLSSessionCacheEntry *pEntry;
+	int j;
+
+	if (NULL == pHost || TLS_SESSION_HOST_LEN <= strlen(pHost)) {
+		return NULL;
+	}
+
+	for (j = 0; j < AWS_IOT_TLS_SESSION_CACHE_LEN; j++) {
+		pEntry = &(pTLSData->sessionCache[j]);
+		if (pEntry->isValid && port == pEntry->port && 0 == strcmp(pHost, pEntry->host)) {
+			return pEntry;
+		}
+		if (pVictim->isValid && (!pEntry->isValid || pEntry->lastUsed < pVictim->lastUsed)) {
+			pVictim = pEntry;
+		}
+	}
+
+	return isForInsert ? pVictim : NULL;
+}
+
+static void forgetCachedSession(TLSSessionCacheEntry *pEntry) {
+	mbedtls_ssl_session_free(&(pEntry->session));
+	pEntry->isValid = false;
+}
+
+static void forgetAllCachedSessions(TLSDataParams *pTLSData) {
+	int j;
+
+	for (j = 0; j < AWS_IOT_TLS_SESSION_CACHE_LEN; j++) {
+		if (pTLSData->sessionCache[j].isValid) {
+			forgetCachedSession(&(pTLSData->sessionCache[j]));
+		}
+	}
+}
+
+static void cacheSession(TLSDataParams *pTLSData, const char *pHost, int port) {
+	TLSSessionCacheEntry *pEntry = findCachedSession(pTLSData, pHost, port, true);
+
+	if (NULL == pEntry) {
+		return;
+	}
+
+	if (pEntry->isValid) {
+		forgetCachedSession(pEntry);
+	}
+	mbedtls_ssl_session_init(&(pEntry->session));
+	if (0 != mbedtls_ssl_get_session(&(pTLSData->ssl), &(pEntry->session))) {
+		mbedtls_ssl_session_free(&(pEntry->session));
+		return;
+	}
+	strcpy(pEntry->host, pHost);
+	pEntry->port = port;
+	pEntry->isValid = true;
+	pEntry->lastUsed = ++(pTLSData->sessionCacheUseCount);
+}
+
+/* A server that resumes a session echoes its ID, also when the client offered a ticket */
+static bool isSessionResumed(TLSDataParams *pTLSData, TLSSessionCacheEntry *pCachedSession) {
+	if (NULL == pCachedSession || 0 == pCachedSession->session.id_len || NULL == pTLSData->ssl.session) {
+		return false;
+	}
+
+	return pTLSData->ssl.session->id_len == pCachedSession->session.id_len
+			&& 0 == memcmp(pTLSData->ssl.session->id, pCachedSession->session.id, pCachedSession->session.id_len);
+}
+
+static bool isSameLocation(const char *pLoaded, const char *pLocation) {
+	if (NULL == pLocation) {
+		return '\0' == pLoaded[0];
+	}
+	return 0 == strcmp(pLoaded, pLocation);
+}
+
+static bool areCredentialsLoaded(TLSDataParams *pTLSData, TLSConnectParams *pParams) {
+	if (!pTLSData->credentialSource.isLoaded) {
+		return false;
+	}
+	if (pParams->pRootCADer != pTLSData->credentialSource.pRootCADer || pParams->RootCADerLen != pTLSData->credentialSource.RootCADerLen
+			|| pParams->pDeviceCertDer != pTLSData->credentialSource.pDeviceCertDer
+			|| pParams->DeviceCertDerLen != pTLSData->credentialSource.DeviceCertDerLen
+			|| pParams->pDevicePrivateKeyDer != pTLSData->credentialSource.pDevicePrivateKeyDer
+			|| pParams->DevicePrivateKeyDerLen != pTLSData->credentialSource.DevicePrivateKeyDerLen) {
+		return false;
+	}
+	return (NULL != pParams->pRootCADer || isSameLocation(pTLSData->credentialSource.rootCALocation, pParams->pRootCALocation))
+			&& (NULL != pParams->pDeviceCertDer || isSameLocation(pTLSData->credentialSource.deviceCertLocation, pParams->pDeviceCertLocation))
+			&& (NULL != pParams->pDevicePrivateKeyDer || isSameLocation(pTLSData->credentialSource.devicePrivateKeyLocation, pParams->pDevicePrivateKeyLocation));
+}
+
+static bool copyLocation(char *pLoaded, const char *pLocation) {
+	if (NULL == pLocation) {
+		pLoaded[0] = '\0';
+		return true;
+	}
+	if (TLS_CREDENTIAL_PATH_LEN <= strlen(pLocation)) {
+		return false;
+	}
+	strcpy(pLoaded, pLocation);
+	return true;
+}
+
+static void rememberCredentials(TLSDataParams *pTLSData, TLSConnectParams *pParams) {
+	pTLSData->credentialSource.pRootCADer = pParams->pRootCADer;
+	pTLSData->credentialSource.RootCADerLen = pParams->RootCADerLen;
+	pTLSData->credentialSource.pDeviceCertDer = pParams->pDeviceCertDer;
+	pTLSData->credentialSource.DeviceCertDerLen = pParams->DeviceCertDerLen;
+	pTLSData->credentialSource.pDevicePrivateKeyDer = pParams->pDevicePrivateKeyDer;
+	pTLSData->credentialSource.DevicePrivateKeyDerLen = pParams->DevicePrivateKeyDerLen;
+	pTLSData->credentialSource.isLoaded = copyLocation(pTLSData->credentialSource.rootCALocation, pParams->pRootCALocation)
+			&& copyLocation(pTLSData->credentialSource.deviceCertLocation, pParams->pDeviceCertLocation)
+			&& copyLocation(pTLSData->credentialSource.devicePrivateKeyLocation, pParams->pDevicePrivateKeyLocation);
+}
+
+/*
+ * Parsing the certificates and the key costs more than a resumed handshake, so they are
+ * parsed on the first connect and kept, together with the configuration that refers to them,
+ * until the credentials change. No connection uses them while a connect runs
+ */
+static int loadCredentials(TLSDataParams *pTLSData, TLSConnectParams *pParams) {
+	int ret;
+
+	if (areCredentialsLoaded(pTLSData, pParams)) {
+		return 0;
+	}
+
+	pTLSData->credentialSource.isLoaded = false;
+	/* Sessions of the old credentials must not be resumed with the new ones */
+	forgetAllCachedSessions(pTLSData);
+	mbedtls_ssl_config_free(&(pTLSData->conf));
+	mbedtls_x509_crt_free(&(pTLSData->cacert));
+	mbedtls_x509_crt_free(&(pTLSData->clicert));
+	mbedtls_pk_free(&(pTLSData->pkey));
+	mbedtls_ssl_config_init(&(pTLSData->conf));
+	mbedtls_x509_crt_init(&(pTLSData->cacert));
+	mbedtls_x509_crt_init(&(pTLSData->clicert));
+	mbedtls_pk_init(&(pTLSData->pkey));
 
 	DEBUG("  . Loading the CA root certificate ...");
-	ret = mbedtls_x509_crt_parse_file(&cacert, params.pRootCALocation);
+	if (NULL != pParams->pRootCADer) {
+		ret = mbedtls_x509_crt_parse_der(&(pTLSData->cacert), pParams->pRootCADer, pParams->RootCADerLen);
+	} else {
+		ret = mbedtls_x509_crt_parse_file(&(pTLSData->cacert), pParams->pRootCALocation);
+	}
 	if (ret < 0) {
 		ERROR(" failed\n  !  mbedtls_x509_crt_parse returned -0x%x\n\n", -ret);
 		return ret;
 	} DEBUG(" ok (%d skipped)\n", ret);
 
 	DEBUG("  . Loading the client cert. and key...");
-	ret = mbedtls_x509_crt_parse_file(&clicert, params.pDeviceCertLocation);
+	if (NULL != pParams->pDeviceCertDer) {
+		ret = mbedtls_x509_crt_parse_der(&(pTLSData->clicert), pParams->pDeviceCertDer, pParams->DeviceCertDerLen);
+	} else {
+		ret = mbedtls_x509_crt_parse_file(&(pTLSData->clicert), pParams->pDeviceCertLocation);
+	}
 	if (ret != 0) {
 		ERROR(" failed\n  !  mbedtls_x509_crt_parse returned -0x%x\n\n", -ret);
 		return ret;
 	}
 
-	ret = mbedtls_pk_parse_keyfile(&pkey, params.pDevicePrivateKeyLocation, "");
-	if (ret != 0) {
-		ERROR(" failed\n  !  mbedtls_pk_parse_key returned -0x%x\n\n", -ret);
-		return ret;
-	} DEBUG(" ok\n");
-	char portBuffer[6];
-	sprintf(portBuffer, "%d", params.DestinationPort); DEBUG("  . Connecting to %s/%s...", params.pDestinationURL, portBuffer);
-	if ((ret = mbedtls_net_connect(&server_fd, params.pDestinationURL, portBuffer, MBEDTLS_NET_PROTO_TCP)) != 0) {
-		ERROR(" failed\n  ! mbedtls_net_connect returned -0x%x\n\n", -ret);
-		return ret;
+	if (NULL != pParams->pDevicePrivateKeyDer) {
+		ret = mbedtls_pk_parse_key(&(pTLSData->pkey), pParams->pDevicePrivateKeyDer, pParams->DevicePrivateKeyDerLen, NULL, 0);
+	} else {
+		ret = mbedtls_pk_parse_keyfile(&(pTLSData->pkey), pParams->pDevicePrivateKeyLocation, "");
 	}
-
-	ret = mbedtls_net_set_block(&server_fd);
 	if (ret != 0) {
-		ERROR(" failed\n  ! net_set_(non)block() returned -0x%x\n\n", -ret);
+		ERROR(" failed\n  !  mbedtls_pk_parse_key returned -0x%x\n\n", -ret);
 		return ret;
 	} DEBUG(" ok\n");
 
 	DEBUG("  . Setting up the SSL/TLS structure...");
-	if ((ret = mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+	if ((ret = mbedtls_ssl_config_defaults(&(pTLSData->conf), MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
 			MBEDTLS_SSL_PRESET_DEFAULT)) != 0) {
 		ERROR(" failed\n  ! mbedtls_ssl_config_defaults returned -0x%x\n\n", -ret);
 		return ret;
 	}
 
-	mbedtls_ssl_conf_verify(&conf, myCertVerify, NULL);
-	if (params.ServerVerificationFlag == true) {
-		mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_REQUIRED);
-	} else {
-		mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_OPTIONAL);
-	}
-	mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &ctr_drbg);
+	mbedtls_ssl_conf_verify(&(pTLSData->conf), myCertVerify, NULL);
+	mbedtls_ssl_conf_rng(&(pTLSData->conf), mbedtls_ctr_drbg_random, &(pTLSData->ctr_drbg));
 
-	mbedtls_ssl_conf_ca_chain(&conf, &cacert, NULL);
-	if ((ret = mbedtls_ssl_conf_own_cert(&conf, &clicert, &pkey)) != 0) {
+	mbedtls_ssl_conf_ca_chain(&(pTLSData->conf), &(pTLSData->cacert), NULL);
+	if ((ret = mbedtls_ssl_conf_own_cert(&(pTLSData->conf), &(pTLSData->clicert), &(pTLSData->pkey))) != 0) {
 		ERROR(" failed\n  ! mbedtls_ssl_conf_own_cert returned %d\n\n", ret);
 		return ret;
 	}
 
-	mbedtls_ssl_conf_read_timeout(&conf, params.timeout_ms);
+	rememberCredentials(pTLSData, pParams);
+	return 0;
+}
+
+void iot_tls_invalidate_credentials(Network *pNetwork) {
+	pNetwork->tlsDataParams.credentialSource.isLoaded = false;
+	forgetAllCachedSessions(&(pNetwork->tlsDataParams));
+}
 
-	if ((ret = mbedtls_ssl_setup(&ssl, &conf)) != 0) {
+int iot_tls_init(Network *pNetwork) {
+	const char *pers = "aws_iot_tls_wrapper";
+	TLSDataParams *pTLSData = &(pNetwork->tlsDataParams);
+	int ret;
+
+	if (NONE_ERROR != iot_resolver_init()) {
+		return MUTEX_INIT_ERROR;
+	}
+
+	/* Runs before every connect, the random number generator of a Network is only seeded on its first */
+	if (!pTLSData->isInitialized) {
+		mbedtls_net_init(&(pTLSData->server_fd));
+		mbedtls_ssl_init(&(pTLSData->ssl));
+		mbedtls_ssl_config_init(&(pTLSData->conf));
+		mbedtls_ctr_drbg_init(&(pTLSData->ctr_drbg));
+		mbedtls_x509_crt_init(&(pTLSData->cacert));
+		mbedtls_x509_crt_init(&(pTLSData->clicert));
+		mbedtls_pk_init(&(pTLSData->pkey));
+#ifdef _ENABLE_THREAD_SUPPORT_
+		if (NONE_ERROR != aws_iot_thread_mutex_init(&(pTLSData->sslLock))) {
+			return MUTEX_INIT_ERROR;
+		}
+#endif
+
+		DEBUG("\n  . Seeding the random number generator...");
+		mbedtls_entropy_init(&(pTLSData->entropy));
+		if ((ret = mbedtls_ctr_drbg_seed(&(pTLSData->ctr_drbg), mbedtls_entropy_func, &(pTLSData->entropy), (const unsigned char *) pers,
+				strlen(pers))) != 0) {
+			ERROR(" failed\n  ! mbedtls_ctr_drbg_seed returned -0x%x\n", -ret);
+			mbedtls_ctr_drbg_free(&(pTLSData->ctr_drbg));
+			mbedtls_entropy_free(&(pTLSData->entropy));
+#ifdef _ENABLE_THREAD_SUPPORT_
+			aws_iot_thread_mutex_destroy(&(pTLSData->sslLock));
+#endif
+			return ret;
+		} DEBUG("ok\n");
+		pTLSData->isInitialized = true;
+	}
+
+	pNetwork->my_socket = -1;
+	pNetwork->isSessionResumed = 0;
+	pNetwork->connect = iot_tls_connect;
+	pNetwork->mqttread = iot_tls_read;
+	pNetwork->mqttreadsome = iot_tls_read_some;
+	pNetwork->mqttwrite = iot_tls_write;
+	pNetwork->mqttwritev = iot_tls_writev;
+	pNetwork->mqttsendfile = iot_tls_sendfile;
+	pNetwork->disconnect = iot_tls_disconnect;
+	pNetwork->isConnected = iot_tls_is_connected;
+	pNetwork->destroy = iot_tls_destroy;
+
+	return NONE_ERROR;
+}
+
+int iot_tls_is_connected(Network *pNetwork) {
+	/* Use this to add implementation which can check for physical layer disconnect */
+	return 1;
+}
+
+int iot_tls_connect(Network *pNetwork, TLSConnectParams params) {
+	unsigned char buf[MBEDTLS_SSL_MAX_CONTENT_LEN + 1];
+	TLSSessionCacheEntry *pCachedSession = NULL;
+	TLSDataParams *pTLSData = &(pNetwork->tlsDataParams);
+	Timer handshakeTimer;
+	uint32_t flags;
+	int pollRc;
+	int ret;
+
+	pNetwork->isSessionResumed = 0;
+
+	/* Left over from a connect that failed, freeing them twice is harmless */
+	mbedtls_ssl_free(&(pTLSData->ssl));
+	mbedtls_net_free(&(pTLSData->server_fd));
+
+	if ((ret = loadCredentials(pTLSData, &params)) != 0) {
+		return ret;
+	}
+
+	DEBUG("  . Connecting to %s/%d...", params.pDestinationURL, params.DestinationPort);
+	/* Instead of mbedtls_net_connect, which tries one address after the other */
+	ret = iot_resolver_connect(params.pDestinationURL, params.DestinationPort, params.timeout_ms);
+	if (ret < 0) {
+		ERROR(" failed\n  ! iot_resolver_connect returned %d\n\n", ret);
+		return ret;
+	}
+	pTLSData->server_fd.fd = ret;
+
+	pNetwork->my_socket = pTLSData->server_fd.fd;
+
+	/* Every read and write waits in poll, with what is left of its own timeout */
+	ret = mbedtls_net_set_nonblock(&(pTLSData->server_fd));
+	if (ret != 0) {
+		ERROR(" failed\n  ! net_set_(non)block() returned -0x%x\n\n", -ret);
+		return ret;
+	} DEBUG(" ok\n");
+
+	if (params.ServerVerificationFlag == true) {
+		mbedtls_ssl_conf_authmode(&(pTLSData->conf), MBEDTLS_SSL_VERIFY_REQUIRED);
+	} else {
+		mbedtls_ssl_conf_authmode(&(pTLSData->conf), MBEDTLS_SSL_VERIFY_OPTIONAL);
+	}
+
+	if ((ret = mbedtls_ssl_setup(&(pTLSData->ssl), &(pTLSData->conf))) != 0) {
 		ERROR(" failed\n  ! mbedtls_ssl_setup returned -0x%x\n\n", -ret);
 		return ret;
 	}
-	if ((ret = mbedtls_ssl_set_hostname(&ssl, params.pDestinationURL)) != 0) {
+	if ((ret = mbedtls_ssl_set_hostname(&(pTLSData->ssl), params.pDestinationURL)) != 0) {
 		ERROR(" failed\n  ! mbedtls_ssl_set_hostname returned %d\n\n", ret);
 		return ret;
 	}
-	mbedtls_ssl_set_bio(&ssl, &server_fd, mbedtls_net_send, NULL, mbedtls_net_recv_timeout);
+	mbedtls_ssl_set_bio(&(pTLSData->ssl), &(pTLSData->server_fd), mbedtls_net_send, mbedtls_net_recv, NULL);
 	DEBUG(" ok\n");
 
+	/* The server skips the certificate exchange and key agreement if it still knows the session */
+	pCachedSession = findCachedSession(pTLSData, params.pDestinationURL, params.DestinationPort, false);
+	if (NULL != pCachedSession && 0 != mbedtls_ssl_set_session(&(pTLSData->ssl), &(pCachedSession->session))) {
+		pCachedSession = NULL;
+	}
+
 	DEBUG("  . Performing the SSL/TLS handshake...");
-	while ((ret = mbedtls_ssl_handshake(&ssl)) != 0) {
-		if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+	InitTimer(&handshakeTimer);
+	countdown_ms(&handshakeTimer, params.timeout_ms);
+	while ((ret = mbedtls_ssl_handshake(&(pTLSData->ssl))) != 0) {
+		if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+			pollRc = waitForSocket(pTLSData, eventsWanted(ret), &handshakeTimer);
+			if (0 == pollRc) {
+				ERROR(" failed\n  ! handshake timed out\n");
+				return SSL_CONNECT_TIMEOUT_ERROR;
+			}
+			if (0 > pollRc) {
+				ERROR(" failed\n  ! poll returned %d\n", pollRc);
+				return SSL_CONNECT_ERROR;
+			}
+		} else {
 			ERROR(" failed\n  ! mbedtls_ssl_handshake returned -0x%x\n", -ret);
 			if (ret == MBEDTLS_ERR_X509_CERT_VERIFY_FAILED) {
 				ERROR("    Unable to verify the server's certificate. "
@@ -182,12 +443,16 @@ int iot_tls_connect(Network *pNetwork, TLSConnectParams params) {
 						"    Alternatively, you may want to use "
 						"auth_mode=optional for testing purposes.\n");
 			}
+			if (NULL != pCachedSession) {
+				/* Should the session be what makes the handshake fail, the next attempt does a full one */
+				forgetCachedSession(pCachedSession);
+			}
 			return ret;
 		}
 	}
 
-	DEBUG(" ok\n    [ Protocol is %s ]\n    [ Ciphersuite is %s ]\n", mbedtls_ssl_get_version(&ssl), mbedtls_ssl_get_ciphersuite(&ssl));
-	if ((ret = mbedtls_ssl_get_record_expansion(&ssl)) >= 0) {
+	DEBUG(" ok\n    [ Protocol is %s ]\n    [ Ciphersuite is %s ]\n", mbedtls_ssl_get_version(&(pTLSData->ssl)), mbedtls_ssl_get_ciphersuite(&(pTLSData->ssl)));
+	if ((ret = mbedtls_ssl_get_record_expansion(&(pTLSData->ssl))) >= 0) {
 		DEBUG("    [ Record expansion is %d ]\n", ret);
 	} else {
 		DEBUG("    [ Record expansion is unknown (compression) ]\n");
@@ -196,7 +461,7 @@ int iot_tls_connect(Network *pNetwork, TLSConnectParams params) {
 	DEBUG("  . Verifying peer X.509 certificate...");
 
 	if (params.ServerVerificationFlag == true) {
-		if ((flags = mbedtls_ssl_get_verify_result(&ssl)) != 0) {
+		if ((flags = mbedtls_ssl_get_verify_result(&(pTLSData->ssl))) != 0) {
 			char vrfy_buf[512];
 			ERROR(" failed\n");
 			mbedtls_x509_crt_verify_info(vrfy_buf, sizeof(vrfy_buf), "  ! ", flags);
@@ -210,72 +475,230 @@ int iot_tls_connect(Network *pNetwork, TLSConnectParams params) {
 		ret = NONE_ERROR;
 	}
 
-	if (mbedtls_ssl_get_peer_cert(&ssl) != NULL) {
+	if (mbedtls_ssl_get_peer_cert(&(pTLSData->ssl)) != NULL) {
 		DEBUG("  . Peer certificate information    ...\n");
-		mbedtls_x509_crt_info((char *) buf, sizeof(buf) - 1, "      ", mbedtls_ssl_get_peer_cert(&ssl));
+		mbedtls_x509_crt_info((char *) buf, sizeof(buf) - 1, "      ", mbedtls_ssl_get_peer_cert(&(pTLSData->ssl)));
 		DEBUG("%s\n", buf);
 	}
 
-	mbedtls_ssl_conf_read_timeout(&conf, 10);
+	if (NONE_ERROR == ret) {
+		pNetwork->isSessionResumed = isSessionResumed(pTLSData, pCachedSession) ? 1 : 0;
+		DEBUG("  . TLS session %s\n", pNetwork->isSessionResumed ? "resumed" : "established");
+		cacheSession(pTLSData, params.pDestinationURL, params.DestinationPort);
+	}
 
 	return ret;
 }
 
 int iot_tls_write(Network *pNetwork, unsigned char *pMsg, int len, int timeout_ms) {
+	TLSDataParams *pTLSData = &(pNetwork->tlsDataParams);
+	int written = 0;
+	int pollRc;
+	int ret;
+	Timer writeTimer;
+
+	InitTimer(&writeTimer);
+	countdown_ms(&writeTimer, timeout_ms);
+
+	while (written < len) {
+		lockSSL(pTLSData);
+		ret = mbedtls_ssl_write(&(pTLSData->ssl), pMsg + written, len - written);
+		unlockSSL(pTLSData);
+		if (ret > 0) {
+			written += ret;
+			continue;
+		}
+		if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+			ERROR(" failed\n  ! mbedtls_ssl_write returned -0x%x\n\n", -ret);
+			return ret;
+		}
+		/* mbedTLS keeps the unsent record and expects the same arguments again */
+		pollRc = waitForSocket(pTLSData, eventsWanted(ret), &writeTimer);
+		if (0 == pollRc) {
+			return SSL_WRITE_TIMEOUT_ERROR;
+		}
+		if (0 > pollRc) {
+			return SSL_WRITE_ERROR;
+		}
+	}
+	return written;
+}
 
-	int written;
-	int frags;
+int iot_tls_writev(Network *pNetwork, NetworkIoVec *pIov, int iovcnt, int timeout_ms) {
+	unsigned char gatherBuf[TLS_WRITEV_GATHER_LEN];
+	unsigned char *pSegment = NULL;
+	int segmentLeft = 0;
+	int gatheredLen = 0;
+	int writtenLen = 0;
+	int copyLen = 0;
+	int rc = 0;
+	int i;
+	Timer writeTimer;
+
+	/* The timeout covers the whole vector, not each record */
+	InitTimer(&writeTimer);
+	countdown_ms(&writeTimer, timeout_ms);
+
+	/* Small segments such as the MQTT header are copied together with the start of the next
+	 * segment so that they go out in one TLS record. Anything larger is written in place. */
+	for (i = 0; i < iovcnt; i++) {
+		pSegment = pIov[i].pData;
+		segmentLeft = pIov[i].len;
+		while (0 < segmentLeft) {
+			if (0 == gatheredLen && TLS_WRITEV_GATHER_LEN <= segmentLeft) {
+				rc = iot_tls_write(pNetwork, pSegment, segmentLeft, left_ms(&writeTimer));
+				if (0 > rc) {
+					return rc;
+				}
+				writtenLen += rc;
+				break;
+			}
 
-	for (written = 0, frags = 0; written < len; written += ret, frags++) {
-		while ((ret = mbedtls_ssl_write(&ssl, pMsg + written, len - written)) <= 0) {
-			if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
-				ERROR(" failed\n  ! mbedtls_ssl_write returned -0x%x\n\n", -ret);
-				return ret;
+			copyLen = TLS_WRITEV_GATHER_LEN - gatheredLen;
+			if (segmentLeft < copyLen) {
+				copyLen = segmentLeft;
+			}
+			memcpy(gatherBuf + gatheredLen, pSegment, copyLen);
+			gatheredLen += copyLen;
+			pSegment += copyLen;
+			segmentLeft -= copyLen;
+
+			if (TLS_WRITEV_GATHER_LEN == gatheredLen) {
+				rc = iot_tls_write(pNetwork, gatherBuf, gatheredLen, left_ms(&writeTimer));
+				if (0 > rc) {
+					return rc;
+				}
+				writtenLen += rc;
+				gatheredLen = 0;
 			}
 		}
 	}
-	return written;
+
+	if (0 < gatheredLen) {
+		rc = iot_tls_write(pNetwork, gatherBuf, gatheredLen, left_ms(&writeTimer));
+		if (0 > rc) {
+			return rc;
+		}
+		writtenLen += rc;
+	}
+
+	return writtenLen;
+}
+
+int iot_tls_sendfile(Network *pNetwork, int fd, int64_t offset, int len, int timeout_ms) {
+	unsigned char chunk[TLS_SENDFILE_CHUNK_LEN];
+	ssize_t chunkLen = 0;
+	int writtenLen = 0;
+	int rc = 0;
+	Timer writeTimer;
+
+	InitTimer(&writeTimer);
+	countdown_ms(&writeTimer, timeout_ms);
+
+	/* mbedTLS encrypts in user space, the file passes through one chunk at a time */
+	while (writtenLen < len) {
+		chunkLen = (TLS_SENDFILE_CHUNK_LEN < len - writtenLen) ? TLS_SENDFILE_CHUNK_LEN : len - writtenLen;
+		chunkLen = pread(fd, chunk, (size_t) chunkLen, (off_t) (offset + writtenLen));
+		if (0 > chunkLen && EINTR == errno) {
+			continue;
+		}
+		if (0 >= chunkLen) {
+			/* A read error, or the file ends early */
+			return SSL_WRITE_ERROR;
+		}
+
+		rc = iot_tls_write(pNetwork, chunk, (int) chunkLen, left_ms(&writeTimer));
+		if (0 > rc) {
+			return rc;
+		}
+		writtenLen += rc;
+	}
+
+	return writtenLen;
 }
 
 int iot_tls_read(Network *pNetwork, unsigned char *pMsg, int len, int timeout_ms) {
+	TLSDataParams *pTLSData = &(pNetwork->tlsDataParams);
 	int rxLen = 0;
-	bool isErrorFlag = false;
-	bool isCompleteFlag = false;
+	int pollRc;
+	int ret;
+	Timer readTimer;
 
-//	mbedtls_ssl_conf_read_timeout(&conf, timeout_ms);
+	InitTimer(&readTimer);
+	countdown_ms(&readTimer, timeout_ms);
 
-	do {
-		ret = mbedtls_ssl_read(&ssl, pMsg, len);
+	while (rxLen < len) {
+		lockSSL(pTLSData);
+		ret = mbedtls_ssl_read(&(pTLSData->ssl), pMsg + rxLen, len - rxLen);
+		unlockSSL(pTLSData);
 		if (ret > 0) {
 			rxLen += ret;
-		} else if (ret != MBEDTLS_ERR_SSL_WANT_READ) {
-			isErrorFlag = true;
+			continue;
+		}
+		if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+			/* 0 is the peer closing the connection */
+			return (0 == ret) ? SSL_READ_ERROR : ret;
+		}
+		pollRc = waitForSocket(pTLSData, eventsWanted(ret), &readTimer);
+		if (0 == pollRc) {
+			return SSL_READ_TIMEOUT_ERROR;
 		}
-		if (rxLen >= len) {
-			isCompleteFlag = true;
+		if (0 > pollRc) {
+			return SSL_READ_ERROR;
 		}
-	} while (!isErrorFlag && !isCompleteFlag);
+	}
 
-	return ret;
+	return rxLen;
 }
 
-void iot_tls_disconnect(Network *pNetwork) {
+int iot_tls_read_some(Network *pNetwork, unsigned char *pMsg, int len, int timeout_ms) {
+	TLSDataParams *pTLSData = &(pNetwork->tlsDataParams);
+	Timer readTimer;
+	int pollRc;
+	int ret;
+
+	InitTimer(&readTimer);
+	countdown_ms(&readTimer, timeout_ms);
+
+	/* a record that is already buffered is returned without looking at the socket */
 	do {
-		ret = mbedtls_ssl_close_notify(&ssl);
-	} while (ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+		lockSSL(pTLSData);
+		ret = mbedtls_ssl_read(&(pTLSData->ssl), pMsg, len);
+		unlockSSL(pTLSData);
+		if (ret > 0) {
+			return ret;
+		}
+		if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+			return (0 == ret) ? SSL_READ_ERROR : ret;
+		}
+		pollRc = waitForSocket(pTLSData, eventsWanted(ret), &readTimer);
+	} while (0 < pollRc);
+
+	return (0 == pollRc) ? SSL_READ_TIMEOUT_ERROR : SSL_READ_ERROR;
 }
 
-int iot_tls_destroy(Network *pNetwork) {
+void iot_tls_disconnect(Network *pNetwork) {
+	TLSDataParams *pTLSData = &(pNetwork->tlsDataParams);
+	Timer closeTimer;
+
+	InitTimer(&closeTimer);
+	countdown_ms(&closeTimer, TLS_CLOSE_NOTIFY_TIMEOUT_MS);
+	lockSSL(pTLSData);
+	while (mbedtls_ssl_close_notify(&(pTLSData->ssl)) == MBEDTLS_ERR_SSL_WANT_WRITE) {
+		if (0 >= waitForSocket(pTLSData, POLLOUT, &closeTimer)) {
+			break;
+		}
+	}
+	unlockSSL(pTLSData);
+	pNetwork->my_socket = -1;
+}
 
-	mbedtls_net_free(&server_fd);
+int iot_tls_destroy(Network *pNetwork) {
+	TLSDataParams *pTLSData = &(pNetwork->tlsDataParams);
 
-	mbedtls_x509_crt_free(&clicert);
-	mbedtls_x509_crt_free(&cacert);
-	mbedtls_pk_free(&pkey);
-	mbedtls_ssl_free(&ssl);
-	mbedtls_ssl_config_free(&conf);
-	mbedtls_ctr_drbg_free(&ctr_drbg);
-	mbedtls_entropy_free(&entropy);
+	/* The configuration and the parsed credentials are kept for the next connect */
+	mbedtls_net_free(&(pTLSData->server_fd));
+	mbedtls_ssl_free(&(pTLSData->ssl));
 
 	return 0;
 }
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_MBEDTLS_NETWORK_PLATFORM_H_
+#define SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_MBEDTLS_NETWORK_PLATFORM_H_
+
+/**
+ * @file network_platform.h
+ */
+#include <stdbool.h>
+
+#include "aws_iot_config.h"
+#include "threads_interface.h"
+#include "mbedtls/config.h"
+
+#include "mbedtls/net.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/pk.h"
+
+#ifndef AWS_IOT_TLS_SESSION_CACHE_LEN
+#define AWS_IOT_TLS_SESSION_CACHE_LEN 4
+#endif
+#define TLS_SESSION_HOST_LEN 128 ///< Sessions of endpoints with longer names are not cached
+#define TLS_CREDENTIAL_PATH_LEN 256 ///< Credentials from longer paths are parsed again for every connect
+
+/**
+ * @brief Session of the last connection to one endpoint, offered for resumption on the next
+ */
+typedef struct {
+	char host[TLS_SESSION_HOST_LEN];
+	int port;
+	bool isValid;
+	mbedtls_ssl_session session;
+	unsigned int lastUsed;
+} TLSSessionCacheEntry;
+
+/**
+ * @brief Where the parsed credentials came from
+ *
+ * A file is recognised by its path, a DER buffer by its address and length.
+ */
+typedef struct {
+	bool isLoaded;
+	char rootCALocation[TLS_CREDENTIAL_PATH_LEN];
+	char deviceCertLocation[TLS_CREDENTIAL_PATH_LEN];
+	char devicePrivateKeyLocation[TLS_CREDENTIAL_PATH_LEN];
+	const unsigned char *pRootCADer;
+	unsigned int RootCADerLen;
+	const unsigned char *pDeviceCertDer;
+	unsigned int DeviceCertDerLen;
+	const unsigned char *pDevicePrivateKeyDer;
+	unsigned int DevicePrivateKeyDerLen;
+} TLSCredentialSource;
+
+/**
+ * definition of the TLS state of a Network. Platform specific
+ *
+ * Only ssl and server_fd belong to the connection.  The random number generator, the
+ * configuration, the parsed credentials and the sessions for resumption are kept from one
+ * connect to the next.  The Network must be zeroed before its first iot_tls_init, as a
+ * static one is.
+ */
+typedef struct {
+	bool isInitialized;
+	mbedtls_entropy_context entropy;
+	mbedtls_ctr_drbg_context ctr_drbg;
+	mbedtls_ssl_config conf;
+	mbedtls_x509_crt cacert;
+	mbedtls_x509_crt clicert;
+	mbedtls_pk_context pkey;
+	TLSCredentialSource credentialSource;
+	TLSSessionCacheEntry sessionCache[AWS_IOT_TLS_SESSION_CACHE_LEN];
+	unsigned int sessionCacheUseCount;
+	mbedtls_ssl_context ssl;
+	mbedtls_net_context server_fd;
+#ifdef _ENABLE_THREAD_SUPPORT_
+	IoT_Mutex_t sslLock;	///< The SSL context must not be used by two threads at once
+#endif
+} TLSDataParams;
+
+#endif /* SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_MBEDTLS_NETWORK_PLATFORM_H_ */
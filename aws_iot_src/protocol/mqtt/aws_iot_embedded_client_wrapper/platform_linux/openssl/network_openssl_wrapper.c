@@ -18,56 +18,326 @@
 #include <openssl/pem.h>
 #include <openssl/x509.h>
 #include <openssl/x509_vfy.h>
+#include <stdbool.h>
 #include <sys/socket.h>
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
-#include <sys/select.h>
-#include <arpa/inet.h>
-#include <netinet/in.h>
-#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
 
+#include "aws_iot_config.h"
 #include "aws_iot_error.h"
 #include "aws_iot_log.h"
 #include "network_interface.h"
+#include "timer_interface.h"
+#include "threads_interface.h"
 #include "openssl_hostname_validation.h"
+#include "network_resolver.h"
 
-static SSL_CTX *pSSLContext;
-static SSL *pSSLHandle;
-static int server_TCPSocket;
-static char* pDestinationURL;
+#define TLS_WRITEV_GATHER_LEN 1024 ///< Segments of a vectored write are coalesced up to this many bytes so they share a TLS record
+#define TLS_SENDFILE_CHUNK_LEN 4096 ///< Bytes of a file read and written at a time while OpenSSL does the TLS encryption
+
+// Not part of the state of a Network, OpenSSL is set up once for the whole process
+static bool isLibraryInitialized;
 
-static int Create_TCPSocket(void);
-static IoT_Error_t Connect_TCPSocket(int socket_fd, char *pURLString, int port);
 static IoT_Error_t setSocketToNonBlocking(int server_fd);
-static IoT_Error_t ConnectOrTimeoutOrExitOnError(SSL *pSSL, int timeout_ms);
-static IoT_Error_t ReadOrTimeoutOrExitOnError(SSL *pSSL, unsigned char *msg, int totalLen, int timeout_ms);
+static IoT_Error_t ConnectOrTimeoutOrExitOnError(TLSDataParams *pTLSData, int timeout_ms);
+static IoT_Error_t ReadOrTimeoutOrExitOnError(TLSDataParams *pTLSData, unsigned char *msg, int totalLen, int timeout_ms);
+static IoT_Error_t WriteOrTimeoutOrExitOnError(TLSDataParams *pTLSData, unsigned char *msg, int totalLen, int timeout_ms);
+
+/* Waits until the socket is ready for events or the deadline has passed. Returns what poll
+ * does: more than 0 if ready, 0 at the deadline, less than 0 on error */
+static int waitForSocket(TLSDataParams *pTLSData, short events, Timer *pDeadline) {
+	struct pollfd pollFd;
+	int rc;
+
+	pollFd.fd = pTLSData->server_TCPSocket;
+	pollFd.events = events;
+	do{
+		pollFd.revents = 0;
+		rc = poll(&pollFd, 1, left_ms(pDeadline));
+		// The MQTT client may have cached the time, which would never let the deadline pass
+		TimerRefreshNow();
+	}while(0 > rc && EINTR == errno && !expired(pDeadline));
 
-int iot_tls_init(Network *pNetwork) {
+	return rc;
+}
 
-	IoT_Error_t ret_val = NONE_ERROR;
-	const SSL_METHOD *method;
+// The lock is only held while SSL_read or SSL_write run, never while waiting for the socket,
+// so a thread waiting for incoming data does not hold up a thread that writes.
+static void lockSSL(TLSDataParams *pTLSData) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	aws_iot_thread_mutex_lock(&(pTLSData->sslLock));
+#endif
+}
 
-	OpenSSL_add_all_algorithms();
-	ERR_load_BIO_strings();
-	ERR_load_crypto_strings();
-	SSL_load_error_strings();
+static void unlockSSL(TLSDataParams *pTLSData) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+	aws_iot_thread_mutex_unlock(&(pTLSData->sslLock));
+#endif
+}
+
+/* Returns the entry of an endpoint. With isForInsert an endpoint without one gets an unused
+ * entry or the least recently used one. NULL if there is none or the name is too long */
+static TLSSessionCacheEntry *findCachedSession(TLSDataParams *pTLSData, char *pHost, int port, bool isForInsert) {
+	TLSSessionCacheEntry *pVictim = &(pTLSData->sessionCache[0]);
+	TLSSessionCacheEntry *pEntry;
+	int i;
+
+	if(NULL == pHost || TLS_SESSION_HOST_LEN <= strlen(pHost)){
+		return NULL;
+	}
 
-	if (SSL_library_init() < 0) {
-		ret_val = SSL_INIT_ERROR;
+	for(i = 0; i < AWS_IOT_TLS_SESSION_CACHE_LEN; i++){
+		pEntry = &(pTLSData->sessionCache[i]);
+		if(NULL != pEntry->pSession && port == pEntry->port && 0 == strcmp(pHost, pEntry->host)){
+			return pEntry;
+		}
+		if(NULL != pVictim->pSession && (NULL == pEntry->pSession || pEntry->lastUsed < pVictim->lastUsed)){
+			pVictim = pEntry;
+		}
 	}
 
-	method = TLSv1_2_method();
+	return isForInsert ? pVictim : NULL;
+}
+
+static void forgetCachedSession(TLSSessionCacheEntry *pEntry) {
+	SSL_SESSION_free(pEntry->pSession);
+	pEntry->pSession = NULL;
+}
+
+static void forgetAllCachedSessions(TLSDataParams *pTLSData) {
+	int i;
+
+	for(i = 0; i < AWS_IOT_TLS_SESSION_CACHE_LEN; i++){
+		if(NULL != pTLSData->sessionCache[i].pSession){
+			forgetCachedSession(&(pTLSData->sessionCache[i]));
+		}
+	}
+}
+
+static void cacheSession(TLSDataParams *pTLSData, char *pHost, int port) {
+	SSL_SESSION *pSession = SSL_get1_session(pTLSData->pSSLHandle);
+	TLSSessionCacheEntry *pEntry;
+
+	if(NULL == pSession){
+		return;
+	}
 
-	if ((pSSLContext = SSL_CTX_new(method)) == NULL) {
+	pEntry = findCachedSession(pTLSData, pHost, port, true);
+	if(NULL == pEntry){
+		SSL_SESSION_free(pSession);
+		return;
+	}
+
+	if(NULL != pEntry->pSession){
+		SSL_SESSION_free(pEntry->pSession);
+	}
+	strcpy(pEntry->host, pHost);
+	pEntry->port = port;
+	pEntry->pSession = pSession;
+	pEntry->lastUsed = ++(pTLSData->sessionCacheUseCount);
+}
+
+static bool isSameLocation(const char *pLoaded, const char *pLocation) {
+	if(NULL == pLocation){
+		return '\0' == pLoaded[0];
+	}
+	return 0 == strcmp(pLoaded, pLocation);
+}
+
+static bool areCredentialsLoaded(TLSCredentialSource *pSource, TLSConnectParams *pParams) {
+	if(!pSource->isLoaded){
+		return false;
+	}
+	if(pParams->pRootCADer != pSource->pRootCADer || pParams->RootCADerLen != pSource->RootCADerLen
+			|| pParams->pDeviceCertDer != pSource->pDeviceCertDer
+			|| pParams->DeviceCertDerLen != pSource->DeviceCertDerLen
+			|| pParams->pDevicePrivateKeyDer != pSource->pDevicePrivateKeyDer
+			|| pParams->DevicePrivateKeyDerLen != pSource->DevicePrivateKeyDerLen){
+		return false;
+	}
+	return (NULL != pParams->pRootCADer || isSameLocation(pSource->rootCALocation, pParams->pRootCALocation))
+			&& (NULL != pParams->pDeviceCertDer || isSameLocation(pSource->deviceCertLocation, pParams->pDeviceCertLocation))
+			&& (NULL != pParams->pDevicePrivateKeyDer || isSameLocation(pSource->devicePrivateKeyLocation, pParams->pDevicePrivateKeyLocation));
+}
+
+static bool copyLocation(char *pLoaded, const char *pLocation) {
+	if(NULL == pLocation){
+		pLoaded[0] = '\0';
+		return true;
+	}
+	if(TLS_CREDENTIAL_PATH_LEN <= strlen(pLocation)){
+		return false;
+	}
+	strcpy(pLoaded, pLocation);
+	return true;
+}
+
+static void rememberCredentials(TLSCredentialSource *pSource, TLSConnectParams *pParams) {
+	pSource->pRootCADer = pParams->pRootCADer;
+	pSource->RootCADerLen = pParams->RootCADerLen;
+	pSource->pDeviceCertDer = pParams->pDeviceCertDer;
+	pSource->DeviceCertDerLen = pParams->DeviceCertDerLen;
+	pSource->pDevicePrivateKeyDer = pParams->pDevicePrivateKeyDer;
+	pSource->DevicePrivateKeyDerLen = pParams->DevicePrivateKeyDerLen;
+	pSource->isLoaded = copyLocation(pSource->rootCALocation, pParams->pRootCALocation)
+			&& copyLocation(pSource->deviceCertLocation, pParams->pDeviceCertLocation)
+			&& copyLocation(pSource->devicePrivateKeyLocation, pParams->pDevicePrivateKeyLocation);
+}
+
+static IoT_Error_t loadRootCA(SSL_CTX *pContext, TLSConnectParams *pParams) {
+	const unsigned char *pDer = pParams->pRootCADer;
+	X509 *pCert;
+	int rc;
+
+	if(NULL == pDer){
+		return SSL_CTX_load_verify_locations(pContext, pParams->pRootCALocation, NULL) ? NONE_ERROR : SSL_CERT_ERROR;
+	}
+
+	pCert = d2i_X509(NULL, &pDer, pParams->RootCADerLen);
+	if(NULL == pCert){
+		return SSL_CERT_ERROR;
+	}
+	rc = X509_STORE_add_cert(SSL_CTX_get_cert_store(pContext), pCert);
+	X509_free(pCert);
+
+	return rc ? NONE_ERROR : SSL_CERT_ERROR;
+}
+
+static IoT_Error_t loadDeviceCert(SSL_CTX *pContext, TLSConnectParams *pParams) {
+	int rc;
+
+	if(NULL == pParams->pDeviceCertDer){
+		rc = SSL_CTX_use_certificate_file(pContext, pParams->pDeviceCertLocation, SSL_FILETYPE_PEM);
+	}
+	else{
+		rc = SSL_CTX_use_certificate_ASN1(pContext, pParams->DeviceCertDerLen, pParams->pDeviceCertDer);
+	}
+
+	return (1 == rc) ? NONE_ERROR : SSL_CERT_ERROR;
+}
+
+static IoT_Error_t loadDevicePrivateKey(SSL_CTX *pContext, TLSConnectParams *pParams) {
+	const unsigned char *pDer = pParams->pDevicePrivateKeyDer;
+	EVP_PKEY *pKey;
+	int rc;
+
+	if(NULL == pDer){
+		rc = SSL_CTX_use_PrivateKey_file(pContext, pParams->pDevicePrivateKeyLocation, SSL_FILETYPE_PEM);
+	}
+	else{
+		pKey = d2i_AutoPrivateKey(NULL, &pDer, pParams->DevicePrivateKeyDerLen);
+		if(NULL == pKey){
+			return SSL_CERT_ERROR;
+		}
+		rc = SSL_CTX_use_PrivateKey(pContext, pKey);
+		EVP_PKEY_free(pKey);
+	}
+
+	return (1 == rc) ? NONE_ERROR : SSL_CERT_ERROR;
+}
+
+/* Parsing the PEM files and checking the key against the certificate costs more than a
+ * resumed handshake, so they are loaded into a context that is kept for later connects.
+ * A new context is only made when the credentials change, the old one is freed once the
+ * last connection that uses it is gone */
+static IoT_Error_t loadCredentials(TLSDataParams *pTLSData, TLSConnectParams *pParams) {
+	SSL_CTX *pContext;
+
+	if(NULL != pTLSData->pSSLContext && areCredentialsLoaded(&(pTLSData->credentialSource), pParams)){
+		return NONE_ERROR;
+	}
+
+	pContext = SSL_CTX_new(TLSv1_2_method());
+	if(NULL == pContext){
 		ERROR(" SSL INIT Failed - Unable to create SSL Context");
-		ret_val = SSL_INIT_ERROR;
+		return SSL_INIT_ERROR;
+	}
+
+#if AWS_IOT_TLS_KTLS && defined(SSL_OP_ENABLE_KTLS)
+	// The kernel takes over the record encryption after the handshake, where it supports the
+	// negotiated cipher. Otherwise OpenSSL keeps doing it, nothing else changes
+	SSL_CTX_set_options(pContext, SSL_OP_ENABLE_KTLS);
+#endif
+
+	if(NONE_ERROR != loadRootCA(pContext, pParams)){
+		ERROR(" Root CA Loading error");
+		SSL_CTX_free(pContext);
+		return SSL_CERT_ERROR;
+	}
+
+	if(NONE_ERROR != loadDeviceCert(pContext, pParams)){
+		ERROR(" Device Certificate Loading error");
+		SSL_CTX_free(pContext);
+		return SSL_CERT_ERROR;
+	}
+
+	if(NONE_ERROR != loadDevicePrivateKey(pContext, pParams)){
+		ERROR(" Device Private Key Loading error");
+		SSL_CTX_free(pContext);
+		return SSL_CERT_ERROR;
+	}
+
+	// Sessions of the old credentials must not be resumed with the new ones
+	forgetAllCachedSessions(pTLSData);
+	if(NULL != pTLSData->pSSLContext){
+		SSL_CTX_free(pTLSData->pSSLContext);
+	}
+	pTLSData->pSSLContext = pContext;
+	rememberCredentials(&(pTLSData->credentialSource), pParams);
+
+	return NONE_ERROR;
+}
+
+void iot_tls_invalidate_credentials(Network *pNetwork) {
+	pNetwork->tlsDataParams.credentialSource.isLoaded = false;
+	forgetAllCachedSessions(&(pNetwork->tlsDataParams));
+}
+
+int iot_tls_init(Network *pNetwork) {
+
+	IoT_Error_t ret_val = NONE_ERROR;
+	TLSDataParams *pTLSData = &(pNetwork->tlsDataParams);
+
+	// Runs before every connect, the library is only set up on the first of the process
+	// and the state of the Network on its first
+	if(!isLibraryInitialized){
+		OpenSSL_add_all_algorithms();
+		ERR_load_BIO_strings();
+		ERR_load_crypto_strings();
+		SSL_load_error_strings();
+
+		if (SSL_library_init() < 0) {
+			return SSL_INIT_ERROR;
+		}
+
+		if (NONE_ERROR != iot_resolver_init()) {
+			return MUTEX_INIT_ERROR;
+		}
+		isLibraryInitialized = true;
+	}
+
+	if(!pTLSData->isInitialized){
+#ifdef _ENABLE_THREAD_SUPPORT_
+		if (NONE_ERROR != aws_iot_thread_mutex_init(&(pTLSData->sslLock))) {
+			return MUTEX_INIT_ERROR;
+		}
+#endif
+		pTLSData->pSSLHandle = NULL;
+		pTLSData->server_TCPSocket = -1;
+		pTLSData->isInitialized = true;
 	}
 
-	pNetwork->my_socket = 0;
+	pNetwork->my_socket = -1;
+	pNetwork->isSessionResumed = 0;
 	pNetwork->connect = iot_tls_connect;
 	pNetwork->mqttread = iot_tls_read;
+	pNetwork->mqttreadsome = iot_tls_read_some;
 	pNetwork->mqttwrite = iot_tls_write;
+	pNetwork->mqttwritev = iot_tls_writev;
+	pNetwork->mqttsendfile = iot_tls_sendfile;
 	pNetwork->disconnect = iot_tls_disconnect;
 	pNetwork->isConnected = iot_tls_is_connected;
 	pNetwork->destroy = iot_tls_destroy;
@@ -90,8 +360,11 @@ int tls_server_certificate_verify(int preverify_ok, X509_STORE_CTX *pX509CTX){
 	if((X509_STORE_CTX_get_error_depth(pX509CTX) == 0) && (preverify_ok == 1)){
 		X509 *pX509Cert;
 		HostnameValidationResult result;
+		// iot_tls_connect hangs the state of the Network off the SSL object being verified
+		SSL *pSSL = X509_STORE_CTX_get_ex_data(pX509CTX, SSL_get_ex_data_X509_STORE_CTX_idx());
+		TLSDataParams *pTLSData = SSL_get_app_data(pSSL);
 		pX509Cert = X509_STORE_CTX_get_current_cert(pX509CTX);
-		result = validate_hostname(pDestinationURL, pX509Cert);
+		result = validate_hostname(pTLSData->pDestinationURL, pX509Cert);
 		if(MatchFound == result){
 			verification_return = 1;
 		}
@@ -107,130 +380,308 @@ int iot_tls_connect(Network *pNetwork, TLSConnectParams params) {
 
 	IoT_Error_t ret_val = NONE_ERROR;
 	int connect_status = 0;
-
-	server_TCPSocket = Create_TCPSocket();
-	if(-1 == server_TCPSocket){
-		ret_val = TCP_SETUP_ERROR;
-		return ret_val;
+	TLSSessionCacheEntry *pCachedSession = NULL;
+	TLSDataParams *pTLSData = &(pNetwork->tlsDataParams);
+
+	pNetwork->isSessionResumed = 0;
+	if(NULL != pTLSData->pSSLHandle){
+		// Left over from a connect that failed
+		SSL_free(pTLSData->pSSLHandle);
+		pTLSData->pSSLHandle = NULL;
 	}
 
-	if (!SSL_CTX_load_verify_locations(pSSLContext, params.pRootCALocation, NULL)) {
-		ERROR(" Root CA Loading error");
-		ret_val = SSL_CERT_ERROR;
+	ret_val = loadCredentials(pTLSData, &params);
+	if(NONE_ERROR != ret_val){
+		return ret_val;
 	}
 
-	if (!SSL_CTX_use_certificate_file(pSSLContext, params.pDeviceCertLocation, SSL_FILETYPE_PEM)) {
-		ERROR(" Device Certificate Loading error");
-		ret_val = SSL_CERT_ERROR;
-	}
-
-	if(1 != SSL_CTX_use_PrivateKey_file(pSSLContext, params.pDevicePrivateKeyLocation, SSL_FILETYPE_PEM)){
-		ERROR(" Device Private Key Loading error");
-		ret_val = SSL_CERT_ERROR;
+	pTLSData->pSSLHandle = SSL_new(pTLSData->pSSLContext);
+	if(NULL == pTLSData->pSSLHandle){
+		return SSL_INIT_ERROR;
 	}
+	SSL_set_app_data(pTLSData->pSSLHandle, pTLSData);
 	if(params.ServerVerificationFlag){
-		SSL_CTX_set_verify(pSSLContext, SSL_VERIFY_PEER, tls_server_certificate_verify);
+		SSL_set_verify(pTLSData->pSSLHandle, SSL_VERIFY_PEER, tls_server_certificate_verify);
 	}
 	else{
-		SSL_CTX_set_verify(pSSLContext, SSL_VERIFY_PEER, NULL);
+		SSL_set_verify(pTLSData->pSSLHandle, SSL_VERIFY_PEER, NULL);
 	}
 
-	pSSLHandle = SSL_new(pSSLContext);
+	// The server skips the certificate exchange and key agreement if it still knows the session
+	pCachedSession = findCachedSession(pTLSData, params.pDestinationURL, params.DestinationPort, false);
+	if(NULL != pCachedSession){
+		SSL_set_session(pTLSData->pSSLHandle, pCachedSession->pSession);
+	}
 
-	pDestinationURL = params.pDestinationURL;
-	ret_val = Connect_TCPSocket(server_TCPSocket, params.pDestinationURL, params.DestinationPort);
-	if(NONE_ERROR != ret_val){
+	pTLSData->pDestinationURL = params.pDestinationURL;
+	pTLSData->server_TCPSocket = iot_resolver_connect(params.pDestinationURL, params.DestinationPort, params.timeout_ms);
+	if(0 > pTLSData->server_TCPSocket){
 		ERROR(" TCP Connection error");
+		ret_val = pTLSData->server_TCPSocket;
+		pTLSData->server_TCPSocket = -1;
 		return ret_val;
 	}
 
-	SSL_set_fd(pSSLHandle, server_TCPSocket);
+	SSL_set_fd(pTLSData->pSSLHandle, pTLSData->server_TCPSocket);
+	pNetwork->my_socket = pTLSData->server_TCPSocket;
 
 	if(ret_val == NONE_ERROR){
-		ret_val = setSocketToNonBlocking(server_TCPSocket);
+		ret_val = setSocketToNonBlocking(pTLSData->server_TCPSocket);
 		if(ret_val != NONE_ERROR){
 			ERROR(" Unable to set the socket to Non-Blocking");
 		}
 	}
 
 	if(NONE_ERROR == ret_val){
-		ret_val = ConnectOrTimeoutOrExitOnError(pSSLHandle, params.timeout_ms);
-		if(X509_V_OK != SSL_get_verify_result(pSSLHandle)){
+		ret_val = ConnectOrTimeoutOrExitOnError(pTLSData, params.timeout_ms);
+		if(X509_V_OK != SSL_get_verify_result(pTLSData->pSSLHandle)){
 			ERROR(" Server Certificate Verification failed");
 			ret_val = SSL_CONNECT_ERROR;
 		}
 		else{
 			// ensure you have a valid certificate returned, otherwise no certificate exchange happened
-			if(NULL == SSL_get_peer_certificate(pSSLHandle)){
+			if(NULL == SSL_get_peer_certificate(pTLSData->pSSLHandle)){
 				ERROR(" No certificate exchange happened");
 				ret_val = SSL_CONNECT_ERROR;
 			}
 		}
 	}
+
+	if(NONE_ERROR == ret_val){
+		pNetwork->isSessionResumed = SSL_session_reused(pTLSData->pSSLHandle) ? 1 : 0;
+		DEBUG(" TLS session %s", pNetwork->isSessionResumed ? "resumed" : "established");
+#if AWS_IOT_TLS_KTLS && defined(SSL_OP_ENABLE_KTLS)
+		DEBUG(" Kernel TLS %s for sending", BIO_get_ktls_send(SSL_get_wbio(pTLSData->pSSLHandle)) ? "in use" : "not available");
+#endif
+		cacheSession(pTLSData, params.pDestinationURL, params.DestinationPort);
+	}
+	else{
+		if(NULL != pCachedSession){
+			// Should the session be what makes the handshake fail, the next attempt does a full one
+			forgetCachedSession(pCachedSession);
+		}
+		close(pTLSData->server_TCPSocket);
+		pTLSData->server_TCPSocket = -1;
+		pNetwork->my_socket = -1;
+	}
 	return ret_val;
 }
 
 int iot_tls_write(Network *pNetwork, unsigned char *pMsg, int len, int timeout_ms){
 
-	return WriteOrTimeoutOrExitOnError(pSSLHandle, pMsg, len, timeout_ms);
+	return WriteOrTimeoutOrExitOnError(&(pNetwork->tlsDataParams), pMsg, len, timeout_ms);
 }
 
-int iot_tls_read(Network *pNetwork, unsigned char *pMsg, int len, int timeout_ms) {
-	return ReadOrTimeoutOrExitOnError(pSSLHandle, pMsg, len, timeout_ms);
+int iot_tls_writev(Network *pNetwork, NetworkIoVec *pIov, int iovcnt, int timeout_ms){
+	unsigned char gatherBuf[TLS_WRITEV_GATHER_LEN];
+	unsigned char *pSegment = NULL;
+	int segmentLeft = 0;
+	int gatheredLen = 0;
+	int writtenLen = 0;
+	int copyLen = 0;
+	int rc = 0;
+	int i;
+	Timer writeTimer;
+	TLSDataParams *pTLSData = &(pNetwork->tlsDataParams);
+
+	InitTimer(&writeTimer);
+	countdown_ms(&writeTimer, timeout_ms);
+
+	// Small segments such as the MQTT header are copied together with the start of the next
+	// segment so that they go out in one TLS record. Anything larger is written in place.
+	for(i = 0; i < iovcnt; i++){
+		pSegment = pIov[i].pData;
+		segmentLeft = pIov[i].len;
+		while(0 < segmentLeft){
+			if(0 == gatheredLen && TLS_WRITEV_GATHER_LEN <= segmentLeft){
+				rc = WriteOrTimeoutOrExitOnError(pTLSData, pSegment, segmentLeft, left_ms(&writeTimer));
+				if(0 > rc){
+					return rc;
+				}
+				writtenLen += rc;
+				break;
+			}
+
+			copyLen = TLS_WRITEV_GATHER_LEN - gatheredLen;
+			if(segmentLeft < copyLen){
+				copyLen = segmentLeft;
+			}
+			memcpy(gatherBuf + gatheredLen, pSegment, copyLen);
+			gatheredLen += copyLen;
+			pSegment += copyLen;
+			segmentLeft -= copyLen;
+
+			if(TLS_WRITEV_GATHER_LEN == gatheredLen){
+				rc = WriteOrTimeoutOrExitOnError(pTLSData, gatherBuf, gatheredLen, left_ms(&writeTimer));
+				if(0 > rc){
+					return rc;
+				}
+				writtenLen += rc;
+				gatheredLen = 0;
+			}
+		}
+	}
+
+	if(0 < gatheredLen){
+		rc = WriteOrTimeoutOrExitOnError(pTLSData, gatherBuf, gatheredLen, left_ms(&writeTimer));
+		if(0 > rc){
+			return rc;
+		}
+		writtenLen += rc;
+	}
+
+	return writtenLen;
 }
 
-void iot_tls_disconnect(Network *pNetwork){
-	SSL_shutdown(pSSLHandle);
-	close(server_TCPSocket);
+#if AWS_IOT_TLS_KTLS && defined(SSL_OP_ENABLE_KTLS)
+/* Hands the bytes of the file to the kernel, which encrypts them on their way to the socket
+ * without copying them to user space */
+static int sendFileKTLS(TLSDataParams *pTLSData, int fd, int64_t offset, int len, Timer *pDeadline) {
+	ossl_ssize_t rc = 0;
+	int errorCode = 0;
+	int pollRc = 0;
+	int writtenLen = 0;
+
+	while(writtenLen < len){
+		lockSSL(pTLSData);
+		rc = SSL_sendfile(pTLSData->pSSLHandle, fd, (off_t) (offset + writtenLen), (size_t) (len - writtenLen), 0);
+		errorCode = SSL_get_error(pTLSData->pSSLHandle, (int) rc);
+		unlockSSL(pTLSData);
+
+		if(0 < rc){
+			writtenLen += (int) rc;
+		}
+		else if(0 > rc && SSL_ERROR_WANT_WRITE == errorCode){
+			pollRc = waitForSocket(pTLSData, POLLOUT, pDeadline);
+			if(0 == pollRc){
+				return SSL_WRITE_TIMEOUT_ERROR;
+			}
+			if(0 > pollRc){
+				return SSL_WRITE_ERROR;
+			}
+		}
+		else{
+			// 0 if the file ends early
+			return SSL_WRITE_ERROR;
+		}
+	}
+
+	return writtenLen;
 }
+#endif
 
-int iot_tls_destroy(Network *pNetwork) {
-	SSL_free(pSSLHandle);
-	SSL_CTX_free(pSSLContext);
-	return 0;
+/* Reads the bytes of the file a chunk at a time and writes each with SSL_write */
+static int sendFileByChunks(TLSDataParams *pTLSData, int fd, int64_t offset, int len, Timer *pDeadline) {
+	unsigned char chunk[TLS_SENDFILE_CHUNK_LEN];
+	ssize_t chunkLen = 0;
+	int writtenLen = 0;
+	int rc = 0;
+
+	while(writtenLen < len){
+		chunkLen = (TLS_SENDFILE_CHUNK_LEN < len - writtenLen) ? TLS_SENDFILE_CHUNK_LEN : len - writtenLen;
+		chunkLen = pread(fd, chunk, (size_t) chunkLen, (off_t) (offset + writtenLen));
+		if(0 > chunkLen && EINTR == errno){
+			continue;
+		}
+		if(0 >= chunkLen){
+			// A read error, or the file ends early
+			return SSL_WRITE_ERROR;
+		}
+
+		rc = WriteOrTimeoutOrExitOnError(pTLSData, chunk, (int) chunkLen, left_ms(pDeadline));
+		if(0 > rc){
+			return rc;
+		}
+		writtenLen += rc;
+	}
+
+	return writtenLen;
 }
 
-int Create_TCPSocket(void) {
-	int sockfd;
-	sockfd = socket(AF_INET, SOCK_STREAM, 0);
-	return sockfd;
+int iot_tls_sendfile(Network *pNetwork, int fd, int64_t offset, int len, int timeout_ms) {
+	Timer deadline;
+	TLSDataParams *pTLSData = &(pNetwork->tlsDataParams);
+
+	InitTimer(&deadline);
+	countdown_ms(&deadline, timeout_ms);
+
+#if AWS_IOT_TLS_KTLS && defined(SSL_OP_ENABLE_KTLS)
+	if(BIO_get_ktls_send(SSL_get_wbio(pTLSData->pSSLHandle))){
+		return sendFileKTLS(pTLSData, fd, offset, len, &deadline);
+	}
+#endif
+
+	return sendFileByChunks(pTLSData, fd, offset, len, &deadline);
 }
 
-IoT_Error_t Connect_TCPSocket(int socket_fd, char *pURLString, int port) {
-	IoT_Error_t ret_val = TCP_CONNECT_ERROR;
-	int connect_status = -1;
-	struct hostent *host;
-	struct sockaddr_in dest_addr;
+int iot_tls_read(Network *pNetwork, unsigned char *pMsg, int len, int timeout_ms) {
+	return ReadOrTimeoutOrExitOnError(&(pNetwork->tlsDataParams), pMsg, len, timeout_ms);
+}
 
-	host = gethostbyname(pURLString);
+int iot_tls_read_some(Network *pNetwork, unsigned char *pMsg, int len, int timeout_ms) {
+	int rc = 0;
+	int errorCode = 0;
+	int pollRc = 0;
+	Timer deadline;
+	TLSDataParams *pTLSData = &(pNetwork->tlsDataParams);
 
-	if (NULL != host) {
-		dest_addr.sin_family = AF_INET;
-		dest_addr.sin_port = htons(port);
-		dest_addr.sin_addr.s_addr = *(long*) (host->h_addr);
-		memset(&(dest_addr.sin_zero), '\0', 8);
+	InitTimer(&deadline);
+	countdown_ms(&deadline, timeout_ms);
 
-		connect_status = connect(socket_fd, (struct sockaddr *) &dest_addr,
-				sizeof(struct sockaddr));
-		if (-1 != connect_status) {
-			ret_val = NONE_ERROR;
+	do{
+		// a single SSL_read returns at most one record, which is all that is asked for here
+		lockSSL(pTLSData);
+		rc = SSL_read(pTLSData->pSSLHandle, pMsg, len);
+		errorCode = SSL_get_error(pTLSData->pSSLHandle, rc);
+		unlockSSL(pTLSData);
+		if(0 < rc){
+			return rc;
 		}
+
+		if(SSL_ERROR_WANT_READ == errorCode){
+			pollRc = waitForSocket(pTLSData, POLLIN, &deadline);
+		}
+		else if(SSL_ERROR_WANT_WRITE == errorCode){
+			pollRc = waitForSocket(pTLSData, POLLOUT, &deadline);
+		}
+		else{
+			return SSL_READ_ERROR;
+		}
+	}while(0 < pollRc);
+
+	return (0 == pollRc) ? SSL_READ_TIMEOUT_ERROR : SSL_READ_ERROR;
+}
+
+void iot_tls_disconnect(Network *pNetwork){
+	TLSDataParams *pTLSData = &(pNetwork->tlsDataParams);
+
+	if(NULL != pTLSData->pSSLHandle){
+		SSL_shutdown(pTLSData->pSSLHandle);
 	}
-	return ret_val;
+	close(pTLSData->server_TCPSocket);
+	pTLSData->server_TCPSocket = -1;
+	pNetwork->my_socket = -1;
 }
 
-IoT_Error_t setSocketToNonBlocking( server_fd) {
+int iot_tls_destroy(Network *pNetwork) {
+	// The context keeps the credentials for the next connect
+	SSL_free(pNetwork->tlsDataParams.pSSLHandle);
+	pNetwork->tlsDataParams.pSSLHandle = NULL;
+	return 0;
+}
+
+IoT_Error_t setSocketToNonBlocking(int server_fd) {
 
 	int flags, status;
 	IoT_Error_t ret_val = NONE_ERROR;
 
-	flags = fcntl(server_TCPSocket, F_GETFL, 0);
+	flags = fcntl(server_fd, F_GETFL, 0);
 	// set underlying socket to non blocking
 	if (flags < 0) {
 		ret_val = TCP_CONNECT_ERROR;
 	}
 
-	status = fcntl(server_TCPSocket, F_SETFL, flags | O_NONBLOCK);
+	status = fcntl(server_fd, F_SETFL, flags | O_NONBLOCK);
 	if (status < 0) {
 		ERROR("fcntl - %s", strerror(errno));
 		ret_val = TCP_CONNECT_ERROR;
@@ -239,54 +690,49 @@ IoT_Error_t setSocketToNonBlocking( server_fd) {
 	return ret_val;
 }
 
-IoT_Error_t ConnectOrTimeoutOrExitOnError(SSL *pSSL, int timeout_ms){
+IoT_Error_t ConnectOrTimeoutOrExitOnError(TLSDataParams *pTLSData, int timeout_ms){
 
 	enum{
-		SSL_CONNECTED = 1,
-		SELECT_TIMEOUT = 0,
-		SELECT_ERROR = -1
+		SSL_CONNECTED = 1
 	};
 
 	IoT_Error_t ret_val = NONE_ERROR;
 	int rc = 0;
-	fd_set readFds;
-	fd_set writeFds;
-	struct timeval timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
 	int errorCode = 0;
-	int select_retCode = SELECT_TIMEOUT;
+	int pollRc = 0;
+	Timer deadline;
+
+	InitTimer(&deadline);
+	countdown_ms(&deadline, timeout_ms);
 
 	do{
-		rc = SSL_connect(pSSL);
+		rc = SSL_connect(pTLSData->pSSLHandle);
 
 		if(SSL_CONNECTED == rc){
 			ret_val = NONE_ERROR;
 			break;
 		}
 
-		errorCode = SSL_get_error(pSSL, rc);
+		errorCode = SSL_get_error(pTLSData->pSSLHandle, rc);
 
 		if(errorCode == SSL_ERROR_WANT_READ){
-			FD_ZERO(&readFds);
-			FD_SET(server_TCPSocket, &readFds);
-			select_retCode = select(server_TCPSocket + 1, (void *) &readFds, NULL, NULL, &timeout);
-			if (SELECT_TIMEOUT == select_retCode) {
+			pollRc = waitForSocket(pTLSData, POLLIN, &deadline);
+			if (0 == pollRc) {
 				ERROR(" SSL Connect time out while waiting for read");
 				ret_val = SSL_CONNECT_TIMEOUT_ERROR;
-			} else if (SELECT_ERROR == select_retCode) {
-				ERROR(" SSL Connect Select error for read %d", select_retCode);
+			} else if (0 > pollRc) {
+				ERROR(" SSL Connect poll error for read %d", pollRc);
 				ret_val = SSL_CONNECT_ERROR;
 			}
 		}
 
 		else if(errorCode == SSL_ERROR_WANT_WRITE){
-			FD_ZERO(&writeFds);
-			FD_SET(server_TCPSocket, &writeFds);
-			select_retCode = select(server_TCPSocket + 1, NULL, (void *) &writeFds, NULL, &timeout);
-			if (SELECT_TIMEOUT == select_retCode) {
+			pollRc = waitForSocket(pTLSData, POLLOUT, &deadline);
+			if (0 == pollRc) {
 				ERROR(" SSL Connect time out while waiting for write");
 				ret_val = SSL_CONNECT_TIMEOUT_ERROR;
-			} else if (SELECT_ERROR == select_retCode) {
-				ERROR(" SSL Connect Select error for write %d", select_retCode);
+			} else if (0 > pollRc) {
+				ERROR(" SSL Connect poll error for write %d", pollRc);
 				ret_val = SSL_CONNECT_ERROR;
 			}
 		}
@@ -300,39 +746,39 @@ IoT_Error_t ConnectOrTimeoutOrExitOnError(SSL *pSSL, int timeout_ms){
 	return ret_val;
 }
 
-IoT_Error_t WriteOrTimeoutOrExitOnError(SSL *pSSL, unsigned char *msg, int totalLen, int timeout_ms){
+IoT_Error_t WriteOrTimeoutOrExitOnError(TLSDataParams *pTLSData, unsigned char *msg, int totalLen, int timeout_ms){
 
 
 	IoT_Error_t errorStatus = NONE_ERROR;
 
-	fd_set writeFds;
-	enum{
-		SELECT_TIMEOUT = 0,
-		SELECT_ERROR = -1
-	};
 	int errorCode = 0;
-	int select_retCode;
+	int pollRc;
 	int writtenLength = 0;
 	int rc = 0;
 	int returnCode = 0;
-	struct timeval timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+	Timer deadline;
+
+	InitTimer(&deadline);
+	countdown_ms(&deadline, timeout_ms);
 
 	do{
-		rc = SSL_write(pSSL, msg, totalLen);
+		// Without SSL_MODE_ENABLE_PARTIAL_WRITE the write is all or nothing, and a write that
+		// has to wait is retried with the same arguments
+		lockSSL(pTLSData);
+		rc = SSL_write(pTLSData->pSSLHandle, msg, totalLen);
 
-		errorCode = SSL_get_error(pSSL, rc);
+		errorCode = SSL_get_error(pTLSData->pSSLHandle, rc);
+		unlockSSL(pTLSData);
 
 		if(0 < rc){
 			writtenLength += rc;
 		}
 
-		else if (errorCode == SSL_ERROR_WANT_WRITE) {
-			FD_ZERO(&writeFds);
-			FD_SET(server_TCPSocket, &writeFds);
-			select_retCode = select(server_TCPSocket + 1, NULL, (void *) &writeFds, NULL, &timeout);
-			if (SELECT_TIMEOUT == select_retCode) {
+		else if (errorCode == SSL_ERROR_WANT_WRITE || errorCode == SSL_ERROR_WANT_READ) {
+			pollRc = waitForSocket(pTLSData, (errorCode == SSL_ERROR_WANT_WRITE) ? POLLOUT : POLLIN, &deadline);
+			if (0 == pollRc) {
 				errorStatus = SSL_WRITE_TIMEOUT_ERROR;
-			} else if (SELECT_ERROR == select_retCode) {
+			} else if (0 > pollRc) {
 				errorStatus = SSL_WRITE_ERROR;
 			}
 		}
@@ -353,38 +799,36 @@ IoT_Error_t WriteOrTimeoutOrExitOnError(SSL *pSSL, unsigned char *msg, int total
 	return returnCode;
 }
 
-IoT_Error_t ReadOrTimeoutOrExitOnError(SSL *pSSL, unsigned char *msg, int totalLen, int timeout_ms){
+IoT_Error_t ReadOrTimeoutOrExitOnError(TLSDataParams *pTLSData, unsigned char *msg, int totalLen, int timeout_ms){
 
 
 	IoT_Error_t errorStatus = NONE_ERROR;
 
-	fd_set readFds;
-	enum{
-		SELECT_TIMEOUT = 0,
-		SELECT_ERROR = -1
-	};
 	int errorCode = 0;
-	int select_retCode;
+	int pollRc;
 	int readLength = 0;
 	int rc = 0;
 	int returnCode = 0;
-	struct timeval timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000 };
+	Timer deadline;
+
+	InitTimer(&deadline);
+	countdown_ms(&deadline, timeout_ms);
 
 	do{
-		rc = SSL_read(pSSL, msg, totalLen);
-		errorCode = SSL_get_error(pSSL, rc);
+		lockSSL(pTLSData);
+		rc = SSL_read(pTLSData->pSSLHandle, msg + readLength, totalLen - readLength);
+		errorCode = SSL_get_error(pTLSData->pSSLHandle, rc);
+		unlockSSL(pTLSData);
 
 		if(0 < rc){
 			readLength += rc;
 		}
 
-		else if (errorCode == SSL_ERROR_WANT_READ) {
-			FD_ZERO(&readFds);
-			FD_SET(server_TCPSocket, &readFds);
-			select_retCode = select(server_TCPSocket + 1, (void *) &readFds, NULL, NULL, &timeout);
-			if (SELECT_TIMEOUT == select_retCode) {
+		else if (errorCode == SSL_ERROR_WANT_READ || errorCode == SSL_ERROR_WANT_WRITE) {
+			pollRc = waitForSocket(pTLSData, (errorCode == SSL_ERROR_WANT_READ) ? POLLIN : POLLOUT, &deadline);
+			if (0 == pollRc) {
 				errorStatus = SSL_READ_TIMEOUT_ERROR;
-			} else if (SELECT_ERROR == select_retCode) {
+			} else if (0 > pollRc) {
 				errorStatus = SSL_READ_ERROR;
 			}
 		}
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_OPENSSL_NETWORK_PLATFORM_H_
+#define SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_OPENSSL_NETWORK_PLATFORM_H_
+
+/**
+ * @file network_platform.h
+ */
+#include <stdbool.h>
+#include <openssl/ssl.h>
+
+#include "aws_iot_config.h"
+#include "threads_interface.h"
+
+#ifndef AWS_IOT_TLS_SESSION_CACHE_LEN
+#define AWS_IOT_TLS_SESSION_CACHE_LEN 4
+#endif
+#ifndef AWS_IOT_TLS_KTLS
+#define AWS_IOT_TLS_KTLS 0
+#endif
+#define TLS_SESSION_HOST_LEN 128 ///< Sessions of endpoints with longer names are not cached
+#define TLS_CREDENTIAL_PATH_LEN 256 ///< Credentials from longer paths are loaded again for every connect
+
+/**
+ * @brief Session of the last connection to one endpoint, offered for resumption on the next
+ */
+typedef struct {
+	char host[TLS_SESSION_HOST_LEN];
+	int port;
+	SSL_SESSION *pSession;	///< NULL while the entry is unused
+	unsigned int lastUsed;
+} TLSSessionCacheEntry;
+
+/**
+ * @brief Where the credentials in the SSL context were loaded from
+ *
+ * A file is recognised by its path, a DER buffer by its address and length.
+ */
+typedef struct {
+	bool isLoaded;
+	char rootCALocation[TLS_CREDENTIAL_PATH_LEN];
+	char deviceCertLocation[TLS_CREDENTIAL_PATH_LEN];
+	char devicePrivateKeyLocation[TLS_CREDENTIAL_PATH_LEN];
+	const unsigned char *pRootCADer;
+	unsigned int RootCADerLen;
+	const unsigned char *pDeviceCertDer;
+	unsigned int DeviceCertDerLen;
+	const unsigned char *pDevicePrivateKeyDer;
+	unsigned int DevicePrivateKeyDerLen;
+} TLSCredentialSource;
+
+/**
+ * definition of the TLS state of a Network. Platform specific
+ *
+ * Everything but the connection itself is kept from one connect to the next: the SSL context
+ * with the credentials and the sessions for resumption.  The Network must be zeroed before
+ * its first iot_tls_init, as a static one is.
+ */
+typedef struct {
+	bool isInitialized;
+	SSL_CTX *pSSLContext;	///< Holds the credentials, NULL until the first connect loads them
+	TLSCredentialSource credentialSource;
+	TLSSessionCacheEntry sessionCache[AWS_IOT_TLS_SESSION_CACHE_LEN];
+	unsigned int sessionCacheUseCount;
+	SSL *pSSLHandle;	///< NULL while not connected
+	int server_TCPSocket;
+	char *pDestinationURL;	///< Host name the server certificate is checked against
+#ifdef _ENABLE_THREAD_SUPPORT_
+	IoT_Mutex_t sslLock;	///< The SSL object must not be used by two threads at once
+#endif
+} TLSDataParams;
+
+#endif /* SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_OPENSSL_NETWORK_PLATFORM_H_ */
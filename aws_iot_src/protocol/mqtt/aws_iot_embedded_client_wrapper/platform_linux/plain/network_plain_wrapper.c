@@ -0,0 +1,323 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/*
+ * The network interface over plain TCP, without TLS.  For measuring the MQTT client on its
+ * own and for devices behind a local proxy that terminates TLS.  AWS IoT itself only
+ * accepts TLS connections.
+ *
+ * Reads and writes wait in poll against their timeout and return the same codes as the TLS
+ * wrappers, so the MQTT client cannot tell the difference.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <errno.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_error.h"
+#include "aws_iot_log.h"
+#include "network_interface.h"
+#include "timer_interface.h"
+#include "network_resolver.h"
+
+#define PLAIN_WRITEV_SEGMENTS 8 ///< Segments of a vectored write handed to one sendmsg
+
+/* Waits until the socket is ready for events or the deadline has passed. Returns what poll
+ * does: more than 0 if ready, 0 at the deadline, less than 0 on error */
+static int waitForSocket(TLSDataParams *pTLSData, short events, Timer *pDeadline) {
+	struct pollfd pollFd;
+	int rc;
+
+	pollFd.fd = pTLSData->server_TCPSocket;
+	pollFd.events = events;
+	do{
+		pollFd.revents = 0;
+		rc = poll(&pollFd, 1, left_ms(pDeadline));
+		// The MQTT client may have cached the time, which would never let the deadline pass
+		TimerRefreshNow();
+	}while(0 > rc && EINTR == errno && !expired(pDeadline));
+
+	return rc;
+}
+
+/* Sends all bytes of the segments, in order. Returns how many that were,
+ * SSL_WRITE_TIMEOUT_ERROR at the deadline or SSL_WRITE_ERROR */
+static int sendSegments(TLSDataParams *pTLSData, struct iovec *pIov, int iovcnt, Timer *pDeadline) {
+	struct msghdr msg;
+	ssize_t sentLen;
+	int writtenLen = 0;
+	int pollRc;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = pIov;
+	msg.msg_iovlen = iovcnt;
+
+	while(0 < msg.msg_iovlen){
+		// A peer that went away is reported as an error rather than with SIGPIPE
+		sentLen = sendmsg(pTLSData->server_TCPSocket, &msg, MSG_NOSIGNAL);
+		if(0 > sentLen){
+			if(EINTR == errno){
+				continue;
+			}
+			if(EAGAIN != errno && EWOULDBLOCK != errno){
+				return SSL_WRITE_ERROR;
+			}
+			pollRc = waitForSocket(pTLSData, POLLOUT, pDeadline);
+			if(0 == pollRc){
+				return SSL_WRITE_TIMEOUT_ERROR;
+			}
+			if(0 > pollRc){
+				return SSL_WRITE_ERROR;
+			}
+			continue;
+		}
+
+		// Drop what went out from the front of the vector
+		writtenLen += sentLen;
+		while(0 < msg.msg_iovlen && (size_t) sentLen >= msg.msg_iov->iov_len){
+			sentLen -= msg.msg_iov->iov_len;
+			msg.msg_iov++;
+			msg.msg_iovlen--;
+		}
+		if(0 < msg.msg_iovlen){
+			msg.msg_iov->iov_base = (unsigned char *) msg.msg_iov->iov_base + sentLen;
+			msg.msg_iov->iov_len -= sentLen;
+		}
+	}
+
+	return writtenLen;
+}
+
+/* Has the kernel copy the bytes of the file to the socket. Returns how many that were,
+ * SSL_WRITE_TIMEOUT_ERROR at the deadline or SSL_WRITE_ERROR */
+static int sendFileBytes(TLSDataParams *pTLSData, int fd, int64_t offset, int len, Timer *pDeadline) {
+	off_t fileOffset = (off_t) offset;
+	ssize_t sentLen;
+	int writtenLen = 0;
+	int pollRc;
+
+	while(writtenLen < len){
+		// Moves fileOffset along, the offset of the file itself stays
+		sentLen = sendfile(pTLSData->server_TCPSocket, fd, &fileOffset, (size_t) (len - writtenLen));
+		if(0 < sentLen){
+			writtenLen += sentLen;
+			continue;
+		}
+		if(0 == sentLen){
+			// The file ends early
+			return SSL_WRITE_ERROR;
+		}
+		if(EINTR == errno){
+			continue;
+		}
+		if(EAGAIN != errno && EWOULDBLOCK != errno){
+			return SSL_WRITE_ERROR;
+		}
+		pollRc = waitForSocket(pTLSData, POLLOUT, pDeadline);
+		if(0 == pollRc){
+			return SSL_WRITE_TIMEOUT_ERROR;
+		}
+		if(0 > pollRc){
+			return SSL_WRITE_ERROR;
+		}
+	}
+
+	return writtenLen;
+}
+
+/* Reads what the socket has, up to len bytes, waiting for the first of them until the
+ * deadline. Returns the number of bytes, SSL_READ_TIMEOUT_ERROR at the deadline or
+ * SSL_READ_ERROR */
+static int receiveSome(TLSDataParams *pTLSData, unsigned char *pMsg, int len, Timer *pDeadline) {
+	ssize_t rxLen;
+	int pollRc;
+
+	while(1){
+		rxLen = recv(pTLSData->server_TCPSocket, pMsg, len, 0);
+		if(0 < rxLen){
+			return rxLen;
+		}
+		if(0 == rxLen){
+			// The peer closed the connection
+			return SSL_READ_ERROR;
+		}
+		if(EINTR == errno){
+			continue;
+		}
+		if(EAGAIN != errno && EWOULDBLOCK != errno){
+			return SSL_READ_ERROR;
+		}
+		pollRc = waitForSocket(pTLSData, POLLIN, pDeadline);
+		if(0 == pollRc){
+			return SSL_READ_TIMEOUT_ERROR;
+		}
+		if(0 > pollRc){
+			return SSL_READ_ERROR;
+		}
+	}
+}
+
+void iot_tls_invalidate_credentials(Network *pNetwork) {
+	// No credentials are loaded
+}
+
+int iot_tls_init(Network *pNetwork) {
+
+	if(NONE_ERROR != iot_resolver_init()){
+		return MUTEX_INIT_ERROR;
+	}
+
+	pNetwork->tlsDataParams.server_TCPSocket = -1;
+	pNetwork->my_socket = -1;
+	pNetwork->isSessionResumed = 0;
+	pNetwork->connect = iot_tls_connect;
+	pNetwork->mqttread = iot_tls_read;
+	pNetwork->mqttreadsome = iot_tls_read_some;
+	pNetwork->mqttwrite = iot_tls_write;
+	pNetwork->mqttwritev = iot_tls_writev;
+	pNetwork->mqttsendfile = iot_tls_sendfile;
+	pNetwork->disconnect = iot_tls_disconnect;
+	pNetwork->isConnected = iot_tls_is_connected;
+	pNetwork->destroy = iot_tls_destroy;
+
+	return NONE_ERROR;
+}
+
+int iot_tls_is_connected(Network *pNetwork) {
+	/* Use this to add implementation which can check for physical layer disconnect */
+	return 1;
+}
+
+int iot_tls_connect(Network *pNetwork, TLSConnectParams params) {
+	int socketFd;
+
+	pNetwork->isSessionResumed = 0;
+
+	// The credentials in params are not used, nothing is encrypted
+	WARN(" Connecting to %s:%d without TLS", params.pDestinationURL, params.DestinationPort);
+	socketFd = iot_resolver_connect(params.pDestinationURL, params.DestinationPort, params.timeout_ms);
+	if(0 > socketFd){
+		ERROR(" TCP Connection error");
+		return socketFd;
+	}
+
+	pNetwork->tlsDataParams.server_TCPSocket = socketFd;
+	pNetwork->my_socket = socketFd;
+
+	return NONE_ERROR;
+}
+
+int iot_tls_write(Network *pNetwork, unsigned char *pMsg, int len, int timeout_ms) {
+	struct iovec iov;
+	Timer deadline;
+
+	InitTimer(&deadline);
+	countdown_ms(&deadline, timeout_ms);
+
+	iov.iov_base = pMsg;
+	iov.iov_len = len;
+
+	return sendSegments(&(pNetwork->tlsDataParams), &iov, 1, &deadline);
+}
+
+int iot_tls_writev(Network *pNetwork, NetworkIoVec *pIov, int iovcnt, int timeout_ms) {
+	struct iovec iov[PLAIN_WRITEV_SEGMENTS];
+	int writtenLen = 0;
+	int segmentCount;
+	int rc;
+	int i;
+	Timer deadline;
+
+	// The timeout covers the whole vector
+	InitTimer(&deadline);
+	countdown_ms(&deadline, timeout_ms);
+
+	// The segments go to the kernel as they are, no copy is made to put them together
+	while(0 < iovcnt){
+		segmentCount = (PLAIN_WRITEV_SEGMENTS < iovcnt) ? PLAIN_WRITEV_SEGMENTS : iovcnt;
+		for(i = 0; i < segmentCount; i++){
+			iov[i].iov_base = pIov[i].pData;
+			iov[i].iov_len = pIov[i].len;
+		}
+
+		rc = sendSegments(&(pNetwork->tlsDataParams), iov, segmentCount, &deadline);
+		if(0 > rc){
+			return rc;
+		}
+		writtenLen += rc;
+		pIov += segmentCount;
+		iovcnt -= segmentCount;
+	}
+
+	return writtenLen;
+}
+
+int iot_tls_sendfile(Network *pNetwork, int fd, int64_t offset, int len, int timeout_ms) {
+	Timer deadline;
+
+	InitTimer(&deadline);
+	countdown_ms(&deadline, timeout_ms);
+
+	return sendFileBytes(&(pNetwork->tlsDataParams), fd, offset, len, &deadline);
+}
+
+int iot_tls_read(Network *pNetwork, unsigned char *pMsg, int len, int timeout_ms) {
+	int rxLen = 0;
+	int rc;
+	Timer deadline;
+
+	InitTimer(&deadline);
+	countdown_ms(&deadline, timeout_ms);
+
+	while(rxLen < len){
+		rc = receiveSome(&(pNetwork->tlsDataParams), pMsg + rxLen, len - rxLen, &deadline);
+		if(0 > rc){
+			return rc;
+		}
+		rxLen += rc;
+	}
+
+	return rxLen;
+}
+
+int iot_tls_read_some(Network *pNetwork, unsigned char *pMsg, int len, int timeout_ms) {
+	Timer deadline;
+
+	InitTimer(&deadline);
+	countdown_ms(&deadline, timeout_ms);
+
+	return receiveSome(&(pNetwork->tlsDataParams), pMsg, len, &deadline);
+}
+
+void iot_tls_disconnect(Network *pNetwork) {
+	TLSDataParams *pTLSData = &(pNetwork->tlsDataParams);
+
+	if(0 <= pTLSData->server_TCPSocket){
+		close(pTLSData->server_TCPSocket);
+	}
+	pTLSData->server_TCPSocket = -1;
+	pNetwork->my_socket = -1;
+}
+
+int iot_tls_destroy(Network *pNetwork) {
+	// disconnect already closed the socket
+	return 0;
+}
@@ -0,0 +1,33 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_PLAIN_NETWORK_PLATFORM_H_
+#define SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_PLAIN_NETWORK_PLATFORM_H_
+
+/**
+ * @file network_platform.h
+ */
+
+/**
+ * definition of the TLS state of a Network. Platform specific
+ *
+ * This backend does not encrypt, the connection is the socket alone.  A thread reading from
+ * it does not get in the way of a thread writing to it, so there is no lock.
+ */
+typedef struct {
+	int server_TCPSocket;	///< -1 while not connected
+} TLSDataParams;
+
+#endif /* SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_LINUX_PLAIN_NETWORK_PLATFORM_H_ */
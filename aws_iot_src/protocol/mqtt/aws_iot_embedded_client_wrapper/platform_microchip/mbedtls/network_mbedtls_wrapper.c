@@ -63,6 +63,10 @@ static mbedtls_x509_crt clicert;
 static mbedtls_pk_context pkey;
 static mbedtls_net_context server_fd;
 
+void iot_tls_invalidate_credentials(Network *pNetwork) {
+	// Nothing is kept, every connect loads the credentials again
+}
+
 int iot_tls_init(Network *pNetwork) {
 	IoT_Error_t ret_val = NONE_ERROR;
 	const char *pers = "aws_iot_tls_wrapper";
@@ -84,10 +88,13 @@ int iot_tls_init(Network *pNetwork) {
 		return ret;
 	} DEBUG("ok\n");
 
-	pNetwork->my_socket = 0;
+	pNetwork->my_socket = -1;
 	pNetwork->connect = iot_tls_connect;
 	pNetwork->mqttread = iot_tls_read;
+	pNetwork->mqttreadsome = NULL;
 	pNetwork->mqttwrite = iot_tls_write;
+	pNetwork->mqttwritev = NULL;
+	pNetwork->mqttsendfile = NULL;
 	pNetwork->disconnect = iot_tls_disconnect;
 	pNetwork->isConnected = iot_tls_is_connected;
 	pNetwork->destroy = iot_tls_destroy;
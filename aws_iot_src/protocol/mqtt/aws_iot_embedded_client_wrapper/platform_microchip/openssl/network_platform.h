@@ -0,0 +1,33 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+#ifndef SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_MICROCHIP_OPENSSL_NETWORK_PLATFORM_H_
+#define SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_MICROCHIP_OPENSSL_NETWORK_PLATFORM_H_
+
+/**
+ * @file network_platform.h
+ */
+
+/**
+ * definition of the TLS state of a Network. Platform specific
+ *
+ * This port still keeps the state of its one connection in statics of the wrapper, so a
+ * Network carries nothing of its own yet.
+ */
+typedef struct {
+	char unused;	///< Placeholder, C does not allow an empty struct
+} TLSDataParams;
+
+#endif /* SRC_PROTOCOL_MQTT_AWS_IOT_EMBEDDED_CLIENT_WRAPPER_PLATFORM_MICROCHIP_OPENSSL_NETWORK_PLATFORM_H_ */
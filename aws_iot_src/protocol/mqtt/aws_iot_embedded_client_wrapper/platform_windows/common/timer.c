@@ -45,3 +45,17 @@ int left_ms(Timer* timer) {
 void InitTimer(Timer* timer) {
 	timer->timeout_time = 0;
 }
+
+/* The tick read above is already cheap, so the cached-now hooks are no-ops here. */
+void TimerCacheNow(void) {
+}
+
+void TimerRefreshNow(void) {
+}
+
+void TimerClearNow(void) {
+}
+
+char TimerIsNowCached(void) {
+	return 0;
+}
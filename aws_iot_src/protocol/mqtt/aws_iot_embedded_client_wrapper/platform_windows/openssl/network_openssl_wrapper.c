@@ -56,6 +56,10 @@ static IoT_Error_t ConnectOrTimeoutOrExitOnError( SSL *pSSL, int timeout_ms );
 static IoT_Error_t ReadOrTimeoutOrExitOnError( SSL *pSSL, unsigned char *msg, int totalLen, int timeout_ms );
 static IoT_Error_t WriteOrTimeoutOrExitOnError( SSL *pSSL, unsigned char *msg, int totalLen, int timeout_ms );
 
+void iot_tls_invalidate_credentials(Network *pNetwork) {
+	// Nothing is kept, every connect loads the credentials again
+}
+
 int iot_tls_init(Network *pNetwork) {
 
 	IoT_Error_t ret_val = NONE_ERROR;
@@ -77,10 +81,13 @@ int iot_tls_init(Network *pNetwork) {
 		ret_val = SSL_INIT_ERROR;
 	}
 
-	pNetwork->my_socket = 0;
+	pNetwork->my_socket = -1;
 	pNetwork->connect = iot_tls_connect;
 	pNetwork->mqttread = iot_tls_read;
+	pNetwork->mqttreadsome = NULL;
 	pNetwork->mqttwrite = iot_tls_write;
+	pNetwork->mqttwritev = NULL;
+	pNetwork->mqttsendfile = NULL;
 	pNetwork->disconnect = iot_tls_disconnect;
 	pNetwork->isConnected = iot_tls_is_connected;
 	pNetwork->destroy = iot_tls_destroy;
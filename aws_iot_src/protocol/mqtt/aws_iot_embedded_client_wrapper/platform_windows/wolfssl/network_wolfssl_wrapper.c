@@ -48,6 +48,10 @@ static IoT_Error_t ReadOrTimeoutOrExitOnError( WOLFSSL *pSSL, unsigned char *msg
 static IoT_Error_t WriteOrTimeoutOrExitOnError( WOLFSSL *pSSL, unsigned char *msg, int totalLen, int timeout_ms );
 
 
+void iot_tls_invalidate_credentials(Network *pNetwork) {
+	// Nothing is kept, every connect loads the credentials again
+}
+
 int iot_tls_init(Network *pNetwork)
 {
 	if (wolfSSL_Init() != SSL_SUCCESS)	{		return SSL_INIT_ERROR;
@@ -58,10 +62,13 @@ int iot_tls_init(Network *pNetwork)
 		ERROR( " WOLFSSL INIT Failed - Unable to create WOLFSSL Context" );
 		return SSL_INIT_ERROR;
 	}
-	pNetwork->my_socket = 0;
+	pNetwork->my_socket = -1;
 	pNetwork->connect = iot_tls_connect;
 	pNetwork->mqttread = iot_tls_read;
+	pNetwork->mqttreadsome = NULL;
 	pNetwork->mqttwrite = iot_tls_write;
+	pNetwork->mqttwritev = NULL;
+	pNetwork->mqttsendfile = NULL;
 	pNetwork->disconnect = iot_tls_disconnect;
 	pNetwork->isConnected = iot_tls_is_connected;
 	pNetwork->destroy = iot_tls_destroy;
@@ -0,0 +1,178 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file threads_interface.h
+ * @brief Thread synchronization interface definition for MQTT client.
+ *
+ * Defines an interface to mutexes, condition variables and background threads.
+ * The MQTT client only uses them when it is built with _ENABLE_THREAD_SUPPORT_,
+ * which lets one thread yield while other threads publish, subscribe and unsubscribe.
+ * Starting point for porting the SDK to the threading layer of a new platform.
+ */
+
+#ifndef __THREADS_INTERFACE_H_
+#define __THREADS_INTERFACE_H_
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "aws_iot_error.h"
+
+// Include a platform-specific threads definition file
+// Which implementation is selected is defined by your include paths
+#include <threads_platform.h>
+
+/**
+ * @brief Mutex Type
+ *
+ * Forward declaration of a mutex struct.  The definition of this struct is
+ * platform dependent.  When porting to a new platform add this definition
+ * in "threads_platform.h" and include that file above.
+ *
+ */
+typedef struct IoT_Mutex IoT_Mutex_t;
+
+/**
+ * @brief Condition Variable Type
+ *
+ * Forward declaration of a condition variable struct.  The definition of this
+ * struct is platform dependent, see IoT_Mutex_t.
+ *
+ */
+typedef struct IoT_Cond IoT_Cond_t;
+
+/**
+ * @brief Thread Identifier Type
+ *
+ * Forward declaration of a struct that identifies a thread.  The definition of
+ * this struct is platform dependent, see IoT_Mutex_t.
+ *
+ */
+typedef struct IoT_Thread_Id IoT_Thread_Id_t;
+
+/**
+ * @brief Initialize a mutex
+ *
+ * @param IoT_Mutex_t - pointer to the mutex to be initialized, unlocked
+ * @return IoT_Error_t - NONE_ERROR or MUTEX_INIT_ERROR
+ */
+IoT_Error_t aws_iot_thread_mutex_init(IoT_Mutex_t *);
+
+/**
+ * @brief Lock a mutex, waiting as long as another thread holds it
+ *
+ * The mutex does not have to be recursive, the MQTT client never locks a mutex
+ * it already holds.
+ *
+ * @param IoT_Mutex_t - pointer to the mutex to be locked
+ * @return IoT_Error_t - NONE_ERROR or MUTEX_LOCK_ERROR
+ */
+IoT_Error_t aws_iot_thread_mutex_lock(IoT_Mutex_t *);
+
+/**
+ * @brief Lock a mutex only if no other thread holds it
+ *
+ * @param IoT_Mutex_t - pointer to the mutex to be locked
+ * @return IoT_Error_t - NONE_ERROR if the mutex was locked, MUTEX_LOCK_ERROR otherwise
+ */
+IoT_Error_t aws_iot_thread_mutex_trylock(IoT_Mutex_t *);
+
+/**
+ * @brief Unlock a mutex held by the calling thread
+ *
+ * @param IoT_Mutex_t - pointer to the mutex to be unlocked
+ * @return IoT_Error_t - NONE_ERROR or MUTEX_UNLOCK_ERROR
+ */
+IoT_Error_t aws_iot_thread_mutex_unlock(IoT_Mutex_t *);
+
+/**
+ * @brief Release the resources of an unlocked mutex
+ *
+ * @param IoT_Mutex_t - pointer to the mutex to be destroyed
+ * @return IoT_Error_t - NONE_ERROR or MUTEX_DESTROY_ERROR
+ */
+IoT_Error_t aws_iot_thread_mutex_destroy(IoT_Mutex_t *);
+
+/**
+ * @brief Initialize a condition variable
+ *
+ * @param IoT_Cond_t - pointer to the condition variable to be initialized
+ * @return IoT_Error_t - NONE_ERROR or MUTEX_INIT_ERROR
+ */
+IoT_Error_t aws_iot_thread_cond_init(IoT_Cond_t *);
+
+/**
+ * @brief Wait for a condition variable to be signalled
+ *
+ * Atomically unlocks the mutex and waits until the condition variable is
+ * broadcast or the timeout passes, then locks the mutex again.  Spurious
+ * wakeups are allowed, the caller checks its condition after every wait.
+ *
+ * @param IoT_Cond_t - pointer to the condition variable to wait for
+ * @param IoT_Mutex_t - pointer to the mutex held by the calling thread
+ * @param uint32_t - longest time to wait in milliseconds
+ * @return IoT_Error_t - NONE_ERROR whether signalled or timed out, MUTEX_LOCK_ERROR on failure
+ */
+IoT_Error_t aws_iot_thread_cond_wait(IoT_Cond_t *, IoT_Mutex_t *, uint32_t);
+
+/**
+ * @brief Wake every thread waiting for a condition variable
+ *
+ * @param IoT_Cond_t - pointer to the condition variable to be signalled
+ * @return IoT_Error_t - NONE_ERROR or MUTEX_UNLOCK_ERROR
+ */
+IoT_Error_t aws_iot_thread_cond_broadcast(IoT_Cond_t *);
+
+/**
+ * @brief Release the resources of a condition variable nobody waits for
+ *
+ * @param IoT_Cond_t - pointer to the condition variable to be destroyed
+ * @return IoT_Error_t - NONE_ERROR or MUTEX_DESTROY_ERROR
+ */
+IoT_Error_t aws_iot_thread_cond_destroy(IoT_Cond_t *);
+
+/**
+ * @brief Identify the calling thread
+ *
+ * @param IoT_Thread_Id_t - pointer to where the identifier of the calling thread is stored
+ */
+void aws_iot_thread_id_get(IoT_Thread_Id_t *);
+
+/**
+ * @brief Tell whether an identifier is the one of the calling thread
+ *
+ * @param IoT_Thread_Id_t - pointer to an identifier stored by aws_iot_thread_id_get
+ * @return bool - true if it was stored by the calling thread
+ */
+bool aws_iot_thread_id_is_current(const IoT_Thread_Id_t *);
+
+/**
+ * @brief Run a function on a thread of its own
+ *
+ * Nobody waits for the thread to end, its resources are released when the function returns.
+ * Used for work that may block for long, such as looking up a host name.
+ *
+ * @param pRoutine - function to run, its result is ignored
+ * @param void pointer - argument passed to the function
+ * @return IoT_Error_t - NONE_ERROR or THREAD_CREATE_ERROR
+ */
+IoT_Error_t aws_iot_thread_create_detached(void *(*pRoutine)(void *), void *);
+
+#endif //_ENABLE_THREAD_SUPPORT_
+
+#endif //__THREADS_INTERFACE_H_
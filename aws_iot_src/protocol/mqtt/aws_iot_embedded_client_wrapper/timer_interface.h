@@ -91,4 +91,38 @@ int left_ms(Timer*);
  */
 void InitTimer(Timer*);
 
+/**
+ * @brief Cache the current time for this thread
+ *
+ * Reads the clock once. Until TimerClearNow is called, expired, countdown_ms,
+ * countdown and left_ms on the calling thread use this reading instead of
+ * reading the clock themselves, so a pass through the MQTT client costs a
+ * single clock read. Calling it while the cache is active reads the clock again.
+ * Platforms whose clock is already cheap may implement this as a no-op.
+ */
+void TimerCacheNow(void);
+
+/**
+ * @brief Re-read the cached time
+ *
+ * Updates the cached time if TimerCacheNow is active on the calling thread and
+ * does nothing otherwise. While the cache is active, code that waits for a
+ * timer to expire must call this after each blocking call or the timer never will.
+ */
+void TimerRefreshNow(void);
+
+/**
+ * @brief Stop using the cached time
+ *
+ * Timer functions on the calling thread go back to reading the clock on every call.
+ */
+void TimerClearNow(void);
+
+/**
+ * @brief Check if the time is cached
+ *
+ * @return character - 1 = TimerCacheNow is active on the calling thread, 0 = it is not
+ */
+char TimerIsNowCached(void);
+
 #endif //__TIMER_INTERFACE_H_
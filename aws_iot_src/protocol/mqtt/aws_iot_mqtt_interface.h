@@ -86,6 +86,12 @@ typedef struct {
 	char *pRootCALocation;				///< Pointer to a string defining the Root CA file (full file, not path)
 	char *pDeviceCertLocation;			///< Pointer to a string defining the device identity certificate file (full file, not path)
 	char *pDevicePrivateKeyLocation;	///< Pointer to a string defining the device private key file (full file, not path)
+	const unsigned char *pRootCADer;	///< Root CA in DER form, used instead of pRootCALocation when not NULL.  Must stay valid while the client may reconnect
+	uint32_t RootCADerLen;				///< Number of bytes at pRootCADer
+	const unsigned char *pDeviceCertDer;	///< Device certificate in DER form, used instead of pDeviceCertLocation when not NULL
+	uint32_t DeviceCertDerLen;			///< Number of bytes at pDeviceCertDer
+	const unsigned char *pDevicePrivateKeyDer;	///< Device private key in DER form, used instead of pDevicePrivateKeyLocation when not NULL
+	uint32_t DevicePrivateKeyDerLen;	///< Number of bytes at pDevicePrivateKeyDer
 	char *pClientID;					///< Pointer to a string defining the MQTT client ID (this needs to be unique \b per \b device across your AWS account)
 	char *pUserName;					///< Not used in the AWS IoT Service
 	char *pPassword;					///< Not used in the AWS IoT Service
@@ -114,6 +120,7 @@ typedef struct {
 	uint16_t id;			///< Message sequence identifier.  Handled automatically by the MQTT client.
 	void *pPayload;			///< Pointer to MQTT message payload (bytes).
 	uint32_t PayloadLen;	///< Length of MQTT payload.
+	uint32_t OfflineTTL_sec;	///< Seconds the message may wait in the offline queue, 0 for the queue's DefaultTTL_sec
 } MQTTMessageParams;
 extern const MQTTMessageParams MQTTMessageParamsDefault;
 /**
@@ -139,6 +146,109 @@ extern const MQTTCallbackParams MQTTCallbackParamsDefault;
  */
 typedef int32_t (*iot_message_handler)(MQTTCallbackParams params);
 
+/**
+ * @brief MQTT Message Chunk Callback Function Parameters
+ *
+ * Defines a type for parameters returned to the user for each part of a message too large for
+ * AWS_IOT_MQTT_RX_BUF_LEN.  MessageParams.pPayload and MessageParams.PayloadLen describe this
+ * chunk only, the other message parameters are the same for every chunk of the message.
+ *
+ */
+typedef struct {
+	char *pTopicName;					///< Pointer to the topic string on which the message was delivered
+	uint16_t TopicNameLen;				///< Length of the topic string.
+	MQTTMessageParams MessageParams;	///< Message parameters structure, the payload is this chunk
+	uint32_t Offset;					///< Position of this chunk in the message payload
+	uint32_t TotalPayloadLen;			///< Length of the whole message payload
+	bool isFinal;						///< Is this the last chunk of the message?
+} MQTTChunkCallbackParams;
+
+/**
+ * @brief MQTT Message Chunk Callback Function
+ *
+ * Defines a type for the function pointer invoked with the payload of a received message that is
+ * too large for the MQTT RX buffer, one chunk at a time and in order.  The chunk data is only valid
+ * for the duration of the call.
+ *
+ */
+typedef void (*iot_message_chunk_handler)(MQTTChunkCallbackParams params);
+
+/**
+ * @brief MQTT Publish Complete Callback Function
+ *
+ * Defines a type for the function pointer invoked when an asynchronous publish completes.
+ * For QoS 1 this is on receipt of PUBACK, for QoS 2 on receipt of PUBCOMP and for QoS 0
+ * as soon as the message was passed to the TLS layer.
+ *
+ * @param messageId Packet id assigned to the message by the MQTT client
+ * @param status NONE_ERROR if the message was acknowledged, PUBLISH_ERROR if the ack timed out
+ *        or NETWORK_DISCONNECTED if the connection was lost before the ack arrived
+ * @param pContext Context pointer supplied with the publish
+ */
+typedef void (*iot_publish_complete_handler)(uint16_t messageId, IoT_Error_t status, void *pContext);
+
+/**
+ * @brief What the offline queue does with a message that does not fit
+ */
+typedef enum {
+	OFFLINE_DROP_NEWEST = 0,	///< The new message is rejected with OFFLINE_QUEUE_FULL_ERROR
+	OFFLINE_DROP_OLDEST = 1		///< The oldest queued messages are dropped until the new one fits
+} OfflineDropPolicy_t;
+
+/**
+ * @brief MQTT Offline Queue Parameters
+ *
+ * Defines the storage and policies of the queue that holds messages published while the
+ * client is disconnected.  The queue keeps all of its state in the storage, so storage from
+ * aws_iot_offline_storage_open keeps the queued messages across a restart of the application.
+ *
+ */
+typedef struct {
+	unsigned char *pStorage;		///< Storage for the queue, aligned to 4 bytes
+	uint32_t StorageLen;			///< Size of the storage in bytes
+	OfflineDropPolicy_t DropPolicy;	///< What to do when the queue is full
+	uint32_t DefaultTTL_sec;		///< TTL of messages published with OfflineTTL_sec 0, 0 to keep them until they are sent
+	uint32_t (*getTimeSec)(void);	///< Clock for the TTLs that keeps counting across restarts, such as time().  NULL disables TTLs
+	iot_publish_complete_handler completeHandler;	///< Called with the ack of each queued QoS 1 or QoS 2 message, pContext is NULL.  May be NULL
+} MQTTOfflineQueueParams;
+extern const MQTTOfflineQueueParams MQTTOfflineQueueParamsDefault;
+
+/**
+ * @brief How the auto-reconnect delay grows from one attempt to the next
+ */
+typedef enum {
+	RECONNECT_EXPONENTIAL = 0,			///< Doubles from MinDelay_ms, the same on every device
+	RECONNECT_DECORRELATED_JITTER = 1	///< Random between MinDelay_ms and three times the previous delay
+} ReconnectStrategy_t;
+
+/**
+ * @brief Returns the delay before a reconnect attempt
+ *
+ * @param attempt Counts from 0 for the first attempt after the connection was lost
+ * @param previousDelay_ms Delay before the previous attempt, 0 for the first one
+ * @param pContext Context pointer supplied with the reconnect parameters
+ * @return The delay in ms, capped at MaxDelay_ms, or 0xFFFFFFFF to give up
+ */
+typedef uint32_t (*iot_reconnect_delay_handler)(uint32_t attempt, uint32_t previousDelay_ms, void *pContext);
+
+/**
+ * @brief MQTT Reconnect Parameters
+ *
+ * Defines how long the auto-reconnect waits before each attempt and when it gives up.  The
+ * defaults spread the attempts of a fleet with decorrelated jitter and never give up.
+ *
+ */
+typedef struct {
+	ReconnectStrategy_t Strategy;
+	uint32_t MinDelay_ms;			///< Delay before the first attempt, and the shortest one the jitter picks
+	uint32_t MaxDelay_ms;			///< Longest delay, except one asked for with aws_iot_mqtt_set_reconnect_hint
+	uint32_t MaxAttempts;			///< Attempts before NETWORK_RECONNECT_TIMED_OUT, 0 to keep trying
+	uint32_t Seed;					///< Per device seed of the jitter, such as a serial number.  0 derives one from the client ID
+	iot_reconnect_delay_handler getDelay;	///< Replaces Strategy if not NULL
+	void *pContext;					///< Passed to getDelay
+} MQTTReconnectParams;
+extern const MQTTReconnectParams MQTTReconnectParamsDefault;
+
 /**
  * @brief MQTT Subscription Parameters
  *
@@ -187,6 +297,131 @@ IoT_Error_t aws_iot_mqtt_connect(MQTTConnectParams *pParams);
  */
 IoT_Error_t aws_iot_mqtt_publish(MQTTPublishParams *pParams);
 
+/**
+ * @brief Publish an MQTT message on a topic without waiting for the ack
+ *
+ * Called to publish an MQTT message without blocking on the PUBACK/PUBCOMP.  Up to
+ * AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISHES QoS 1 and QoS 2 messages can be awaiting their ack
+ * at the same time.  Acks are processed during aws_iot_mqtt_yield and each one invokes
+ * the supplied completion handler.
+ *
+ * @param pParams	Pointer to MQTT publish parameters
+ * @param handler	Completion handler, may be NULL
+ * @param pContext	Context pointer passed back to the completion handler
+ * @return NONE_ERROR if the message was sent, PUBLISH_WINDOW_FULL_ERROR if the publish window is full,
+ *         PUBLISH_QUEUED if it went to the offline queue
+ */
+IoT_Error_t aws_iot_mqtt_publish_async(MQTTPublishParams *pParams, iot_publish_complete_handler handler,
+		void *pContext);
+
+/**
+ * @brief Publish part of a file as the payload of an MQTT message
+ *
+ * Like aws_iot_mqtt_publish, but the payload is MessageParams.PayloadLen bytes of the open
+ * file fd, starting at offset, and pPayload is not used.  The file is read while the message
+ * is written, so a large one, such as a log bundle, is not held in memory.  On Linux the
+ * plain TCP wrapper, and the OpenSSL wrapper built with AWS_IOT_TLS_KTLS once the kernel
+ * took over the TLS encryption, send the bytes with sendfile.  The other Linux wrappers read
+ * them a chunk at a time.  The file must not be shorter than the payload; if it turns out to
+ * be, the message cannot be finished and the client disconnects as if the connection was
+ * lost: the disconnect handler is called and auto-reconnect, if enabled, takes over.  A file
+ * is not queued while the client is disconnected.
+ *
+ * @param pParams	Pointer to MQTT publish parameters
+ * @param fd		File descriptor of the file, which must allow pread
+ * @param offset	Offset in the file of the first byte of the payload
+ * @return An IoT Error Type defining successful/failed publish
+ */
+IoT_Error_t aws_iot_mqtt_publish_from_fd(MQTTPublishParams *pParams, int fd, int64_t offset);
+
+/**
+ * @brief Set the size of the asynchronous publish window
+ *
+ * Limits the number of QoS 1 and QoS 2 messages that can be awaiting their ack at any given time.
+ *
+ * @param windowSize Between 1 and AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISHES
+ * @return An IoT Error Type defining successful/failed API call
+ */
+IoT_Error_t aws_iot_mqtt_set_publish_window(uint32_t windowSize);
+
+/**
+ * @brief Adapt the keepalive to how stable the connection is
+ *
+ * A PINGREQ is sent once nothing was sent or nothing was received for the keepalive interval,
+ * so a connection with traffic in both directions needs none.  With adaptive keepalive every
+ * connection starts with an interval of minIntervalSec, for quick detection of a broken link,
+ * which doubles with each PINGRESP up to KeepAliveInterval_sec of the connect parameters.
+ * Idle devices then wake up less often once the connection has proven stable.
+ *
+ * @param minIntervalSec	Interval each connection starts with, 0 (the default) to always use KeepAliveInterval_sec
+ * @return An IoT Error Type defining successful/failed API call
+ */
+IoT_Error_t aws_iot_mqtt_set_adaptive_keepalive(uint16_t minIntervalSec);
+
+/**
+ * @brief Set how the auto-reconnect backs off
+ *
+ * By default the delay doubles from AWS_IOT_MQTT_MIN_RECONNECT_WAIT_INTERVAL and the client
+ * gives up with NETWORK_RECONNECT_TIMED_OUT once it would pass
+ * AWS_IOT_MQTT_MAX_RECONNECT_WAIT_INTERVAL.  All devices that lost the broker together then
+ * retry at the same moments, which can keep an overloaded broker down.  With jitter and a
+ * per device seed their attempts spread out instead.  Takes effect from the next disconnect.
+ *
+ * @param pParams	Reconnect parameters, NULL to go back to the default doubling.  Must stay valid if getDelay is set
+ * @return An IoT Error Type defining successful/failed API call
+ */
+IoT_Error_t aws_iot_mqtt_set_reconnect_policy(MQTTReconnectParams *pParams);
+
+/**
+ * @brief Replace the next reconnect delay
+ *
+ * For a delay the server asked for, for example in a message before it closed the
+ * connection.  The hint is not capped at MaxDelay_ms and is jittered by up to half of it
+ * with RECONNECT_DECORRELATED_JITTER.  A CONNACK refused with "server unavailable" hints
+ * MaxDelay_ms by itself.  Can be called from the disconnect handler.
+ *
+ * @param delay_ms	Delay before the next reconnect attempt
+ * @return An IoT Error Type defining successful/failed API call
+ */
+IoT_Error_t aws_iot_mqtt_set_reconnect_hint(uint32_t delay_ms);
+
+/**
+ * @brief Let asynchronous publishes wait to be written together
+ *
+ * Small packets the client sends without being asked to, such as PUBACK, PUBREC, PUBREL and
+ * PUBCOMP, are collected in a staging buffer of AWS_IOT_MQTT_TX_STAGE_LEN bytes and written
+ * together, so that they share TLS records.  They go out before the client waits for the
+ * network again and ahead of the next packet written right away.  With a flush delay, messages
+ * published with aws_iot_mqtt_publish_async are staged as well and written at the latest once
+ * the delay has passed, which aws_iot_mqtt_yield and aws_iot_mqtt_process_timers check.
+ *
+ * @param delayMs	Longest time an asynchronous publish is held back, 0 (the default) writes them right away
+ * @return An IoT Error Type defining successful/failed API call
+ */
+IoT_Error_t aws_iot_mqtt_set_flush_delay(uint32_t delayMs);
+
+/**
+ * @brief Write the staged packets right away
+ *
+ * @return NONE_ERROR, or SSL_WRITE_ERROR if the write failed
+ */
+IoT_Error_t aws_iot_mqtt_flush(void);
+
+/**
+ * @brief Queue messages published while the client is disconnected
+ *
+ * With an offline queue, aws_iot_mqtt_publish and aws_iot_mqtt_publish_async return
+ * PUBLISH_QUEUED instead of failing while the client is disconnected or reconnecting.  The
+ * queued messages are sent in order, several PUBLISH packets per write, as soon as the client
+ * is connected again and before any message published after that.  Messages whose TTL passed
+ * while they were queued are dropped.  Call it before aws_iot_mqtt_connect so that messages
+ * queued by a previous run of the application are sent on the first connect.
+ *
+ * @param pParams	Offline queue parameters, NULL to stop queueing.  The storage must stay valid
+ * @return NONE_ERROR, or GENERIC_ERROR if the storage is too small or not aligned
+ */
+IoT_Error_t aws_iot_mqtt_set_offline_queue(MQTTOfflineQueueParams *pParams);
+
 /**
  * @brief Subscribe to an MQTT topic.
  *
@@ -199,6 +434,33 @@ IoT_Error_t aws_iot_mqtt_publish(MQTTPublishParams *pParams);
  */
 IoT_Error_t aws_iot_mqtt_subscribe(MQTTSubscribeParams *pParams);
 
+/**
+ * @brief Subscribe to several MQTT topics at once.
+ *
+ * Called to subscribe to count topics with as few SUBSCRIBE control packets as the TX buffer
+ * allows, each one carrying up to AWS_IOT_MQTT_MAX_SUBSCRIBE_BATCH topic filters.
+ * @note Call is blocking.  The call returns after the receipt of the last SUBACK control packet.
+ *
+ * @param pParams	Array of count MQTT subscribe parameters
+ * @param count		Number of topics to subscribe to
+ * @return An IoT Error Type defining successful/failed subscription. SUBSCRIBE_ERROR is also returned
+ *         if the server rejected some of the topics, the other topics stay subscribed
+ */
+IoT_Error_t aws_iot_mqtt_subscribe_many(MQTTSubscribeParams *pParams, uint32_t count);
+
+/**
+ * @brief Receive messages larger than the MQTT RX buffer in chunks
+ *
+ * Without a chunk handler a message bigger than AWS_IOT_MQTT_RX_BUF_LEN is dropped.  With one,
+ * its topic and header are parsed as usual and the payload is passed to the handler as it is
+ * received, so the RX buffer only needs to hold the topic name.  Messages that fit the RX buffer
+ * still go to the message handler of their subscription.
+ *
+ * @param handler	Chunk handler, NULL to drop large messages again
+ * @return An IoT Error Type defining successful/failed API call
+ */
+IoT_Error_t aws_iot_mqtt_set_message_chunk_handler(iot_message_chunk_handler handler);
+
 /**
  * @brief Unsubscribe to an MQTT topic.
  *
@@ -249,6 +511,57 @@ IoT_Error_t aws_iot_mqtt_disconnect(void);
  */
 IoT_Error_t aws_iot_mqtt_yield(int timeout);
 
+/**
+ * @brief Value of aws_iot_mqtt_get_next_timeout while the client has no timer running
+ */
+#define AWS_IOT_MQTT_NO_PENDING_TIMEOUT 0xFFFFFFFF
+
+/**
+ * @brief Socket of the MQTT connection, for use in an application event loop
+ *
+ * Instead of calling aws_iot_mqtt_yield an application can wait on this socket together
+ * with its own file descriptors, using select, poll, epoll or a library such as libuv.
+ * When the socket becomes readable it calls aws_iot_mqtt_process_readable, and once
+ * aws_iot_mqtt_get_next_timeout milliseconds have passed it calls aws_iot_mqtt_process_timers.
+ * The socket changes on every reconnect, so look it up again after RECONNECT_SUCCESSFUL.
+ *
+ * @note Do not mix this with aws_iot_mqtt_yield on the same connection.
+ *
+ * @return The socket file descriptor, -1 while disconnected or if the network layer has none
+ */
+int aws_iot_mqtt_get_socket(void);
+
+/**
+ * @brief Time until aws_iot_mqtt_process_timers has work to do
+ *
+ * Covers the keepalive ping, acks overdue for publishes and the next reconnect attempt.
+ *
+ * @return Milliseconds to wait at most, 0 if a timer is due already, AWS_IOT_MQTT_NO_PENDING_TIMEOUT if none is running
+ */
+uint32_t aws_iot_mqtt_get_next_timeout(void);
+
+/**
+ * @brief Process the data received on the MQTT socket
+ *
+ * Reads and handles every packet already received, including data the TLS layer holds
+ * decrypted that does not make the socket readable, and returns without waiting for more.
+ * Message handlers and publish completion handlers are called from here.
+ *
+ * @return An IoT Error Type like aws_iot_mqtt_yield.  NETWORK_ATTEMPTING_RECONNECT if the
+ *         connection was found closed and auto-reconnect is enabled
+ */
+IoT_Error_t aws_iot_mqtt_process_readable(void);
+
+/**
+ * @brief Act on the MQTT client timers that are due
+ *
+ * Sends the keepalive ping, fails publishes whose ack is overdue and makes the next
+ * reconnect attempt.  Only a reconnect attempt blocks, for as long as connecting takes.
+ *
+ * @return An IoT Error Type like aws_iot_mqtt_yield
+ */
+IoT_Error_t aws_iot_mqtt_process_timers(void);
+
 /**
  * @brief Is the MQTT client currently connected?
  *
@@ -269,6 +582,30 @@ bool aws_iot_is_mqtt_connected(void);
  */
 bool aws_iot_is_autoreconnect_enabled(void);
 
+/**
+ * @brief Did the last connect resume a TLS session?
+ *
+ * The TLS layer keeps the session of the last connection to each endpoint, up to
+ * AWS_IOT_TLS_SESSION_CACHE_LEN of them, and offers it on the next connect.  If the server
+ * still knows it, the handshake skips the certificate exchange and key agreement and takes
+ * one round trip instead of two.
+ *
+ * @return true = resumed, false = full handshake or not connected yet
+ */
+bool aws_iot_is_tls_session_resumed(void);
+
+/**
+ * @brief Load the TLS credentials again on the next connect
+ *
+ * The root CA, the device certificate and the private key are parsed on the first connect
+ * and kept for every later connect and reconnect of the same connection.  They are parsed
+ * again when a connect names other files or DER buffers.  Call this after rotating the
+ * credentials in place, then disconnect and connect again; the cached TLS sessions are
+ * dropped too.  Must not be called while a connect is in progress.  Only affects the default
+ * connection, see aws_iot_mqtt_client_invalidate_credentials for the others.
+ */
+void aws_iot_mqtt_invalidate_credentials(void);
+
 /**
  * @brief Enable or Disable AutoReconnect on Network Disconnect
  *
@@ -280,16 +617,18 @@ bool aws_iot_is_autoreconnect_enabled(void);
  */
 IoT_Error_t aws_iot_mqtt_autoreconnect_set_status(bool value);
 
-typedef IoT_Error_t (*pConnectFunc_t)(MQTTConnectParams *pParams);
-typedef IoT_Error_t (*pPublishFunc_t)(MQTTPublishParams *pParams);
-typedef IoT_Error_t (*pSubscribeFunc_t)(MQTTSubscribeParams *pParams);
-typedef IoT_Error_t (*pUnsubscribeFunc_t)(char *pTopic);
-typedef IoT_Error_t (*pDisconnectFunc_t)(void);
-typedef IoT_Error_t (*pYieldFunc_t)(int timeout);
-typedef bool (*pIsConnectedFunc_t)(void);
-typedef bool (*pIsAutoReconnectEnabledFunc_t)(void);
-typedef IoT_Error_t (*pReconnectFunc_t)();
-typedef IoT_Error_t (*pSetAutoReconnectStatusFunc_t)(bool);
+typedef struct MQTTClient_t MQTTClient_t;
+
+typedef IoT_Error_t (*pConnectFunc_t)(MQTTClient_t *pClient, MQTTConnectParams *pParams);
+typedef IoT_Error_t (*pPublishFunc_t)(MQTTClient_t *pClient, MQTTPublishParams *pParams);
+typedef IoT_Error_t (*pSubscribeFunc_t)(MQTTClient_t *pClient, MQTTSubscribeParams *pParams);
+typedef IoT_Error_t (*pUnsubscribeFunc_t)(MQTTClient_t *pClient, char *pTopic);
+typedef IoT_Error_t (*pDisconnectFunc_t)(MQTTClient_t *pClient);
+typedef IoT_Error_t (*pYieldFunc_t)(MQTTClient_t *pClient, int timeout);
+typedef bool (*pIsConnectedFunc_t)(MQTTClient_t *pClient);
+typedef bool (*pIsAutoReconnectEnabledFunc_t)(MQTTClient_t *pClient);
+typedef IoT_Error_t (*pReconnectFunc_t)(MQTTClient_t *pClient);
+typedef IoT_Error_t (*pSetAutoReconnectStatusFunc_t)(MQTTClient_t *pClient, bool);
 /**
  * @brief MQTT Client Type Definition
  *
@@ -297,8 +636,11 @@ typedef IoT_Error_t (*pSetAutoReconnectStatusFunc_t)(bool);
  * function.  In this way any MQTT client which implements the iot_mqtt_* interface
  * can be swapped in under the MQTT/Shadow layer.
  *
+ * Every function takes the MQTTClient_t it is called through, so that each MQTTClient_t
+ * can act on a connection of its own.
+ *
  */
-typedef struct{
+struct MQTTClient_t {
 	pConnectFunc_t connect;				///< function implementing the iot_mqtt_connect function
 	pPublishFunc_t publish;				///< function implementing the iot_mqtt_publish function
 	pSubscribeFunc_t subscribe;			///< function implementing the iot_mqtt_subscribe function
@@ -309,7 +651,8 @@ typedef struct{
 	pReconnectFunc_t reconnect;			///< function implementing the iot_mqtt_reconnect function
 	pIsAutoReconnectEnabledFunc_t isAutoReconnectEnabled;	///< function implementing the iot_is_autoreconnect_enabled function
 	pSetAutoReconnectStatusFunc_t setAutoReconnectStatus;	///< function implementing the iot_mqtt_autoreconnect_set_status function
-}MQTTClient_t;
+	void *pInstance;					///< Connection state of this client, owned by the MQTT client implementation
+};
 
 
 /**
@@ -319,8 +662,71 @@ typedef struct{
  * AWS IoT MQTT wrapper layer.  This is done through function pointers to the
  * interface functions.
  *
+ * The client is bound to the default connection, the one the aws_iot_mqtt_* functions act on.
+ *
  */
 void aws_iot_mqtt_init(MQTTClient_t *pClient);
 
+/**
+ * @brief Set up an MQTT client with a connection of its own
+ *
+ * Like aws_iot_mqtt_init, but the client is bound to a connection that is not shared with
+ * the aws_iot_mqtt_* functions or with any other client.  It has its own MQTT client state,
+ * TX/RX buffers, subscriptions and network connection.  Up to AWS_IOT_MQTT_MAX_CLIENT_INSTANCES
+ * connections, the default one included, can exist at the same time.
+ *
+ * @param pClient	Client to set up
+ * @return NONE_ERROR, or MAX_CLIENT_INSTANCES_REACHED_ERROR if every connection is in use
+ */
+IoT_Error_t aws_iot_mqtt_init_instance(MQTTClient_t *pClient);
+
+/**
+ * @brief Release the connection of a client set up with aws_iot_mqtt_init_instance
+ *
+ * Disconnects the client if it is still connected and makes its connection available
+ * to aws_iot_mqtt_init_instance again.
+ *
+ * @param pClient	Client to release
+ * @return An IoT Error Type defining successful/failed API call
+ */
+IoT_Error_t aws_iot_mqtt_free_instance(MQTTClient_t *pClient);
+
+/**
+ * @brief Handle based versions of the aws_iot_mqtt_* functions
+ *
+ * Each one behaves like the function of the same name without "client_" but acts on the
+ * connection of pClient.  These are the functions aws_iot_mqtt_init and
+ * aws_iot_mqtt_init_instance install in the MQTTClient_t.
+ */
+IoT_Error_t aws_iot_mqtt_client_connect(MQTTClient_t *pClient, MQTTConnectParams *pParams);
+IoT_Error_t aws_iot_mqtt_client_publish(MQTTClient_t *pClient, MQTTPublishParams *pParams);
+IoT_Error_t aws_iot_mqtt_client_publish_async(MQTTClient_t *pClient, MQTTPublishParams *pParams,
+		iot_publish_complete_handler handler, void *pContext);
+IoT_Error_t aws_iot_mqtt_client_publish_from_fd(MQTTClient_t *pClient, MQTTPublishParams *pParams, int fd,
+		int64_t offset);
+IoT_Error_t aws_iot_mqtt_client_set_publish_window(MQTTClient_t *pClient, uint32_t windowSize);
+IoT_Error_t aws_iot_mqtt_client_set_adaptive_keepalive(MQTTClient_t *pClient, uint16_t minIntervalSec);
+IoT_Error_t aws_iot_mqtt_client_set_reconnect_policy(MQTTClient_t *pClient, MQTTReconnectParams *pParams);
+IoT_Error_t aws_iot_mqtt_client_set_reconnect_hint(MQTTClient_t *pClient, uint32_t delay_ms);
+IoT_Error_t aws_iot_mqtt_client_set_flush_delay(MQTTClient_t *pClient, uint32_t delayMs);
+IoT_Error_t aws_iot_mqtt_client_flush(MQTTClient_t *pClient);
+IoT_Error_t aws_iot_mqtt_client_set_offline_queue(MQTTClient_t *pClient, MQTTOfflineQueueParams *pParams);
+IoT_Error_t aws_iot_mqtt_client_subscribe(MQTTClient_t *pClient, MQTTSubscribeParams *pParams);
+IoT_Error_t aws_iot_mqtt_client_subscribe_many(MQTTClient_t *pClient, MQTTSubscribeParams *pParams, uint32_t count);
+IoT_Error_t aws_iot_mqtt_client_set_message_chunk_handler(MQTTClient_t *pClient, iot_message_chunk_handler handler);
+IoT_Error_t aws_iot_mqtt_client_unsubscribe(MQTTClient_t *pClient, char *pTopic);
+IoT_Error_t aws_iot_mqtt_client_attempt_reconnect(MQTTClient_t *pClient);
+IoT_Error_t aws_iot_mqtt_client_disconnect(MQTTClient_t *pClient);
+IoT_Error_t aws_iot_mqtt_client_yield(MQTTClient_t *pClient, int timeout);
+int aws_iot_mqtt_client_get_socket(MQTTClient_t *pClient);
+uint32_t aws_iot_mqtt_client_get_next_timeout(MQTTClient_t *pClient);
+IoT_Error_t aws_iot_mqtt_client_process_readable(MQTTClient_t *pClient);
+IoT_Error_t aws_iot_mqtt_client_process_timers(MQTTClient_t *pClient);
+bool aws_iot_mqtt_client_is_connected(MQTTClient_t *pClient);
+bool aws_iot_mqtt_client_is_autoreconnect_enabled(MQTTClient_t *pClient);
+bool aws_iot_mqtt_client_is_tls_session_resumed(MQTTClient_t *pClient);
+void aws_iot_mqtt_client_invalidate_credentials(MQTTClient_t *pClient);
+IoT_Error_t aws_iot_mqtt_client_autoreconnect_set_status(MQTTClient_t *pClient, bool value);
+
 
 #endif /* AWS_IOT_SDK_SRC_IOT_MQTT_INTERFACE_H_ */
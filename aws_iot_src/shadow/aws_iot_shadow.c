@@ -92,7 +92,7 @@ IoT_Error_t aws_iot_shadow_connect(MQTTClient_t *pClient, ShadowParameters_t *pP
 	ConnectParams.port = pParams->port;
 	ConnectParams.disconnectHandler = NULL;
 
-	rc = pClient->connect(&ConnectParams);
+	rc = pClient->connect(pClient, &ConnectParams);
 
 	if(rc == NONE_ERROR){
 		initializeRecords(pClient);
@@ -104,7 +104,7 @@ IoT_Error_t aws_iot_shadow_connect(MQTTClient_t *pClient, ShadowParameters_t *pP
 IoT_Error_t aws_iot_shadow_register_delta(MQTTClient_t *pClient, jsonStruct_t *pStruct) {
 	IoT_Error_t rc = NONE_ERROR;
 
-	if (!(pClient->isConnected())) {
+	if (!(pClient->isConnected(pClient))) {
 		return CONNECTION_ERROR;
 	}
 
@@ -115,11 +115,11 @@ IoT_Error_t aws_iot_shadow_register_delta(MQTTClient_t *pClient, jsonStruct_t *p
 
 IoT_Error_t aws_iot_shadow_yield(MQTTClient_t *pClient, int timeout) {
 	HandleExpiredResponseCallbacks();
-	return pClient->yield(timeout);
+	return pClient->yield(pClient, timeout);
 }
 
 IoT_Error_t aws_iot_shadow_disconnect(MQTTClient_t *pClient) {
-	return pClient->disconnect();
+	return pClient->disconnect(pClient);
 }
 
 IoT_Error_t aws_iot_shadow_update(MQTTClient_t *pClient, const char *pThingName, char *pJsonString,
@@ -127,7 +127,7 @@ IoT_Error_t aws_iot_shadow_update(MQTTClient_t *pClient, const char *pThingName,
 
 	IoT_Error_t ret_val = NONE_ERROR;
 
-	if (!(pClient->isConnected())) {
+	if (!(pClient->isConnected(pClient))) {
 		return CONNECTION_ERROR;
 	}
 
@@ -141,7 +141,7 @@ IoT_Error_t aws_iot_shadow_delete(MQTTClient_t *pClient, const char *pThingName,
 		void *pContextData, uint8_t timeout_seconds, bool isPersistentSubscribe) {
 	IoT_Error_t ret_val = NONE_ERROR;
 
-	if (!(pClient->isConnected())) {
+	if (!(pClient->isConnected(pClient))) {
 		return CONNECTION_ERROR;
 	}
 
@@ -158,7 +158,7 @@ IoT_Error_t aws_iot_shadow_get(MQTTClient_t *pClient, const char *pThingName, fp
 
 	IoT_Error_t ret_val = NONE_ERROR;
 
-	if (!(pClient->isConnected())) {
+	if (!(pClient->isConnected(pClient))) {
 		return CONNECTION_ERROR;
 	}
 
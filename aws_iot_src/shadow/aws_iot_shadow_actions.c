@@ -28,7 +28,7 @@ IoT_Error_t iot_shadow_action(MQTTClient_t *pClient, const char *pThingName, Sha
 	bool isCallbackPresent = false;
 	bool isClientTokenPresent = false;
 	bool isAckWaitListFree = false;
-	uint8_t indexAckWaitList;
+	uint16_t indexAckWaitList;
 
 	if(pClient == NULL || pThingName == NULL || pJsonDocumentToBeSent == NULL){
 		return NULL_VALUE_ERROR;
@@ -66,6 +66,8 @@ IoT_Error_t iot_shadow_action(MQTTClient_t *pClient, const char *pThingName, Sha
 	if (isClientTokenPresent && isCallbackPresent && ret_val == NONE_ERROR && isAckWaitListFree) {
 		addToAckWaitList(indexAckWaitList, pThingName, action, extractedClientToken, callback, pCallbackContext,
 				timeout_seconds);
+	} else if (isAckWaitListFree) {
+		releaseIndexOfAckWaitList(indexAckWaitList);
 	}
 	return ret_val;
 }
@@ -19,6 +19,7 @@
 #include <stdio.h>
 
 #include "timer_interface.h"
+#include "aws_iot_timer_wheel.h"
 #include "aws_iot_json_utils.h"
 #include "aws_iot_log.h"
 #include "aws_iot_shadow_json.h"
@@ -31,7 +32,7 @@ typedef struct {
 	fpActionCallback_t callback;
 	void *pCallbackContext;
 	bool isFree;
-	Timer timer;
+	uint16_t nextFree;
 } ToBeReceivedAckRecord_t;
 
 typedef struct {
@@ -52,8 +53,19 @@ typedef enum {
 	SHADOW_ACCEPTED, SHADOW_REJECTED, SHADOW_ACTION
 } ShadowAckTopicTypes_t;
 
+#ifndef AWS_IOT_SHADOW_ACK_TIMER_TICK_MS
+#define AWS_IOT_SHADOW_ACK_TIMER_TICK_MS 100
+#endif
+
+#define ACK_WAIT_LIST_END 0xFFFF
+
 ToBeReceivedAckRecord_t AckWaitList[MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME];
 
+// the timeout of AckWaitList[i] is AckTimeouts[i]
+static TimerWheel_t AckTimeoutWheel;
+static TimerWheelEntry_t AckTimeouts[MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME];
+static uint16_t ackWaitListFreeHead = ACK_WAIT_LIST_END;
+
 MQTTClient_t *pMqttClient;
 
 char myThingName[MAX_SIZE_OF_THING_NAME];
@@ -79,7 +91,8 @@ static int shadow_delta_callback(MQTTCallbackParams params);
 static void topicNameFromThingAndAction(char *pTopic, const char *pThingName, ShadowActions_t action,
 		ShadowAckTopicTypes_t ackType);
 static int16_t getNextFreeIndexOfSubscriptionList(void);
-static void unsubscribeFromAcceptedAndRejected(uint8_t index);
+static void unsubscribeFromAcceptedAndRejected(uint16_t index);
+static void freeAckWaitListEntry(uint16_t index);
 
 void initDeltaTokens(void) {
 	uint32_t i;
@@ -100,7 +113,7 @@ IoT_Error_t registerJsonTokenOnDelta(jsonStruct_t *pStruct) {
 		snprintf(shadowDeltaTopic,MAX_SHADOW_TOPIC_LENGTH_BYTES, "$aws/things/%s/shadow/update/delta", myThingName);
 		subParams.pTopic = shadowDeltaTopic;
 		subParams.qos = QOS_0;
-		rc = pMqttClient->subscribe(&subParams);
+		rc = pMqttClient->subscribe(pMqttClient, &subParams);
 		DEBUG("delta topic %s", shadowDeltaTopic);
 		deltaTopicSubscribedFlag = true;
 	}
@@ -165,7 +178,7 @@ static bool isAckForMyThingName(const char *pTopicName) {
 
 static int AckStatusCallback(MQTTCallbackParams params) {
 	int32_t tokenCount;
-	uint8_t i;
+	uint16_t i;
 	void *pJsonHandler = NULL;
 	char temporaryClientToken[MAX_SIZE_CLIENT_ID_WITH_SEQUENCE];
 
@@ -206,7 +219,7 @@ static int AckStatusCallback(MQTTCallbackParams params) {
 									shadowRxBuf, AckWaitList[i].pCallbackContext);
 						}
 						unsubscribeFromAcceptedAndRejected(i);
-						AckWaitList[i].isFree = true;
+						freeAckWaitListEntry(i);
 						return NONE_ERROR;
 					}
 				}
@@ -229,7 +242,7 @@ static int16_t findIndexOfSubscriptionList(const char *pTopic) {
 	return -1;
 }
 
-static void unsubscribeFromAcceptedAndRejected(uint8_t index) {
+static void unsubscribeFromAcceptedAndRejected(uint16_t index) {
 
 	char TemporaryTopicNameAccepted[MAX_SHADOW_TOPIC_LENGTH_BYTES];
 	char TemporaryTopicNameRejected[MAX_SHADOW_TOPIC_LENGTH_BYTES];
@@ -245,7 +258,7 @@ static void unsubscribeFromAcceptedAndRejected(uint8_t index) {
 	indexSubList = findIndexOfSubscriptionList(TemporaryTopicNameAccepted);
 	if ((indexSubList >= 0)) {
 		if (!SubscriptionList[indexSubList].isSticky && (SubscriptionList[indexSubList].count == 1)) {
-			ret_val = pMqttClient->unsubscribe(TemporaryTopicNameAccepted);
+			ret_val = pMqttClient->unsubscribe(pMqttClient, TemporaryTopicNameAccepted);
 			if (ret_val == NONE_ERROR) {
 				SubscriptionList[indexSubList].isFree = true;
 			}
@@ -257,7 +270,7 @@ static void unsubscribeFromAcceptedAndRejected(uint8_t index) {
 	indexSubList = findIndexOfSubscriptionList(TemporaryTopicNameRejected);
 	if ((indexSubList >= 0)) {
 		if (!SubscriptionList[indexSubList].isSticky && (SubscriptionList[indexSubList].count == 1)) {
-			ret_val = pMqttClient->unsubscribe(TemporaryTopicNameRejected);
+			ret_val = pMqttClient->unsubscribe(pMqttClient, TemporaryTopicNameRejected);
 			if (ret_val == NONE_ERROR) {
 				SubscriptionList[indexSubList].isFree = true;
 			}
@@ -268,9 +281,14 @@ static void unsubscribeFromAcceptedAndRejected(uint8_t index) {
 }
 
 void initializeRecords(MQTTClient_t *pClient) {
-	uint8_t i;
-	for (i = 0; i < MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME; i++) {
-		AckWaitList[i].isFree = true;
+	uint16_t i;
+	aws_iot_timer_wheel_init(&AckTimeoutWheel, AWS_IOT_SHADOW_ACK_TIMER_TICK_MS);
+	memset(AckTimeouts, 0, sizeof(AckTimeouts));
+	ackWaitListFreeHead = ACK_WAIT_LIST_END;
+	for (i = MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME; i > 0; i--) {
+		AckWaitList[i - 1].isFree = true;
+		AckWaitList[i - 1].nextFree = ackWaitListFreeHead;
+		ackWaitListFreeHead = i - 1;
 	}
 	for (i = 0; i < MAX_TOPICS_AT_ANY_GIVEN_TIME; i++) {
 		SubscriptionList[i].isFree = true;
@@ -323,14 +341,14 @@ IoT_Error_t subscribeToShadowActionAcks(const char *pThingName, ShadowActions_t
 		subParams.mHandler = AckStatusCallback;
 		subParams.qos = QOS_0;
 		subParams.pTopic = SubscriptionList[indexAcceptedSubList].Topic;
-		ret_val = pMqttClient->subscribe(&subParams);
+		ret_val = pMqttClient->subscribe(pMqttClient, &subParams);
 		if (ret_val == NONE_ERROR) {
 			SubscriptionList[indexAcceptedSubList].count = 1;
 			SubscriptionList[indexAcceptedSubList].isSticky = isSticky;
 			topicNameFromThingAndAction(SubscriptionList[indexRejectedSubList].Topic, pThingName, action,
 					SHADOW_REJECTED);
 			subParams.pTopic = SubscriptionList[indexRejectedSubList].Topic;
-			ret_val = pMqttClient->subscribe(&subParams);
+			ret_val = pMqttClient->subscribe(pMqttClient, &subParams);
 			if (ret_val == NONE_ERROR) {
 				SubscriptionList[indexRejectedSubList].count = 1;
 				SubscriptionList[indexRejectedSubList].isSticky = isSticky;
@@ -353,7 +371,7 @@ IoT_Error_t subscribeToShadowActionAcks(const char *pThingName, ShadowActions_t
 			SubscriptionList[indexRejectedSubList].isFree = true;
 		}
 		if (SubscriptionList[indexAcceptedSubList].count == 1) {
-			pMqttClient->unsubscribe(SubscriptionList[indexAcceptedSubList].Topic);
+			pMqttClient->unsubscribe(pMqttClient, SubscriptionList[indexAcceptedSubList].Topic);
 		}
 	}
 
@@ -390,25 +408,37 @@ IoT_Error_t publishToShadowAction(const char * pThingName, ShadowActions_t actio
 	msgParams.PayloadLen = strlen(pJsonDocumentToBeSent) + 1;
 	msgParams.pPayload = (char *) pJsonDocumentToBeSent;
 	pubParams.MessageParams = msgParams;
-	ret_val = pMqttClient->publish(&pubParams);
+	ret_val = pMqttClient->publish(pMqttClient, &pubParams);
 
 	return ret_val;
 }
 
-bool getNextFreeIndexOfAckWaitList(uint8_t *pIndex) {
-	uint8_t i;
-	if (pIndex != NULL) {
-		for (i = 0; i < MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME; i++) {
-			if (AckWaitList[i].isFree) {
-				*pIndex = i;
-				return true;
-			}
-		}
+// the entry is taken off the free list right away: acks handled while the action subscribes
+// free other entries, which would otherwise take its place at the head
+bool getNextFreeIndexOfAckWaitList(uint16_t *pIndex) {
+	if (pIndex != NULL && ackWaitListFreeHead != ACK_WAIT_LIST_END) {
+		*pIndex = ackWaitListFreeHead;
+		ackWaitListFreeHead = AckWaitList[*pIndex].nextFree;
+		return true;
 	}
 	return false;
 }
 
-void addToAckWaitList(uint8_t indexAckWaitList, const char *pThingName, ShadowActions_t action,
+// gives back an index getNextFreeIndexOfAckWaitList returned, for an action that was not sent
+void releaseIndexOfAckWaitList(uint16_t index) {
+	AckWaitList[index].nextFree = ackWaitListFreeHead;
+	ackWaitListFreeHead = index;
+}
+
+static void freeAckWaitListEntry(uint16_t index) {
+	aws_iot_timer_wheel_cancel(&AckTimeoutWheel, &AckTimeouts[index]);
+	AckWaitList[index].isFree = true;
+	AckWaitList[index].nextFree = ackWaitListFreeHead;
+	ackWaitListFreeHead = index;
+}
+
+// indexAckWaitList is the one getNextFreeIndexOfAckWaitList returned
+void addToAckWaitList(uint16_t indexAckWaitList, const char *pThingName, ShadowActions_t action,
 		const char *pExtractedClientToken, fpActionCallback_t callback, void *pCallbackContext,
 		uint32_t timeout_seconds) {
 	AckWaitList[indexAckWaitList].callback = callback;
@@ -416,24 +446,24 @@ void addToAckWaitList(uint8_t indexAckWaitList, const char *pThingName, ShadowAc
 	strncpy(AckWaitList[indexAckWaitList].thingName, pThingName, MAX_SIZE_OF_THING_NAME);
 	AckWaitList[indexAckWaitList].pCallbackContext = pCallbackContext;
 	AckWaitList[indexAckWaitList].action = action;
-	InitTimer(&(AckWaitList[indexAckWaitList].timer));
-	countdown(&(AckWaitList[indexAckWaitList].timer), timeout_seconds);
+	aws_iot_timer_wheel_add(&AckTimeoutWheel, &AckTimeouts[indexAckWaitList], timeout_seconds * 1000);
 	AckWaitList[indexAckWaitList].isFree = false;
 }
 
+// only the requests whose timeout fired are visited, however many are waiting
 void HandleExpiredResponseCallbacks(void) {
-	uint8_t i;
-	for (i = 0; i < MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME; i++) {
-		if (!AckWaitList[i].isFree) {
-			if (expired(&(AckWaitList[i].timer))) {
-				if (AckWaitList[i].callback != NULL) {
-					AckWaitList[i].callback(AckWaitList[i].thingName, AckWaitList[i].action, SHADOW_ACK_TIMEOUT,
-							shadowRxBuf, AckWaitList[i].pCallbackContext);
-				}
-				AckWaitList[i].isFree = true;
-				unsubscribeFromAcceptedAndRejected(i);
-			}
+	TimerWheelEntry_t *pEntry;
+	uint16_t i;
+
+	aws_iot_timer_wheel_advance(&AckTimeoutWheel);
+	while (NULL != (pEntry = aws_iot_timer_wheel_next_expired(&AckTimeoutWheel))) {
+		i = (uint16_t) (pEntry - AckTimeouts);
+		if (AckWaitList[i].callback != NULL) {
+			AckWaitList[i].callback(AckWaitList[i].thingName, AckWaitList[i].action, SHADOW_ACK_TIMEOUT,
+					shadowRxBuf, AckWaitList[i].pCallbackContext);
 		}
+		unsubscribeFromAcceptedAndRejected(i);
+		freeAckWaitListEntry(i);
 	}
 }
 
@@ -34,10 +34,11 @@ IoT_Error_t subscribeToShadowActionAcks(const char *pThingName, ShadowActions_t
 void incrementSubscriptionCnt(const char *pThingName, ShadowActions_t action, bool isSticky);
 
 IoT_Error_t publishToShadowAction(const char * pThingName, ShadowActions_t action, const char *pJsonDocumentToBeSent);
-void addToAckWaitList(uint8_t indexAckWaitList, const char *pThingName, ShadowActions_t action,
+void addToAckWaitList(uint16_t indexAckWaitList, const char *pThingName, ShadowActions_t action,
 		const char *pExtractedClientToken, fpActionCallback_t callback, void *pCallbackContext,
 		uint32_t timeout_seconds);
-bool getNextFreeIndexOfAckWaitList(uint8_t *pIndex);
+bool getNextFreeIndexOfAckWaitList(uint16_t *pIndex);
+void releaseIndexOfAckWaitList(uint16_t index);
 void HandleExpiredResponseCallbacks(void);
 void initDeltaTokens(void);
 IoT_Error_t registerJsonTokenOnDelta(jsonStruct_t *pStruct);
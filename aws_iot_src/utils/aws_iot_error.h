@@ -28,6 +28,8 @@
  * Enumeration of return values from the IoT_* functions within the SDK.
  */
 typedef enum {
+	/** Return value of publish functions when the client was disconnected and the message went to the offline queue */
+	PUBLISH_QUEUED = 2,
 	/** Return value of yield function to indicate auto-reconnect was successful */
 	RECONNECT_SUCCESSFUL = 1,
 	/** Success return value - no error occurred. */
@@ -87,7 +89,27 @@ typedef enum {
 	/** The MQTT RX buffer received corrupt message  */
 	RX_MESSAGE_INVALID = -27,
 	/** The MQTT RX buffer received a bigger message. The message will be dropped  */
-	RX_MESSAGE_BIGGER_THAN_MQTT_RX_BUF = -28
+	RX_MESSAGE_BIGGER_THAN_MQTT_RX_BUF = -28,
+	/** Every slot of the publish window is waiting for an ack. Yield and retry the publish */
+	PUBLISH_WINDOW_FULL_ERROR = -29,
+	/** Every MQTT client instance is in use. Increase AWS_IOT_MQTT_MAX_CLIENT_INSTANCES */
+	MAX_CLIENT_INSTANCES_REACHED_ERROR = -30,
+	/** A mutex or condition variable could not be initialized */
+	MUTEX_INIT_ERROR = -31,
+	/** A mutex could not be locked or a condition variable could not be waited for */
+	MUTEX_LOCK_ERROR = -32,
+	/** A mutex could not be unlocked or a condition variable could not be signalled */
+	MUTEX_UNLOCK_ERROR = -33,
+	/** A mutex or condition variable could not be destroyed */
+	MUTEX_DESTROY_ERROR = -34,
+	/** The offline queue has no room for the message, see OfflineDropPolicy_t */
+	OFFLINE_QUEUE_FULL_ERROR = -35,
+	/** The storage of the offline queue could not be opened, mapped or synced */
+	OFFLINE_STORAGE_ERROR = -36,
+	/** A background thread could not be started */
+	THREAD_CREATE_ERROR = -37,
+	/** The endpoint's host name could not be resolved, or not in time */
+	HOST_RESOLVE_ERROR = -38
 }IoT_Error_t;
 
 #endif /* AWS_IOT_SDK_SRC_IOT_ERROR_H_ */
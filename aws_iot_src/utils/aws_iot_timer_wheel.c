@@ -0,0 +1,191 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file aws_iot_timer_wheel.c
+ * @brief Hierarchical timer wheel
+ */
+
+#include "aws_iot_timer_wheel.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/* left_ms reports an int, so the wheel's clock is restarted well before it runs out */
+#define TIMER_WHEEL_CLOCK_SPAN_MS (1u << 30)
+#define TIMER_WHEEL_CLOCK_RESTART_MS (TIMER_WHEEL_CLOCK_SPAN_MS / 2)
+
+/* The furthest ahead of currentTick that an entry can be placed */
+#define TIMER_WHEEL_MAX_DELTA ((1u << (TIMER_WHEEL_SLOT_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+static void pushEntry(TimerWheelEntry_t **ppHead, TimerWheelEntry_t *pEntry) {
+	pEntry->pNext = *ppHead;
+	if (NULL != pEntry->pNext) {
+		pEntry->pNext->ppPrev = &(pEntry->pNext);
+	}
+	pEntry->ppPrev = ppHead;
+	*ppHead = pEntry;
+}
+
+static void unlinkEntry(TimerWheelEntry_t *pEntry) {
+	*(pEntry->ppPrev) = pEntry->pNext;
+	if (NULL != pEntry->pNext) {
+		pEntry->pNext->ppPrev = pEntry->ppPrev;
+	}
+	pEntry->pNext = NULL;
+	pEntry->ppPrev = NULL;
+}
+
+static uint32_t readNowTick(TimerWheel_t *pWheel) {
+	uint32_t elapsedMs = TIMER_WHEEL_CLOCK_SPAN_MS - (uint32_t) left_ms(&(pWheel->clock));
+	uint32_t elapsedTicks = elapsedMs / pWheel->tickMs;
+
+	if (TIMER_WHEEL_CLOCK_RESTART_MS <= elapsedMs) {
+		/* keep the part of a tick that has passed already */
+		pWheel->clockBaseTick += elapsedTicks;
+		countdown_ms(&(pWheel->clock), TIMER_WHEEL_CLOCK_SPAN_MS - (elapsedMs - elapsedTicks * pWheel->tickMs));
+		elapsedTicks = 0;
+	}
+
+	return pWheel->clockBaseTick + elapsedTicks;
+}
+
+/* Puts an entry into the slot of the lowest level that reaches its expiry. An entry that is
+ * due at currentTick goes to the level 0 slot that is processed next */
+static void placeEntry(TimerWheel_t *pWheel, TimerWheelEntry_t *pEntry) {
+	uint32_t delta = pEntry->expiryTick - pWheel->currentTick;
+	uint32_t target;
+	uint32_t level = 0;
+
+	if ((int32_t) delta < 0) {
+		delta = 0;
+	} else if (TIMER_WHEEL_MAX_DELTA < delta) {
+		delta = TIMER_WHEEL_MAX_DELTA;
+	}
+	target = pWheel->currentTick + delta;
+
+	while (level + 1 < TIMER_WHEEL_LEVELS && (delta >> (TIMER_WHEEL_SLOT_BITS * (level + 1))) != 0) {
+		level++;
+	}
+
+	pushEntry(&(pWheel->slots[level][(target >> (TIMER_WHEEL_SLOT_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)]), pEntry);
+}
+
+/* Moves the entries of a slot one level down, now that the ticks it spans have come */
+static void cascadeSlot(TimerWheel_t *pWheel, uint32_t level) {
+	uint32_t slot = (pWheel->currentTick >> (TIMER_WHEEL_SLOT_BITS * level)) & (TIMER_WHEEL_SLOTS - 1);
+	TimerWheelEntry_t *pEntry = pWheel->slots[level][slot];
+	TimerWheelEntry_t *pNext;
+
+	pWheel->slots[level][slot] = NULL;
+	while (NULL != pEntry) {
+		pNext = pEntry->pNext;
+		placeEntry(pWheel, pEntry);
+		pEntry = pNext;
+	}
+}
+
+IoT_Error_t aws_iot_timer_wheel_init(TimerWheel_t *pWheel, uint32_t tickMs) {
+	if (NULL == pWheel || 0 == tickMs) {
+		return NULL_VALUE_ERROR;
+	}
+
+	memset(pWheel, 0, sizeof(TimerWheel_t));
+	pWheel->tickMs = tickMs;
+	InitTimer(&(pWheel->clock));
+	countdown_ms(&(pWheel->clock), TIMER_WHEEL_CLOCK_SPAN_MS);
+
+	return NONE_ERROR;
+}
+
+void aws_iot_timer_wheel_add(TimerWheel_t *pWheel, TimerWheelEntry_t *pEntry, uint32_t timeoutMs) {
+	uint32_t nowTick;
+	uint32_t ticks;
+
+	aws_iot_timer_wheel_cancel(pWheel, pEntry);
+
+	/* the wheel may not have caught up with the clock, the entry still fires after timeoutMs */
+	nowTick = readNowTick(pWheel);
+	if ((int32_t) (nowTick - pWheel->currentTick) < 0) {
+		nowTick = pWheel->currentTick;
+	}
+	/* plus one for the part of the current tick that has passed already */
+	ticks = (timeoutMs + pWheel->tickMs - 1) / pWheel->tickMs + 1;
+
+	pEntry->expiryTick = nowTick + ticks;
+	pEntry->isExpired = false;
+	placeEntry(pWheel, pEntry);
+	pWheel->scheduledCount++;
+}
+
+void aws_iot_timer_wheel_cancel(TimerWheel_t *pWheel, TimerWheelEntry_t *pEntry) {
+	if (NULL == pEntry->ppPrev) {
+		return;
+	}
+
+	unlinkEntry(pEntry);
+	if (!pEntry->isExpired) {
+		pWheel->scheduledCount--;
+	}
+	pEntry->isExpired = false;
+}
+
+void aws_iot_timer_wheel_advance(TimerWheel_t *pWheel) {
+	uint32_t nowTick = readNowTick(pWheel);
+	uint32_t slot;
+	uint32_t level;
+	TimerWheelEntry_t *pEntry;
+
+	while (pWheel->currentTick != nowTick) {
+		if (0 == pWheel->scheduledCount) {
+			/* nothing can fire on the way */
+			pWheel->currentTick = nowTick;
+			break;
+		}
+
+		pWheel->currentTick++;
+		slot = pWheel->currentTick & (TIMER_WHEEL_SLOTS - 1);
+
+		/* when a level wraps round, the next slot of the level above is due */
+		for (level = 1; level < TIMER_WHEEL_LEVELS
+				&& 0 == ((pWheel->currentTick >> (TIMER_WHEEL_SLOT_BITS * (level - 1))) & (TIMER_WHEEL_SLOTS - 1));
+				level++) {
+			cascadeSlot(pWheel, level);
+		}
+
+		while (NULL != (pEntry = pWheel->slots[0][slot])) {
+			unlinkEntry(pEntry);
+			if (pEntry->expiryTick != pWheel->currentTick) {
+				/* waited in the last level for longer than the wheel reaches */
+				placeEntry(pWheel, pEntry);
+				continue;
+			}
+			pEntry->isExpired = true;
+			pWheel->scheduledCount--;
+			pushEntry(&(pWheel->pExpired), pEntry);
+		}
+	}
+}
+
+TimerWheelEntry_t *aws_iot_timer_wheel_next_expired(TimerWheel_t *pWheel) {
+	TimerWheelEntry_t *pEntry = pWheel->pExpired;
+
+	if (NULL != pEntry) {
+		unlinkEntry(pEntry);
+		pEntry->isExpired = false;
+	}
+
+	return pEntry;
+}
@@ -0,0 +1,122 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file aws_iot_timer_wheel.h
+ * @brief Hierarchical timer wheel
+ *
+ * Schedules many timeouts against a single clock. Adding and cancelling a timeout take
+ * constant time, and advancing the wheel only touches the timeouts that fire plus, now and
+ * then, the ones moving to a finer level. The entries live in memory owned by the caller.
+ *
+ * The wheel has TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SLOTS slots. A slot of level 0
+ * spans one tick, a slot of each further level spans as many ticks as the whole level
+ * below it. A timeout further away than the wheel reaches waits in the last level and is
+ * placed again each time that slot comes round.
+ */
+
+#ifndef AWS_IOT_SDK_SRC_TIMER_WHEEL_H_
+#define AWS_IOT_SDK_SRC_TIMER_WHEEL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "aws_iot_error.h"
+#include "timer_interface.h"
+
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1u << TIMER_WHEEL_SLOT_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+/**
+ * @brief Timer Wheel Entry
+ *
+ * One scheduled timeout. Usually part of, or kept alongside, the record it times out.
+ * Must be zeroed before it is first scheduled.
+ */
+typedef struct TimerWheelEntry {
+	struct TimerWheelEntry *pNext;		///< Next entry in the same slot
+	struct TimerWheelEntry **ppPrev;	///< The pointer that points at this entry, NULL while it is not scheduled
+	uint32_t expiryTick;				///< Tick at which the timeout fires
+	bool isExpired;						///< The timeout fired and waits to be collected with aws_iot_timer_wheel_next_expired
+} TimerWheelEntry_t;
+
+/**
+ * @brief Timer Wheel
+ */
+typedef struct {
+	TimerWheelEntry_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];	///< Scheduled entries by level and slot
+	TimerWheelEntry_t *pExpired;	///< Entries that fired and have not been collected yet
+	uint32_t scheduledCount;		///< Number of entries in the slots
+	uint32_t currentTick;			///< Last tick the wheel has processed
+	uint32_t tickMs;				///< Length of a tick in milliseconds
+	Timer clock;					///< Counts down from TIMER_WHEEL_CLOCK_SPAN_MS, how far it got is the time since clockBaseTick
+	uint32_t clockBaseTick;			///< Tick at which clock was started
+} TimerWheel_t;
+
+/**
+ * @brief Initialize a timer wheel
+ *
+ * @param pWheel	timer wheel to initialize, any entries it held are forgotten
+ * @param tickMs	resolution of the wheel in milliseconds, timeouts are rounded up to it
+ *
+ * @return NONE_ERROR - success
+ * @return NULL_VALUE_ERROR - pWheel is NULL or tickMs is 0
+ */
+IoT_Error_t aws_iot_timer_wheel_init(TimerWheel_t *pWheel, uint32_t tickMs);
+
+/**
+ * @brief Schedule a timeout
+ *
+ * An entry that is scheduled already is moved to the new time.
+ *
+ * @param pWheel	timer wheel
+ * @param pEntry	entry to schedule
+ * @param timeoutMs	the entry fires once this many milliseconds have passed
+ */
+void aws_iot_timer_wheel_add(TimerWheel_t *pWheel, TimerWheelEntry_t *pEntry, uint32_t timeoutMs);
+
+/**
+ * @brief Cancel a timeout
+ *
+ * Does nothing if the entry is not scheduled. An entry that fired but was not collected yet
+ * is cancelled as well.
+ *
+ * @param pWheel	timer wheel
+ * @param pEntry	entry to cancel
+ */
+void aws_iot_timer_wheel_cancel(TimerWheel_t *pWheel, TimerWheelEntry_t *pEntry);
+
+/**
+ * @brief Fire the timeouts that are due
+ *
+ * Reads the clock once and moves every entry whose time has come to the expired entries.
+ * Should be called at least every few days, longer gaps are counted as a few days.
+ *
+ * @param pWheel	timer wheel
+ */
+void aws_iot_timer_wheel_advance(TimerWheel_t *pWheel);
+
+/**
+ * @brief Collect a fired timeout
+ *
+ * @param pWheel	timer wheel
+ *
+ * @return an entry that fired in aws_iot_timer_wheel_advance, which is no longer scheduled,
+ * or NULL if there are none
+ */
+TimerWheelEntry_t *aws_iot_timer_wheel_next_expired(TimerWheel_t *pWheel);
+
+#endif /* AWS_IOT_SDK_SRC_TIMER_WHEEL_H_ */
@@ -15,9 +15,147 @@
  *******************************************************************************/
 
 #include "MQTTClient.h"
+#include "aws_iot_error.h"
 #include <string.h>
 
 static void MQTTForceDisconnect(Client *c);
+static void abortInflightPublishes(Client *c, MQTTReturnCode rc);
+static void resetRxRing(Client *c);
+static void resetInboundQos2(Client *c);
+static MQTTReturnCode connectClient(Client *c, MQTTPacket_connectData *options);
+static MQTTReturnCode disconnectClient(Client *c);
+static MQTTReturnCode resubscribe(Client *c);
+static MQTTReturnCode drainOfflineQueue(Client *c);
+
+/* With _ENABLE_THREAD_SUPPORT_ one thread can sit in MQTTYield while others publish,
+ * subscribe and unsubscribe. The receive side (readbuf, the receive ring, reading the
+ * network) belongs to the holder of rxLock, the transmit side (c->buf, writing the network)
+ * to the holder of txLock, and what both sides share (in-flight publishes, subscriptions,
+ * the pending SUBACK/UNSUBACK and packet ids) to the holder of stateLock. Locks are taken
+ * in that order and none of them is held while a network read waits for data, except rxLock.
+ * Without thread support the helpers below do nothing */
+static void lockTx(Client *c) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+    aws_iot_thread_mutex_lock(&(c->txLock));
+#endif
+}
+
+static void unlockTx(Client *c) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+    aws_iot_thread_mutex_unlock(&(c->txLock));
+#endif
+}
+
+static void lockState(Client *c) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+    aws_iot_thread_mutex_lock(&(c->stateLock));
+#endif
+}
+
+static void unlockState(Client *c) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+    aws_iot_thread_mutex_unlock(&(c->stateLock));
+#endif
+}
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+/* Called with stateLock and the freshly taken rxLock held */
+static void setRxLockOwner(Client *c) {
+    aws_iot_thread_id_get(&(c->rxLockOwner));
+    c->isRxLockOwned = 1;
+}
+
+/* Called with stateLock held. Message handlers run on the thread holding rxLock, so this
+ * tells whether a wait for an ack comes from one of them */
+static uint8_t isRxLockOwnedByCaller(Client *c) {
+    return (c->isRxLockOwned && aws_iot_thread_id_is_current(&(c->rxLockOwner))) ? 1 : 0;
+}
+#endif
+
+/* Whether the calling thread holds rxLock, as the one running a message handler does */
+static uint8_t isRxLockHeldByCaller(Client *c) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+    uint8_t isHeld;
+
+    lockState(c);
+    isHeld = isRxLockOwnedByCaller(c);
+    unlockState(c);
+
+    return isHeld;
+#else
+    return 0;
+#endif
+}
+
+static void lockRx(Client *c) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+    aws_iot_thread_mutex_lock(&(c->rxLock));
+    lockState(c);
+    setRxLockOwner(c);
+    unlockState(c);
+    /* Another thread may have been reading for a while */
+    TimerRefreshNow();
+#endif
+}
+
+/* Only takes rxLock if no other thread is reading from the network */
+static uint8_t tryLockRx(Client *c) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+    if(NONE_ERROR != aws_iot_thread_mutex_trylock(&(c->rxLock))) {
+        return 0;
+    }
+    lockState(c);
+    setRxLockOwner(c);
+    unlockState(c);
+#endif
+    return 1;
+}
+
+/* Called with stateLock held, wakes every thread waiting for an ack */
+static void signalStateChanged(Client *c) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+    aws_iot_thread_cond_broadcast(&(c->stateChanged));
+#endif
+}
+
+/* Waiting threads may have to take over reading from the network */
+static void unlockRx(Client *c) {
+#ifdef _ENABLE_THREAD_SUPPORT_
+    lockState(c);
+    c->isRxLockOwned = 0;
+    aws_iot_thread_mutex_unlock(&(c->rxLock));
+    signalStateChanged(c);
+    unlockState(c);
+#endif
+}
+
+/* The API calls that run often cache the time for their duration, see TimerCacheNow. They
+ * may be called from a callback of another one, which leaves the cache to the outer call */
+static uint8_t startTimeCache(void) {
+    uint8_t isTimeCached = (uint8_t)TimerIsNowCached();
+    TimerCacheNow();
+    return isTimeCached;
+}
+
+static void stopTimeCache(uint8_t isTimeCached) {
+    if(!isTimeCached) {
+        TimerClearNow();
+    }
+}
+
+/* Callbacks see the real time, an application waiting for a timer in one would otherwise
+ * wait forever */
+static uint8_t suspendTimeCache(void) {
+    uint8_t isTimeCached = (uint8_t)TimerIsNowCached();
+    TimerClearNow();
+    return isTimeCached;
+}
+
+static void resumeTimeCache(uint8_t isTimeCached) {
+    if(isTimeCached) {
+        TimerCacheNow();
+    }
+}
 
 void NewMessageData(MessageData *md, MQTTString *aTopicName, MQTTMessage *aMessage, pApplicationHandler_t applicationHandler) {
     md->topicName = aTopicName;
@@ -25,38 +163,387 @@ void NewMessageData(MessageData *md, MQTTString *aTopicName, MQTTMessage *aMessa
     md->applicationHandler = applicationHandler;
 }
 
+typedef struct {
+    uint8_t isComplete;
+    MQTTReturnCode rc;
+} BlockingPublishResult;
+
+/* Called with stateLock held */
 uint16_t getNextPacketId(Client *c) {
     return c->nextPacketId = (uint16_t)((MAX_PACKET_ID == c->nextPacketId) ? 1 : (c->nextPacketId + 1));
 }
 
-MQTTReturnCode sendPacket(Client *c, uint32_t length, Timer *timer) {
+/* Returns NULL if the publish window is full. The slot of an in-flight publish is
+ * its packet id modulo MAX_INFLIGHT_PUBLISHES, so ids whose slot is still busy are skipped.
+ * Called with stateLock held, the ack timer starts right away */
+static struct InflightPublishes *allocInflightPublish(Client *c) {
+    uint32_t itr;
+    uint16_t packetId;
+    struct InflightPublishes *pEntry;
+
+    if(c->inflightPublishCount >= c->publishWindowSize) {
+        return NULL;
+    }
+
+    for(itr = 0; itr < MAX_INFLIGHT_PUBLISHES; itr++) {
+        packetId = getNextPacketId(c);
+        pEntry = &(c->inflightPublishes[packetId % MAX_INFLIGHT_PUBLISHES]);
+        if(pEntry->isFree) {
+            pEntry->packetId = packetId;
+            pEntry->isFree = 0;
+            pEntry->isPubrecReceived = 0;
+            pEntry->isBlocking = 0;
+            InitTimer(&(pEntry->ackTimer));
+            countdown_ms(&(pEntry->ackTimer), c->commandTimeoutMs);
+            c->inflightPublishCount++;
+            return pEntry;
+        }
+    }
+
+    return NULL;
+}
+
+static struct InflightPublishes *findInflightPublish(Client *c, uint16_t packetId) {
+    struct InflightPublishes *pEntry = &(c->inflightPublishes[packetId % MAX_INFLIGHT_PUBLISHES]);
+
+    if(pEntry->isFree || pEntry->packetId != packetId) {
+        return NULL;
+    }
+
+    return pEntry;
+}
+
+static void releaseInflightPublish(Client *c, struct InflightPublishes *pEntry) {
+    pEntry->isFree = 1;
+    c->inflightPublishCount--;
+}
+
+/* Called with stateLock held. The slot is released before the callback runs, and stateLock
+ * is dropped around the callback, so the callback can publish again. The result of a
+ * blocking publish is stored in the same step as the slot is released */
+static void completeInflightPublish(Client *c, struct InflightPublishes *pEntry, MQTTReturnCode rc) {
+    PublishCompleteData pcd;
+    BlockingPublishResult *pResult;
+    void (*fp) (PublishCompleteData *) = pEntry->fp;
+    uint8_t isTimeCached;
+
+    pcd.packetId = pEntry->packetId;
+    pcd.rc = rc;
+    pcd.applicationHandler = pEntry->applicationHandler;
+    pcd.pApplicationContext = pEntry->pApplicationContext;
+
+    releaseInflightPublish(c, pEntry);
+
+    if(pEntry->isBlocking) {
+        pResult = (BlockingPublishResult *)pcd.pApplicationContext;
+        pResult->rc = rc;
+        pResult->isComplete = 1;
+    }
+    signalStateChanged(c);
+
+    if(NULL != fp) {
+        unlockState(c);
+        isTimeCached = suspendTimeCache();
+        fp(&pcd);
+        resumeTimeCache(isTimeCached);
+        lockState(c);
+    }
+}
+
+static void expireInflightPublishes(Client *c) {
+    uint32_t itr;
+
+    lockState(c);
+    for(itr = 0; itr < MAX_INFLIGHT_PUBLISHES && 0 < c->inflightPublishCount; itr++) {
+        if(!c->inflightPublishes[itr].isFree && expired(&(c->inflightPublishes[itr].ackTimer))) {
+            completeInflightPublish(c, &(c->inflightPublishes[itr]), MQTT_REQUEST_TIMEOUT_ERROR);
+        }
+    }
+    unlockState(c);
+}
+
+static void abortInflightPublishes(Client *c, MQTTReturnCode rc) {
+    uint32_t itr;
+
+    lockState(c);
+    for(itr = 0; itr < MAX_INFLIGHT_PUBLISHES && 0 < c->inflightPublishCount; itr++) {
+        if(!c->inflightPublishes[itr].isFree) {
+            completeInflightPublish(c, &(c->inflightPublishes[itr]), rc);
+        }
+    }
+    /* A SUBSCRIBE or UNSUBSCRIBE waiting for its ack gives up as well */
+    signalStateChanged(c);
+    unlockState(c);
+}
+
+/* The slot of packetId in the set of pending inbound QoS2 packet ids, or the unused slot
+ * where it would go. The set is never full, so the probe always ends */
+static uint32_t findInboundQos2Slot(Client *c, uint16_t packetId) {
+    uint32_t slot = packetId % INBOUND_QOS2_TABLE_LEN;
+
+    while(0 != c->inboundQos2Ids[slot] && packetId != c->inboundQos2Ids[slot]) {
+        slot = (slot + 1) % INBOUND_QOS2_TABLE_LEN;
+    }
+
+    return slot;
+}
+
+static void resetInboundQos2(Client *c) {
+    memset(c->inboundQos2Ids, 0, sizeof(c->inboundQos2Ids));
+    c->inboundQos2Count = 0;
+}
+
+static uint8_t isInboundQos2Pending(Client *c, uint16_t packetId) {
+    return (0 != packetId && packetId == c->inboundQos2Ids[findInboundQos2Slot(c, packetId)]) ? 1 : 0;
+}
+
+/* Remembers a QoS2 publish that was passed on until its PUBREL arrives. Without room the
+ * publish is not remembered, so a redelivery of it would be passed on again */
+static void addInboundQos2(Client *c, uint16_t packetId) {
+    uint32_t slot;
+
+    if(0 == packetId || MAX_INBOUND_QOS2 <= c->inboundQos2Count) {
+        return;
+    }
+
+    slot = findInboundQos2Slot(c, packetId);
+    if(0 == c->inboundQos2Ids[slot]) {
+        c->inboundQos2Ids[slot] = packetId;
+        c->inboundQos2Count++;
+    }
+}
+
+static void releaseInboundQos2(Client *c, uint16_t packetId) {
+    uint32_t hole;
+    uint32_t slot;
+    uint32_t home;
+
+    if(0 == packetId) {
+        return;
+    }
+
+    hole = findInboundQos2Slot(c, packetId);
+    if(packetId != c->inboundQos2Ids[hole]) {
+        return;
+    }
+    c->inboundQos2Ids[hole] = 0;
+    c->inboundQos2Count--;
+
+    /* Move ids that were probed past the hole back into it, so that no probe stops short of them */
+    for(slot = (hole + 1) % INBOUND_QOS2_TABLE_LEN; 0 != c->inboundQos2Ids[slot];
+        slot = (slot + 1) % INBOUND_QOS2_TABLE_LEN) {
+        home = c->inboundQos2Ids[slot] % INBOUND_QOS2_TABLE_LEN;
+        if((slot + INBOUND_QOS2_TABLE_LEN - home) % INBOUND_QOS2_TABLE_LEN
+           >= (slot + INBOUND_QOS2_TABLE_LEN - hole) % INBOUND_QOS2_TABLE_LEN) {
+            c->inboundQos2Ids[hole] = c->inboundQos2Ids[slot];
+            c->inboundQos2Ids[slot] = 0;
+            hole = slot;
+        }
+    }
+}
+
+/* Stops all further writes after one left a packet incomplete, called with txLock held.
+ * The broker would take whatever is written next for the rest of that packet. The
+ * connection is taken down under rxLock, see handleTxFailure */
+static void markTxFailed(Client *c) {
+    lockState(c);
+    c->isTxFailed = 1;
+    unlockState(c);
+}
+
+/* Writes the segments in order. The network's vectored write is used when there is more
+ * than one segment so that, for example, a publish payload is sent straight from the
+ * caller's memory without being copied behind its header first. A write that fails
+ * before any byte went out leaves the connection usable */
+static MQTTReturnCode writeSegments(Client *c, NetworkIoVec *iov, int iovcnt, Timer *timer) {
     int32_t sentLen = 0;
     uint32_t sent = 0;
+    uint32_t totalLen = 0;
+    uint32_t totalSent = 0;
+    int i;
 
-    if(NULL == c || NULL == timer) {
-        return MQTT_NULL_VALUE_ERROR;
+    if(c->isTxFailed) {
+        /* The broker would take these bytes for the rest of an incomplete packet */
+        return FAILURE;
     }
 
-    if(length >= c->bufSize) {
-    	return MQTTPACKET_BUFFER_TOO_SHORT;
+    for(i = 0; i < iovcnt; i++) {
+        totalLen += (uint32_t)iov[i].len;
     }
 
-    while(sent < length && !expired(timer)) {
-        sentLen = c->networkStack.mqttwrite(&(c->networkStack), &c->buf[sent], (int)length, left_ms(timer));
-        if(sentLen < 0) {
-            /* there was an error writing the data */
-            break;
+    if(1 < iovcnt && NULL != c->networkStack.mqttwritev) {
+        sentLen = c->networkStack.mqttwritev(&(c->networkStack), iov, iovcnt, left_ms(timer));
+        TimerRefreshNow();
+        if((int32_t)totalLen != sentLen) {
+            /* An error does not tell how much of the vector the network took */
+            if(0 != sentLen) {
+                markTxFailed(c);
+            }
+            return FAILURE;
+        }
+        countdown(&(c->txIdleTimer), c->currentKeepAliveInterval);
+        return SUCCESS;
+    }
+
+    for(i = 0; i < iovcnt; i++) {
+        sent = 0;
+        while(sent < (uint32_t)iov[i].len && !expired(timer)) {
+            sentLen = c->networkStack.mqttwrite(&(c->networkStack), iov[i].pData + sent,
+                                                iov[i].len - (int)sent, left_ms(timer));
+            if(sentLen < 0) {
+                /* there was an error writing the data, possibly after part of it went out */
+                markTxFailed(c);
+                break;
+            }
+            sent = sent + (uint32_t)sentLen;
+            totalSent = totalSent + (uint32_t)sentLen;
+            if(sent < (uint32_t)iov[i].len) {
+                /* A short write waited for the timeout, which the loop has to see */
+                TimerRefreshNow();
+            }
+        }
+
+        if(sent != (uint32_t)iov[i].len) {
+            TimerRefreshNow();
+            if(0 < totalSent) {
+                markTxFailed(c);
+            }
+            return FAILURE;
         }
-        sent = sent + (uint32_t)sentLen;
     }
+    TimerRefreshNow();
+
+    /* record the fact that we have successfully sent the packet */
+    countdown(&(c->txIdleTimer), c->currentKeepAliveInterval);
+    return SUCCESS;
+}
+
+/* Writes the staged packets, called with txLock held. They are dropped if the write fails,
+ * acks and publishes reported as sent among them, so the connection is marked failed and
+ * the loss shows as a disconnect */
+static MQTTReturnCode flushTxStage(Client *c, Timer *timer) {
+    NetworkIoVec iov;
+    MQTTReturnCode rc;
 
-    if(sent == length) {
-        /* record the fact that we have successfully sent the packet */
-        //countdown(&c->pingTimer, c->keepAliveInterval);
+    if(0 == c->txStageUsed) {
         return SUCCESS;
     }
 
-    return FAILURE;
+    iov.pData = c->txStage;
+    iov.len = (int)c->txStageUsed;
+    c->txStageUsed = 0;
+    c->isTxFlushTimerRunning = 0;
+
+    rc = writeSegments(c, &iov, 1, timer);
+    if(SUCCESS != rc) {
+        markTxFailed(c);
+    }
+
+    return rc;
+}
+
+/* Writes the segments in order as one packet, behind whatever is staged. The staged packets
+ * and the first segment share one write if the segment fits behind them in the stage */
+static MQTTReturnCode sendPacketv(Client *c, NetworkIoVec *iov, int iovcnt, Timer *timer) {
+    NetworkIoVec first;
+    MQTTReturnCode rc;
+
+    if(0 == c->txStageUsed) {
+        return writeSegments(c, iov, iovcnt, timer);
+    }
+
+    if((uint32_t)iov[0].len > TX_STAGE_LEN - c->txStageUsed) {
+        rc = flushTxStage(c, timer);
+        if(SUCCESS != rc) {
+            return rc;
+        }
+        return writeSegments(c, iov, iovcnt, timer);
+    }
+
+    first = iov[0];
+    memcpy(c->txStage + c->txStageUsed, first.pData, (size_t)first.len);
+    iov[0].pData = c->txStage;
+    iov[0].len = (int)c->txStageUsed + first.len;
+    c->txStageUsed = 0;
+    c->isTxFlushTimerRunning = 0;
+
+    rc = writeSegments(c, iov, iovcnt, timer);
+    if(SUCCESS != rc) {
+        /* The staged packets are lost with it, see flushTxStage */
+        markTxFailed(c);
+    }
+    iov[0] = first;
+
+    return rc;
+}
+
+/* Sends a packet that can wait for others to share its write, called with txLock held. It is
+ * copied to the stage if there is room, otherwise written right away behind what is staged.
+ * Staged packets go out before the client next waits for the network, with the next packet
+ * that cannot wait or, if delayMs is not 0, once delayMs has passed */
+static MQTTReturnCode stagePacketv(Client *c, NetworkIoVec *iov, int iovcnt, uint32_t delayMs, Timer *timer) {
+    uint32_t totalLen = 0;
+    int i;
+
+    for(i = 0; i < iovcnt; i++) {
+        totalLen += (uint32_t)iov[i].len;
+    }
+
+    if(totalLen > TX_STAGE_LEN - c->txStageUsed) {
+        return sendPacketv(c, iov, iovcnt, timer);
+    }
+
+    for(i = 0; i < iovcnt; i++) {
+        memcpy(c->txStage + c->txStageUsed, iov[i].pData, (size_t)iov[i].len);
+        c->txStageUsed += (uint32_t)iov[i].len;
+    }
+
+    if(0 < delayMs && (!c->isTxFlushTimerRunning || (uint32_t)left_ms(&(c->txFlushTimer)) > delayMs)) {
+        countdown_ms(&(c->txFlushTimer), delayMs);
+        c->isTxFlushTimerRunning = 1;
+    }
+
+    return SUCCESS;
+}
+
+static MQTTReturnCode stagePacket(Client *c, uint32_t length, Timer *timer) {
+    NetworkIoVec iov;
+
+    iov.pData = c->buf;
+    iov.len = (int)length;
+    return stagePacketv(c, &iov, 1, 0, timer);
+}
+
+/* Writes whatever is staged before the client waits for the network or hands control back */
+static MQTTReturnCode flushTx(Client *c) {
+    Timer timer;
+    MQTTReturnCode rc = SUCCESS;
+
+    lockTx(c);
+    if(0 < c->txStageUsed) {
+        InitTimer(&timer);
+        countdown_ms(&timer, c->commandTimeoutMs);
+        rc = flushTxStage(c, &timer);
+    }
+    unlockTx(c);
+
+    return rc;
+}
+
+MQTTReturnCode sendPacket(Client *c, uint32_t length, Timer *timer) {
+    NetworkIoVec iov;
+
+    if(NULL == c || NULL == timer) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    if(length >= c->bufSize) {
+    	return MQTTPACKET_BUFFER_TOO_SHORT;
+    }
+
+    iov.pData = c->buf;
+    iov.len = (int)length;
+    return sendPacketv(c, &iov, 1, timer);
 }
 
 void copyMQTTConnectData(MQTTPacket_connectData *destination, MQTTPacket_connectData *source) {
@@ -78,23 +565,58 @@ void copyMQTTConnectData(MQTTPacket_connectData *destination, MQTTPacket_connect
 
 MQTTReturnCode MQTTClient(Client *c, uint32_t commandTimeoutMs,
                           unsigned char *buf, size_t bufSize, unsigned char *readbuf,
-                          size_t readBufSize, uint8_t enableAutoReconnect,
-                          networkInitHandler_t networkInitHandler,
+                          size_t readBufSize, MQTTSubscriptionPool *pSubscriptionPool,
+                          uint8_t enableAutoReconnect, networkInitHandler_t networkInitHandler,
                           TLSConnectParams *tlsConnectParams) {
     uint32_t i;
+    MQTTReturnCode rc;
+    MQTTReconnectPolicyConfig reconnectConfig;
     MQTTPacket_connectData default_options = MQTTPacket_connectData_initializer;
 
     if(NULL == c || NULL == tlsConnectParams || NULL == buf || NULL == readbuf
-       || NULL == networkInitHandler) {
+       || NULL == networkInitHandler || NULL == pSubscriptionPool
+       || NULL == pSubscriptionPool->pHandlers || NULL == pSubscriptionPool->pTrieNodes) {
         return MQTT_NULL_VALUE_ERROR;
     }
 
-    for(i = 0; i < MAX_MESSAGE_HANDLERS; ++i) {
+    if(0 == pSubscriptionPool->handlerCount || MAX_MESSAGE_HANDLERS < pSubscriptionPool->handlerCount) {
+        return FAILURE;
+    }
+
+    rc = MQTTTopicTrie_init(&(c->subscriptionTrie), pSubscriptionPool->pTrieNodes,
+                            pSubscriptionPool->trieNodeCount);
+    if(SUCCESS != rc) {
+        return rc;
+    }
+
+    c->messageHandlers = pSubscriptionPool->pHandlers;
+    c->messageHandlerCount = pSubscriptionPool->handlerCount;
+    for(i = 0; i < c->messageHandlerCount; ++i) {
         c->messageHandlers[i].topicFilter = NULL;
         c->messageHandlers[i].fp = NULL;
         c->messageHandlers[i].applicationHandler = NULL;
         c->messageHandlers[i].qos = 0;
-    }
+        c->messageHandlers[i].nextFree = (uint16_t)(i + 1);
+    }
+    c->messageHandlers[c->messageHandlerCount - 1].nextFree = MQTT_TOPIC_TRIE_NIL;
+    c->freeMessageHandlerHead = 0;
+
+    for(i = 0; i < MAX_INFLIGHT_PUBLISHES; ++i) {
+        c->inflightPublishes[i].isFree = 1;
+        c->inflightPublishes[i].fp = NULL;
+        c->inflightPublishes[i].applicationHandler = NULL;
+        c->inflightPublishes[i].pApplicationContext = NULL;
+    }
+    c->inflightPublishCount = 0;
+    c->publishWindowSize = MAX_INFLIGHT_PUBLISHES;
+    c->pendingAck.packetType = 0;
+    resetRxRing(c);
+    resetInboundQos2(c);
+    c->txStageUsed = 0;
+    c->txFlushDelayMs = 0;
+    c->isTxFlushTimerRunning = 0;
+    c->isTxFailed = 0;
+    InitTimer(&(c->txFlushTimer));
 
     c->commandTimeoutMs = commandTimeoutMs;
     c->buf = buf;
@@ -108,6 +630,11 @@ MQTTReturnCode MQTTClient(Client *c, uint32_t commandTimeoutMs,
     c->isAutoReconnectEnabled = enableAutoReconnect;
     c->defaultMessageHandler = NULL;
     c->disconnectHandler = NULL;
+    c->messageChunkHandler = NULL;
+    c->messageChunkApplicationHandler = NULL;
+    c->isOfflineQueueEnabled = 0;
+    c->offlineCompleteHandler = NULL;
+    c->offlineApplicationHandler = NULL;
     copyMQTTConnectData(&(c->options), &default_options);
 
     c->networkInitHandler = networkInitHandler;
@@ -118,20 +645,201 @@ MQTTReturnCode MQTTClient(Client *c, uint32_t commandTimeoutMs,
     c->tlsConnectParams.pRootCALocation = tlsConnectParams->pRootCALocation;
     c->tlsConnectParams.timeout_ms = tlsConnectParams->timeout_ms;
     c->tlsConnectParams.ServerVerificationFlag = tlsConnectParams->ServerVerificationFlag;
-
+    c->tlsConnectParams.pRootCADer = tlsConnectParams->pRootCADer;
+    c->tlsConnectParams.RootCADerLen = tlsConnectParams->RootCADerLen;
+    c->tlsConnectParams.pDeviceCertDer = tlsConnectParams->pDeviceCertDer;
+    c->tlsConnectParams.DeviceCertDerLen = tlsConnectParams->DeviceCertDerLen;
+    c->tlsConnectParams.pDevicePrivateKeyDer = tlsConnectParams->pDevicePrivateKeyDer;
+    c->tlsConnectParams.DevicePrivateKeyDerLen = tlsConnectParams->DevicePrivateKeyDerLen;
+
+    c->minKeepAliveInterval = 0;
+    c->currentKeepAliveInterval = 0;
     InitTimer(&(c->pingTimer));
+    InitTimer(&(c->txIdleTimer));
+    InitTimer(&(c->rxIdleTimer));
     InitTimer(&(c->reconnectDelayTimer));
+    MQTTReconnectPolicy_legacyConfig(&reconnectConfig, MIN_RECONNECT_WAIT_INTERVAL, MAX_RECONNECT_WAIT_INTERVAL);
+    MQTTReconnectPolicy_init(&(c->reconnectPolicy), &reconnectConfig);
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+    if(NONE_ERROR != aws_iot_thread_mutex_init(&(c->txLock))
+       || NONE_ERROR != aws_iot_thread_mutex_init(&(c->rxLock))
+       || NONE_ERROR != aws_iot_thread_mutex_init(&(c->stateLock))
+       || NONE_ERROR != aws_iot_thread_cond_init(&(c->stateChanged))) {
+        return FAILURE;
+    }
+    c->isRxLockOwned = 0;
+#endif
+
+    return SUCCESS;
+}
+
+/* Releases what MQTTClient set up. No other thread may be using the client */
+void MQTTClientFree(Client *c) {
+    if(NULL == c) {
+        return;
+    }
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+    aws_iot_thread_cond_destroy(&(c->stateChanged));
+    aws_iot_thread_mutex_destroy(&(c->stateLock));
+    aws_iot_thread_mutex_destroy(&(c->rxLock));
+    aws_iot_thread_mutex_destroy(&(c->txLock));
+#endif
+}
+
+static void resetRxRing(Client *c) {
+    c->rxRingStart = 0;
+    c->rxRingUsed = 0;
+    c->rxDiscardLen = 0;
+    c->rxStreamLeft = 0;
+    c->isRxFailed = 0;
+}
+
+/* Pulls more bytes from the network into the free space after the last buffered byte.
+ * With mqttreadsome this is a single read of whatever the TLS layer has available,
+ * otherwise exactly the number of bytes the parser still needs is requested */
+static uint32_t fillRxRing(Client *c, uint32_t wanted, Timer *timer) {
+    uint32_t tail;
+    uint32_t space;
+    int32_t ret_val;
+
+    if(0 == c->rxRingUsed) {
+        c->rxRingStart = 0;
+    }
+
+    tail = (c->rxRingStart + c->rxRingUsed) % RX_RING_LEN;
+    if(c->rxRingUsed == RX_RING_LEN) {
+        return 0;
+    } else if(tail >= c->rxRingStart) {
+        space = RX_RING_LEN - tail;
+    } else {
+        space = c->rxRingStart - tail;
+    }
+
+    /* The packets staged while handling what was read so far must not wait for the read */
+    flushTx(c);
+
+    if(NULL != c->networkStack.mqttreadsome) {
+        ret_val = c->networkStack.mqttreadsome(&(c->networkStack), c->rxRing + tail, (int)space, left_ms(timer));
+    } else {
+        ret_val = c->networkStack.mqttread(&(c->networkStack), c->rxRing + tail,
+                                           (int)(wanted < space ? wanted : space), left_ms(timer));
+    }
+
+    if(0 >= ret_val) {
+        /* The read waited out the timeout. Callers retry until it expires, so it must show */
+        TimerRefreshNow();
+        /* Only mqttreadsome tells a quiet connection from a broken one */
+        c->isRxFailed = (NULL != c->networkStack.mqttreadsome && SSL_READ_TIMEOUT_ERROR != ret_val) ? 1 : 0;
+        return 0;
+    }
+
+    c->isRxFailed = 0;
+    c->rxRingUsed += (uint32_t)ret_val;
+    return (uint32_t)ret_val;
+}
+
+static unsigned char peekRxRing(Client *c, uint32_t offset) {
+    return c->rxRing[(c->rxRingStart + offset) % RX_RING_LEN];
+}
+
+static void consumeRxRing(Client *c, unsigned char *dest, uint32_t len) {
+    uint32_t firstPart = RX_RING_LEN - c->rxRingStart;
+
+    if(NULL != dest) {
+        if(len <= firstPart) {
+            memcpy(dest, c->rxRing + c->rxRingStart, len);
+        } else {
+            memcpy(dest, c->rxRing + c->rxRingStart, firstPart);
+            memcpy(dest + firstPart, c->rxRing, len - firstPart);
+        }
+    }
+
+    c->rxRingStart = (c->rxRingStart + len) % RX_RING_LEN;
+    c->rxRingUsed -= len;
+}
+
+/* Skips an oversized packet as its bytes arrive. Returns MQTTPACKET_BUFFER_TOO_SHORT once
+ * the whole packet has been dropped, MQTT_NOTHING_TO_READ while part of it is still pending */
+static MQTTReturnCode discardRxPacket(Client *c, Timer *timer) {
+    uint32_t discard_len;
+
+    while(0 < c->rxDiscardLen) {
+        if(0 == c->rxRingUsed && 0 == fillRxRing(c, c->rxDiscardLen, timer)) {
+            return MQTT_NOTHING_TO_READ;
+        }
+        discard_len = (c->rxRingUsed < c->rxDiscardLen) ? c->rxRingUsed : c->rxDiscardLen;
+        consumeRxRing(c, NULL, discard_len);
+        c->rxDiscardLen -= discard_len;
+    }
+
+    return MQTTPACKET_BUFFER_TOO_SHORT;
+}
+
+/* Starts passing the payload of a PUBLISH that does not fit the read buffer on to the message
+ * chunk handler. The fixed header, topic name and packet id are moved to the read buffer first.
+ * Returns MQTT_NOTHING_TO_READ with *pWanted set while that header has not fully arrived, and
+ * MQTTPACKET_BUFFER_TOO_SHORT if the header itself is too large to stream */
+static MQTTReturnCode beginRxStream(Client *c, uint32_t lenBytes, uint32_t totalLen, uint32_t *pWanted) {
+    MQTTHeader header = {0};
+    uint32_t headerLen = 1 + lenBytes + 2;
+    uint32_t topicLen;
+    unsigned char *curdata;
+
+    if(c->rxRingUsed < headerLen) {
+        *pWanted = headerLen - c->rxRingUsed;
+        return MQTT_NOTHING_TO_READ;
+    }
+
+    header.byte = peekRxRing(c, 0);
+    topicLen = ((uint32_t)peekRxRing(c, 1 + lenBytes) << 8) | peekRxRing(c, 2 + lenBytes);
+    headerLen += topicLen + ((0 < header.bits.qos) ? 2 : 0);
+    if(headerLen >= totalLen || headerLen > c->readBufSize || headerLen > RX_RING_LEN) {
+        return MQTTPACKET_BUFFER_TOO_SHORT;
+    }
+
+    if(c->rxRingUsed < headerLen) {
+        *pWanted = headerLen - c->rxRingUsed;
+        return MQTT_NOTHING_TO_READ;
+    }
+
+    consumeRxRing(c, c->readbuf, headerLen);
+    curdata = c->readbuf + 1 + lenBytes + 2;
+
+    c->rxStreamTopicName.cstring = NULL;
+    c->rxStreamTopicName.lenstring.len = topicLen;
+    c->rxStreamTopicName.lenstring.data = (char *)curdata;
+    curdata += topicLen;
+
+    c->rxStreamMessage.qos = (QoS)header.bits.qos;
+    c->rxStreamMessage.retained = header.bits.retain;
+    c->rxStreamMessage.dup = header.bits.dup;
+    c->rxStreamMessage.id = 0;
+    if(0 < header.bits.qos) {
+        c->rxStreamMessage.id = (uint16_t)((curdata[0] << 8) | curdata[1]);
+    }
+    c->rxStreamMessage.payload = NULL;
+    c->rxStreamMessage.payloadlen = totalLen - headerLen;
+
+    c->rxStreamLeft = totalLen - headerLen;
+    c->rxStreamOffset = 0;
+    /* A QoS2 message whose PUBREC got lost is only acknowledged again */
+    c->isRxStreamDuplicate = (QOS2 == c->rxStreamMessage.qos)
+                             ? isInboundQos2Pending(c, c->rxStreamMessage.id) : 0;
 
     return SUCCESS;
 }
 
-MQTTReturnCode decodePacket(Client *c, uint32_t *value, uint32_t timeout) {
+/* Decodes the remaining length of the packet at the head of the receive ring.
+ * Returns MQTT_NOTHING_TO_READ if the length bytes have not all arrived yet */
+MQTTReturnCode decodePacket(Client *c, uint32_t *value, uint32_t *lenBytes) {
     unsigned char i;
     uint32_t multiplier = 1;
     uint32_t len = 0;
     const uint32_t MAX_NO_OF_REMAINING_LENGTH_BYTES = 4;
 
-    if(NULL == c || NULL == value) {
+    if(NULL == c || NULL == value || NULL == lenBytes) {
         return MQTT_NULL_VALUE_ERROR;
     }
 
@@ -143,18 +851,16 @@ MQTTReturnCode decodePacket(Client *c, uint32_t *value, uint32_t timeout) {
             return MQTTPACKET_READ_ERROR;
         }
 
-        if((c->networkStack.mqttread(&(c->networkStack), &i, 1, (int)timeout)) != 1) {
-            /* The value argument is the important value. len is just used temporarily
-             * and never used by the calling function for anything else */
-            return FAILURE;
+        if(len >= c->rxRingUsed) {
+            return MQTT_NOTHING_TO_READ;
         }
 
+        i = peekRxRing(c, len);
         *value += ((i & 127) * multiplier);
         multiplier *= 128;
     }while((i & 128) != 0);
 
-    /* The value argument is the important value. len is just used temporarily
-     * and never used by the calling function for anything else */
+    *lenBytes = len;
     return SUCCESS;
 }
 
@@ -162,57 +868,85 @@ MQTTReturnCode readPacket(Client *c, Timer *timer, uint8_t *packet_type) {
     MQTTHeader header = {0};
     uint32_t len = 0;
     uint32_t rem_len = 0;
-    uint32_t total_bytes_read = 0;
-    uint32_t bytes_to_be_read = 0;
-    int32_t ret_val = 0;
+    uint32_t total_len = 0;
+    uint32_t wanted = 0;
+    uint8_t isRead = 0;
     MQTTReturnCode rc;
 
-    if(NULL == c || NULL == timer) {
+    if(NULL == c || NULL == timer || NULL == packet_type) {
         return MQTT_NULL_VALUE_ERROR;
     }
 
-    /* 1. read the header byte.  This has the packet type in it */
-    if(1 != c->networkStack.mqttread(&(c->networkStack), c->readbuf, 1, left_ms(timer))) {
-        /* If a network disconnect has occurred it would have been caught by keepalive already.
-         * If nothing is found at this point means there was nothing to read. Not 100% correct,
-         * but the only way to be sure is to pass proper error codes from the network stack
-         * which the mbedtls/openssl implementations do not return */
-        return MQTT_NOTHING_TO_READ;
+    /* 1. finish skipping a packet that did not fit the read buffer */
+    if(0 < c->rxDiscardLen) {
+        return discardRxPacket(c, timer);
     }
 
-    len = 1;
-    /* 2. read the remaining length.  This is variable in itself */
-    rc = decodePacket(c, &rem_len, (uint32_t)left_ms(timer));
-    if(SUCCESS != rc) {
-        return rc;
+    /* 2. the rest of a streamed PUBLISH payload goes to handlePublish as it arrives */
+    if(0 < c->rxStreamLeft) {
+        if(0 == c->rxRingUsed) {
+            if(0 == fillRxRing(c, c->rxStreamLeft, timer)) {
+                return MQTT_NOTHING_TO_READ;
+            }
+            TimerRefreshNow();
+        }
+        *packet_type = PUBLISH;
+        return SUCCESS;
     }
 
-    /* if the buffer is too short then the message will be dropped silently */
-	if (rem_len >= c->readBufSize) {
-		bytes_to_be_read = c->readBufSize;
-		do {
-			ret_val = c->networkStack.mqttread(&(c->networkStack), c->readbuf, bytes_to_be_read, left_ms(timer));
-			if (ret_val > 0) {
-				total_bytes_read += ret_val;
-				if((rem_len - total_bytes_read) >= c->readBufSize){
-					bytes_to_be_read = c->readBufSize;
-				}
-				else{
-					bytes_to_be_read = rem_len - total_bytes_read;
-				}
-			}
-		} while (total_bytes_read < rem_len && ret_val > 0);
-		return MQTTPACKET_BUFFER_TOO_SHORT;
-	}
-
-    /* put the original remaining length back into the buffer */
-    len += MQTTPacket_encode(c->readbuf + 1, rem_len);
-
-    /* 3. read the rest of the buffer using a callback to supply the rest of the data */
-    if(rem_len > 0 && (c->networkStack.mqttread(&(c->networkStack), c->readbuf + len, (int)rem_len, left_ms(timer)) != (int)rem_len)) {
-        return FAILURE;
+    /* 3. buffer until the header, the remaining length and the whole body are available.
+     * A packet cut short by the timer stays in the ring and is completed on the next call */
+    while(1) {
+        wanted = 1;
+        if(0 < c->rxRingUsed) {
+            rc = decodePacket(c, &rem_len, &len);
+            if(MQTTPACKET_READ_ERROR == rc) {
+                return rc;
+            }
+            if(SUCCESS == rc) {
+                total_len = 1 + len + rem_len;
+                if(rem_len >= c->readBufSize || total_len > RX_RING_LEN) {
+                    header.byte = peekRxRing(c, 0);
+                    rc = MQTTPACKET_BUFFER_TOO_SHORT;
+                    if(PUBLISH == header.bits.type && NULL != c->messageChunkHandler) {
+                        rc = beginRxStream(c, len, total_len, &wanted);
+                    }
+                    if(SUCCESS == rc) {
+                        *packet_type = PUBLISH;
+                        return SUCCESS;
+                    }
+                    if(MQTTPACKET_BUFFER_TOO_SHORT == rc) {
+                        /* if the buffer is too short then the message will be dropped silently */
+                        c->rxDiscardLen = total_len;
+                        return discardRxPacket(c, timer);
+                    }
+                } else if(total_len <= c->rxRingUsed) {
+                    break;
+                } else {
+                    wanted = total_len - c->rxRingUsed;
+                }
+            }
+        }
+
+        if(0 == fillRxRing(c, wanted, timer)) {
+            /* If a network disconnect has occurred it would have been caught by keepalive already.
+             * If nothing is found at this point means there was nothing to read. Not 100% correct,
+             * but the only way to be sure is to pass proper error codes from the network stack
+             * which the mbedtls/openssl implementations do not return */
+            return MQTT_NOTHING_TO_READ;
+        }
+        isRead = 1;
+    }
+
+    /* The reads may have waited for the packet to arrive. Refreshing the cached time once per
+     * packet rather than after every read keeps it to a single clock read */
+    if(isRead) {
+        TimerRefreshNow();
     }
 
+    /* 4. hand the complete packet, including its fixed header, to the deserializers */
+    consumeRxRing(c, c->readbuf, total_len);
+
     header.byte = c->readbuf[0];
     *packet_type = header.bits.type;
 
@@ -259,52 +993,83 @@ char isTopicMatched(char *topicFilter, MQTTString *topicName) {
     return (curn == curn_end) && (*curf == '\0');
 }
 
+static uint8_t isMessageHandlerMatched(Client *c, uint32_t i, MQTTString *topicName) {
+    return (i < c->messageHandlerCount && NULL != c->messageHandlers[i].topicFilter
+            && NULL != c->messageHandlers[i].fp
+            && (MQTTPacket_equals(topicName, (char*)c->messageHandlers[i].topicFilter) ||
+                isTopicMatched((char*)c->messageHandlers[i].topicFilter, topicName)));
+}
+
 MQTTReturnCode deliverMessage(Client *c, MQTTString *topicName, MQTTMessage *message) {
     uint32_t i;
     MessageData md;
+    const char *topicData;
+    size_t topicLen;
+    messageHandler fp = NULL;
+    pApplicationHandler_t applicationHandler = NULL;
+    uint8_t isTimeCached;
 
     if(NULL == c || NULL == topicName || NULL == message) {
         return MQTT_NULL_VALUE_ERROR;
     }
 
-    // we have to find the right message handler - indexed by topic
-    for(i = 0; i < MAX_MESSAGE_HANDLERS; ++i) {
-        if((c->messageHandlers[i].topicFilter != 0)
-           && (MQTTPacket_equals(topicName, (char*)c->messageHandlers[i].topicFilter) ||
-                isTopicMatched((char*)c->messageHandlers[i].topicFilter, topicName))) {
-            if(c->messageHandlers[i].fp != NULL) {
-                NewMessageData(&md, topicName, message, c->messageHandlers[i].applicationHandler);
-                c->messageHandlers[i].fp(&md);
-                return SUCCESS;
-            }
-        }
+    if(NULL != topicName->cstring) {
+        topicData = topicName->cstring;
+        topicLen = strlen(topicName->cstring);
+    } else {
+        topicData = topicName->lenstring.data;
+        topicLen = (size_t)topicName->lenstring.len;
     }
 
-    if(NULL != c->defaultMessageHandler) {
-        NewMessageData(&md, topicName, message, NULL);
-        c->defaultMessageHandler(&md);
-        return SUCCESS;
+    // we have to find the right message handler - the trie gives the first one whose filter
+    // can match, which is confirmed against the filter itself
+    lockState(c);
+    i = MQTTTopicTrie_match(&(c->subscriptionTrie), topicData, topicLen);
+    if(MQTT_TOPIC_TRIE_NIL != i && !isMessageHandlerMatched(c, i, topicName)) {
+        /* Only happens if two topic levels hash alike, check every handler instead */
+        for(i = 0; i < c->messageHandlerCount && !isMessageHandlerMatched(c, i, topicName); ++i);
+    }
+
+    if(MQTT_TOPIC_TRIE_NIL != i && i < c->messageHandlerCount) {
+        fp = c->messageHandlers[i].fp;
+        applicationHandler = c->messageHandlers[i].applicationHandler;
+    } else {
+        fp = c->defaultMessageHandler;
     }
+    unlockState(c);
 
-    /* Message handler not found for topic */
-    return FAILURE;
+    if(NULL == fp) {
+        /* Message handler not found for topic */
+        return FAILURE;
+    }
+
+    /* The handler runs without stateLock so that it can publish, subscribe and unsubscribe.
+     * Its thread holds rxLock, so it reads the acks it waits for itself */
+    NewMessageData(&md, topicName, message, applicationHandler);
+    isTimeCached = suspendTimeCache();
+    fp(&md);
+    resumeTimeCache(isTimeCached);
+    return SUCCESS;
 }
 
 MQTTReturnCode handleDisconnect(Client *c) {
     MQTTReturnCode rc;
+    uint8_t isTimeCached;
 
     if(NULL == c) {
         return MQTT_NULL_VALUE_ERROR;
     }
 
-    rc = MQTTDisconnect(c);
+    rc = disconnectClient(c);
     if(rc != SUCCESS){
     	// If the sendPacket prevents us from sending a disconnect packet then we have to clean the stack
     	MQTTForceDisconnect(c);
     }
 
     if(NULL != c->disconnectHandler) {
+        isTimeCached = suspendTimeCache();
         c->disconnectHandler();
+        resumeTimeCache(isTimeCached);
     }
 
     /* Reset to 0 since this was not a manual disconnect */
@@ -312,33 +1077,53 @@ MQTTReturnCode handleDisconnect(Client *c) {
     return MQTT_NETWORK_DISCONNECTED_ERROR;
 }
 
-MQTTReturnCode MQTTAttemptReconnect(Client *c) {
+/* Called with rxLock held */
+static MQTTReturnCode attemptReconnect(Client *c) {
     MQTTReturnCode rc = MQTT_ATTEMPTING_RECONNECT;
 
-    if(NULL == c) {
-        return MQTT_NULL_VALUE_ERROR;
-    }
-
     if(1 == c->isConnected) {
         return MQTT_NETWORK_ALREADY_CONNECTED_ERROR;
     }
 
-    /* Ignoring return code. failures expected if network is disconnected */
-    rc = MQTTConnect(c, NULL);
+    /* Failures are expected while the network is disconnected */
+    rc = connectClient(c, NULL);
 
     /* If still disconnected handle disconnect */
     if(0 == c->isConnected) {
+        if(MQTT_CONNACK_SERVER_UNAVAILABLE_ERROR == rc) {
+            /* The broker is up but overloaded, give it the longest break before the next try */
+            lockState(c);
+            MQTTReconnectPolicy_hint(&(c->reconnectPolicy), c->reconnectPolicy.config.maxDelayMs);
+            unlockState(c);
+        }
         return MQTT_ATTEMPTING_RECONNECT;
     }
 
-    rc = MQTTResubscribe(c);
+    rc = resubscribe(c);
     if(SUCCESS != rc) {
         return rc;
     }
 
+    /* Messages published while disconnected go out before anything new */
+    drainOfflineQueue(c);
+
     return MQTT_NETWORK_RECONNECTED;
 }
 
+MQTTReturnCode MQTTAttemptReconnect(Client *c) {
+    MQTTReturnCode rc;
+
+    if(NULL == c) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    lockRx(c);
+    rc = attemptReconnect(c);
+    unlockRx(c);
+
+    return rc;
+}
+
 MQTTReturnCode handleReconnect(Client *c) {
     int8_t isPhysicalLayerConnected = 1;
     MQTTReturnCode rc = MQTT_NETWORK_RECONNECTED;
@@ -358,52 +1143,74 @@ MQTTReturnCode handleReconnect(Client *c) {
     }
 
     if(isPhysicalLayerConnected) {
-        rc = MQTTAttemptReconnect(c);
+        rc = attemptReconnect(c);
         if(MQTT_NETWORK_RECONNECTED == rc) {
             return MQTT_NETWORK_RECONNECTED;
         }
     }
 
-    c->currentReconnectWaitInterval *= 2;
+    lockState(c);
+    c->currentReconnectWaitInterval = MQTTReconnectPolicy_nextDelay(&(c->reconnectPolicy));
+    unlockState(c);
 
-    if(MAX_RECONNECT_WAIT_INTERVAL < c->currentReconnectWaitInterval) {
+    if(MQTT_RECONNECT_GIVE_UP == c->currentReconnectWaitInterval) {
         return MQTT_RECONNECT_TIMED_OUT;
     }
     countdown_ms(&(c->reconnectDelayTimer), c->currentReconnectWaitInterval);
     return rc;
 }
 
+/* Restarts both idle timers, for example once the interval changed */
+static void restartIdleTimers(Client *c) {
+    countdown(&(c->rxIdleTimer), c->currentKeepAliveInterval);
+    lockTx(c);
+    countdown(&(c->txIdleTimer), c->currentKeepAliveInterval);
+    unlockTx(c);
+}
+
+/* A PINGREQ is only due once nothing was sent or nothing was received for the keepalive
+ * interval. Sending keeps the broker from dropping the client, receiving shows that the
+ * connection still works, so steady traffic both ways needs no PINGREQ at all */
 MQTTReturnCode keepalive(Client *c) {
     MQTTReturnCode rc = SUCCESS;
     Timer timer;
     uint32_t serialized_len = 0;
+    uint8_t isIdle;
 
     if(NULL == c) {
         return MQTT_NULL_VALUE_ERROR;
     }
 
-	if(0 == c->keepAliveInterval) {
-		return SUCCESS;
-	}
-
-	if(!expired(&c->pingTimer)) {
+    if(0 == c->keepAliveInterval) {
         return SUCCESS;
     }
 
     if(c->isPingOutstanding) {
+        if(!expired(&c->pingTimer)) {
+            return SUCCESS;
+        }
         return handleDisconnect(c);
     }
 
+    lockTx(c);
+    isIdle = (expired(&(c->txIdleTimer)) || expired(&(c->rxIdleTimer))) ? 1 : 0;
+    if(!isIdle) {
+        unlockTx(c);
+        return SUCCESS;
+    }
+
     /* there is no ping outstanding - send one */
     InitTimer(&timer);
     countdown_ms(&timer, c->commandTimeoutMs);
     rc = MQTTSerialize_pingreq(c->buf, c->bufSize, &serialized_len);
     if(SUCCESS != rc) {
+        unlockTx(c);
         return rc;
     }
 
     /* send the ping packet */
     rc = sendPacket(c, serialized_len, &timer);
+    unlockTx(c);
     if(SUCCESS != rc) {
     	//If sending a PING fails we can no longer determine if we are connected.  In this case we decide we are disconnected and begin reconnection attempts
         return handleDisconnect(c);
@@ -416,11 +1223,101 @@ MQTTReturnCode keepalive(Client *c) {
     return SUCCESS;
 }
 
+/* A PINGRESP arrived in time. With adaptive keepalive the connection has been idle for the
+ * whole interval without trouble, so the next PINGREQ can wait twice as long, up to the
+ * interval sent in CONNECT */
+static void handlePingresp(Client *c) {
+    c->isPingOutstanding = 0;
+
+    lockTx(c);
+    if(0 != c->minKeepAliveInterval && c->currentKeepAliveInterval < c->keepAliveInterval) {
+        c->currentKeepAliveInterval *= 2;
+        if(c->currentKeepAliveInterval > c->keepAliveInterval) {
+            c->currentKeepAliveInterval = c->keepAliveInterval;
+        }
+    }
+    unlockTx(c);
+    restartIdleTimers(c);
+}
+
+static MQTTReturnCode acknowledgePublish(Client *c, MQTTMessage *msg, Timer *timer) {
+    MQTTReturnCode rc;
+    uint32_t len = 0;
+
+    if(QOS0 == msg->qos) {
+        /* No further processing required for QOS0 */
+        return SUCCESS;
+    }
+
+    lockTx(c);
+    if(QOS1 == msg->qos) {
+        rc = MQTTSerialize_ack(c->buf, c->bufSize, PUBACK, 0, msg->id, &len);
+    } else { /* Message is not QOS0 or 1 means only option left is QOS2 */
+        rc = MQTTSerialize_ack(c->buf, c->bufSize, PUBREC, 0, msg->id, &len);
+    }
+
+    if(SUCCESS == rc) {
+        rc = stagePacket(c, len, timer);
+    }
+    unlockTx(c);
+
+    return rc;
+}
+
+/* Passes the payload bytes of a streamed PUBLISH that are in the receive ring on to the
+ * message chunk handler, straight from the ring. The PUBLISH is acknowledged after the
+ * last chunk */
+static MQTTReturnCode handlePublishChunks(Client *c, Timer *timer) {
+    MessageChunkData chunkData;
+    uint32_t chunkLen;
+    uint8_t isTimeCached;
+
+    while(0 < c->rxStreamLeft && 0 < c->rxRingUsed) {
+        chunkLen = RX_RING_LEN - c->rxRingStart;
+        if(chunkLen > c->rxRingUsed) {
+            chunkLen = c->rxRingUsed;
+        }
+        if(chunkLen > c->rxStreamLeft) {
+            chunkLen = c->rxStreamLeft;
+        }
+        c->rxStreamLeft -= chunkLen;
+
+        chunkData.message = &(c->rxStreamMessage);
+        chunkData.topicName = &(c->rxStreamTopicName);
+        chunkData.offset = c->rxStreamOffset;
+        chunkData.chunk = c->rxRing + c->rxRingStart;
+        chunkData.chunkLen = chunkLen;
+        chunkData.isFinal = (0 == c->rxStreamLeft) ? 1 : 0;
+        chunkData.applicationHandler = c->messageChunkApplicationHandler;
+        if(NULL != c->messageChunkHandler && !c->isRxStreamDuplicate) {
+            isTimeCached = suspendTimeCache();
+            c->messageChunkHandler(&chunkData);
+            resumeTimeCache(isTimeCached);
+        }
+
+        consumeRxRing(c, NULL, chunkLen);
+        c->rxStreamOffset += chunkLen;
+    }
+
+    if(0 < c->rxStreamLeft) {
+        return SUCCESS;
+    }
+
+    if(QOS2 == c->rxStreamMessage.qos) {
+        addInboundQos2(c, c->rxStreamMessage.id);
+    }
+
+    return acknowledgePublish(c, &(c->rxStreamMessage), timer);
+}
+
 MQTTReturnCode handlePublish(Client *c, Timer *timer) {
     MQTTString topicName;
     MQTTMessage msg;
     MQTTReturnCode rc;
-    uint32_t len = 0;
+
+    if(0 < c->rxStreamLeft) {
+        return handlePublishChunks(c, timer);
+    }
 
     rc = MQTTDeserialize_publish((unsigned char *) &msg.dup, (QoS *) &msg.qos, (unsigned char *) &msg.retained,
                                  (uint16_t *)&msg.id, &topicName,
@@ -430,30 +1327,42 @@ MQTTReturnCode handlePublish(Client *c, Timer *timer) {
         return rc;
     }
 
+    /* The broker sends a QoS2 message again until it gets the PUBREC, the handler has had
+     * it already if it is still waiting for its PUBREL */
+    if(QOS2 == msg.qos && isInboundQos2Pending(c, msg.id)) {
+        return acknowledgePublish(c, &msg, timer);
+    }
+
     rc = deliverMessage(c, &topicName, &msg);
     if(SUCCESS != rc) {
         return rc;
     }
 
-    if(QOS0 == msg.qos) {
-        /* No further processing required for QOS0 */
-        return SUCCESS;
+    if(QOS2 == msg.qos) {
+        addInboundQos2(c, msg.id);
     }
 
-    if(QOS1 == msg.qos) {
-        rc = MQTTSerialize_ack(c->buf, c->bufSize, PUBACK, 0, msg.id, &len);
-    } else { /* Message is not QOS0 or 1 means only option left is QOS2 */
-        rc = MQTTSerialize_ack(c->buf, c->bufSize, PUBREC, 0, msg.id, &len);
-    }
+    return acknowledgePublish(c, &msg, timer);
+}
+
+MQTTReturnCode handlePuback(Client *c) {
+    uint16_t packet_id;
+    unsigned char dup, type;
+    MQTTReturnCode rc;
+    struct InflightPublishes *pEntry;
 
+    rc = MQTTDeserialize_ack(&type, &dup, &packet_id, c->readbuf, c->readBufSize);
     if(SUCCESS != rc) {
         return rc;
     }
 
-    rc = sendPacket(c, len, timer);
-    if(SUCCESS != rc) {
-        return rc;
+    /* Acks for unknown packet ids belong to publishes that already timed out */
+    lockState(c);
+    pEntry = findInflightPublish(c, packet_id);
+    if(NULL != pEntry) {
+        completeInflightPublish(c, pEntry, SUCCESS);
     }
+    unlockState(c);
 
     return SUCCESS;
 }
@@ -463,49 +1372,136 @@ MQTTReturnCode handlePubrec(Client *c, Timer *timer) {
     unsigned char dup, type;
     MQTTReturnCode rc;
     uint32_t len;
+    struct InflightPublishes *pEntry;
 
     rc = MQTTDeserialize_ack(&type, &dup, &packet_id, c->readbuf, c->readBufSize);
     if(SUCCESS != rc) {
         return rc;
     }
 
+    /* QoS2 publish is now waiting for PUBCOMP, restart its ack timer */
+    lockState(c);
+    pEntry = findInflightPublish(c, packet_id);
+    if(NULL != pEntry) {
+        pEntry->isPubrecReceived = 1;
+        countdown_ms(&(pEntry->ackTimer), c->commandTimeoutMs);
+    }
+    unlockState(c);
+
+    lockTx(c);
     rc = MQTTSerialize_ack(c->buf, c->bufSize, PUBREL, 0, packet_id, &len);
+    if(SUCCESS == rc) {
+        /* send the PUBREL packet */
+        rc = stagePacket(c, len, timer);
+    }
+    unlockTx(c);
+
+    return rc;
+}
+
+/* The sender has released a QoS2 message, so it will not be sent again. PUBCOMP is sent for
+ * unknown packet ids as well, the PUBCOMP sent for those earlier may have got lost */
+static MQTTReturnCode handlePubrel(Client *c, Timer *timer) {
+    uint16_t packet_id;
+    unsigned char dup, type;
+    MQTTReturnCode rc;
+    uint32_t len;
+
+    rc = MQTTDeserialize_ack(&type, &dup, &packet_id, c->readbuf, c->readBufSize);
     if(SUCCESS != rc) {
         return rc;
     }
 
-    /* send the PUBREL packet */
-    rc = sendPacket(c, len, timer);
+    releaseInboundQos2(c, packet_id);
+
+    lockTx(c);
+    rc = MQTTSerialize_ack(c->buf, c->bufSize, PUBCOMP, 0, packet_id, &len);
+    if(SUCCESS == rc) {
+        /* send the PUBCOMP packet */
+        rc = stagePacket(c, len, timer);
+    }
+    unlockTx(c);
+
+    return rc;
+}
+
+MQTTReturnCode handlePubcomp(Client *c) {
+    uint16_t packet_id;
+    unsigned char dup, type;
+    MQTTReturnCode rc;
+    struct InflightPublishes *pEntry;
+
+    rc = MQTTDeserialize_ack(&type, &dup, &packet_id, c->readbuf, c->readBufSize);
     if(SUCCESS != rc) {
-        /* there was a problem */
         return rc;
     }
 
+    lockState(c);
+    pEntry = findInflightPublish(c, packet_id);
+    if(NULL != pEntry) {
+        completeInflightPublish(c, pEntry, SUCCESS);
+    }
+    unlockState(c);
+
     return SUCCESS;
 }
 
-MQTTReturnCode cycle(Client *c, Timer *timer, uint8_t *packet_type) {
+/* Hands a SUBACK or UNSUBACK to the SUBSCRIBE or UNSUBSCRIBE waiting for it */
+static MQTTReturnCode handleCommandAck(Client *c, uint8_t packetType) {
+    QoS grantedQoS[MAX_SUBSCRIBE_BATCH];
+    uint32_t grantedCount = 0;
+    uint16_t packetId;
     MQTTReturnCode rc;
-    if(NULL == c || NULL == timer) {
-        return MQTT_NULL_VALUE_ERROR;
-    }
 
-    /* read the socket, see what work is due */
-    rc = readPacket(c, timer, packet_type);
-    if(MQTT_NOTHING_TO_READ == rc) {
-        /* Nothing to read, not a cycle failure */
-        return SUCCESS;
+    if(SUBACK == packetType) {
+        rc = MQTTDeserialize_suback(&packetId, MAX_SUBSCRIBE_BATCH, &grantedCount, grantedQoS,
+                                    c->readbuf, c->readBufSize);
+    } else {
+        rc = MQTTDeserialize_unsuback(&packetId, c->readbuf, c->readBufSize);
     }
     if(SUCCESS != rc) {
         return rc;
     }
 
-    switch(*packet_type) {
+    /* Acks nobody waits for anymore belong to commands that already timed out */
+    lockState(c);
+    if(packetType == c->pendingAck.packetType && packetId == c->pendingAck.packetId
+       && !c->pendingAck.isReceived) {
+        c->pendingAck.rc = SUCCESS;
+        if(SUBACK == packetType) {
+            if(grantedCount == c->pendingAck.count) {
+                memcpy(c->pendingAck.pGrantedQoS, grantedQoS, grantedCount * sizeof(QoS));
+            } else {
+                c->pendingAck.rc = FAILURE;
+            }
+        }
+        c->pendingAck.isReceived = 1;
+        signalStateChanged(c);
+    }
+    unlockState(c);
+
+    return SUCCESS;
+}
+
+/* Acts on the packet readPacket just returned, the timer bounds any ack sent in reply */
+static MQTTReturnCode handlePacket(Client *c, uint8_t packet_type, Timer *timer) {
+    MQTTReturnCode rc = SUCCESS;
+
+    countdown(&(c->rxIdleTimer), c->currentKeepAliveInterval);
+
+    switch(packet_type) {
         case CONNACK:
-        case PUBACK:
+            /* MQTTConnect reads it from readbuf */
+            break;
         case SUBACK:
-        case UNSUBACK:
+        case UNSUBACK: {
+            rc = handleCommandAck(c, packet_type);
+            break;
+        }
+        case PUBACK: {
+            rc = handlePuback(c);
             break;
+        }
         case PUBLISH: {
             rc = handlePublish(c, timer);
             break;
@@ -514,11 +1510,16 @@ MQTTReturnCode cycle(Client *c, Timer *timer, uint8_t *packet_type) {
             rc = handlePubrec(c, timer);
             break;
         }
-        case PUBCOMP:
+        case PUBREL: {
+            rc = handlePubrel(c, timer);
+            break;
+        }
+        case PUBCOMP: {
+            rc = handlePubcomp(c);
             break;
+        }
         case PINGRESP: {
-            c->isPingOutstanding = 0;
-            countdown(&c->pingTimer, c->keepAliveInterval);
+            handlePingresp(c);
             break;
         }
         default: {
@@ -532,15 +1533,28 @@ MQTTReturnCode cycle(Client *c, Timer *timer, uint8_t *packet_type) {
     return rc;
 }
 
-MQTTReturnCode MQTTYield(Client *c, uint32_t timeout_ms) {
-    MQTTReturnCode rc = SUCCESS;
-    Timer timer;
-    uint8_t packet_type;
-
-    if(NULL == c) {
+MQTTReturnCode cycle(Client *c, Timer *timer, uint8_t *packet_type) {
+    MQTTReturnCode rc;
+    if(NULL == c || NULL == timer) {
         return MQTT_NULL_VALUE_ERROR;
     }
 
+    /* read the socket, see what work is due */
+    rc = readPacket(c, timer, packet_type);
+    if(MQTT_NOTHING_TO_READ == rc) {
+        /* Nothing to read, not a cycle failure */
+        return SUCCESS;
+    }
+    if(SUCCESS != rc) {
+        return rc;
+    }
+
+    return handlePacket(c, *packet_type, timer);
+}
+
+/* Returns SUCCESS if the client is connected or will reconnect by itself, otherwise why
+ * there is nothing for MQTTYield and friends to do */
+static MQTTReturnCode checkYieldable(Client *c) {
     /* Check if network was manually disconnected */
     if(0 == c->isConnected && 1 == c->wasManuallyDisconnected) {
         return MQTT_NETWORK_MANUALLY_DISCONNECTED;
@@ -551,18 +1565,151 @@ MQTTReturnCode MQTTYield(Client *c, uint32_t timeout_ms) {
         return MQTT_NETWORK_DISCONNECTED_ERROR;
     }
 
+    return SUCCESS;
+}
+
+/* Seed of the reconnect jitter for a policy that was not given one. Devices share the
+ * firmware but not the client ID, so their delays still differ */
+static uint32_t clientIdSeed(Client *c) {
+    MQTTString *pClientId = &(c->options.clientID);
+    const char *pData = pClientId->lenstring.data;
+    size_t len = (size_t)pClientId->lenstring.len;
+    uint32_t hash = 2166136261u;
+    size_t itr;
+
+    if(NULL != pClientId->cstring) {
+        pData = pClientId->cstring;
+        len = strlen(pClientId->cstring);
+    }
+    for(itr = 0; NULL != pData && itr < len; itr++) {
+        hash = (hash ^ (unsigned char)pData[itr]) * 16777619u;
+    }
+
+    return hash;
+}
+
+/* Arms the reconnect timer after the connection was lost */
+static void scheduleReconnect(Client *c) {
+    lockState(c);
+    if(!c->reconnectPolicy.isSeeded) {
+        MQTTReconnectPolicy_seed(&(c->reconnectPolicy), clientIdSeed(c));
+    }
+    MQTTReconnectPolicy_reset(&(c->reconnectPolicy));
+    c->currentReconnectWaitInterval = MQTTReconnectPolicy_nextDelay(&(c->reconnectPolicy));
+    unlockState(c);
+
+    if(MQTT_RECONNECT_GIVE_UP != c->currentReconnectWaitInterval) {
+        countdown_ms(&(c->reconnectDelayTimer), c->currentReconnectWaitInterval);
+    }
+    c->counterNetworkDisconnected++;
+}
+
+/* Takes down a connection that was found broken and arms auto-reconnect if it is enabled.
+ * Called with rxLock held, so the network is not closed under a read */
+static MQTTReturnCode handleLostConnection(Client *c) {
+    MQTTReturnCode rc;
+
+    rc = handleDisconnect(c);
+    if(1 == c->isAutoReconnectEnabled) {
+        scheduleReconnect(c);
+        rc = MQTT_ATTEMPTING_RECONNECT;
+    }
+
+    return rc;
+}
+
+/* Takes the connection down if a write left a packet incomplete. Called with rxLock held */
+static MQTTReturnCode handleTxFailure(Client *c) {
+    uint8_t isTxFailed;
+
+    lockState(c);
+    isTxFailed = c->isTxFailed;
+    unlockState(c);
+    if(!isTxFailed || 0 == c->isConnected) {
+        return SUCCESS;
+    }
+
+    /* The DISCONNECT cannot be written either, so the network is torn down right away */
+    return handleLostConnection(c);
+}
+
+/* Does the work of one pass of MQTTYield that is driven by timers rather than by the
+ * network: a reconnect attempt once the delay has passed, taking down a connection a
+ * write broke, failing publishes whose ack is overdue, staged publishes whose flush delay
+ * has passed and the keepalive ping. Called with rxLock held */
+static MQTTReturnCode processTimers(Client *c) {
+    MQTTReturnCode rc;
+    uint8_t isFlushDue;
+
+    if(0 == c->isConnected) {
+        if(MQTT_RECONNECT_GIVE_UP == c->currentReconnectWaitInterval) {
+            return MQTT_RECONNECT_TIMED_OUT;
+        }
+        return handleReconnect(c);
+    }
+
+    rc = handleTxFailure(c);
+    if(SUCCESS != rc) {
+        return rc;
+    }
+
+    expireInflightPublishes(c);
+
+    lockTx(c);
+    isFlushDue = (c->isTxFlushTimerRunning && expired(&(c->txFlushTimer))) ? 1 : 0;
+    unlockTx(c);
+    if(isFlushDue && SUCCESS != flushTx(c)) {
+        return handleTxFailure(c);
+    }
+
+    rc = keepalive(c);
+    if(SUCCESS == rc) {
+        /* Queued messages the publish window had no room for before */
+        drainOfflineQueue(c);
+    } else if(MQTT_NETWORK_DISCONNECTED_ERROR == rc && 1 == c->isAutoReconnectEnabled) {
+        scheduleReconnect(c);
+        /* Depending on timer values, it is possible that yield timer has expired
+         * Set to rc to attempting reconnect to inform client that autoreconnect
+         * attempt has started */
+        rc = MQTT_ATTEMPTING_RECONNECT;
+    }
+
+    return rc;
+}
+
+MQTTReturnCode MQTTYield(Client *c, uint32_t timeout_ms) {
+    MQTTReturnCode rc = SUCCESS;
+    MQTTReturnCode txRc;
+    Timer timer;
+    uint8_t packet_type;
+    uint8_t isTimeCached;
+
+    if(NULL == c) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    rc = checkYieldable(c);
+    if(SUCCESS != rc) {
+        return rc;
+    }
+
+    /* One clock read per packet: the cached time is only refreshed after waiting for the
+     * network, and every timer checked in between uses it */
+    isTimeCached = startTimeCache();
     InitTimer(&timer);
     countdown_ms(&timer, timeout_ms);
 
+    /* Threads waiting for an ack meanwhile rely on this one to read it */
+    lockRx(c);
     while(!expired(&timer)) {
         if(0 == c->isConnected) {
-            if(MAX_RECONNECT_WAIT_INTERVAL < c->currentReconnectWaitInterval) {
-                rc = MQTT_RECONNECT_TIMED_OUT;
+            rc = processTimers(c);
+            if(MQTT_RECONNECT_TIMED_OUT == rc) {
                 break;
             }
-            rc = handleReconnect(c);
             /* Network reconnect attempted, check if yield timer expired before
-             * doing anything else */
+             * doing anything else. Nothing here waits, so the time has to be read again */
+            TimerRefreshNow();
             continue;
         }
 
@@ -571,58 +1718,341 @@ MQTTReturnCode MQTTYield(Client *c, uint32_t timeout_ms) {
             break;
         }
 
-        rc = keepalive(c);
-        if(MQTT_NETWORK_DISCONNECTED_ERROR == rc && 1 == c->isAutoReconnectEnabled) {
-            c->currentReconnectWaitInterval = MIN_RECONNECT_WAIT_INTERVAL;
-            countdown_ms(&(c->reconnectDelayTimer), c->currentReconnectWaitInterval);
-            c->counterNetworkDisconnected++;
-            /* Depending on timer values, it is possible that yield timer has expired
-             * Set to rc to attempting reconnect to inform client that autoreconnect
-             * attempt has started */
-            rc = MQTT_ATTEMPTING_RECONNECT;
-        } else if(SUCCESS != rc) {
+        if(c->isRxFailed) {
+            /* The read found the connection gone, for example closed by the server */
+            rc = handleLostConnection(c);
+            if(MQTT_ATTEMPTING_RECONNECT != rc) {
+                break;
+            }
+            continue;
+        }
+
+        rc = processTimers(c);
+        if(SUCCESS != rc && MQTT_ATTEMPTING_RECONNECT != rc) {
             break;
         }
     }
+    if(SUCCESS != flushTx(c)) {
+        /* The staged acks were lost, the connection with them */
+        txRc = handleTxFailure(c);
+        if(SUCCESS == rc) {
+            rc = txRc;
+        }
+    }
+    unlockRx(c);
+    stopTimeCache(isTimeCached);
 
     return rc;
 }
 
-/* only used in single-threaded mode where one command at a time is in process */
-MQTTReturnCode waitfor(Client *c, uint8_t packet_type, Timer *timer) {
-    MQTTReturnCode rc = FAILURE;
-    uint8_t read_packet_type = 0;
-    if(NULL == c || NULL == timer) {
-        return MQTT_NULL_VALUE_ERROR;
+/* MQTTGetSocket, MQTTGetNextTimeout, MQTTProcessReadable and MQTTProcessTimers let an
+ * application that has its own event loop drive the client instead of calling MQTTYield:
+ * wait until the socket is readable or the next timeout has passed, then process whichever
+ * is due. The socket changes on every reconnect */
+int MQTTGetSocket(Client *c) {
+    if(NULL == c || 0 == c->isConnected) {
+        return -1;
     }
 
-    do {
-        if(expired(timer)) {
-            /* we timed out */
-            break;
-        }
-        rc = cycle(c, timer, &read_packet_type);
-    }while(MQTT_NETWORK_DISCONNECTED_ERROR != rc  && read_packet_type != packet_type);
+    return c->networkStack.my_socket;
+}
 
-    if(MQTT_NETWORK_DISCONNECTED_ERROR != rc && read_packet_type != packet_type) {
-        return FAILURE;
+static void lowerTimeout(uint32_t *pTimeoutMs, Timer *timer) {
+    uint32_t leftMs = 0;
+
+    /* left_ms rounds down, so a timer less than 1ms from expiring would look due already */
+    if(!expired(timer)) {
+        leftMs = (uint32_t)left_ms(timer) + 1;
     }
 
-    /* Something failed or we didn't receive the expected packet, return error code */
-    return rc;
+    if(leftMs < *pTimeoutMs) {
+        *pTimeoutMs = leftMs;
+    }
 }
 
-MQTTReturnCode MQTTConnect(Client *c, MQTTPacket_connectData *options) {
-    Timer connect_timer;
-    MQTTReturnCode connack_rc = FAILURE;
-    char sessionPresent = 0;
-    uint32_t len = 0;
-    MQTTReturnCode rc = FAILURE;
+static uint32_t nextTimeout(Client *c) {
+    uint32_t timeoutMs = MQTT_NO_PENDING_TIMEOUT;
+    uint32_t itr;
+
+    if(0 == c->isConnected) {
+        if(MQTT_RECONNECT_GIVE_UP == c->currentReconnectWaitInterval) {
+            /* MQTTProcessTimers reports MQTT_RECONNECT_TIMED_OUT right away */
+            return 0;
+        }
+        lowerTimeout(&timeoutMs, &(c->reconnectDelayTimer));
+        return timeoutMs;
+    }
+
+    if(0 != c->keepAliveInterval && c->isPingOutstanding) {
+        lowerTimeout(&timeoutMs, &(c->pingTimer));
+    } else if(0 != c->keepAliveInterval) {
+        lowerTimeout(&timeoutMs, &(c->rxIdleTimer));
+        lockTx(c);
+        lowerTimeout(&timeoutMs, &(c->txIdleTimer));
+        unlockTx(c);
+    }
+
+    lockTx(c);
+    if(c->isTxFlushTimerRunning) {
+        lowerTimeout(&timeoutMs, &(c->txFlushTimer));
+    }
+    unlockTx(c);
+
+    lockState(c);
+    for(itr = 0; itr < MAX_INFLIGHT_PUBLISHES && 0 < c->inflightPublishCount; itr++) {
+        if(!c->inflightPublishes[itr].isFree) {
+            lowerTimeout(&timeoutMs, &(c->inflightPublishes[itr].ackTimer));
+        }
+    }
+    if(c->isOfflineQueueEnabled && 0 < MQTTOfflineQueue_count(&(c->offlineQueue))
+       && c->inflightPublishCount < c->publishWindowSize) {
+        /* MQTTProcessTimers sends more of the offline queue */
+        timeoutMs = 0;
+    }
+    unlockState(c);
+
+    return timeoutMs;
+}
+
+/* Milliseconds until MQTTProcessTimers has work to do, 0 if it is due already */
+uint32_t MQTTGetNextTimeout(Client *c) {
+    uint32_t timeoutMs;
+    uint8_t isTimeCached;
+
+    if(NULL == c || SUCCESS != checkYieldable(c)) {
+        return MQTT_NO_PENDING_TIMEOUT;
+    }
+
+    isTimeCached = startTimeCache();
+    timeoutMs = nextTimeout(c);
+    stopTimeCache(isTimeCached);
+
+    return timeoutMs;
+}
+
+/* Handles every packet the network has available without waiting for more data */
+MQTTReturnCode MQTTProcessReadable(Client *c) {
+    MQTTReturnCode rc;
+    MQTTReturnCode txRc;
+    MQTTReturnCode droppedRc = SUCCESS;
+    Timer readTimer;
+    Timer ackTimer;
+    uint8_t packet_type;
+    uint8_t isTimeCached;
 
     if(NULL == c) {
         return MQTT_NULL_VALUE_ERROR;
     }
 
+    rc = checkYieldable(c);
+    if(SUCCESS != rc) {
+        return rc;
+    }
+
+    /* Whoever holds rxLock is reading already, so there is nothing left for us to do */
+    if(!tryLockRx(c)) {
+        return SUCCESS;
+    }
+
+    if(0 == c->isConnected) {
+        unlockRx(c);
+        return MQTT_ATTEMPTING_RECONNECT;
+    }
+
+    /* A zero read timeout never waits for data. Keep going until the network has nothing
+     * more, which also drains what the TLS layer has buffered and the socket cannot signal */
+    isTimeCached = startTimeCache();
+    InitTimer(&readTimer);
+    do {
+        rc = readPacket(c, &readTimer, &packet_type);
+        if(SUCCESS == rc) {
+            InitTimer(&ackTimer);
+            countdown_ms(&ackTimer, c->commandTimeoutMs);
+            rc = handlePacket(c, packet_type, &ackTimer);
+        } else if(MQTTPACKET_BUFFER_TOO_SHORT == rc) {
+            /* The packet did not fit the read buffer and was dropped, the ones behind it may not be */
+            droppedRc = rc;
+            rc = SUCCESS;
+        }
+    } while(SUCCESS == rc);
+
+    /* The acks for what was read go out together */
+    flushTx(c);
+
+    if(MQTT_NOTHING_TO_READ == rc) {
+        rc = droppedRc;
+        if(c->isRxFailed) {
+            /* The socket was readable but the connection is gone, for example closed by the server */
+            rc = handleLostConnection(c);
+        }
+    }
+    /* An ack that could not be written broke the connection */
+    txRc = handleTxFailure(c);
+    if(SUCCESS != txRc) {
+        rc = txRc;
+    }
+    stopTimeCache(isTimeCached);
+    unlockRx(c);
+
+    return rc;
+}
+
+/* Does whatever is due of the keepalive, the ack timeouts, the offline queue and reconnecting. Only a
+ * reconnect attempt blocks, for as long as connecting takes */
+MQTTReturnCode MQTTProcessTimers(Client *c) {
+    MQTTReturnCode rc;
+    uint8_t isTimeCached;
+
+    if(NULL == c) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    rc = checkYieldable(c);
+    if(SUCCESS != rc) {
+        return rc;
+    }
+
+    if(!tryLockRx(c)) {
+        return SUCCESS;
+    }
+    isTimeCached = startTimeCache();
+    rc = processTimers(c);
+    stopTimeCache(isTimeCached);
+    unlockRx(c);
+
+    return rc;
+}
+
+/* Reads packets until one of the given type arrives, which is left in readbuf. Only used
+ * for the CONNACK, with rxLock held */
+MQTTReturnCode waitfor(Client *c, uint8_t packet_type, Timer *timer) {
+    MQTTReturnCode rc = FAILURE;
+    uint8_t read_packet_type = 0;
+    if(NULL == c || NULL == timer) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    do {
+        if(expired(timer)) {
+            /* we timed out */
+            break;
+        }
+        rc = cycle(c, timer, &read_packet_type);
+    }while(MQTT_NETWORK_DISCONNECTED_ERROR != rc  && read_packet_type != packet_type);
+
+    if(MQTT_NETWORK_DISCONNECTED_ERROR != rc && read_packet_type != packet_type) {
+        return FAILURE;
+    }
+
+    /* Something failed or we didn't receive the expected packet, return error code */
+    return rc;
+}
+
+/* Lets the receive side make progress while the caller waits for an ack, called and
+ * returning with stateLock held. If no other thread is reading from the network, or the
+ * caller holds rxLock already, one packet is read and handled right here. That includes a
+ * message handler, which runs on the thread holding rxLock. Otherwise the caller sleeps
+ * until the reading thread handles an ack or gives up rxLock */
+static MQTTReturnCode awaitStateChange(Client *c, uint8_t isRxLockHeld, Timer *timer) {
+    MQTTReturnCode rc;
+    uint8_t packetType = 0;
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+    int waitMs;
+
+    if(!isRxLockHeld) {
+        isRxLockHeld = isRxLockOwnedByCaller(c);
+    }
+    if(!isRxLockHeld) {
+        /* stateLock is held, so only trying rxLock keeps to the locking order */
+        if(NONE_ERROR != aws_iot_thread_mutex_trylock(&(c->rxLock))) {
+            waitMs = left_ms(timer);
+            if(0 < waitMs) {
+                aws_iot_thread_cond_wait(&(c->stateChanged), &(c->stateLock), (uint32_t)waitMs);
+                TimerRefreshNow();
+            }
+            return SUCCESS;
+        }
+        setRxLockOwner(c);
+    }
+#endif
+
+    unlockState(c);
+    rc = cycle(c, timer, &packetType);
+    if(!isRxLockHeld) {
+        unlockRx(c);
+    }
+    lockState(c);
+
+    return rc;
+}
+
+/* Reserves the pending ack for a SUBSCRIBE of count topic filters, whose granted QoS go to
+ * pGrantedQoS, or for an UNSUBSCRIBE, and picks the packet id. Only one command at a time
+ * can wait for its ack, others wait here until it is done */
+static MQTTReturnCode beginPendingAck(Client *c, uint8_t packetType, uint32_t count, QoS *pGrantedQoS,
+                                      uint8_t isRxLockHeld, Timer *timer, uint16_t *pPacketId) {
+    MQTTReturnCode rc = SUCCESS;
+
+    lockState(c);
+    while(0 != c->pendingAck.packetType) {
+        if(expired(timer) || MQTT_NETWORK_DISCONNECTED_ERROR == rc) {
+            unlockState(c);
+            return (MQTT_NETWORK_DISCONNECTED_ERROR == rc) ? rc : FAILURE;
+        }
+        rc = awaitStateChange(c, isRxLockHeld, timer);
+    }
+
+    c->pendingAck.packetType = packetType;
+    c->pendingAck.isReceived = 0;
+    c->pendingAck.packetId = getNextPacketId(c);
+    c->pendingAck.count = count;
+    c->pendingAck.pGrantedQoS = pGrantedQoS;
+    c->pendingAck.rc = FAILURE;
+    *pPacketId = c->pendingAck.packetId;
+    unlockState(c);
+
+    return SUCCESS;
+}
+
+/* Waits for the ack reserved with beginPendingAck, or only releases the reservation if the
+ * command could not be sent */
+static MQTTReturnCode endPendingAck(Client *c, MQTTReturnCode sendRc, uint8_t isRxLockHeld, Timer *timer) {
+    MQTTReturnCode rc = sendRc;
+
+    lockState(c);
+    while(SUCCESS == sendRc && !c->pendingAck.isReceived) {
+        if(expired(timer) || 0 == c->isConnected || MQTT_NETWORK_DISCONNECTED_ERROR == rc) {
+            break;
+        }
+        rc = awaitStateChange(c, isRxLockHeld, timer);
+    }
+
+    if(SUCCESS == sendRc) {
+        if(c->pendingAck.isReceived) {
+            rc = c->pendingAck.rc;
+        } else if(MQTT_NETWORK_DISCONNECTED_ERROR != rc && 0 != c->isConnected) {
+            rc = FAILURE;
+        } else {
+            rc = MQTT_NETWORK_DISCONNECTED_ERROR;
+        }
+    }
+
+    c->pendingAck.packetType = 0;
+    signalStateChanged(c);
+    unlockState(c);
+
+    return rc;
+}
+
+/* Called with rxLock held */
+static MQTTReturnCode connectClient(Client *c, MQTTPacket_connectData *options) {
+    Timer connect_timer;
+    MQTTReturnCode connack_rc = FAILURE;
+    char sessionPresent = 0;
+    uint32_t len = 0;
+    MQTTReturnCode rc = FAILURE;
+
     InitTimer(&connect_timer);
     countdown_ms(&connect_timer, c->commandTimeoutMs);
 
@@ -636,328 +2066,1006 @@ MQTTReturnCode MQTTConnect(Client *c, MQTTPacket_connectData *options) {
         copyMQTTConnectData(&(c->options), options);
     }
 
+    /* Bytes buffered from a previous connection are meaningless on the new one */
+    resetRxRing(c);
+
+    lockTx(c);
+    /* Packets staged for the previous connection are meaningless as well */
+    c->txStageUsed = 0;
+    c->isTxFlushTimerRunning = 0;
+    lockState(c);
+    c->isTxFailed = 0;
+    unlockState(c);
     c->networkInitHandler(&(c->networkStack));
     rc = c->networkStack.connect(&(c->networkStack), c->tlsConnectParams);
+    TimerRefreshNow();
     if(0 != rc) {
         /* TLS Connect failed, return error */
+        unlockTx(c);
         return FAILURE;
     }
 
-    c->keepAliveInterval = c->options.keepAliveInterval;
-    rc = MQTTSerialize_connect(c->buf, c->bufSize, &(c->options), &len);
-    if(SUCCESS != rc || 0 >= len) {
-        return FAILURE;
-    }
+    c->keepAliveInterval = c->options.keepAliveInterval;
+    rc = MQTTSerialize_connect(c->buf, c->bufSize, &(c->options), &len);
+    if(SUCCESS != rc || 0 >= len) {
+        unlockTx(c);
+        return FAILURE;
+    }
+
+    /* send the connect packet */
+    rc = sendPacket(c, len, &connect_timer);
+    unlockTx(c);
+    if(SUCCESS != rc) {
+        return rc;
+    }
+
+    /* this will be a blocking call, wait for the CONNACK */
+    rc = waitfor(c, CONNACK, &connect_timer);
+    if(SUCCESS != rc) {
+        return rc;
+    }
+
+    /* Received CONNACK, check the return code */
+    rc = MQTTDeserialize_connack((unsigned char *)&sessionPresent, &connack_rc, c->readbuf, c->readBufSize);
+    if(SUCCESS != rc) {
+        return rc;
+    }
+
+    if(MQTT_CONNACK_CONNECTION_ACCEPTED != connack_rc) {
+        return connack_rc;
+    }
+
+    /* Without a session the broker will not send PUBREL for what it sent before */
+    if(!sessionPresent) {
+        resetInboundQos2(c);
+    }
+
+    c->isConnected = 1;
+    c->wasManuallyDisconnected = 0;
+    c->isPingOutstanding = 0;
+    lockTx(c);
+    c->currentKeepAliveInterval = c->keepAliveInterval;
+    if(0 != c->minKeepAliveInterval && c->minKeepAliveInterval < c->keepAliveInterval) {
+        c->currentKeepAliveInterval = c->minKeepAliveInterval;
+    }
+    unlockTx(c);
+    restartIdleTimers(c);
+
+    return SUCCESS;
+}
+
+MQTTReturnCode MQTTConnect(Client *c, MQTTPacket_connectData *options) {
+    MQTTReturnCode rc;
+
+    if(NULL == c) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    lockRx(c);
+    rc = connectClient(c, options);
+    unlockRx(c);
+
+    if(SUCCESS == rc) {
+        drainOfflineQueue(c);
+    }
+
+    return rc;
+}
+
+/* Return MQTT_TOPIC_TRIE_NIL if no free index is available. The handler stays on the
+ * free list until it is taken with AllocMessageHandler. Message handlers are only used
+ * with stateLock held */
+uint16_t GetFreeMessageHandlerIndex(Client *c) {
+    return c->freeMessageHandlerHead;
+}
+
+static void AllocMessageHandler(Client *c, uint16_t index) {
+    c->freeMessageHandlerHead = c->messageHandlers[index].nextFree;
+    c->messageHandlers[index].nextFree = MQTT_TOPIC_TRIE_NIL;
+}
+
+static void FreeMessageHandler(Client *c, uint16_t index) {
+    c->messageHandlers[index].topicFilter = NULL;
+    c->messageHandlers[index].fp = NULL;
+    c->messageHandlers[index].applicationHandler = NULL;
+    c->messageHandlers[index].nextFree = c->freeMessageHandlerHead;
+    c->freeMessageHandlerHead = index;
+}
+
+/* Takes a free message handler for the topic filter and adds the filter to the trie */
+static MQTTReturnCode registerMessageHandler(Client *c, const char *topicFilter, QoS qos,
+                                             messageHandler messageHandler,
+                                             pApplicationHandler_t applicationHandler,
+                                             uint16_t *pIndex) {
+    MQTTReturnCode rc;
+    uint16_t index = GetFreeMessageHandlerIndex(c);
+
+    if(MQTT_TOPIC_TRIE_NIL == index
+       || !MQTTTopicTrie_hasRoomFor(&(c->subscriptionTrie), topicFilter)) {
+        return MQTT_MAX_SUBSCRIPTIONS_REACHED_ERROR;
+    }
+
+    AllocMessageHandler(c, index);
+    c->messageHandlers[index].topicFilter = topicFilter;
+    c->messageHandlers[index].fp = messageHandler;
+    c->messageHandlers[index].applicationHandler = applicationHandler;
+    c->messageHandlers[index].qos = qos;
+
+    rc = MQTTTopicTrie_insert(&(c->subscriptionTrie), topicFilter, index);
+    if(SUCCESS != rc) {
+        FreeMessageHandler(c, index);
+        return rc;
+    }
+
+    *pIndex = index;
+    return SUCCESS;
+}
+
+static void unregisterMessageHandler(Client *c, uint16_t index) {
+    MQTTTopicTrie_remove(&(c->subscriptionTrie), c->messageHandlers[index].topicFilter, index);
+    FreeMessageHandler(c, index);
+}
+
+/* Adds the topic filter to a SUBSCRIBE of batchCount filters and *pRemLen remaining length
+ * if the packet still fits into the TX buffer */
+static uint8_t addToSubscribeBatch(Client *c, uint32_t batchCount, size_t *pRemLen, const char *topicFilter) {
+    size_t remLen = *pRemLen + 2 + strlen(topicFilter) + 1; /* length + topic + req_qos */
+
+    if(MAX_SUBSCRIBE_BATCH <= batchCount || MQTTPacket_len(remLen) >= c->bufSize) {
+        return 0;
+    }
+
+    *pRemLen = remLen;
+    return 1;
+}
+
+/* Sends the topic filters in one SUBSCRIBE and waits for the SUBACK, which must grant
+ * or reject every one of them */
+static MQTTReturnCode sendSubscribeBatch(Client *c, uint32_t count, MQTTString topics[],
+                                         QoS requestedQoS[], QoS grantedQoS[], uint8_t isRxLockHeld) {
+    MQTTReturnCode rc = FAILURE;
+    Timer timer;
+    uint32_t len = 0;
+    uint16_t packetId;
+
+    InitTimer(&timer);
+    countdown_ms(&timer, c->commandTimeoutMs);
+
+    rc = beginPendingAck(c, SUBACK, count, grantedQoS, isRxLockHeld, &timer, &packetId);
+    if(SUCCESS != rc) {
+        return rc;
+    }
+
+    lockTx(c);
+    if(!c->isConnected) {
+        rc = MQTT_NETWORK_DISCONNECTED_ERROR;
+    } else {
+        rc = MQTTSerialize_subscribe(c->buf, c->bufSize, 0, packetId, count, topics, requestedQoS, &len);
+        if(SUCCESS == rc) {
+            /* send the subscribe packet */
+            rc = sendPacket(c, len, &timer);
+        }
+    }
+    unlockTx(c);
+
+    /* wait for suback */
+    return endPendingAck(c, rc, isRxLockHeld, &timer);
+}
+
+/* A SUBSCRIBE of a single topic filter, see MQTTSubscribeMany. A filter the server rejects
+ * is left without a handler and reported as FAILURE */
+MQTTReturnCode MQTTSubscribe(Client *c, const char *topicFilter, QoS qos,
+                  messageHandler messageHandler, pApplicationHandler_t applicationHandler) {
+    MQTTReturnCode rc;
+    QoS grantedQoS = QOS0;
+
+    if(NULL == c || NULL == topicFilter
+       || NULL == messageHandler || NULL == applicationHandler) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    rc = MQTTSubscribeMany(c, 1, &topicFilter, &qos, messageHandler, &applicationHandler, &grantedQoS);
+    if(SUCCESS == rc && MQTT_SUBACK_FAILURE == (uint8_t)grantedQoS) {
+        rc = FAILURE;
+    }
+
+    return rc;
+}
+
+MQTTReturnCode MQTTSubscribeMany(Client *c, uint32_t count, const char *topicFilters[], QoS qos[],
+                                 messageHandler messageHandler, pApplicationHandler_t applicationHandlers[],
+                                 QoS grantedQoS[]) {
+    MQTTReturnCode rc = FAILURE;
+    MQTTString topics[MAX_SUBSCRIBE_BATCH];
+    QoS batchGrantedQoS[MAX_SUBSCRIBE_BATCH];
+    uint16_t handlerIndices[MAX_SUBSCRIBE_BATCH];
+    uint32_t first = 0;
+    uint32_t batchCount = 0;
+    uint32_t i = 0;
+    size_t remLen = 0;
+
+    if(NULL == c || NULL == topicFilters || NULL == qos
+       || NULL == messageHandler || NULL == applicationHandlers) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    for(i = 0; i < count; i++) {
+        if(NULL == topicFilters[i] || NULL == applicationHandlers[i]) {
+            return MQTT_NULL_VALUE_ERROR;
+        }
+    }
+
+    if(!c->isConnected) {
+        return MQTT_NETWORK_DISCONNECTED_ERROR;
+    }
+
+    while(first < count) {
+        remLen = 2; /* packetid */
+        for(batchCount = 0; first + batchCount < count; batchCount++) {
+            if(!addToSubscribeBatch(c, batchCount, &remLen, topicFilters[first + batchCount])) {
+                break;
+            }
+        }
+        if(0 == batchCount) {
+            return MQTTPACKET_BUFFER_TOO_SHORT;
+        }
+
+        /* Handlers are in place before the SUBSCRIBE goes out, so that messages the server
+         * sends ahead of the SUBACK are not lost */
+        lockState(c);
+        for(i = 0; i < batchCount; i++) {
+            rc = registerMessageHandler(c, topicFilters[first + i], qos[first + i], messageHandler,
+                                        applicationHandlers[first + i], &handlerIndices[i]);
+            if(SUCCESS != rc) {
+                while(0 < i) {
+                    unregisterMessageHandler(c, handlerIndices[--i]);
+                }
+                unlockState(c);
+                return rc;
+            }
+            topics[i].cstring = (char *)topicFilters[first + i];
+            topics[i].lenstring.len = 0;
+            topics[i].lenstring.data = NULL;
+        }
+        unlockState(c);
+
+        rc = sendSubscribeBatch(c, batchCount, topics, &qos[first], batchGrantedQoS, 0);
+        lockState(c);
+        for(i = 0; i < batchCount; i++) {
+            if(SUCCESS != rc || MQTT_SUBACK_FAILURE == (uint8_t)batchGrantedQoS[i]) {
+                unregisterMessageHandler(c, handlerIndices[i]);
+            }
+            if(SUCCESS == rc && NULL != grantedQoS) {
+                grantedQoS[first + i] = batchGrantedQoS[i];
+            }
+        }
+        unlockState(c);
+        if(SUCCESS != rc) {
+            return rc;
+        }
+
+        first += batchCount;
+    }
+
+    return SUCCESS;
+}
+
+/* Called with rxLock held */
+static MQTTReturnCode resubscribe(Client *c) {
+    MQTTReturnCode rc = FAILURE;
+    MQTTString topics[MAX_SUBSCRIBE_BATCH];
+    QoS requestedQoS[MAX_SUBSCRIBE_BATCH];
+    QoS grantedQoS[MAX_SUBSCRIBE_BATCH];
+    uint32_t batchCount = 0;
+    uint32_t itr = 0;
+    size_t remLen = 0;
+
+    if(!c->isConnected) {
+        return MQTT_NETWORK_DISCONNECTED_ERROR;
+    }
+
+    /* As many subscriptions as fit into the TX buffer go out in each SUBSCRIBE */
+    while(itr < c->messageHandlerCount) {
+        remLen = 2; /* packetid */
+        lockState(c);
+        for(batchCount = 0; itr < c->messageHandlerCount; itr++) {
+            if(NULL == c->messageHandlers[itr].topicFilter) {
+                continue;
+            }
+            if(!addToSubscribeBatch(c, batchCount, &remLen, c->messageHandlers[itr].topicFilter)) {
+                break;
+            }
+            topics[batchCount].cstring = (char *)c->messageHandlers[itr].topicFilter;
+            topics[batchCount].lenstring.len = 0;
+            topics[batchCount].lenstring.data = NULL;
+            requestedQoS[batchCount] = c->messageHandlers[itr].qos;
+            batchCount++;
+        }
+        unlockState(c);
+
+        if(0 == batchCount) {
+            if(itr < c->messageHandlerCount) {
+                /* A single topic filter does not fit into the TX buffer */
+                return MQTTPACKET_BUFFER_TOO_SHORT;
+            }
+            break;
+        }
+
+        rc = sendSubscribeBatch(c, batchCount, topics, requestedQoS, grantedQoS, 1);
+        if(SUCCESS != rc) {
+            return rc;
+        }
+    }
+
+    return SUCCESS;
+}
+
+MQTTReturnCode MQTTResubscribe(Client *c) {
+    MQTTReturnCode rc;
+
+    if(NULL == c) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    lockRx(c);
+    rc = resubscribe(c);
+    unlockRx(c);
+
+    return rc;
+}
+
+MQTTReturnCode MQTTUnsubscribe(Client *c, const char *topicFilter) {
+    MQTTReturnCode rc = FAILURE;
+    Timer timer;
+    MQTTString topic = MQTTString_initializer;
+    uint32_t len = 0;
+    uint32_t i = 0;
+    uint16_t packetId;
+
+    if(NULL == c || NULL == topicFilter) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    topic.cstring = (char *)topicFilter;
+
+    if(!c->isConnected) {
+        return MQTT_NETWORK_DISCONNECTED_ERROR;
+    }
+
+    InitTimer(&timer);
+    countdown_ms(&timer, c->commandTimeoutMs);
+
+    rc = beginPendingAck(c, UNSUBACK, 0, NULL, 0, &timer, &packetId);
+    if(SUCCESS != rc) {
+        return rc;
+    }
+
+    lockTx(c);
+    if(!c->isConnected) {
+        rc = MQTT_NETWORK_DISCONNECTED_ERROR;
+    } else {
+        rc = MQTTSerialize_unsubscribe(c->buf, c->bufSize, 0, packetId, 1, &topic, &len);
+        if(SUCCESS == rc) {
+            /* send the unsubscribe packet */
+            rc = sendPacket(c, len, &timer);
+        }
+    }
+    unlockTx(c);
+
+    rc = endPendingAck(c, rc, 0, &timer);
+    if(SUCCESS != rc) {
+        return rc;
+    }
+
+    /* Remove from message handler array */
+    lockState(c);
+    for(i = 0; i < c->messageHandlerCount; ++i) {
+        if(c->messageHandlers[i].topicFilter != NULL &&
+            (strcmp(c->messageHandlers[i].topicFilter, topicFilter) == 0)) {
+            unregisterMessageHandler(c, (uint16_t)i);
+            /* We don't want to break here, if the same topic is registered
+             * with 2 callbacks. Unlikely scenario */
+        }
+    }
+    unlockState(c);
+
+    return SUCCESS;
+}
+
+/* Serializes and sends the PUBLISH under txLock, so that other threads' packets are not
+ * interleaved with it */
+/* With isStaged the publish is staged rather than written right away if the flush delay allows it */
+static MQTTReturnCode sendPublish(Client *c, const char *topicName, MQTTMessage *message, uint8_t isStaged,
+                                  Timer *timer) {
+    MQTTString topic = MQTTString_initializer;
+    NetworkIoVec iov[2];
+    uint32_t len = 0;
+    MQTTReturnCode rc = FAILURE;
+
+    topic.cstring = (char *)topicName;
+
+    if(NULL == message->payload && 0 < message->payloadlen) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    lockTx(c);
+    if(!c->isConnected) {
+        unlockTx(c);
+        return MQTT_NETWORK_DISCONNECTED_ERROR;
+    }
+
+    /* only the fixed header, topic and packet id go through c->buf, the payload is
+     * written from the caller's memory */
+    rc = MQTTSerialize_publishHeader(c->buf, c->bufSize, 0, message->qos, message->retained, message->id,
+              topic, message->payloadlen, &len);
+    if(SUCCESS == rc) {
+        iov[0].pData = c->buf;
+        iov[0].len = (int)len;
+        iov[1].pData = (unsigned char *)message->payload;
+        iov[1].len = (int)message->payloadlen;
+
+        /* send the publish packet */
+        if(isStaged && 0 < c->txFlushDelayMs) {
+            rc = stagePacketv(c, iov, (0 < message->payloadlen) ? 2 : 1, c->txFlushDelayMs, timer);
+        } else {
+            rc = sendPacketv(c, iov, (0 < message->payloadlen) ? 2 : 1, timer);
+        }
+    }
+    unlockTx(c);
+
+    return rc;
+}
+
+/* Like sendPublish, but the payload is message->payloadlen bytes of the file at offset,
+ * which the network writes straight from the file. The packet cannot be left unfinished,
+ * so the connection is closed if the header went out but not all of the file did */
+static MQTTReturnCode sendPublishFromFd(Client *c, const char *topicName, MQTTMessage *message, int fd,
+                                        int64_t offset, Timer *timer) {
+    MQTTString topic = MQTTString_initializer;
+    NetworkIoVec iov;
+    uint32_t len = 0;
+    int32_t sentLen = 0;
+    MQTTReturnCode rc = FAILURE;
+
+    topic.cstring = (char *)topicName;
+
+    lockTx(c);
+    if(!c->isConnected) {
+        unlockTx(c);
+        return MQTT_NETWORK_DISCONNECTED_ERROR;
+    }
+    if(NULL == c->networkStack.mqttsendfile) {
+        unlockTx(c);
+        return FAILURE;
+    }
+
+    rc = MQTTSerialize_publishHeader(c->buf, c->bufSize, 0, message->qos, message->retained, message->id,
+              topic, message->payloadlen, &len);
+    if(SUCCESS == rc) {
+        iov.pData = c->buf;
+        iov.len = (int)len;
+        rc = sendPacketv(c, &iov, 1, timer);
+    }
+    if(SUCCESS == rc && 0 < message->payloadlen) {
+        sentLen = c->networkStack.mqttsendfile(&(c->networkStack), fd, offset, (int)message->payloadlen,
+                                               left_ms(timer));
+        TimerRefreshNow();
+        if((int32_t)message->payloadlen != sentLen) {
+            markTxFailed(c);
+            rc = FAILURE;
+        } else {
+            countdown(&(c->txIdleTimer), c->currentKeepAliveInterval);
+        }
+    }
+    unlockTx(c);
+
+    return rc;
+}
+
+/* Called with stateLock held. The entry may already have been completed while its
+ * publish was being sent, in which case its slot is no longer ours to release */
+static void abandonInflightPublish(Client *c, struct InflightPublishes *pEntry, uint16_t packetId) {
+    if(pEntry == findInflightPublish(c, packetId)) {
+        releaseInflightPublish(c, pEntry);
+        signalStateChanged(c);
+    }
+}
+
+/* Sends queued messages oldest first, in batches of up to OFFLINE_DRAIN_BATCH PUBLISH
+ * packets that are written with one vectored write each. The headers are serialized one
+ * after the other into c->buf and the payloads are sent straight from the queue's storage,
+ * where they are pinned until the write is done. Messages stay queued until they were
+ * written, or while the publish window has no room for them. Messages that expired, or
+ * whose header does not fit c->buf, are dropped */
+static MQTTReturnCode drainOfflineQueue(Client *c) {
+    Timer timer;
+    MQTTOfflineQueueCursor cursor;
+    MQTTOfflineMessage queued;
+    MQTTString topic = MQTTString_initializer;
+    NetworkIoVec iov[2 * OFFLINE_DRAIN_BATCH];
+    struct InflightPublishes *pEntries[OFFLINE_DRAIN_BATCH];
+    uint16_t packetIds[OFFLINE_DRAIN_BATCH];
+    struct InflightPublishes *pEntry;
+    uint32_t msgCount, droppedCount, entryCount, bufUsed, len, i;
+    int iovcnt;
+    MQTTReturnCode rc = SUCCESS;
+
+    if(!c->isOfflineQueueEnabled) {
+        return SUCCESS;
+    }
+
+    lockState(c);
+    msgCount = MQTTOfflineQueue_count(&(c->offlineQueue));
+    unlockState(c);
+    if(0 == msgCount) {
+        return SUCCESS;
+    }
+
+    lockTx(c);
+    lockState(c);
+    while(SUCCESS == rc && c->isConnected && 0 < MQTTOfflineQueue_count(&(c->offlineQueue))) {
+        msgCount = 0;
+        droppedCount = 0;
+        entryCount = 0;
+        bufUsed = 0;
+        iovcnt = 0;
+
+        MQTTOfflineQueue_begin(&(c->offlineQueue), &cursor);
+        while(msgCount < OFFLINE_DRAIN_BATCH && MQTTOfflineQueue_next(&(c->offlineQueue), &cursor, &queued)) {
+            if(queued.isExpired) {
+                msgCount++;
+                droppedCount++;
+                continue;
+            }
+
+            pEntry = NULL;
+            if(QOS0 != queued.message.qos) {
+                pEntry = allocInflightPublish(c);
+                if(NULL == pEntry) {
+                    break;
+                }
+                queued.message.id = pEntry->packetId;
+                pEntry->fp = c->offlineCompleteHandler;
+                pEntry->applicationHandler = c->offlineApplicationHandler;
+                pEntry->pApplicationContext = NULL;
+            }
+
+            topic.lenstring.data = (char *)queued.pTopic;
+            topic.lenstring.len = queued.topicLen;
+            rc = MQTTSerialize_publishHeader(c->buf + bufUsed, c->bufSize - bufUsed, 0, queued.message.qos,
+                                             queued.message.retained, queued.message.id, topic,
+                                             queued.message.payloadlen, &len);
+            if(SUCCESS != rc) {
+                if(NULL != pEntry) {
+                    abandonInflightPublish(c, pEntry, queued.message.id);
+                }
+                rc = SUCCESS;
+                if(0 == bufUsed) {
+                    /* Would not fit an empty buffer either */
+                    msgCount++;
+                    droppedCount++;
+                    continue;
+                }
+                break;
+            }
+
+            if(NULL != pEntry) {
+                pEntries[entryCount] = pEntry;
+                packetIds[entryCount] = queued.message.id;
+                entryCount++;
+            }
+            iov[iovcnt].pData = c->buf + bufUsed;
+            iov[iovcnt].len = (int)len;
+            iovcnt++;
+            bufUsed += len;
+            if(0 < queued.message.payloadlen) {
+                iov[iovcnt].pData = (unsigned char *)queued.message.payload;
+                iov[iovcnt].len = (int)queued.message.payloadlen;
+                iovcnt++;
+            }
+            msgCount++;
+        }
+
+        if(0 == msgCount) {
+            /* The publish window is full, the acks make room for the rest */
+            break;
+        }
+
+        if(0 < iovcnt) {
+            c->offlineQueue.pinnedCount = msgCount;
+            unlockState(c);
+            InitTimer(&timer);
+            countdown_ms(&timer, c->commandTimeoutMs);
+            rc = sendPacketv(c, iov, iovcnt, &timer);
+            lockState(c);
+            c->offlineQueue.pinnedCount = 0;
+        }
 
-    /* send the connect packet */
-    rc = sendPacket(c, len, &connect_timer);
-    if(SUCCESS != rc) {
-        return rc;
+        if(SUCCESS == rc) {
+            MQTTOfflineQueue_pop(&(c->offlineQueue), msgCount);
+            c->offlineQueue.droppedCount += droppedCount;
+        } else {
+            for(i = 0; i < entryCount; i++) {
+                abandonInflightPublish(c, pEntries[i], packetIds[i]);
+            }
+        }
     }
+    unlockState(c);
+    unlockTx(c);
 
-    /* this will be a blocking call, wait for the CONNACK */
-    rc = waitfor(c, CONNACK, &connect_timer);
-    if(SUCCESS != rc) {
-        return rc;
-    }
+    return rc;
+}
 
-    /* Received CONNACK, check the return code */
-    rc = MQTTDeserialize_connack((unsigned char *)&sessionPresent, &connack_rc, c->readbuf, c->readBufSize);
-    if(SUCCESS != rc) {
-        return rc;
+/* With the offline queue enabled a publish is queued while the client is disconnected,
+ * and also while older queued messages are still waiting so that the order is kept.
+ * Returns SUCCESS if the publish is to be sent right away */
+static MQTTReturnCode queuePublishIfNeeded(Client *c, const char *topicName, MQTTMessage *message) {
+    MQTTReturnCode rc = SUCCESS;
+
+    if(!c->isOfflineQueueEnabled) {
+        return c->isConnected ? SUCCESS : MQTT_NETWORK_DISCONNECTED_ERROR;
     }
 
-    if(MQTT_CONNACK_CONNECTION_ACCEPTED != connack_rc) {
-        return connack_rc;
+    if(c->isConnected) {
+        drainOfflineQueue(c);
     }
 
-    c->isConnected = 1;
-    c->wasManuallyDisconnected = 0;
-    c->isPingOutstanding = 0;
-    countdown(&c->pingTimer, c->keepAliveInterval);
+    lockState(c);
+    if(!c->isConnected || 0 < MQTTOfflineQueue_count(&(c->offlineQueue))) {
+        rc = MQTTOfflineQueue_push(&(c->offlineQueue), topicName, message, message->ttlSec);
+        if(SUCCESS == rc) {
+            rc = MQTT_PUBLISH_QUEUED;
+        }
+    }
+    unlockState(c);
 
-    return SUCCESS;
+    return rc;
 }
 
-/* Return MAX_MESSAGE_HANDLERS value if no free index is available */
-uint32_t GetFreeMessageHandlerIndex(Client *c) {
-    uint32_t itr;
-    for(itr = 0; itr < MAX_MESSAGE_HANDLERS; itr++) {
-        if(c->messageHandlers[itr].topicFilter == NULL) {
-            break;
-        }
-    }
+/* Takes the connection down if the write the caller just made failed partway, or a file
+ * ended early. A message handler holds rxLock already, any other caller waits for the
+ * reading thread to give it up */
+static void handleCallerTxFailure(Client *c) {
+    uint8_t isRxLockHeld;
 
-    return itr;
+    isRxLockHeld = isRxLockHeldByCaller(c);
+    if(!isRxLockHeld) {
+        lockRx(c);
+    }
+    handleTxFailure(c);
+    if(!isRxLockHeld) {
+        unlockRx(c);
+    }
 }
 
-MQTTReturnCode MQTTSubscribe(Client *c, const char *topicFilter, QoS qos,
-                  messageHandler messageHandler, pApplicationHandler_t applicationHandler) {
-    MQTTReturnCode rc = FAILURE;
+static MQTTReturnCode publishAsync(Client *c, const char *topicName, MQTTMessage *message,
+                                   publishCompleteHandler completeHandler, pApplicationHandler_t applicationHandler,
+                                   void *pApplicationContext) {
     Timer timer;
-    uint32_t len = 0;
-    uint32_t indexOfFreeMessageHandler;
-    uint32_t count = 0;
-    QoS grantedQoS[3] = {QOS0, QOS0, QOS0};
-    uint16_t packetId;
-    MQTTString topic = MQTTString_initializer;
+    struct InflightPublishes *pEntry = NULL;
+    PublishCompleteData pcd;
+    MQTTReturnCode rc = FAILURE;
+    uint8_t isTimeCached;
 
-    if(NULL == c || NULL == topicFilter
-       || NULL == messageHandler || NULL == applicationHandler) {
+    if(NULL == c || NULL == topicName || NULL == message) {
         return MQTT_NULL_VALUE_ERROR;
     }
 
-    if(!c->isConnected) {
-        return MQTT_NETWORK_DISCONNECTED_ERROR;
+    rc = queuePublishIfNeeded(c, topicName, message);
+    if(SUCCESS != rc) {
+        return rc;
     }
 
-    topic.cstring = (char *)topicFilter;
-
     InitTimer(&timer);
     countdown_ms(&timer, c->commandTimeoutMs);
 
-    rc = MQTTSerialize_subscribe(c->buf, c->bufSize, 0, getNextPacketId(c), 1, &topic, &qos, &len);
-    if(SUCCESS != rc) {
+    if(QOS0 == message->qos) {
+        rc = sendPublish(c, topicName, message, 1, &timer);
+        if(SUCCESS != rc) {
+            handleCallerTxFailure(c);
+        } else if(NULL != completeHandler) {
+            /* No ack for QoS0, the message is complete once it is written or staged */
+            pcd.packetId = message->id;
+            pcd.rc = SUCCESS;
+            pcd.applicationHandler = applicationHandler;
+            pcd.pApplicationContext = pApplicationContext;
+            isTimeCached = suspendTimeCache();
+            completeHandler(&pcd);
+            resumeTimeCache(isTimeCached);
+        }
         return rc;
     }
 
-    indexOfFreeMessageHandler = GetFreeMessageHandlerIndex(c);
-    if(MAX_MESSAGE_HANDLERS <= indexOfFreeMessageHandler) {
-        return MQTT_MAX_SUBSCRIPTIONS_REACHED_ERROR;
-    }
-
-    /* send the subscribe packet */
-    rc = sendPacket(c, len, &timer);
-    if(SUCCESS != rc) {
-        return rc;
+    lockState(c);
+    pEntry = allocInflightPublish(c);
+    if(NULL == pEntry) {
+        unlockState(c);
+        return MQTT_PUBLISH_WINDOW_FULL_ERROR;
     }
 
-    /* wait for suback */
-    rc = waitfor(c, SUBACK, &timer);
-    if(SUCCESS != rc) {
-        return rc;
-    }
+    message->id = pEntry->packetId;
+    pEntry->fp = completeHandler;
+    pEntry->applicationHandler = applicationHandler;
+    pEntry->pApplicationContext = pApplicationContext;
+    unlockState(c);
 
-    /* Granted QoS can be 0, 1 or 2 */
-    rc = MQTTDeserialize_suback(&packetId, 1, &count, grantedQoS, c->readbuf, c->readBufSize);
+    /* The ack is matched to the entry by cycle(), possibly before sendPublish returns */
+    rc = sendPublish(c, topicName, message, 1, &timer);
     if(SUCCESS != rc) {
+        handleCallerTxFailure(c);
+        lockState(c);
+        abandonInflightPublish(c, pEntry, message->id);
+        unlockState(c);
         return rc;
     }
 
-    c->messageHandlers[indexOfFreeMessageHandler].topicFilter =
-            topicFilter;
-    c->messageHandlers[indexOfFreeMessageHandler].fp = messageHandler;
-    c->messageHandlers[indexOfFreeMessageHandler].applicationHandler =
-            applicationHandler;
-    c->messageHandlers[indexOfFreeMessageHandler].qos = qos;
-
     return SUCCESS;
 }
 
-MQTTReturnCode MQTTResubscribe(Client *c) {
-    MQTTReturnCode rc = FAILURE;
-    Timer timer;
-    uint32_t len = 0;
-    uint32_t count = 0;
-    QoS grantedQoS[3] = {QOS0, QOS0, QOS0};
-    uint16_t packetId;
-    uint32_t existingSubCount = 0;
-    uint32_t itr = 0;
+MQTTReturnCode MQTTPublishAsync(Client *c, const char *topicName, MQTTMessage *message,
+                                publishCompleteHandler completeHandler, pApplicationHandler_t applicationHandler,
+                                void *pApplicationContext) {
+    MQTTReturnCode rc;
+    uint8_t isTimeCached;
+
+    isTimeCached = startTimeCache();
+    rc = publishAsync(c, topicName, message, completeHandler, applicationHandler, pApplicationContext);
+    stopTimeCache(isTimeCached);
+
+    return rc;
+}
 
+MQTTReturnCode MQTTSetPublishWindow(Client *c, uint32_t windowSize) {
     if(NULL == c) {
         return MQTT_NULL_VALUE_ERROR;
     }
 
-    if(!c->isConnected) {
-        return MQTT_NETWORK_DISCONNECTED_ERROR;
+    if(0 == windowSize || MAX_INFLIGHT_PUBLISHES < windowSize) {
+        return FAILURE;
     }
 
-    existingSubCount = GetFreeMessageHandlerIndex(c);
-
-    for(itr = 0; itr < existingSubCount; itr++) {
-        MQTTString topic = MQTTString_initializer;
-        topic.cstring = (char *)c->messageHandlers[itr].topicFilter;
-
-        InitTimer(&timer);
-        countdown_ms(&timer, c->commandTimeoutMs);
+    lockState(c);
+    c->publishWindowSize = windowSize;
+    unlockState(c);
+    return SUCCESS;
+}
 
-        rc = MQTTSerialize_subscribe(c->buf, c->bufSize, 0, getNextPacketId(c), 1,
-                                     &topic, &(c->messageHandlers[itr].qos), &len);
-        if(SUCCESS != rc) {
-            return rc;
-        }
+/* Starts every connection with a PINGREQ after minIntervalSec of idle time and doubles that
+ * after each PINGRESP, up to the keepalive interval of the connect options. 0 turns it off */
+MQTTReturnCode MQTTSetAdaptiveKeepalive(Client *c, uint32_t minIntervalSec) {
+    if(NULL == c) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
 
-        /* send the subscribe packet */
-        rc = sendPacket(c, len, &timer);
-        if(SUCCESS != rc) {
-            return rc;
-        }
+    lockTx(c);
+    c->minKeepAliveInterval = minIntervalSec;
+    unlockTx(c);
+    return SUCCESS;
+}
 
-        /* wait for suback */
-        rc = waitfor(c, SUBACK, &timer);
-        if(SUCCESS != rc) {
-            return rc;
-        }
+/* Takes effect from the next failed reconnect attempt */
+MQTTReturnCode MQTTSetReconnectPolicy(Client *c, const MQTTReconnectPolicyConfig *pConfig) {
+    if(NULL == c || NULL == pConfig) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
 
-        /* Granted QoS can be 0, 1 or 2 */
-        rc = MQTTDeserialize_suback(&packetId, 1, &count, grantedQoS, c->readbuf, c->readBufSize);
-        if(SUCCESS != rc) {
-            return rc;
-        }
+    if(MQTT_RECONNECT_CUSTOM == pConfig->strategy && NULL == pConfig->customHandler) {
+        return MQTT_NULL_VALUE_ERROR;
     }
 
+    lockState(c);
+    MQTTReconnectPolicy_init(&(c->reconnectPolicy), pConfig);
+    unlockState(c);
     return SUCCESS;
 }
 
-MQTTReturnCode MQTTUnsubscribe(Client *c, const char *topicFilter) {
-    MQTTReturnCode rc = FAILURE;
-    Timer timer;
-    MQTTString topic = MQTTString_initializer;
-    uint32_t len = 0;
-    uint32_t i = 0;
-    uint16_t packet_id;
-
-    if(NULL == c || NULL == topicFilter) {
+/* Replaces the next reconnect delay, for example with one the server asked for before it
+ * closed the connection. Can be called from the disconnect handler */
+MQTTReturnCode MQTTSetReconnectHint(Client *c, uint32_t delayMs) {
+    if(NULL == c) {
         return MQTT_NULL_VALUE_ERROR;
     }
 
-    topic.cstring = (char *)topicFilter;
+    lockState(c);
+    MQTTReconnectPolicy_hint(&(c->reconnectPolicy), delayMs);
+    unlockState(c);
+    return SUCCESS;
+}
 
-    if(!c->isConnected) {
-        return MQTT_NETWORK_DISCONNECTED_ERROR;
+/* Lets asynchronous publishes wait up to delayMs in the stage so that a burst of them shares
+ * writes, and TLS records, with each other and with acks */
+MQTTReturnCode MQTTSetFlushDelay(Client *c, uint32_t delayMs) {
+    if(NULL == c) {
+        return MQTT_NULL_VALUE_ERROR;
     }
 
-    InitTimer(&timer);
-    countdown_ms(&timer, c->commandTimeoutMs);
+    lockTx(c);
+    c->txFlushDelayMs = delayMs;
+    unlockTx(c);
+    return SUCCESS;
+}
 
-    rc = MQTTSerialize_unsubscribe(c->buf, c->bufSize, 0, getNextPacketId(c), 1, &topic, &len);
-    if(SUCCESS != rc) {
-        return rc;
-    }
+/* Writes the staged packets right away */
+MQTTReturnCode MQTTFlush(Client *c) {
+    MQTTReturnCode rc;
+    uint8_t isTimeCached;
 
-    /* send the unsubscribe packet */
-    rc = sendPacket(c, len, &timer);
-    if(SUCCESS != rc) {
-        return rc;
+    if(NULL == c) {
+        return MQTT_NULL_VALUE_ERROR;
     }
 
-    rc = waitfor(c, UNSUBACK, &timer);
+    isTimeCached = startTimeCache();
+    rc = flushTx(c);
     if(SUCCESS != rc) {
-        return rc;
+        handleCallerTxFailure(c);
     }
+    stopTimeCache(isTimeCached);
 
-    rc = MQTTDeserialize_unsuback(&packet_id, c->readbuf, c->readBufSize);
-    if(SUCCESS != rc) {
-        return rc;
-    }
+    return rc;
+}
 
-    /* Remove from message handler array */
-    for(i = 0; i < MAX_MESSAGE_HANDLERS; ++i) {
-        if(c->messageHandlers[i].topicFilter != NULL &&
-            (strcmp(c->messageHandlers[i].topicFilter, topicFilter) == 0)) {
-            c->messageHandlers[i].topicFilter = NULL;
-            /* We don't want to break here, if the same topic is registered
-             * with 2 callbacks. Unlikely scenario */
-        }
+/* Sends the payload from memory, or from the file fd if it is not negative */
+static MQTTReturnCode sendPublishPayload(Client *c, const char *topicName, MQTTMessage *message, int fd,
+                                         int64_t offset, Timer *timer) {
+    MQTTReturnCode rc;
+
+    if(0 > fd) {
+        rc = sendPublish(c, topicName, message, 0, timer);
+    } else {
+        rc = sendPublishFromFd(c, topicName, message, fd, offset, timer);
+    }
+    if(SUCCESS != rc) {
+        handleCallerTxFailure(c);
     }
 
-    return SUCCESS;
+    return rc;
 }
 
-MQTTReturnCode MQTTPublish(Client *c, const char *topicName, MQTTMessage *message) {
+static MQTTReturnCode publishBlocking(Client *c, const char *topicName, MQTTMessage *message, int fd,
+                                      int64_t offset) {
     Timer timer;
-    MQTTString topic = MQTTString_initializer;
-    uint32_t len = 0;
-    uint8_t waitForAck = 0;
-    uint8_t packetType = PUBACK;
-    uint16_t packet_id;
-    unsigned char dup, type;
+    struct InflightPublishes *pEntry = NULL;
+    BlockingPublishResult result = {0, FAILURE};
     MQTTReturnCode rc = FAILURE;
 
     if(NULL == c || NULL == topicName || NULL == message) {
         return MQTT_NULL_VALUE_ERROR;
     }
 
-    topic.cstring = (char *)topicName;
-
-    if(!c->isConnected) {
-        return MQTT_NETWORK_DISCONNECTED_ERROR;
+    if(0 > fd) {
+        rc = queuePublishIfNeeded(c, topicName, message);
+    } else {
+        /* The file is only read while the publish is written, there is nothing to queue */
+        rc = c->isConnected ? SUCCESS : MQTT_NETWORK_DISCONNECTED_ERROR;
+    }
+    if(SUCCESS != rc) {
+        return rc;
     }
 
     InitTimer(&timer);
     countdown_ms(&timer, c->commandTimeoutMs);
 
-    if(QOS1 == message->qos || QOS2 == message->qos) {
-        message->id = getNextPacketId(c);
-        waitForAck = 1;
-        if(QOS2 == message->qos) {
-            packetType = PUBCOMP;
-        }
+    if(QOS0 == message->qos) {
+        return sendPublishPayload(c, topicName, message, fd, offset, &timer);
     }
 
-    rc = MQTTSerialize_publish(c->buf, c->bufSize, 0, message->qos, message->retained, message->id,
-              topic, (unsigned char*)message->payload, message->payloadlen, &len);
-    if(SUCCESS != rc) {
-        return rc;
+    /* If asynchronous publishes fill the window, wait for one of them to be acked */
+    lockState(c);
+    while(NULL == (pEntry = allocInflightPublish(c))) {
+        if(expired(&timer)) {
+            unlockState(c);
+            return MQTT_PUBLISH_WINDOW_FULL_ERROR;
+        }
+        rc = awaitStateChange(c, 0, &timer);
+        if(MQTT_NETWORK_DISCONNECTED_ERROR == rc) {
+            unlockState(c);
+            return rc;
+        }
     }
 
-    /* send the publish packet */
-    rc = sendPacket(c, len, &timer);
+    message->id = pEntry->packetId;
+    pEntry->fp = NULL;
+    pEntry->applicationHandler = NULL;
+    pEntry->pApplicationContext = &result;
+    pEntry->isBlocking = 1;
+    unlockState(c);
+
+    rc = sendPublishPayload(c, topicName, message, fd, offset, &timer);
+
+    lockState(c);
     if(SUCCESS != rc) {
+        abandonInflightPublish(c, pEntry, message->id);
+        unlockState(c);
         return rc;
     }
 
-    /* Wait for ack if QoS1 or QoS2 */
-    if(1 == waitForAck) {
-        rc = waitfor(c, packetType, &timer);
-        if(SUCCESS != rc) {
-            return rc;
+    /* Wait for PUBACK if QoS1 or PUBCOMP if QoS2, whichever thread reads it stores the result */
+    while(!result.isComplete && !expired(&timer)) {
+        rc = awaitStateChange(c, 0, &timer);
+        if(MQTT_NETWORK_DISCONNECTED_ERROR == rc) {
+            break;
         }
+    }
 
-        rc = MQTTDeserialize_ack(&type, &dup, &packet_id, c->readbuf, c->readBufSize);
-        if(SUCCESS != rc) {
-            return rc;
-        }
+    if(!result.isComplete) {
+        releaseInflightPublish(c, pEntry);
+        unlockState(c);
+        return (MQTT_NETWORK_DISCONNECTED_ERROR == rc) ? rc : FAILURE;
     }
+    unlockState(c);
 
-    return SUCCESS;
+    return result.rc;
+}
+
+MQTTReturnCode MQTTPublish(Client *c, const char *topicName, MQTTMessage *message) {
+    MQTTReturnCode rc;
+    uint8_t isTimeCached;
+
+    isTimeCached = startTimeCache();
+    rc = publishBlocking(c, topicName, message, -1, 0);
+    stopTimeCache(isTimeCached);
+
+    return rc;
+}
+
+/* Publishes message->payloadlen bytes of the file fd, starting at offset, as the payload.
+ * message->payload is not used. The network writes them straight from the file, with
+ * sendfile where it can, so a large file is never held in memory. Blocks like MQTTPublish,
+ * but a file publish is not queued while disconnected. The network must implement
+ * mqttsendfile */
+MQTTReturnCode MQTTPublishFromFd(Client *c, const char *topicName, MQTTMessage *message, int fd, int64_t offset) {
+    MQTTReturnCode rc;
+    uint8_t isTimeCached;
+
+    if(0 > fd || 0 > offset) {
+        return FAILURE;
+    }
+
+    isTimeCached = startTimeCache();
+    rc = publishBlocking(c, topicName, message, fd, offset);
+    stopTimeCache(isTimeCached);
+
+    return rc;
 }
 /**
  * This is for the case when the sendPacket Fails.
  */
 static void MQTTForceDisconnect(Client *c){
+	lockTx(c);
 	c->isConnected = 0;
 	c->networkStack.disconnect(&(c->networkStack));
 	c->networkStack.destroy(&(c->networkStack));
+	unlockTx(c);
+	abortInflightPublishes(c, MQTT_NETWORK_DISCONNECTED_ERROR);
 }
 
-MQTTReturnCode MQTTDisconnect(Client *c) {
+/* Called with rxLock held */
+static MQTTReturnCode disconnectClient(Client *c) {
     MQTTReturnCode rc = FAILURE;
     /* We might wait for incomplete incoming publishes to complete */
     Timer timer;
     uint32_t serialized_len = 0;
 
-    if(NULL == c) {
-        return MQTT_NULL_VALUE_ERROR;
-    }
-
     if(0 == c->isConnected) {
         /* Network is already disconnected. Do nothing */
         return MQTT_NETWORK_DISCONNECTED_ERROR;
     }
 
+    InitTimer(&timer);
+    countdown_ms(&timer, c->commandTimeoutMs);
+
+    lockTx(c);
     rc = MQTTSerialize_disconnect(c->buf, c->bufSize, &serialized_len);
     if(SUCCESS != rc) {
+        unlockTx(c);
         return rc;
     }
 
-    InitTimer(&timer);
-    countdown_ms(&timer, c->commandTimeoutMs);
-
     /* send the disconnect packet */
     if(serialized_len > 0) {
         rc = sendPacket(c, serialized_len, &timer);
         if(SUCCESS != rc) {
+            unlockTx(c);
             return rc;
         }
     }
@@ -967,10 +3075,13 @@ MQTTReturnCode MQTTDisconnect(Client *c) {
     rc = c->networkStack.destroy(&(c->networkStack));
     if(0 != rc) {
         /* TLS Destroy failed, return error */
+        unlockTx(c);
         return FAILURE;
     }
 
     c->isConnected = 0;
+    unlockTx(c);
+    abortInflightPublishes(c, MQTT_NETWORK_DISCONNECTED_ERROR);
 
     /* Always set to 1 whenever disconnect is called. Keepalive resets to 0 */
     c->wasManuallyDisconnected = 1;
@@ -978,6 +3089,20 @@ MQTTReturnCode MQTTDisconnect(Client *c) {
     return SUCCESS;
 }
 
+MQTTReturnCode MQTTDisconnect(Client *c) {
+    MQTTReturnCode rc;
+
+    if(NULL == c) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    lockRx(c);
+    rc = disconnectClient(c);
+    unlockRx(c);
+
+    return rc;
+}
+
 uint8_t MQTTIsConnected(Client *c) {
     if(NULL == c) {
         return 0;
@@ -994,8 +3119,18 @@ uint8_t MQTTIsAutoReconnectEnabled(Client *c) {
     return c->isAutoReconnectEnabled;
 }
 
+/* Whether the last connect resumed a TLS session rather than doing a full handshake */
+uint8_t MQTTIsTlsSessionResumed(Client *c) {
+    if(NULL == c) {
+        return 0;
+    }
+
+    return c->networkStack.isSessionResumed;
+}
+
+/* A NULL handler removes the one registered before */
 MQTTReturnCode setDisconnectHandler(Client *c, disconnectHandler_t disconnectHandler) {
-    if(NULL == c || NULL == disconnectHandler) {
+    if(NULL == c) {
         return MQTT_NULL_VALUE_ERROR;
     }
 
@@ -1003,6 +3138,17 @@ MQTTReturnCode setDisconnectHandler(Client *c, disconnectHandler_t disconnectHan
     return SUCCESS;
 }
 
+MQTTReturnCode setMessageChunkHandler(Client *c, messageChunkHandler chunkHandler,
+                                      pApplicationHandler_t applicationHandler) {
+    if(NULL == c) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    c->messageChunkHandler = chunkHandler;
+    c->messageChunkApplicationHandler = applicationHandler;
+    return SUCCESS;
+}
+
 MQTTReturnCode setAutoReconnectEnabled(Client *c, uint8_t value) {
     if(NULL == c) {
         return FAILURE;
@@ -1011,6 +3157,47 @@ MQTTReturnCode setAutoReconnectEnabled(Client *c, uint8_t value) {
     return SUCCESS;
 }
 
+/* Publishes made while disconnected are stored in the queue instead of failing, and sent
+ * once the client is connected again. QoS1 and QoS2 messages from the queue report their
+ * acks to completeHandler. A NULL config turns the queue off, queued messages stay in
+ * its storage. Call it before the client is connected */
+MQTTReturnCode MQTTSetOfflineQueue(Client *c, MQTTOfflineQueueConfig *pConfig,
+                                   publishCompleteHandler completeHandler, pApplicationHandler_t applicationHandler) {
+    MQTTReturnCode rc = SUCCESS;
+
+    if(NULL == c) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    lockState(c);
+    c->isOfflineQueueEnabled = 0;
+    if(NULL != pConfig) {
+        rc = MQTTOfflineQueue_init(&(c->offlineQueue), pConfig);
+        if(SUCCESS == rc) {
+            c->offlineCompleteHandler = completeHandler;
+            c->offlineApplicationHandler = applicationHandler;
+            c->isOfflineQueueEnabled = 1;
+        }
+    }
+    unlockState(c);
+
+    return rc;
+}
+
+uint32_t MQTTGetOfflineQueueCount(Client *c) {
+    uint32_t count;
+
+    if(NULL == c || !c->isOfflineQueueEnabled) {
+        return 0;
+    }
+
+    lockState(c);
+    count = MQTTOfflineQueue_count(&(c->offlineQueue));
+    unlockState(c);
+
+    return count;
+}
+
 uint32_t MQTTGetNetworkDisconnectedCount(Client *c) {
     return c->counterNetworkDisconnected;
 }
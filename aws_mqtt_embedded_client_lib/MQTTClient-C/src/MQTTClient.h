@@ -26,6 +26,9 @@
 #include "MQTTReturnCodes.h"
 #include "MQTTMessage.h"
 #include "MQTTPacket.h"
+#include "MQTTTopicTrie.h"
+#include "MQTTOfflineQueue.h"
+#include "MQTTReconnectPolicy.h"
 
 /* AWS Specific header files */
 #include "aws_iot_config.h"
@@ -33,9 +36,46 @@
 /* Platform specific implementation header files */
 #include "network_interface.h"
 #include "timer_interface.h"
+#include "threads_interface.h"
 
 #define MAX_PACKET_ID 65535
-#define MAX_MESSAGE_HANDLERS AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS
+/* Maximum number of message handlers in a subscription pool, indices must fit the trie */
+#define MAX_MESSAGE_HANDLERS (MQTT_TOPIC_TRIE_NIL - 1)
+
+#ifndef AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISHES
+#define AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISHES 8
+#endif
+#define MAX_INFLIGHT_PUBLISHES AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISHES
+
+#ifndef AWS_IOT_MQTT_MAX_INBOUND_QOS2
+#define AWS_IOT_MQTT_MAX_INBOUND_QOS2 16
+#endif
+#define MAX_INBOUND_QOS2 AWS_IOT_MQTT_MAX_INBOUND_QOS2
+/* The set of pending inbound QoS2 packet ids is kept at most half full */
+#define INBOUND_QOS2_TABLE_LEN (2 * MAX_INBOUND_QOS2)
+
+#ifndef AWS_IOT_MQTT_MAX_SUBSCRIBE_BATCH
+#define AWS_IOT_MQTT_MAX_SUBSCRIBE_BATCH 32
+#endif
+#define MAX_SUBSCRIBE_BATCH AWS_IOT_MQTT_MAX_SUBSCRIBE_BATCH
+
+#ifndef AWS_IOT_MQTT_RX_RING_LEN
+#define AWS_IOT_MQTT_RX_RING_LEN (AWS_IOT_MQTT_RX_BUF_LEN + 5)
+#endif
+#define RX_RING_LEN AWS_IOT_MQTT_RX_RING_LEN
+
+#ifndef AWS_IOT_MQTT_TX_STAGE_LEN
+#define AWS_IOT_MQTT_TX_STAGE_LEN 256
+#endif
+#define TX_STAGE_LEN AWS_IOT_MQTT_TX_STAGE_LEN
+
+#ifndef AWS_IOT_MQTT_OFFLINE_DRAIN_BATCH
+#define AWS_IOT_MQTT_OFFLINE_DRAIN_BATCH 16
+#endif
+#define OFFLINE_DRAIN_BATCH AWS_IOT_MQTT_OFFLINE_DRAIN_BATCH
+
+/* MQTTGetNextTimeout result while no timer is running */
+#define MQTT_NO_PENDING_TIMEOUT 0xFFFFFFFF
 
 #define MIN_RECONNECT_WAIT_INTERVAL AWS_IOT_MQTT_MIN_RECONNECT_WAIT_INTERVAL
 #define MAX_RECONNECT_WAIT_INTERVAL AWS_IOT_MQTT_MAX_RECONNECT_WAIT_INTERVAL
@@ -45,8 +85,12 @@ void NewTimer(Timer *);
 typedef struct Client Client;
 
 typedef struct MessageData MessageData;
+typedef struct PublishCompleteData PublishCompleteData;
+typedef struct MessageChunkData MessageChunkData;
 
 typedef void (*messageHandler)(MessageData *);
+typedef void (*publishCompleteHandler)(PublishCompleteData *);
+typedef void (*messageChunkHandler)(MessageChunkData *);
 typedef void (*pApplicationHandler_t)(void);
 typedef void (*disconnectHandler_t)(void);
 typedef int (*networkInitHandler_t)(Network *);
@@ -57,25 +101,88 @@ struct MessageData {
     pApplicationHandler_t applicationHandler;
 };
 
+/* Part of the payload of a PUBLISH too large for the read buffer. The chunks of one
+ * message are passed on in order, the last one has isFinal set. The chunk points into the
+ * receive ring, so unlike a message handler a chunk handler must not wait for an ack: no
+ * QoS1 or QoS2 MQTTPublish, no MQTTSubscribe and no MQTTUnsubscribe */
+struct MessageChunkData {
+    MQTTMessage *message;   /* Header fields, payloadlen is the length of the whole payload */
+    MQTTString *topicName;
+    uint32_t offset;        /* Position of the chunk in the payload */
+    unsigned char *chunk;
+    uint32_t chunkLen;
+    uint8_t isFinal;
+    pApplicationHandler_t applicationHandler;
+};
+
+struct PublishCompleteData {
+    uint16_t packetId;
+    MQTTReturnCode rc;
+    pApplicationHandler_t applicationHandler;
+    void *pApplicationContext;
+};
+
+struct MessageHandlers {
+    const char *topicFilter;
+    void (*fp) (MessageData *);
+    pApplicationHandler_t applicationHandler;
+    QoS qos;
+    uint16_t nextFree;      /* Next unused handler while this one is unused */
+};
+
+/* Storage for the subscriptions of one client, supplied by the caller of MQTTClient.
+ * The client can hold up to handlerCount subscriptions as long as their topic filters
+ * fit into trieNodeCount trie nodes, one node per distinct filter level. */
+typedef struct {
+    struct MessageHandlers *pHandlers;
+    uint16_t handlerCount;
+    MQTTTopicTrieNode *pTrieNodes;
+    uint16_t trieNodeCount;
+} MQTTSubscriptionPool;
+
 MQTTReturnCode MQTTConnect(Client *c, MQTTPacket_connectData *options);
 MQTTReturnCode MQTTPublish (Client *, const char *, MQTTMessage *);
+MQTTReturnCode MQTTPublishAsync(Client *c, const char *topicName, MQTTMessage *message,
+                                publishCompleteHandler completeHandler, pApplicationHandler_t applicationHandler,
+                                void *pApplicationContext);
+MQTTReturnCode MQTTPublishFromFd(Client *c, const char *topicName, MQTTMessage *message, int fd, int64_t offset);
+MQTTReturnCode MQTTSetPublishWindow(Client *c, uint32_t windowSize);
+MQTTReturnCode MQTTSetAdaptiveKeepalive(Client *c, uint32_t minIntervalSec);
+MQTTReturnCode MQTTSetReconnectPolicy(Client *c, const MQTTReconnectPolicyConfig *pConfig);
+MQTTReturnCode MQTTSetReconnectHint(Client *c, uint32_t delayMs);
+MQTTReturnCode MQTTSetFlushDelay(Client *c, uint32_t delayMs);
+MQTTReturnCode MQTTFlush(Client *c);
 MQTTReturnCode MQTTSubscribe(Client *c, const char *topicFilter, QoS qos,
                              messageHandler messageHandler, pApplicationHandler_t applicationHandler);
+MQTTReturnCode MQTTSubscribeMany(Client *c, uint32_t count, const char *topicFilters[], QoS qos[],
+                                 messageHandler messageHandler, pApplicationHandler_t applicationHandlers[],
+                                 QoS grantedQoS[]);
 MQTTReturnCode MQTTResubscribe(Client *c);
 MQTTReturnCode MQTTUnsubscribe(Client *c, const char *topicFilter);
 MQTTReturnCode MQTTDisconnect (Client *);
 MQTTReturnCode MQTTYield (Client *, uint32_t);
+MQTTReturnCode MQTTProcessReadable(Client *c);
+MQTTReturnCode MQTTProcessTimers(Client *c);
+int MQTTGetSocket(Client *c);
+uint32_t MQTTGetNextTimeout(Client *c);
 MQTTReturnCode MQTTAttemptReconnect(Client *c);
 
 uint8_t MQTTIsConnected(Client *);
 uint8_t MQTTIsAutoReconnectEnabled(Client *c);
+uint8_t MQTTIsTlsSessionResumed(Client *c);
 
 void setDefaultMessageHandler(Client *, messageHandler);
 MQTTReturnCode setDisconnectHandler(Client *c, disconnectHandler_t disconnectHandler);
+MQTTReturnCode setMessageChunkHandler(Client *c, messageChunkHandler chunkHandler,
+                                      pApplicationHandler_t applicationHandler);
 MQTTReturnCode setAutoReconnectEnabled(Client *c, uint8_t value);
+MQTTReturnCode MQTTSetOfflineQueue(Client *c, MQTTOfflineQueueConfig *pConfig,
+                                   publishCompleteHandler completeHandler, pApplicationHandler_t applicationHandler);
+uint32_t MQTTGetOfflineQueueCount(Client *c);
 
 MQTTReturnCode MQTTClient(Client *, uint32_t, unsigned char *, size_t, unsigned char *,
-                          size_t, uint8_t, networkInitHandler_t, TLSConnectParams *);
+                          size_t, MQTTSubscriptionPool *, uint8_t, networkInitHandler_t, TLSConnectParams *);
+void MQTTClientFree(Client *c);
 
 uint32_t MQTTGetNetworkDisconnectedCount(Client *c);
 void MQTTResetNetworkDisconnectedCount(Client *c);
@@ -89,8 +196,10 @@ struct Client {
     uint16_t nextPacketId;
 
     uint32_t commandTimeoutMs;
-    uint32_t keepAliveInterval;
-    uint32_t currentReconnectWaitInterval;
+    uint32_t keepAliveInterval;          /* Sent in CONNECT, the longest the client may stay silent */
+    uint32_t minKeepAliveInterval;       /* Adaptive keepalive starts from this after connecting, 0 if it is off */
+    uint32_t currentKeepAliveInterval;   /* Idle time in either direction after which a PINGREQ is sent */
+    uint32_t currentReconnectWaitInterval;   /* Delay before the next reconnect attempt, MQTT_RECONNECT_GIVE_UP once the policy gave up */
     uint32_t counterNetworkDisconnected;
 
     size_t bufSize;
@@ -99,20 +208,85 @@ struct Client {
     unsigned char *buf;  
     unsigned char *readbuf;
 
+    uint32_t rxRingStart;
+    uint32_t rxRingUsed;
+    uint32_t rxDiscardLen;
+    uint8_t isRxFailed;                  /* The last network read failed rather than timed out */
+    unsigned char rxRing[RX_RING_LEN];   /* Bytes received from the network that have not been parsed yet */
+
+    uint32_t rxStreamLeft;               /* Payload bytes of a streamed PUBLISH still to be passed on */
+    uint32_t rxStreamOffset;
+    MQTTMessage rxStreamMessage;
+    MQTTString rxStreamTopicName;        /* Points into readbuf, which holds the PUBLISH header */
+    uint8_t isRxStreamDuplicate;         /* The streamed PUBLISH is a QoS2 message that was passed on already */
+    messageChunkHandler messageChunkHandler;
+    pApplicationHandler_t messageChunkApplicationHandler;
+
+    uint32_t txStageUsed;
+    uint32_t txFlushDelayMs;             /* How long an asynchronous publish may wait in the stage, 0 to send it right away */
+    uint8_t isTxFlushTimerRunning;       /* An asynchronous publish is staged, it has to go out when txFlushTimer expires */
+    uint8_t isTxFailed;                  /* A write left a packet incomplete or lost staged ones, nothing more may be written. Changed with txLock and stateLock held, either is enough to read it */
+    Timer txFlushTimer;
+    unsigned char txStage[TX_STAGE_LEN]; /* Small packets not written yet, they go out ahead of the next write. Belongs to txLock */
+
     TLSConnectParams tlsConnectParams;
     MQTTPacket_connectData options;
 
     Network networkStack;
-    Timer pingTimer;
+    Timer pingTimer;                     /* Runs while a PINGREQ waits for its PINGRESP */
+    Timer txIdleTimer;                   /* Restarted by every write, belongs to txLock */
+    Timer rxIdleTimer;                   /* Restarted by every packet received */
     Timer reconnectDelayTimer;
+    MQTTReconnectPolicy reconnectPolicy; /* Belongs to stateLock, a disconnect handler may leave a hint in it */
 
-    struct MessageHandlers {
-        const char *topicFilter;
-        void (*fp) (MessageData *);
+    uint32_t publishWindowSize;
+    uint32_t inflightPublishCount;
+
+    struct InflightPublishes {
+        uint16_t packetId;
+        uint8_t isFree;
+        uint8_t isPubrecReceived;
+        uint8_t isBlocking;   /* MQTTPublish waits for this one, pApplicationContext is its result */
+        Timer ackTimer;
+        void (*fp) (PublishCompleteData *);
         pApplicationHandler_t applicationHandler;
-        QoS qos;
-    } messageHandlers[MAX_MESSAGE_HANDLERS];      /* Message handlers are indexed by subscription topic */
-    
+        void *pApplicationContext;
+    } inflightPublishes[MAX_INFLIGHT_PUBLISHES];   /* QoS1/QoS2 publishes awaiting an ack are indexed by packet id */
+
+    /* QoS2 publishes that were passed on and acknowledged with PUBREC but not yet released
+     * with PUBREL. Open addressing by packet id, 0 marks an unused slot. Belongs to rxLock */
+    uint16_t inboundQos2Ids[INBOUND_QOS2_TABLE_LEN];
+    uint16_t inboundQos2Count;
+
+    struct MessageHandlers *messageHandlers;      /* Message handlers are indexed by subscription topic */
+    uint16_t messageHandlerCount;
+    uint16_t freeMessageHandlerHead;              /* First unused message handler, MQTT_TOPIC_TRIE_NIL if all are used */
+
+    MQTTTopicTrie subscriptionTrie;               /* Maps an incoming topic to the index of its message handler */
+
+    uint8_t isOfflineQueueEnabled;
+    MQTTOfflineQueue offlineQueue;                /* Publishes made while disconnected, sent once connected again */
+    publishCompleteHandler offlineCompleteHandler;
+    pApplicationHandler_t offlineApplicationHandler;
+
+    struct PendingAck {
+        uint8_t packetType;     /* SUBACK or UNSUBACK, 0 while no command is waiting */
+        uint8_t isReceived;
+        uint16_t packetId;
+        uint32_t count;         /* Number of topic filters the SUBACK must grant or reject */
+        QoS *pGrantedQoS;
+        MQTTReturnCode rc;
+    } pendingAck;                                 /* The one SUBSCRIBE or UNSUBSCRIBE waiting for its ack */
+
+#ifdef _ENABLE_THREAD_SUPPORT_
+    IoT_Mutex_t txLock;                           /* Held while c->buf is used and the network is written or torn down */
+    IoT_Mutex_t rxLock;                           /* Held while c->readbuf, the receive ring or reading the network are used */
+    IoT_Mutex_t stateLock;                        /* Guards in-flight publishes, subscriptions, the pending ack and packet ids */
+    IoT_Cond_t stateChanged;                      /* Broadcast under stateLock when an ack arrives or rxLock is released */
+    IoT_Thread_Id_t rxLockOwner;                  /* The thread holding rxLock while isRxLockOwned is set. Belongs to stateLock */
+    uint8_t isRxLockOwned;
+#endif
+
     void (* defaultMessageHandler) (MessageData *);
     disconnectHandler_t disconnectHandler;
     networkInitHandler_t networkInitHandler;
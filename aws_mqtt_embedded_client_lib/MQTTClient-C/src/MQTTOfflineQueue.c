@@ -0,0 +1,318 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file MQTTOfflineQueue.c
+ * @brief Store-and-forward queue for messages published while the client is disconnected
+ */
+
+#include "MQTTOfflineQueue.h"
+
+#include <string.h>
+
+#define OFFLINE_QUEUE_MAGIC 0x514F514D  /* "MQOQ" */
+#define OFFLINE_RECORD_ALIGN 4
+
+/* Followed by the topic and the payload. A record length of 0 marks the unused end of the
+ * ring left behind when a record did not fit there and was written at offset 0 instead */
+typedef struct {
+    uint32_t recordLen;     /* Whole record, rounded up to OFFLINE_RECORD_ALIGN */
+    uint32_t expiresAt;     /* getTimeSec() value the message expires at, 0 for never */
+    uint32_t payloadLen;
+    uint16_t topicLen;
+    uint8_t qos;
+    uint8_t retained;
+} OfflineRecordHeader;
+
+static uint32_t alignRecordLen(uint32_t len) {
+    return (len + OFFLINE_RECORD_ALIGN - 1) & ~(uint32_t)(OFFLINE_RECORD_ALIGN - 1);
+}
+
+static OfflineRecordHeader *getRecord(MQTTOfflineQueue *pQueue, uint32_t pos) {
+    return (OfflineRecordHeader *)(pQueue->pRecords + pos);
+}
+
+/* Skips the unused end of the ring */
+static uint32_t normalizePos(MQTTOfflineQueue *pQueue, uint32_t pos) {
+    if(pos == pQueue->pHeader->recordsLen || 0 == getRecord(pQueue, pos)->recordLen) {
+        return 0;
+    }
+    return pos;
+}
+
+static uint8_t isRecordExpired(MQTTOfflineQueue *pQueue, OfflineRecordHeader *pRecord) {
+    if(0 == pRecord->expiresAt || NULL == pQueue->getTimeSec) {
+        return 0;
+    }
+    return (0 <= (int32_t)(pQueue->getTimeSec() - pRecord->expiresAt)) ? 1 : 0;
+}
+
+/* The magic is cleared first so that a process dying half way leaves a queue init formats again */
+static void formatQueue(MQTTOfflineQueue *pQueue, uint32_t recordsLen) {
+    MQTTOfflineQueueHeader *pHeader = pQueue->pHeader;
+
+    pHeader->magic = 0;
+    pHeader->recordsLen = recordsLen;
+    pHeader->head = 0;
+    pHeader->tail = 0;
+    pHeader->count = 0;
+    pHeader->magic = OFFLINE_QUEUE_MAGIC;
+    pQueue->usedLen = 0;
+}
+
+/* Walks the records of storage that already held a queue, returns 0 if they don't add up */
+static uint8_t recoverQueue(MQTTOfflineQueue *pQueue, uint32_t recordsLen) {
+    MQTTOfflineQueueHeader *pHeader = pQueue->pHeader;
+    OfflineRecordHeader *pRecord;
+    uint32_t pos, usedLen = 0, count = 0;
+
+    if(OFFLINE_QUEUE_MAGIC != pHeader->magic || recordsLen != pHeader->recordsLen
+       || recordsLen <= pHeader->head || recordsLen <= pHeader->tail
+       || 0 != ((pHeader->head | pHeader->tail) & (OFFLINE_RECORD_ALIGN - 1))) {
+        return 0;
+    }
+
+    pos = pHeader->head;
+    if(pos == pHeader->tail && 0 == pHeader->count) {
+        pQueue->usedLen = 0;
+        return 1;
+    }
+
+    do {
+        pRecord = getRecord(pQueue, pos);
+        if(0 == pRecord->recordLen) {
+            if(0 == pos) {
+                return 0;
+            }
+            usedLen += recordsLen - pos;
+            pos = 0;
+            continue;
+        }
+        if(sizeof(OfflineRecordHeader) > pRecord->recordLen || recordsLen - pos < pRecord->recordLen
+           || 0 != (pRecord->recordLen & (OFFLINE_RECORD_ALIGN - 1))
+           || pRecord->recordLen - sizeof(OfflineRecordHeader) < pRecord->topicLen
+           || pRecord->recordLen - sizeof(OfflineRecordHeader) - pRecord->topicLen < pRecord->payloadLen
+           || QOS2 < pRecord->qos) {
+            return 0;
+        }
+        usedLen += pRecord->recordLen;
+        count++;
+        pos += pRecord->recordLen;
+        if(pos == recordsLen) {
+            pos = 0;
+        }
+    } while(pos != pHeader->tail && usedLen <= recordsLen);
+
+    if(recordsLen < usedLen) {
+        return 0;
+    }
+
+    pHeader->count = count;
+    pQueue->usedLen = usedLen;
+    return 1;
+}
+
+MQTTReturnCode MQTTOfflineQueue_init(MQTTOfflineQueue *pQueue, MQTTOfflineQueueConfig *pConfig) {
+    uint32_t recordsLen;
+
+    if(NULL == pQueue || NULL == pConfig || NULL == pConfig->pStorage) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    if(0 != ((uintptr_t)pConfig->pStorage & (OFFLINE_RECORD_ALIGN - 1))
+       || sizeof(MQTTOfflineQueueHeader) + sizeof(OfflineRecordHeader) + OFFLINE_RECORD_ALIGN > pConfig->storageLen
+       || 0xFFFFFFFF < (uint64_t)pConfig->storageLen) {
+        return FAILURE;
+    }
+
+    recordsLen = (uint32_t)(pConfig->storageLen - sizeof(MQTTOfflineQueueHeader))
+                 & ~(uint32_t)(OFFLINE_RECORD_ALIGN - 1);
+
+    pQueue->pHeader = (MQTTOfflineQueueHeader *)pConfig->pStorage;
+    pQueue->pRecords = pConfig->pStorage + sizeof(MQTTOfflineQueueHeader);
+    pQueue->pinnedCount = 0;
+    pQueue->droppedCount = 0;
+    pQueue->dropPolicy = pConfig->dropPolicy;
+    pQueue->defaultTtlSec = pConfig->defaultTtlSec;
+    pQueue->getTimeSec = pConfig->getTimeSec;
+
+    if(!recoverQueue(pQueue, recordsLen)) {
+        formatQueue(pQueue, recordsLen);
+    }
+
+    return SUCCESS;
+}
+
+/* Finds room for a record of recordLen bytes, returns 0 if there is none */
+static uint8_t findSpace(MQTTOfflineQueue *pQueue, uint32_t recordLen, uint32_t *pPos) {
+    MQTTOfflineQueueHeader *pHeader = pQueue->pHeader;
+
+    if(pHeader->tail > pHeader->head || 0 == pHeader->count) {
+        if(pHeader->recordsLen - pHeader->tail >= recordLen) {
+            *pPos = pHeader->tail;
+            return 1;
+        }
+        if(pHeader->head >= recordLen) {
+            *pPos = 0;
+            return 1;
+        }
+        return 0;
+    }
+
+    if(pHeader->tail < pHeader->head && pHeader->head - pHeader->tail >= recordLen) {
+        *pPos = pHeader->tail;
+        return 1;
+    }
+    return 0;
+}
+
+/* Expired messages at the head make room before anything else is dropped, unless they are being sent */
+static void dropExpiredHead(MQTTOfflineQueue *pQueue) {
+    while(0 == pQueue->pinnedCount && 0 < pQueue->pHeader->count
+          && isRecordExpired(pQueue, getRecord(pQueue, normalizePos(pQueue, pQueue->pHeader->head)))) {
+        MQTTOfflineQueue_pop(pQueue, 1);
+        pQueue->droppedCount++;
+    }
+}
+
+MQTTReturnCode MQTTOfflineQueue_push(MQTTOfflineQueue *pQueue, const char *pTopic, MQTTMessage *pMessage,
+                                     uint32_t ttlSec) {
+    MQTTOfflineQueueHeader *pHeader;
+    OfflineRecordHeader *pRecord;
+    size_t topicLen;
+    uint32_t recordLen, pos;
+
+    if(NULL == pQueue || NULL == pTopic || NULL == pMessage
+       || (NULL == pMessage->payload && 0 < pMessage->payloadlen)) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    pHeader = pQueue->pHeader;
+    topicLen = strlen(pTopic);
+    if(0xFFFF < topicLen) {
+        return FAILURE;
+    }
+    if(pHeader->recordsLen < pMessage->payloadlen
+       || pHeader->recordsLen - pMessage->payloadlen < sizeof(OfflineRecordHeader) + topicLen + OFFLINE_RECORD_ALIGN) {
+        return MQTT_OFFLINE_QUEUE_FULL_ERROR;
+    }
+    recordLen = alignRecordLen((uint32_t)(sizeof(OfflineRecordHeader) + topicLen + pMessage->payloadlen));
+
+    dropExpiredHead(pQueue);
+    for(;;) {
+        if(0 == pHeader->count && 0 != pHeader->head) {
+            /* Lets the record use the whole ring */
+            formatQueue(pQueue, pHeader->recordsLen);
+        }
+        if(findSpace(pQueue, recordLen, &pos)) {
+            break;
+        }
+        if(MQTT_OFFLINE_DROP_OLDEST != pQueue->dropPolicy || 0 < pQueue->pinnedCount || 0 == pHeader->count) {
+            return MQTT_OFFLINE_QUEUE_FULL_ERROR;
+        }
+        MQTTOfflineQueue_pop(pQueue, 1);
+        pQueue->droppedCount++;
+    }
+
+    /* The record is complete before the tail makes it part of the queue */
+    pRecord = getRecord(pQueue, pos);
+    pRecord->recordLen = recordLen;
+    pRecord->payloadLen = (uint32_t)pMessage->payloadlen;
+    pRecord->topicLen = (uint16_t)topicLen;
+    pRecord->qos = (uint8_t)pMessage->qos;
+    pRecord->retained = pMessage->retained;
+    if(0 == ttlSec) {
+        ttlSec = pQueue->defaultTtlSec;
+    }
+    pRecord->expiresAt = 0;
+    if(0 != ttlSec && NULL != pQueue->getTimeSec) {
+        pRecord->expiresAt = pQueue->getTimeSec() + ttlSec;
+        if(0 == pRecord->expiresAt) {
+            pRecord->expiresAt = 1;
+        }
+    }
+    memcpy((unsigned char *)(pRecord + 1), pTopic, topicLen);
+    if(0 < pMessage->payloadlen) {
+        memcpy((unsigned char *)(pRecord + 1) + topicLen, pMessage->payload, pMessage->payloadlen);
+    }
+
+    if(pos != pHeader->tail) {
+        getRecord(pQueue, pHeader->tail)->recordLen = 0;
+        pQueue->usedLen += pHeader->recordsLen - pHeader->tail;
+    }
+    pQueue->usedLen += recordLen;
+    pos += recordLen;
+    pHeader->tail = (pos == pHeader->recordsLen) ? 0 : pos;
+    pHeader->count++;
+
+    return SUCCESS;
+}
+
+void MQTTOfflineQueue_begin(MQTTOfflineQueue *pQueue, MQTTOfflineQueueCursor *pCursor) {
+    pCursor->pos = pQueue->pHeader->head;
+    pCursor->left = pQueue->pHeader->count;
+}
+
+uint8_t MQTTOfflineQueue_next(MQTTOfflineQueue *pQueue, MQTTOfflineQueueCursor *pCursor, MQTTOfflineMessage *pMessage) {
+    OfflineRecordHeader *pRecord;
+
+    if(0 == pCursor->left) {
+        return 0;
+    }
+
+    pCursor->pos = normalizePos(pQueue, pCursor->pos);
+    pRecord = getRecord(pQueue, pCursor->pos);
+
+    pMessage->pTopic = (const char *)(pRecord + 1);
+    pMessage->topicLen = pRecord->topicLen;
+    pMessage->isExpired = isRecordExpired(pQueue, pRecord);
+    pMessage->message.qos = (QoS)pRecord->qos;
+    pMessage->message.retained = pRecord->retained;
+    pMessage->message.dup = 0;
+    pMessage->message.id = 0;
+    pMessage->message.payload = (unsigned char *)(pRecord + 1) + pRecord->topicLen;
+    pMessage->message.payloadlen = pRecord->payloadLen;
+    pMessage->message.ttlSec = 0;
+
+    pCursor->pos += pRecord->recordLen;
+    pCursor->left--;
+    return 1;
+}
+
+/* The count goes down before the head moves, init recounts from the head anyway */
+void MQTTOfflineQueue_pop(MQTTOfflineQueue *pQueue, uint32_t count) {
+    MQTTOfflineQueueHeader *pHeader = pQueue->pHeader;
+    uint32_t pos;
+
+    while(0 < count && 0 < pHeader->count) {
+        pos = normalizePos(pQueue, pHeader->head);
+        if(pos != pHeader->head) {
+            pQueue->usedLen -= pHeader->recordsLen - pHeader->head;
+        }
+        pQueue->usedLen -= getRecord(pQueue, pos)->recordLen;
+        pos += getRecord(pQueue, pos)->recordLen;
+        pHeader->count--;
+        pHeader->head = (pos == pHeader->recordsLen) ? 0 : pos;
+        count--;
+    }
+
+    if(0 == pHeader->count) {
+        pQueue->usedLen = 0;
+    }
+}
+
+uint32_t MQTTOfflineQueue_count(MQTTOfflineQueue *pQueue) {
+    return (NULL == pQueue || NULL == pQueue->pHeader) ? 0 : pQueue->pHeader->count;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file MQTTOfflineQueue.h
+ * @brief Store-and-forward queue for messages published while the client is disconnected
+ *
+ * Messages are kept in a ring inside caller supplied storage, oldest first, each one as a
+ * single contiguous record holding its topic and payload.  That lets the client send a
+ * queued payload straight from the storage once the connection is back.
+ *
+ * All state lives in the storage itself, so when the storage is a memory mapped file the
+ * queue is picked up again by MQTTOfflineQueue_init after the process restarts.  Records
+ * are written before the header fields that publish them, and init walks the records
+ * again instead of trusting the header's counters, so a process that dies in the middle
+ * of a push or pop leaves a queue that can still be read.
+ */
+
+#ifndef __MQTT_OFFLINE_QUEUE_H
+#define __MQTT_OFFLINE_QUEUE_H
+
+#include "stdint.h"
+#include "stddef.h"
+
+#include "MQTTReturnCodes.h"
+#include "MQTTMessage.h"
+
+/**
+ * @brief What to do with a message that does not fit the queue
+ */
+typedef enum {
+    MQTT_OFFLINE_DROP_NEWEST = 0,   ///< The new message is rejected
+    MQTT_OFFLINE_DROP_OLDEST = 1    ///< The oldest messages are dropped until the new one fits
+} MQTTOfflineDropPolicy;
+
+/**
+ * @brief Storage and policies of an offline queue
+ */
+typedef struct {
+    unsigned char *pStorage;            ///< Aligned to 4 bytes, for example a memory mapped file
+    size_t storageLen;
+    MQTTOfflineDropPolicy dropPolicy;
+    uint32_t defaultTtlSec;             ///< Used for messages pushed without a TTL, 0 for no expiry
+    uint32_t (*getTimeSec)(void);       ///< Clock for TTLs that keeps counting across restarts, such as time(). NULL disables TTLs
+} MQTTOfflineQueueConfig;
+
+/**
+ * @brief Layout of the start of the storage
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t recordsLen;    ///< Bytes available for records, a different size formats the queue
+    uint32_t head;          ///< Offset of the oldest record
+    uint32_t tail;          ///< Offset the next record is written to
+    uint32_t count;         ///< Number of queued messages, tells a full ring from an empty one
+} MQTTOfflineQueueHeader;
+
+typedef struct {
+    MQTTOfflineQueueHeader *pHeader;
+    unsigned char *pRecords;
+    uint32_t usedLen;           ///< Bytes taken by records, and by the unused end of the ring after a wrap
+    uint32_t pinnedCount;       ///< Messages at the head that are being sent and must not be dropped
+    uint32_t droppedCount;      ///< Messages dropped because the queue was full or they expired
+    MQTTOfflineDropPolicy dropPolicy;
+    uint32_t defaultTtlSec;
+    uint32_t (*getTimeSec)(void);
+} MQTTOfflineQueue;
+
+/**
+ * @brief Position of a message while walking the queue from its head
+ */
+typedef struct {
+    uint32_t pos;
+    uint32_t left;              ///< Messages not yet visited
+} MQTTOfflineQueueCursor;
+
+/**
+ * @brief A queued message, pointing into the storage
+ */
+typedef struct {
+    MQTTMessage message;        ///< The payload points into the storage, id is 0
+    const char *pTopic;         ///< Not NUL terminated
+    uint16_t topicLen;
+    uint8_t isExpired;
+} MQTTOfflineMessage;
+
+MQTTReturnCode MQTTOfflineQueue_init(MQTTOfflineQueue *pQueue, MQTTOfflineQueueConfig *pConfig);
+MQTTReturnCode MQTTOfflineQueue_push(MQTTOfflineQueue *pQueue, const char *pTopic, MQTTMessage *pMessage,
+                                     uint32_t ttlSec);
+void MQTTOfflineQueue_begin(MQTTOfflineQueue *pQueue, MQTTOfflineQueueCursor *pCursor);
+uint8_t MQTTOfflineQueue_next(MQTTOfflineQueue *pQueue, MQTTOfflineQueueCursor *pCursor, MQTTOfflineMessage *pMessage);
+void MQTTOfflineQueue_pop(MQTTOfflineQueue *pQueue, uint32_t count);
+uint32_t MQTTOfflineQueue_count(MQTTOfflineQueue *pQueue);
+
+#endif //__MQTT_OFFLINE_QUEUE_H
@@ -0,0 +1,164 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file MQTTReconnectPolicy.c
+ * @brief Delays between the attempts of the auto-reconnect
+ */
+
+#include "MQTTReconnectPolicy.h"
+
+#include "string.h"
+
+/* Used when no seed was given, xorshift never leaves 0 */
+#define RECONNECT_DEFAULT_SEED 0x9E3779B9
+
+static uint32_t nextRandom(MQTTReconnectPolicy *pPolicy) {
+    uint32_t x = pPolicy->randomState;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    pPolicy->randomState = x;
+
+    return x;
+}
+
+/* Uniform enough for delays, lo <= hi */
+static uint32_t randomBetween(MQTTReconnectPolicy *pPolicy, uint32_t lo, uint32_t hi) {
+    uint64_t span = (uint64_t)hi - lo + 1;
+
+    return lo + (uint32_t)(nextRandom(pPolicy) % span);
+}
+
+static uint32_t capDelay(MQTTReconnectPolicy *pPolicy, uint64_t delayMs) {
+    if(pPolicy->config.maxDelayMs < delayMs) {
+        return pPolicy->config.maxDelayMs;
+    }
+
+    return (uint32_t)delayMs;
+}
+
+void MQTTReconnectPolicy_init(MQTTReconnectPolicy *pPolicy, const MQTTReconnectPolicyConfig *pConfig) {
+    memcpy(&(pPolicy->config), pConfig, sizeof(MQTTReconnectPolicyConfig));
+    if(pPolicy->config.maxDelayMs < pPolicy->config.minDelayMs) {
+        pPolicy->config.maxDelayMs = pPolicy->config.minDelayMs;
+    }
+    if(MQTT_RECONNECT_CUSTOM == pPolicy->config.strategy && NULL == pPolicy->config.customHandler) {
+        pPolicy->config.strategy = MQTT_RECONNECT_EXPONENTIAL;
+    }
+
+    pPolicy->randomState = RECONNECT_DEFAULT_SEED;
+    pPolicy->isSeeded = 0;
+    if(0 != pConfig->seed) {
+        MQTTReconnectPolicy_seed(pPolicy, pConfig->seed);
+    }
+    pPolicy->hintMs = 0;
+    MQTTReconnectPolicy_reset(pPolicy);
+}
+
+/* Doubling from minDelayMs until the delay would pass maxDelayMs, then giving up, as the
+ * client always did */
+void MQTTReconnectPolicy_legacyConfig(MQTTReconnectPolicyConfig *pConfig, uint32_t minDelayMs, uint32_t maxDelayMs) {
+    uint64_t delayMs = minDelayMs;
+
+    memset(pConfig, 0, sizeof(MQTTReconnectPolicyConfig));
+    pConfig->strategy = MQTT_RECONNECT_EXPONENTIAL;
+    pConfig->minDelayMs = minDelayMs;
+    pConfig->maxDelayMs = maxDelayMs;
+
+    if(0 == minDelayMs) {
+        /* Doubling 0 never passed the maximum */
+        return;
+    }
+    while(delayMs <= maxDelayMs) {
+        pConfig->maxAttempts++;
+        delayMs *= 2;
+    }
+}
+
+void MQTTReconnectPolicy_seed(MQTTReconnectPolicy *pPolicy, uint32_t seed) {
+    /* Spreads seeds that differ in a few bits only, such as consecutive serial numbers */
+    seed ^= seed >> 16;
+    seed *= 0x7FEB352D;
+    seed ^= seed >> 15;
+    seed *= 0x846CA68B;
+    seed ^= seed >> 16;
+
+    pPolicy->randomState = (0 != seed) ? seed : RECONNECT_DEFAULT_SEED;
+    pPolicy->isSeeded = 1;
+}
+
+/* Starts over for a new disconnect. A pending hint is kept, the server may have sent it
+ * just before the connection was closed */
+void MQTTReconnectPolicy_reset(MQTTReconnectPolicy *pPolicy) {
+    pPolicy->attempt = 0;
+    pPolicy->previousDelayMs = 0;
+}
+
+void MQTTReconnectPolicy_hint(MQTTReconnectPolicy *pPolicy, uint32_t delayMs) {
+    pPolicy->hintMs = delayMs;
+}
+
+uint32_t MQTTReconnectPolicy_nextDelay(MQTTReconnectPolicy *pPolicy) {
+    MQTTReconnectPolicyConfig *pConfig = &(pPolicy->config);
+    uint32_t delayMs;
+    uint64_t jitterEndMs;
+
+    if(0 != pConfig->maxAttempts && pConfig->maxAttempts <= pPolicy->attempt) {
+        return MQTT_RECONNECT_GIVE_UP;
+    }
+
+    if(0 != pPolicy->hintMs) {
+        /* Not capped, the server knows best when it will take connections again */
+        delayMs = pPolicy->hintMs;
+        if(MQTT_RECONNECT_DECORRELATED_JITTER == pConfig->strategy) {
+            /* Spread over half the hint again, so the fleet does not all come back at once */
+            jitterEndMs = (uint64_t)delayMs + delayMs / 2;
+            if(MQTT_RECONNECT_GIVE_UP <= jitterEndMs) {
+                jitterEndMs = MQTT_RECONNECT_GIVE_UP - 1;
+            }
+            delayMs = randomBetween(pPolicy, delayMs, (uint32_t)jitterEndMs);
+        }
+        pPolicy->hintMs = 0;
+    } else if(MQTT_RECONNECT_CUSTOM == pConfig->strategy) {
+        delayMs = pConfig->customHandler(pConfig->pCustomContext, pPolicy->attempt, pPolicy->previousDelayMs);
+        if(MQTT_RECONNECT_GIVE_UP == delayMs) {
+            return MQTT_RECONNECT_GIVE_UP;
+        }
+        delayMs = capDelay(pPolicy, delayMs);
+    } else if(MQTT_RECONNECT_DECORRELATED_JITTER == pConfig->strategy) {
+        if(0 == pPolicy->previousDelayMs) {
+            delayMs = randomBetween(pPolicy, pConfig->minDelayMs, capDelay(pPolicy, (uint64_t)pConfig->minDelayMs * 3));
+        } else {
+            delayMs = capDelay(pPolicy, (uint64_t)pPolicy->previousDelayMs * 3);
+            if(delayMs < pConfig->minDelayMs) {
+                delayMs = pConfig->minDelayMs;
+            }
+            delayMs = randomBetween(pPolicy, pConfig->minDelayMs, delayMs);
+        }
+    } else {
+        if(0 == pPolicy->previousDelayMs) {
+            delayMs = pConfig->minDelayMs;
+        } else {
+            delayMs = capDelay(pPolicy, (uint64_t)pPolicy->previousDelayMs * 2);
+        }
+    }
+
+    pPolicy->attempt++;
+    pPolicy->previousDelayMs = delayMs;
+
+    return delayMs;
+}
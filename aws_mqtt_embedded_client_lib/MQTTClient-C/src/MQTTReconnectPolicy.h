@@ -0,0 +1,82 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file MQTTReconnectPolicy.h
+ * @brief Delays between the attempts of the auto-reconnect
+ *
+ * The policy hands out the wait before each reconnect attempt, or tells the client to give
+ * up.  Plain doubling makes every device that lost the broker at the same moment come back
+ * at the same moments too, so a fleet keeps hitting the broker in waves.  Decorrelated
+ * jitter spreads those attempts out; each device seeds its own random sequence so that
+ * devices running the same firmware do not pick the same delays.
+ *
+ * The server can also ask for a delay, for example by refusing the connection with
+ * "server unavailable".  A hint replaces the next delay once, jittered the same way.
+ */
+
+#ifndef __MQTT_RECONNECT_POLICY_H
+#define __MQTT_RECONNECT_POLICY_H
+
+#include "stdint.h"
+#include "stddef.h"
+
+/* MQTTReconnectPolicy_nextDelay result once the policy has run out of attempts */
+#define MQTT_RECONNECT_GIVE_UP 0xFFFFFFFF
+
+/**
+ * @brief How the delay grows from one attempt to the next
+ */
+typedef enum {
+    MQTT_RECONNECT_EXPONENTIAL = 0,             ///< Doubles from minDelayMs, the same on every device
+    MQTT_RECONNECT_DECORRELATED_JITTER = 1,     ///< Random between minDelayMs and three times the previous delay
+    MQTT_RECONNECT_CUSTOM = 2                   ///< Asks customHandler
+} MQTTReconnectStrategy;
+
+/**
+ * @brief Returns the delay before an attempt, or MQTT_RECONNECT_GIVE_UP
+ *
+ * attempt counts from 0 for the first attempt after the connection was lost, previousDelayMs
+ * is 0 for that attempt.  The result is capped at maxDelayMs.
+ */
+typedef uint32_t (*reconnectDelayHandler)(void *pContext, uint32_t attempt, uint32_t previousDelayMs);
+
+typedef struct {
+    MQTTReconnectStrategy strategy;
+    uint32_t minDelayMs;                ///< First delay, and the smallest one the jitter picks
+    uint32_t maxDelayMs;                ///< No delay is longer, except one asked for by the server
+    uint32_t maxAttempts;               ///< Attempts before giving up, 0 to keep trying for ever
+    uint32_t seed;                      ///< Per device seed of the jitter, for example from the MAC address. 0 lets the client derive one from its client ID
+    reconnectDelayHandler customHandler;
+    void *pCustomContext;
+} MQTTReconnectPolicyConfig;
+
+typedef struct {
+    MQTTReconnectPolicyConfig config;
+    uint32_t attempt;                   ///< Delays handed out since the connection was lost
+    uint32_t previousDelayMs;
+    uint32_t randomState;
+    uint32_t hintMs;                    ///< Delay the server asked for, 0 if none
+    uint8_t isSeeded;
+} MQTTReconnectPolicy;
+
+void MQTTReconnectPolicy_init(MQTTReconnectPolicy *pPolicy, const MQTTReconnectPolicyConfig *pConfig);
+void MQTTReconnectPolicy_legacyConfig(MQTTReconnectPolicyConfig *pConfig, uint32_t minDelayMs, uint32_t maxDelayMs);
+void MQTTReconnectPolicy_seed(MQTTReconnectPolicy *pPolicy, uint32_t seed);
+void MQTTReconnectPolicy_reset(MQTTReconnectPolicy *pPolicy);
+void MQTTReconnectPolicy_hint(MQTTReconnectPolicy *pPolicy, uint32_t delayMs);
+uint32_t MQTTReconnectPolicy_nextDelay(MQTTReconnectPolicy *pPolicy);
+
+#endif //__MQTT_RECONNECT_POLICY_H
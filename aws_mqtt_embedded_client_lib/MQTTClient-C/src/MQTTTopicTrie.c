@@ -0,0 +1,325 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file MQTTTopicTrie.c
+ * @brief Subscription index used to find the message handler for an incoming topic
+ */
+
+#include "MQTTTopicTrie.h"
+
+#include <string.h>
+
+typedef struct {
+    MQTTTopicTrie *pTrie;
+    const char *pTopicEnd;
+    uint32_t plusHash;
+    uint32_t hashHash;
+    uint16_t bestHandlerIndex;
+} TopicMatchContext;
+
+/* FNV-1a */
+static uint32_t hashLevel(const char *pLevel, size_t levelLen) {
+    uint32_t hash = 2166136261u;
+    size_t i;
+
+    for(i = 0; i < levelLen; i++) {
+        hash ^= (unsigned char)pLevel[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static size_t getLevelLength(const char *pLevel, const char *pEnd) {
+    const char *pCur = pLevel;
+
+    while(pCur < pEnd && '/' != *pCur) {
+        pCur++;
+    }
+
+    return (size_t)(pCur - pLevel);
+}
+
+static uint16_t getBucket(MQTTTopicTrie *pTrie, uint16_t parent, uint32_t levelHash) {
+    return (uint16_t)((levelHash ^ ((uint32_t)parent * 2654435761u)) % pTrie->nodeCount);
+}
+
+static uint16_t findChild(MQTTTopicTrie *pTrie, uint16_t parent, uint32_t levelHash, size_t levelLen) {
+    uint16_t node = pTrie->pNodes[getBucket(pTrie, parent, levelHash)].bucketHead;
+
+    while(MQTT_TOPIC_TRIE_NIL != node) {
+        if(pTrie->pNodes[node].parent == parent && pTrie->pNodes[node].levelHash == levelHash
+           && pTrie->pNodes[node].levelLen == levelLen) {
+            break;
+        }
+        node = pTrie->pNodes[node].nextInBucket;
+    }
+
+    return node;
+}
+
+static uint16_t allocNode(MQTTTopicTrie *pTrie, uint16_t parent, uint32_t levelHash, size_t levelLen) {
+    uint16_t node = pTrie->freeHead;
+    uint16_t bucket;
+
+    if(MQTT_TOPIC_TRIE_NIL == node) {
+        return MQTT_TOPIC_TRIE_NIL;
+    }
+
+    pTrie->freeHead = pTrie->pNodes[node].nextInBucket;
+    pTrie->freeCount--;
+
+    pTrie->pNodes[node].levelHash = levelHash;
+    pTrie->pNodes[node].levelLen = (uint16_t)levelLen;
+    pTrie->pNodes[node].parent = parent;
+    pTrie->pNodes[node].childCount = 0;
+    pTrie->pNodes[node].filterCount = 0;
+    pTrie->pNodes[node].handlerIndex = MQTT_TOPIC_TRIE_NIL;
+
+    bucket = getBucket(pTrie, parent, levelHash);
+    pTrie->pNodes[node].nextInBucket = pTrie->pNodes[bucket].bucketHead;
+    pTrie->pNodes[bucket].bucketHead = node;
+
+    if(MQTT_TOPIC_TRIE_NIL != parent) {
+        pTrie->pNodes[parent].childCount++;
+    }
+
+    return node;
+}
+
+static void freeNode(MQTTTopicTrie *pTrie, uint16_t node) {
+    uint16_t *pLink = &(pTrie->pNodes[getBucket(pTrie, pTrie->pNodes[node].parent,
+                                                pTrie->pNodes[node].levelHash)].bucketHead);
+
+    while(node != *pLink) {
+        pLink = &(pTrie->pNodes[*pLink].nextInBucket);
+    }
+    *pLink = pTrie->pNodes[node].nextInBucket;
+
+    if(MQTT_TOPIC_TRIE_NIL != pTrie->pNodes[node].parent) {
+        pTrie->pNodes[pTrie->pNodes[node].parent].childCount--;
+    }
+
+    pTrie->pNodes[node].nextInBucket = pTrie->freeHead;
+    pTrie->freeHead = node;
+    pTrie->freeCount++;
+}
+
+/* Returns the node at which the filter ends, MQTT_TOPIC_TRIE_NIL if it is not in the trie */
+static uint16_t findFilter(MQTTTopicTrie *pTrie, const char *pTopicFilter) {
+    const char *pLevel = pTopicFilter;
+    const char *pEnd = pTopicFilter + strlen(pTopicFilter);
+    uint16_t node = MQTT_TOPIC_TRIE_NIL;
+    size_t levelLen;
+
+    while(1) {
+        levelLen = getLevelLength(pLevel, pEnd);
+        node = findChild(pTrie, node, hashLevel(pLevel, levelLen), levelLen);
+        if(MQTT_TOPIC_TRIE_NIL == node || pLevel + levelLen == pEnd) {
+            break;
+        }
+        pLevel += levelLen + 1;
+    }
+
+    return node;
+}
+
+static void matchLevel(TopicMatchContext *pCtx, uint16_t parent, const char *pLevel);
+
+static void matchNode(TopicMatchContext *pCtx, uint16_t node, const char *pLevelEnd) {
+    MQTTTopicTrieNode *pNode;
+
+    if(MQTT_TOPIC_TRIE_NIL == node) {
+        return;
+    }
+
+    pNode = &(pCtx->pTrie->pNodes[node]);
+    if(pLevelEnd == pCtx->pTopicEnd) {
+        if(0 < pNode->filterCount && pNode->handlerIndex < pCtx->bestHandlerIndex) {
+            pCtx->bestHandlerIndex = pNode->handlerIndex;
+        }
+    } else if(0 < pNode->childCount) {
+        matchLevel(pCtx, node, pLevelEnd + 1);
+    }
+}
+
+static void matchLevel(TopicMatchContext *pCtx, uint16_t parent, const char *pLevel) {
+    size_t levelLen = getLevelLength(pLevel, pCtx->pTopicEnd);
+    uint16_t node;
+
+    /* '#' takes whatever is left of the topic, starting with a non empty level */
+    if(0 < levelLen) {
+        node = findChild(pCtx->pTrie, parent, pCtx->hashHash, 1);
+        if(MQTT_TOPIC_TRIE_NIL != node && 0 < pCtx->pTrie->pNodes[node].filterCount
+           && pCtx->pTrie->pNodes[node].handlerIndex < pCtx->bestHandlerIndex) {
+            pCtx->bestHandlerIndex = pCtx->pTrie->pNodes[node].handlerIndex;
+        }
+    }
+
+    matchNode(pCtx, findChild(pCtx->pTrie, parent, hashLevel(pLevel, levelLen), levelLen), pLevel + levelLen);
+
+    /* '+' takes exactly one non empty level */
+    if(0 < levelLen) {
+        matchNode(pCtx, findChild(pCtx->pTrie, parent, pCtx->plusHash, 1), pLevel + levelLen);
+    }
+}
+
+MQTTReturnCode MQTTTopicTrie_init(MQTTTopicTrie *pTrie, MQTTTopicTrieNode *pNodes, uint16_t nodeCount) {
+    uint16_t i;
+
+    if(NULL == pTrie || NULL == pNodes) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    if(0 == nodeCount || MQTT_TOPIC_TRIE_NIL == nodeCount) {
+        return FAILURE;
+    }
+
+    for(i = 0; i < nodeCount; i++) {
+        pNodes[i].bucketHead = MQTT_TOPIC_TRIE_NIL;
+        pNodes[i].nextInBucket = (uint16_t)(i + 1);
+        pNodes[i].filterCount = 0;
+        pNodes[i].childCount = 0;
+    }
+    pNodes[nodeCount - 1].nextInBucket = MQTT_TOPIC_TRIE_NIL;
+
+    pTrie->pNodes = pNodes;
+    pTrie->nodeCount = nodeCount;
+    pTrie->freeCount = nodeCount;
+    pTrie->freeHead = 0;
+
+    return SUCCESS;
+}
+
+/**
+ * Checks that inserting the filter cannot run out of nodes, so that the caller can
+ * find out before subscribing with the server
+ */
+uint8_t MQTTTopicTrie_hasRoomFor(MQTTTopicTrie *pTrie, const char *pTopicFilter) {
+    uint32_t levels = 1;
+    const char *pCur;
+
+    if(NULL == pTrie || NULL == pTopicFilter) {
+        return 0;
+    }
+
+    for(pCur = pTopicFilter; '\0' != *pCur; pCur++) {
+        if('/' == *pCur) {
+            levels++;
+        }
+    }
+
+    return (levels <= pTrie->freeCount) ? 1 : 0;
+}
+
+MQTTReturnCode MQTTTopicTrie_insert(MQTTTopicTrie *pTrie, const char *pTopicFilter, uint16_t handlerIndex) {
+    const char *pLevel = pTopicFilter;
+    const char *pEnd;
+    uint16_t parent = MQTT_TOPIC_TRIE_NIL;
+    uint16_t node;
+    uint32_t levelHash;
+    size_t levelLen;
+
+    if(NULL == pTrie || NULL == pTopicFilter) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    if(MQTT_TOPIC_TRIE_NIL == handlerIndex) {
+        return FAILURE;
+    }
+
+    if(!MQTTTopicTrie_hasRoomFor(pTrie, pTopicFilter)) {
+        return MQTT_MAX_SUBSCRIPTIONS_REACHED_ERROR;
+    }
+
+    pEnd = pTopicFilter + strlen(pTopicFilter);
+    while(1) {
+        levelLen = getLevelLength(pLevel, pEnd);
+        levelHash = hashLevel(pLevel, levelLen);
+        node = findChild(pTrie, parent, levelHash, levelLen);
+        if(MQTT_TOPIC_TRIE_NIL == node) {
+            node = allocNode(pTrie, parent, levelHash, levelLen);
+        }
+        if(pLevel + levelLen == pEnd) {
+            break;
+        }
+        parent = node;
+        pLevel += levelLen + 1;
+    }
+
+    if(0 == pTrie->pNodes[node].filterCount || handlerIndex < pTrie->pNodes[node].handlerIndex) {
+        pTrie->pNodes[node].handlerIndex = handlerIndex;
+    }
+    pTrie->pNodes[node].filterCount++;
+
+    return SUCCESS;
+}
+
+MQTTReturnCode MQTTTopicTrie_remove(MQTTTopicTrie *pTrie, const char *pTopicFilter, uint16_t handlerIndex) {
+    uint16_t node;
+    uint16_t parent;
+
+    if(NULL == pTrie || NULL == pTopicFilter) {
+        return MQTT_NULL_VALUE_ERROR;
+    }
+
+    node = findFilter(pTrie, pTopicFilter);
+    if(MQTT_TOPIC_TRIE_NIL == node || 0 == pTrie->pNodes[node].filterCount) {
+        return FAILURE;
+    }
+
+    pTrie->pNodes[node].filterCount--;
+    if(0 == pTrie->pNodes[node].filterCount) {
+        pTrie->pNodes[node].handlerIndex = MQTT_TOPIC_TRIE_NIL;
+    } else if(handlerIndex == pTrie->pNodes[node].handlerIndex) {
+        /* The remaining filters are not known here. Zero is never above their lowest
+         * handler index, so matches stay correct and are sorted out by the caller's check */
+        pTrie->pNodes[node].handlerIndex = 0;
+    }
+
+    /* prune the levels that no filter uses any more */
+    while(MQTT_TOPIC_TRIE_NIL != node && 0 == pTrie->pNodes[node].filterCount
+          && 0 == pTrie->pNodes[node].childCount) {
+        parent = pTrie->pNodes[node].parent;
+        freeNode(pTrie, node);
+        node = parent;
+    }
+
+    return SUCCESS;
+}
+
+/**
+ * Returns the lowest handler index among the filters that match the topic, or
+ * MQTT_TOPIC_TRIE_NIL if none does. See MQTTTopicTrie.h for why the caller must
+ * confirm the result against the handler's filter.
+ */
+uint16_t MQTTTopicTrie_match(MQTTTopicTrie *pTrie, const char *pTopicName, size_t topicNameLen) {
+    TopicMatchContext ctx;
+
+    if(NULL == pTrie || NULL == pTopicName || pTrie->freeCount == pTrie->nodeCount) {
+        return MQTT_TOPIC_TRIE_NIL;
+    }
+
+    ctx.pTrie = pTrie;
+    ctx.pTopicEnd = pTopicName + topicNameLen;
+    ctx.plusHash = hashLevel("+", 1);
+    ctx.hashHash = hashLevel("#", 1);
+    ctx.bestHandlerIndex = MQTT_TOPIC_TRIE_NIL;
+
+    matchLevel(&ctx, MQTT_TOPIC_TRIE_NIL, pTopicName);
+
+    return ctx.bestHandlerIndex;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file MQTTTopicTrie.h
+ * @brief Subscription index used to find the message handler for an incoming topic
+ *
+ * Topic filters are stored level by level in a trie whose nodes come from a caller
+ * supplied array.  Children are found through a hash of the parent node and the level
+ * text, so matching a topic costs a constant number of lookups per topic level no
+ * matter how many filters are subscribed.
+ *
+ * Nodes keep only a hash and the length of their level, never a pointer to the filter
+ * string, because callers are free to reuse a filter buffer once it is unsubscribed.
+ * As a consequence the handler index returned by MQTTTopicTrie_match is a candidate:
+ * it is never greater than the index of the first handler whose filter matches, but
+ * it must be confirmed against that handler's filter before use.
+ */
+
+#ifndef __MQTT_TOPIC_TRIE_H
+#define __MQTT_TOPIC_TRIE_H
+
+#include "stdint.h"
+#include "stddef.h"
+
+#include "MQTTReturnCodes.h"
+
+#define MQTT_TOPIC_TRIE_NIL 0xFFFF	///< Marks the absence of a node or of a handler index
+
+/**
+ * @brief One level of one or more topic filters
+ */
+typedef struct {
+    uint32_t levelHash;     ///< Hash of the level text
+    uint16_t levelLen;      ///< Length of the level text
+    uint16_t parent;        ///< Parent node, MQTT_TOPIC_TRIE_NIL for the first level
+    uint16_t nextInBucket;  ///< Next node in the same hash bucket, or next free node
+    uint16_t bucketHead;    ///< First node of the hash bucket that has this node's index
+    uint16_t childCount;    ///< Number of nodes that have this node as parent
+    uint16_t filterCount;   ///< Number of subscribed filters ending at this node
+    uint16_t handlerIndex;  ///< Lowest handler index of the filters ending at this node
+} MQTTTopicTrieNode;
+
+/**
+ * @brief Trie of subscribed topic filters
+ */
+typedef struct {
+    MQTTTopicTrieNode *pNodes;  ///< Caller supplied node storage
+    uint16_t nodeCount;         ///< Number of nodes in pNodes
+    uint16_t freeCount;         ///< Number of nodes not in use
+    uint16_t freeHead;          ///< First node of the free list
+} MQTTTopicTrie;
+
+MQTTReturnCode MQTTTopicTrie_init(MQTTTopicTrie *pTrie, MQTTTopicTrieNode *pNodes, uint16_t nodeCount);
+uint8_t MQTTTopicTrie_hasRoomFor(MQTTTopicTrie *pTrie, const char *pTopicFilter);
+MQTTReturnCode MQTTTopicTrie_insert(MQTTTopicTrie *pTrie, const char *pTopicFilter, uint16_t handlerIndex);
+MQTTReturnCode MQTTTopicTrie_remove(MQTTTopicTrie *pTrie, const char *pTopicFilter, uint16_t handlerIndex);
+uint16_t MQTTTopicTrie_match(MQTTTopicTrie *pTrie, const char *pTopicName, size_t topicNameLen);
+
+#endif //__MQTT_TOPIC_TRIE_H
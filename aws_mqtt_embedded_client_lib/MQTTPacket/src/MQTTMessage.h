@@ -53,6 +53,7 @@ typedef struct {
     uint16_t id;
     void *payload;
     size_t payloadlen;
+    uint32_t ttlSec;    /* Only used when the message goes to the offline queue, 0 for the queue's default */
 }MQTTMessage;
 
 #endif //__MQTT_MESSAGE_H
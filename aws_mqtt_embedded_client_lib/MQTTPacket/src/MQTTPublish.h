@@ -32,6 +32,11 @@ DLLExport MQTTReturnCode MQTTSerialize_publish(unsigned char *buf, size_t buflen
                                                MQTTString topicName, unsigned char *payload, size_t payloadlen,
                                                uint32_t *serialized_len);
 
+DLLExport MQTTReturnCode MQTTSerialize_publishHeader(unsigned char *buf, size_t buflen, uint8_t dup,
+                                                     QoS qos, uint8_t retained, uint16_t packetid,
+                                                     MQTTString topicName, size_t payloadlen,
+                                                     uint32_t *serialized_len);
+
 DLLExport MQTTReturnCode MQTTDeserialize_publish(unsigned char *dup, QoS *qos,
                                                  unsigned char *retained, uint16_t *packetid,
                                                  MQTTString* topicName, unsigned char **payload,
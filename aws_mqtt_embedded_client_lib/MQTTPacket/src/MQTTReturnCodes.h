@@ -23,6 +23,7 @@
 
 /* all failure return codes must be negative */
 typedef enum {
+    MQTT_PUBLISH_QUEUED = 6,
     MQTT_NETWORK_MANUALLY_DISCONNECTED = 5,
     MQTT_CONNACK_CONNECTION_ACCEPTED = 4,
     MQTT_ATTEMPTING_RECONNECT = 3,
@@ -46,7 +47,10 @@ typedef enum {
     MQTT_CONNACK_SERVER_UNAVAILABLE_ERROR = -15,
     MQTT_CONNACK_BAD_USERDATA_ERROR = -16,
     MQTT_CONNACK_NOT_AUTHORIZED_ERROR = -17,
-	MQTT_BUFFER_RX_MESSAGE_INVALID = -18
+	MQTT_BUFFER_RX_MESSAGE_INVALID = -18,
+    MQTT_PUBLISH_WINDOW_FULL_ERROR = -19,
+    MQTT_REQUEST_TIMEOUT_ERROR = -20,
+    MQTT_OFFLINE_QUEUE_FULL_ERROR = -21
 }MQTTReturnCode;
 
 #endif //__MQTT_ERRORCODES_H
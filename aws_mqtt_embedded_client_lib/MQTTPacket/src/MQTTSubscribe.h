@@ -18,6 +18,8 @@
 #ifndef MQTTSUBSCRIBE_H_
 #define MQTTSUBSCRIBE_H_
 
+#define MQTT_SUBACK_FAILURE 0x80  /* Return code in a SUBACK for a topic filter the server rejected */
+
 #if !defined(DLLImport)
   #define DLLImport 
 #endif
@@ -147,7 +147,7 @@ MQTTReturnCode MQTTDeserialize_suback(uint16_t *packetid, uint32_t maxcount,
 
 	*count = 0;
 	while(curdata < enddata) {
-		if(*count > maxcount) {
+		if(*count >= maxcount) {
 			FUNC_EXIT_RC(FAILURE);
 			return FAILURE;
 		}
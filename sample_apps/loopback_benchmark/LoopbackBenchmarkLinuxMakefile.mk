@@ -0,0 +1,62 @@
+CC = gcc
+
+#remove @ for no make command prints
+DEBUG=@
+
+APP_DIR = .
+APP_INCLUDE_DIRS += -I $(APP_DIR)
+APP_NAME=loopback_benchmark
+APP_SRC_FILES=$(APP_NAME).c
+
+#IoT client directory
+IOT_CLIENT_DIR=../../aws_iot_src
+IOT_INCLUDE_DIRS += -I $(IOT_CLIENT_DIR)/protocol/mqtt
+IOT_INCLUDE_DIRS += -I $(IOT_CLIENT_DIR)/protocol/mqtt/aws_iot_embedded_client_wrapper
+IOT_INCLUDE_DIRS += -I $(IOT_CLIENT_DIR)/protocol/mqtt/aws_iot_embedded_client_wrapper/platform_linux
+IOT_INCLUDE_DIRS += -I $(IOT_CLIENT_DIR)/protocol/mqtt/aws_iot_embedded_client_wrapper/platform_linux/common
+# The network goes to a broker stub in the same process
+IOT_INCLUDE_DIRS += -I $(IOT_CLIENT_DIR)/protocol/mqtt/aws_iot_embedded_client_wrapper/platform_linux/loopback
+IOT_INCLUDE_DIRS += -I $(IOT_CLIENT_DIR)/utils
+
+PLATFORM_COMMON_DIR = $(IOT_CLIENT_DIR)/protocol/mqtt/aws_iot_embedded_client_wrapper/platform_linux/common
+PLATFORM_LOOPBACK_DIR = $(IOT_CLIENT_DIR)/protocol/mqtt/aws_iot_embedded_client_wrapper/platform_linux/loopback
+IOT_SRC_FILES += $(shell find $(PLATFORM_COMMON_DIR)/ -name '*.c')
+IOT_SRC_FILES += $(shell find $(PLATFORM_LOOPBACK_DIR)/ -name '*.c')
+
+#MQTT Paho Embedded C client directory
+MQTT_DIR = ../../aws_mqtt_embedded_client_lib
+MQTT_C_DIR = $(MQTT_DIR)/MQTTClient-C/src
+MQTT_EMB_DIR = $(MQTT_DIR)/MQTTPacket/src
+
+MQTT_INCLUDE_DIR += -I $(MQTT_EMB_DIR)
+MQTT_INCLUDE_DIR += -I $(MQTT_C_DIR)
+
+MQTT_SRC_FILES += $(shell find $(MQTT_EMB_DIR)/ -name '*.c')
+MQTT_SRC_FILES += $(MQTT_C_DIR)/MQTTClient.c
+MQTT_SRC_FILES += $(MQTT_C_DIR)/MQTTTopicTrie.c
+MQTT_SRC_FILES += $(MQTT_C_DIR)/MQTTOfflineQueue.c
+MQTT_SRC_FILES += $(MQTT_C_DIR)/MQTTReconnectPolicy.c
+
+#Aggregate all include and src directories
+INCLUDE_ALL_DIRS += $(IOT_INCLUDE_DIRS) 
+INCLUDE_ALL_DIRS += $(MQTT_INCLUDE_DIR) 
+INCLUDE_ALL_DIRS += $(APP_INCLUDE_DIRS)
+ 
+SRC_FILES += $(MQTT_SRC_FILES)
+SRC_FILES += $(APP_SRC_FILES)
+SRC_FILES += $(IOT_SRC_FILES)
+
+COMPILER_FLAGS += -O2
+
+#If the processor is big endian uncomment the compiler flag
+#COMPILER_FLAGS += -DREVERSED
+
+MAKE_CMD = $(CC) $(SRC_FILES) $(COMPILER_FLAGS) -o $(APP_NAME) $(LD_FLAG) $(INCLUDE_ALL_DIRS)
+
+all:
+	$(PRE_MAKE_CMD)
+	$(DEBUG)$(MAKE_CMD)
+	$(POST_MAKE_CMD)
+	
+clean:
+	rm -rf $(APP_DIR)/$(APP_NAME)	
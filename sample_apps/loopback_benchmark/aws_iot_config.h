@@ -0,0 +1,38 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file aws_iot_config.h
+ * @brief AWS IoT specific configuration file for the loopback benchmark
+ *
+ * The benchmark connects to the broker stub of the loopback network, only the values the MQTT client headers and the stub need are defined.
+ */
+
+#ifndef SRC_LOOPBACK_BENCHMARK_CONFIG_H_
+#define SRC_LOOPBACK_BENCHMARK_CONFIG_H_
+
+// MQTT PubSub
+#define AWS_IOT_MQTT_TX_BUF_LEN 512 ///< Any time a message is sent out through the MQTT layer it is serialized into this buffer. For a publish only the header and topic are copied here, the payload is written to the network straight from the application's memory
+#define AWS_IOT_MQTT_RX_BUF_LEN 512 ///< Any message that comes into the device should be less than this buffer size. If a received message is bigger than this buffer size the message will be dropped.
+#define AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS 5 ///< Maximum number of topic filters the MQTT client can handle at any given time
+
+// Auto Reconnect specific config
+#define AWS_IOT_MQTT_MIN_RECONNECT_WAIT_INTERVAL 1000 ///< Minimum time before the First reconnect attempt is made as part of the exponential back-off algorithm
+#define AWS_IOT_MQTT_MAX_RECONNECT_WAIT_INTERVAL 8000 ///< Maximum time interval after which exponential back-off will stop attempting to reconnect.
+
+// Loopback network
+#define AWS_IOT_LOOPBACK_BUF_LEN 16384 ///< Bytes each way between the client and the broker stub of the loopback network. Must hold the largest packet, a client that does not read blocks its writes once they are full
+
+#endif /* SRC_LOOPBACK_BENCHMARK_CONFIG_H_ */
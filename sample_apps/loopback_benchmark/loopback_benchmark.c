@@ -0,0 +1,169 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file loopback_benchmark.c
+ * @brief Measures the message throughput of the MQTT client without a network
+ *
+ * The client is built with the loopback network, whose reads and writes go to a broker stub
+ * in the same process, so the numbers are those of the client, the packet serialization and
+ * a memory copy. For each QoS the benchmark
+ *  - publishes to a topic nobody subscribed to with MQTTPublish, which for QoS1 and QoS2
+ *    returns once the publish is acknowledged
+ *  - publishes to a topic the client subscribed to, and reads the message the broker sends
+ *    back with MQTTProcessReadable, the part of MQTTYield that does not wait
+ *
+ * No connection to AWS IoT is made.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "aws_iot_error.h"
+#include "MQTTClient.h"
+
+#define NUM_MESSAGES 100000
+#define BENCH_TOPIC "bench/loopback/sink"
+#define ECHO_TOPIC "bench/loopback/echo"
+#define BENCH_PAYLOAD "{\"state\":{\"reported\":{\"temperature\":21}}}"
+
+static unsigned long receivedCount = 0;
+
+static void messageReceived(MessageData *pData) {
+	receivedCount++;
+}
+
+/* The client requires one, messageReceived does not use it */
+static void unusedApplicationHandler(void) {
+}
+
+static double nowNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+static double startNs;
+
+static void beginRun(void) {
+	startNs = nowNs();
+}
+
+static void endRun(const char *pName, QoS qos) {
+	double elapsedNs = nowNs() - startNs;
+
+	printf("%-40s QoS%d | %10.0f msgs/s | %8.1f ns/msg\n", pName, qos,
+			NUM_MESSAGES * 1e9 / elapsedNs, elapsedNs / NUM_MESSAGES);
+}
+
+static unsigned char writeBuf[AWS_IOT_MQTT_TX_BUF_LEN];
+static unsigned char readBuf[AWS_IOT_MQTT_RX_BUF_LEN];
+static struct MessageHandlers handlers[AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS];
+static MQTTTopicTrieNode trieNodes[16];
+static MQTTSubscriptionPool pool = { handlers, AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS, trieNodes, 16 };
+/* Zeroed, as the loopback network needs it before the first iot_tls_init */
+static Client client;
+
+static int publish(QoS qos) {
+	MQTTMessage msg;
+	uint32_t i;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.qos = qos;
+	msg.payload = BENCH_PAYLOAD;
+	msg.payloadlen = strlen(BENCH_PAYLOAD);
+
+	for (i = 0; i < NUM_MESSAGES; i++) {
+		if (SUCCESS != MQTTPublish(&client, BENCH_TOPIC, &msg)) {
+			printf("publish %u failed\n", i);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int publishEcho(QoS qos) {
+	MQTTMessage msg;
+	uint32_t i;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.qos = qos;
+	msg.payload = BENCH_PAYLOAD;
+	msg.payloadlen = strlen(BENCH_PAYLOAD);
+
+	receivedCount = 0;
+	for (i = 0; i < NUM_MESSAGES; i++) {
+		if (SUCCESS != MQTTPublish(&client, ECHO_TOPIC, &msg)) {
+			printf("publish %u failed\n", i);
+			return -1;
+		}
+		/* With QoS1 and QoS2 the echo may already have been read while waiting for the ack */
+		while (receivedCount <= i) {
+			if (SUCCESS != MQTTProcessReadable(&client)) {
+				printf("echo %u not received\n", i);
+				return -1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	TLSConnectParams tlsParams;
+	MQTTPacket_connectData options = MQTTPacket_connectData_initializer;
+	QoS qos;
+
+	memset(&tlsParams, 0, sizeof(tlsParams));
+	tlsParams.timeout_ms = 2000;
+	if (SUCCESS != MQTTClient(&client, 2000, writeBuf, sizeof(writeBuf), readBuf, sizeof(readBuf),
+			&pool, 0, iot_tls_init, &tlsParams)) {
+		printf("client init failed\n");
+		return -1;
+	}
+
+	options.clientID.cstring = "loopback_benchmark";
+	options.keepAliveInterval = 600;
+	if (SUCCESS != MQTTConnect(&client, &options)) {
+		printf("connect failed\n");
+		return -1;
+	}
+	/* Granted QoS2, every echo comes back at the QoS it was published with */
+	if (SUCCESS != MQTTSubscribe(&client, ECHO_TOPIC, QOS2, messageReceived, unusedApplicationHandler)) {
+		printf("subscribe failed\n");
+		return -1;
+	}
+
+	printf("Throughput over %d messages of %u bytes\n", NUM_MESSAGES, (unsigned int) strlen(BENCH_PAYLOAD));
+
+	for (qos = QOS0; qos <= QOS2; qos++) {
+		beginRun();
+		if (0 != publish(qos)) {
+			return -1;
+		}
+		endRun("MQTTPublish", qos);
+
+		beginRun();
+		if (0 != publishEcho(qos)) {
+			return -1;
+		}
+		endRun("MQTTPublish + echo MQTTProcessReadable", qos);
+	}
+
+	MQTTDisconnect(&client);
+
+	return 0;
+}
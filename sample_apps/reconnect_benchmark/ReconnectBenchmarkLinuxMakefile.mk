@@ -0,0 +1,39 @@
+CC = gcc
+
+#remove @ for no make command prints
+DEBUG=@
+
+APP_DIR = .
+APP_INCLUDE_DIRS += -I $(APP_DIR)
+APP_NAME=reconnect_benchmark
+APP_SRC_FILES=$(APP_NAME).c
+
+#MQTT Paho Embedded C client directory
+MQTT_DIR = ../../aws_mqtt_embedded_client_lib
+MQTT_C_DIR = $(MQTT_DIR)/MQTTClient-C/src
+
+MQTT_INCLUDE_DIR += -I $(MQTT_C_DIR)
+
+#The simulation only needs the reconnect policy
+MQTT_SRC_FILES += $(MQTT_C_DIR)/MQTTReconnectPolicy.c
+
+#Aggregate all include and src directories
+INCLUDE_ALL_DIRS += $(MQTT_INCLUDE_DIR) 
+INCLUDE_ALL_DIRS += $(APP_INCLUDE_DIRS)
+ 
+SRC_FILES += $(MQTT_SRC_FILES)
+SRC_FILES += $(APP_SRC_FILES)
+
+COMPILER_FLAGS += -O2
+#If the processor is big endian uncomment the compiler flag
+#COMPILER_FLAGS += -DREVERSED
+
+MAKE_CMD = $(CC) $(SRC_FILES) $(COMPILER_FLAGS) -o $(APP_NAME) $(LD_FLAG) $(INCLUDE_ALL_DIRS)
+
+all:
+	$(PRE_MAKE_CMD)
+	$(DEBUG)$(MAKE_CMD)
+	$(POST_MAKE_CMD)
+	
+clean:
+	rm -rf $(APP_DIR)/$(APP_NAME)	
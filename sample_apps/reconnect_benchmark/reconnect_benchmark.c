@@ -0,0 +1,189 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file reconnect_benchmark.c
+ * @brief Simulates a fleet of devices reconnecting after a broker outage
+ *
+ * 10000 simulated clients lose the broker at the same moment.  The broker is unreachable for
+ * OUTAGE_MS and then accepts at most ACCEPTS_PER_SLOT connections per SLOT_MS, refusing the
+ * rest with "server unavailable" the way an overloaded broker does.  Every client waits the
+ * delays its MQTTReconnectPolicy hands out, exactly as the auto-reconnect of the MQTT client
+ * does, and the benchmark reports how the attempts spread over time for each policy:
+ * the default doubling of the client, doubling that never gives up, decorrelated jitter with
+ * one seed for the whole fleet and with a seed per device, and the latter with the broker's
+ * "server unavailable" taken as a hint.
+ *
+ * No network connection is made, time is simulated.
+ */
+#include <stdio.h>
+#include <string.h>
+
+#include "aws_iot_config.h"
+#include "MQTTReconnectPolicy.h"
+
+#define NUM_CLIENTS 10000
+#define SLOT_MS 100
+#define OUTAGE_MS 10000
+#define ACCEPTS_PER_SLOT 100
+#define SIMULATED_MS 900000
+#define HISTOGRAM_BIN_MS 5000
+#define HISTOGRAM_BINS 12
+#define HISTOGRAM_WIDTH 50
+
+typedef struct {
+	const char *pName;
+	MQTTReconnectStrategy strategy;
+	uint8_t isLegacy;
+	uint8_t isSeededPerDevice;
+	uint8_t isHintTaken;
+} Scenario;
+
+static const Scenario scenarios[] = {
+	{"default: doubling, gives up",         MQTT_RECONNECT_EXPONENTIAL,         1, 0, 0},
+	{"doubling, never gives up",            MQTT_RECONNECT_EXPONENTIAL,         0, 0, 0},
+	{"jitter, one seed for the fleet",      MQTT_RECONNECT_DECORRELATED_JITTER, 0, 0, 0},
+	{"jitter, seed per device",             MQTT_RECONNECT_DECORRELATED_JITTER, 0, 1, 0},
+	{"jitter, seed per device, server hint", MQTT_RECONNECT_DECORRELATED_JITTER, 0, 1, 1},
+};
+
+static MQTTReconnectPolicy policies[NUM_CLIENTS];
+static uint32_t nextAttemptMs[NUM_CLIENTS];	///< MQTT_RECONNECT_GIVE_UP once connected or given up
+static uint32_t attemptsPerSlot[SIMULATED_MS / SLOT_MS];
+
+static void runScenario(const Scenario *pScenario) {
+	MQTTReconnectPolicyConfig config;
+	uint32_t histogram[HISTOGRAM_BINS];
+	uint32_t connected = 0;
+	uint32_t gaveUp = 0;
+	uint32_t totalAttempts = 0;
+	uint32_t peakPerSecond = 0;
+	uint32_t perSecond;
+	uint32_t halfMs = 0;
+	uint32_t ninetyNineMs = 0;
+	uint32_t allMs = 0;
+	uint32_t accepted;
+	uint32_t delayMs;
+	uint32_t slot;
+	uint32_t slotEndMs;
+	uint32_t maxBin = 1;
+	uint32_t i;
+	uint32_t j;
+
+	if (pScenario->isLegacy) {
+		MQTTReconnectPolicy_legacyConfig(&config, AWS_IOT_MQTT_MIN_RECONNECT_WAIT_INTERVAL,
+				AWS_IOT_MQTT_MAX_RECONNECT_WAIT_INTERVAL);
+	} else {
+		memset(&config, 0, sizeof(config));
+		config.strategy = pScenario->strategy;
+		config.minDelayMs = AWS_IOT_MQTT_MIN_RECONNECT_WAIT_INTERVAL;
+		config.maxDelayMs = AWS_IOT_MQTT_MAX_RECONNECT_WAIT_INTERVAL;
+		config.maxAttempts = 0;
+	}
+
+	memset(attemptsPerSlot, 0, sizeof(attemptsPerSlot));
+	for (i = 0; i < NUM_CLIENTS; i++) {
+		/* consecutive serial numbers, or the same seed baked into every device */
+		config.seed = pScenario->isSeededPerDevice ? i + 1 : 1;
+		MQTTReconnectPolicy_init(&policies[i], &config);
+		nextAttemptMs[i] = MQTTReconnectPolicy_nextDelay(&policies[i]);
+	}
+
+	for (slot = 0; slot < SIMULATED_MS / SLOT_MS && connected + gaveUp < NUM_CLIENTS; slot++) {
+		slotEndMs = (slot + 1) * SLOT_MS;
+		accepted = 0;
+		for (i = 0; i < NUM_CLIENTS; i++) {
+			if (MQTT_RECONNECT_GIVE_UP == nextAttemptMs[i] || slotEndMs <= nextAttemptMs[i]) {
+				continue;
+			}
+
+			attemptsPerSlot[slot]++;
+			totalAttempts++;
+			if (OUTAGE_MS <= nextAttemptMs[i] && accepted < ACCEPTS_PER_SLOT) {
+				accepted++;
+				connected++;
+				nextAttemptMs[i] = MQTT_RECONNECT_GIVE_UP;
+				if (0 == halfMs && NUM_CLIENTS / 2 <= connected) {
+					halfMs = slotEndMs;
+				}
+				if (0 == ninetyNineMs && NUM_CLIENTS - NUM_CLIENTS / 100 <= connected) {
+					ninetyNineMs = slotEndMs;
+				}
+				continue;
+			}
+
+			if (OUTAGE_MS <= nextAttemptMs[i] && pScenario->isHintTaken) {
+				/* refused with "server unavailable", what attemptReconnect does with it */
+				MQTTReconnectPolicy_hint(&policies[i], config.maxDelayMs);
+			}
+			delayMs = MQTTReconnectPolicy_nextDelay(&policies[i]);
+			if (MQTT_RECONNECT_GIVE_UP == delayMs) {
+				gaveUp++;
+				nextAttemptMs[i] = MQTT_RECONNECT_GIVE_UP;
+			} else {
+				nextAttemptMs[i] += delayMs;
+			}
+		}
+	}
+	if (NUM_CLIENTS == connected) {
+		allMs = slot * SLOT_MS;
+	}
+
+	memset(histogram, 0, sizeof(histogram));
+	for (i = 0; i < SIMULATED_MS / SLOT_MS; i += 1000 / SLOT_MS) {
+		perSecond = 0;
+		for (j = i; j < i + 1000 / SLOT_MS; j++) {
+			perSecond += attemptsPerSlot[j];
+		}
+		if (peakPerSecond < perSecond) {
+			peakPerSecond = perSecond;
+		}
+	}
+	for (i = 0; i < HISTOGRAM_BINS * (HISTOGRAM_BIN_MS / SLOT_MS); i++) {
+		histogram[i / (HISTOGRAM_BIN_MS / SLOT_MS)] += attemptsPerSlot[i];
+	}
+	for (i = 0; i < HISTOGRAM_BINS; i++) {
+		if (maxBin < histogram[i]) {
+			maxBin = histogram[i];
+		}
+	}
+
+	printf("\n%s\n", pScenario->pName);
+	printf("  attempts %u, peak %u/s, connected %u, gave up %u\n", totalAttempts, peakPerSecond, connected, gaveUp);
+	printf("  50%% connected after %.1f s, 99%% after %.1f s, all after %.1f s (0: never)\n",
+			halfMs / 1000.0, ninetyNineMs / 1000.0, allMs / 1000.0);
+	for (i = 0; i < HISTOGRAM_BINS; i++) {
+		printf("  %3u-%3us %6u ", i * HISTOGRAM_BIN_MS / 1000, (i + 1) * HISTOGRAM_BIN_MS / 1000, histogram[i]);
+		for (j = 0; j < (uint32_t) ((uint64_t) histogram[i] * HISTOGRAM_WIDTH / maxBin); j++) {
+			putchar('#');
+		}
+		putchar('\n');
+	}
+}
+
+int main(int argc, char** argv) {
+	uint32_t i;
+
+	printf("%d clients disconnected at 0 s, the broker is back after %d s and accepts %d connections/s\n",
+			NUM_CLIENTS, OUTAGE_MS / 1000, ACCEPTS_PER_SLOT * 1000 / SLOT_MS);
+	printf("Reconnect delays between %d ms and %d ms\n", AWS_IOT_MQTT_MIN_RECONNECT_WAIT_INTERVAL,
+			AWS_IOT_MQTT_MAX_RECONNECT_WAIT_INTERVAL);
+
+	for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		runScenario(&scenarios[i]);
+	}
+
+	return 0;
+}
@@ -0,0 +1,87 @@
+CC = gcc
+
+#remove @ for no make command prints
+DEBUG=@
+
+APP_DIR = .
+APP_NAME=shadow_sample
+APP_INCLUDE_DIRS += -I $(APP_DIR)
+APP_SRC_FILES=$(APP_NAME).c
+
+#IoT client directory
+
+
+IOT_CLIENT_DIR=../../aws_iot_src
+
+PLATFORM_DIR = $(IOT_CLIENT_DIR)/protocol/mqtt/aws_iot_embedded_client_wrapper/platform_linux/plain
+PLATFORM_COMMON_DIR = $(IOT_CLIENT_DIR)/protocol/mqtt/aws_iot_embedded_client_wrapper/platform_linux/common
+SHADOW_SRC_DIR= $(IOT_CLIENT_DIR)/shadow
+
+
+IOT_INCLUDE_DIRS += -I $(IOT_CLIENT_DIR)/protocol/mqtt
+IOT_INCLUDE_DIRS += -I $(IOT_CLIENT_DIR)/protocol/mqtt/aws_iot_embedded_client_wrapper
+IOT_INCLUDE_DIRS += -I $(IOT_CLIENT_DIR)/protocol/mqtt/aws_iot_embedded_client_wrapper/platform_linux
+IOT_INCLUDE_DIRS += -I $(PLATFORM_COMMON_DIR)
+IOT_INCLUDE_DIRS += -I $(PLATFORM_DIR)
+IOT_INCLUDE_DIRS += -I $(SHADOW_SRC_DIR)
+IOT_INCLUDE_DIRS += -I $(IOT_CLIENT_DIR)/utils
+IOT_INCLUDE_DIRS += -I $(IOT_CLIENT_DIR)/shadow
+
+IOT_SRC_FILES += $(IOT_CLIENT_DIR)/protocol/mqtt/aws_iot_embedded_client_wrapper/aws_iot_mqtt_embedded_client_wrapper.c
+IOT_SRC_FILES += $(IOT_CLIENT_DIR)/utils/jsmn.c
+IOT_SRC_FILES += $(IOT_CLIENT_DIR)/utils/aws_iot_json_utils.c
+IOT_SRC_FILES += $(IOT_CLIENT_DIR)/utils/aws_iot_timer_wheel.c
+IOT_SRC_FILES += $(shell find $(SHADOW_SRC_DIR)/ -name '*.c')
+IOT_SRC_FILES += $(shell find $(PLATFORM_DIR)/ -name '*.c')
+IOT_SRC_FILES += $(shell find $(PLATFORM_COMMON_DIR)/ -name '*.c')
+
+#MQTT Paho Embedded C client directory
+MQTT_DIR = ../../aws_mqtt_embedded_client_lib
+MQTT_C_DIR = $(MQTT_DIR)/MQTTClient-C/src
+MQTT_EMB_DIR = $(MQTT_DIR)/MQTTPacket/src
+
+MQTT_INCLUDE_DIR += -I $(MQTT_EMB_DIR)
+MQTT_INCLUDE_DIR += -I $(MQTT_C_DIR)
+
+MQTT_SRC_FILES += $(shell find $(MQTT_EMB_DIR)/ -name '*.c')
+MQTT_SRC_FILES += $(MQTT_C_DIR)/MQTTClient.c
+MQTT_SRC_FILES += $(MQTT_C_DIR)/MQTTTopicTrie.c
+MQTT_SRC_FILES += $(MQTT_C_DIR)/MQTTOfflineQueue.c
+MQTT_SRC_FILES += $(MQTT_C_DIR)/MQTTReconnectPolicy.c
+
+#No TLS library, the connection is plain TCP.  Only for a broker behind a local TLS-terminating
+#proxy or for measurements, AWS IoT itself only accepts TLS connections
+LD_FLAG := -ldl
+
+#Aggregate all include and src directories
+INCLUDE_ALL_DIRS += $(IOT_INCLUDE_DIRS) 
+INCLUDE_ALL_DIRS += $(MQTT_INCLUDE_DIR) 
+INCLUDE_ALL_DIRS += $(APP_INCLUDE_DIRS)
+ 
+SRC_FILES += $(MQTT_SRC_FILES)
+SRC_FILES += $(APP_SRC_FILES)
+SRC_FILES += $(IOT_SRC_FILES)
+
+# Logging level control
+LOG_FLAGS += -DIOT_DEBUG
+LOG_FLAGS += -DIOT_INFO
+LOG_FLAGS += -DIOT_WARN
+LOG_FLAGS += -DIOT_ERROR
+
+COMPILER_FLAGS += -g 
+COMPILER_FLAGS += $(LOG_FLAGS)
+#If the processor is big endian uncomment the compiler flag
+#COMPILER_FLAGS += -DREVERSED
+
+#To yield from one thread while other threads publish, subscribe and unsubscribe
+#uncomment the thread support flag and link with pthreads
+#COMPILER_FLAGS += -D_ENABLE_THREAD_SUPPORT_
+#LD_FLAG += -lpthread
+
+MAKE_CMD = $(CC) $(SRC_FILES) $(COMPILER_FLAGS) -o $(APP_NAME) $(EXTERNAL_LIBS) $(LD_FLAG) $(INCLUDE_ALL_DIRS)
+
+all:
+	$(DEBUG)$(MAKE_CMD)
+	
+clean:
+	rm -rf $(APP_DIR)/$(APP_NAME)	
@@ -33,9 +33,21 @@
 // =================================================
 
 // MQTT PubSub
-#define AWS_IOT_MQTT_TX_BUF_LEN 512 ///< Any time a message is sent out through the MQTT layer. The message is copied into this buffer anytime a publish is done. This will also be used in the case of Thing Shadow
-#define AWS_IOT_MQTT_RX_BUF_LEN 512 ///< Any message that comes into the device should be less than this buffer size. If a received message is bigger than this buffer size the message will be dropped.
-#define AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS 5 ///< Maximum number of topic filters the MQTT client can handle at any given time. This should be increased appropriately when using Thing Shadow
+#define AWS_IOT_MQTT_TX_BUF_LEN 512 ///< Any time a message is sent out through the MQTT layer it is serialized into this buffer. For a publish only the header and topic are copied here, the payload is written to the network straight from the application's memory. This will also be used in the case of Thing Shadow
+#define AWS_IOT_MQTT_RX_BUF_LEN 512 ///< Any message that comes into the device should be less than this buffer size. If a received message is bigger than this buffer size the message will be dropped, unless a message chunk handler is set with aws_iot_mqtt_set_message_chunk_handler, in which case only its topic has to fit.
+#define AWS_IOT_MQTT_RX_RING_LEN (AWS_IOT_MQTT_RX_BUF_LEN + 5) ///< Size of the ring that buffers raw bytes read from the network before they are parsed into MQTT packets. Must hold at least one full packet of AWS_IOT_MQTT_RX_BUF_LEN plus its fixed header. Larger values let a whole TLS record be drained with a single read
+#define AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS 5 ///< Maximum number of topic filters the MQTT client can handle at any given time. This sizes the subscription pool the SDK passes to MQTTClient() and should be increased appropriately when using Thing Shadow
+#define AWS_IOT_MQTT_MAX_SUBSCRIBE_BATCH 32 ///< Maximum number of topic filters sent in one SUBSCRIBE control packet when subscribing to several topics at once or resubscribing after a reconnect. Fewer are sent if they do not fit into AWS_IOT_MQTT_TX_BUF_LEN
+#define AWS_IOT_MQTT_MAX_INFLIGHT_PUBLISHES 8 ///< Maximum number of QoS1/QoS2 publishes that can be awaiting their ack at any given time when publishing asynchronously
+#define AWS_IOT_MQTT_MAX_INBOUND_QOS2 16 ///< Maximum number of received QoS2 messages that can be awaiting their PUBREL. Redeliveries of these are acknowledged without calling the message handler again
+#define AWS_IOT_MQTT_OFFLINE_DRAIN_BATCH 16 ///< Maximum number of messages from the offline queue sent with one network write once the client is connected again. Their headers share AWS_IOT_MQTT_TX_BUF_LEN, so fewer are sent if they do not fit
+#define AWS_IOT_MQTT_TX_STAGE_LEN 256 ///< Size of the buffer in which acks, and asynchronous publishes if a flush delay is set, are collected so that they are written together
+#define AWS_IOT_MQTT_MAX_CLIENT_INSTANCES 1 ///< Number of MQTT connections that can be open at the same time, including the default connection used by the aws_iot_mqtt_* functions. Each one has its own buffers and subscription handlers
+#define AWS_IOT_TLS_SESSION_CACHE_LEN 4 ///< Number of endpoints whose last TLS session each connection keeps, so that a reconnect resumes it with an abbreviated handshake instead of a full one
+#define AWS_IOT_TLS_KTLS 0 ///< 1 to let the kernel do the TLS encryption after the handshake, with OpenSSL 3 and a kernel with TLS support, so that aws_iot_mqtt_publish_from_fd sends the file with sendfile. Ignored by the other TLS wrappers
+#define AWS_IOT_DNS_CACHE_LEN 4 ///< Number of endpoints whose addresses are kept, so that a reconnect does not wait for a DNS lookup
+#define AWS_IOT_DNS_CACHE_TTL_SEC 60 ///< Seconds after which the addresses of an endpoint are looked up again. They are used meanwhile, and dropped if none of them can be reached
+#define AWS_IOT_CONNECT_ATTEMPT_DELAY_MS 250 ///< Milliseconds a TCP connect to one address of the endpoint gets before the next address, alternately IPv6 and IPv4, is tried alongside it
 
 // Thing Shadow specific configs
 #define SHADOW_MAX_SIZE_OF_RX_BUFFER AWS_IOT_MQTT_RX_BUF_LEN+1 ///< Maximum size of the SHADOW buffer to store the received Shadow message
@@ -43,6 +55,7 @@
 #define MAX_SIZE_CLIENT_ID_WITH_SEQUENCE MAX_SIZE_OF_UNIQUE_CLIENT_ID_BYTES + 10 ///< This is size of the extra sequence number that will be appended to the Unique client Id
 #define MAX_SIZE_CLIENT_TOKEN_CLIENT_SEQUENCE MAX_SIZE_CLIENT_ID_WITH_SEQUENCE + 20 ///< This is size of the the total clientToken key and value pair in the JSON
 #define MAX_ACKS_TO_COMEIN_AT_ANY_GIVEN_TIME 10 ///< At Any given time we will wait for this many responses. This will correlate to the rate at which the shadow actions are requested
+#define AWS_IOT_SHADOW_ACK_TIMER_TICK_MS 100 ///< Resolution of the shadow request timeouts. Timeouts are rounded up to a whole number of ticks
 #define MAX_THINGNAME_HANDLED_AT_ANY_GIVEN_TIME 10 ///< We could perform shadow action on any thing Name and this is maximum Thing Names we can act on at any given time
 #define MAX_JSON_TOKEN_EXPECTED 120 ///< These are the max tokens that is expected to be in the Shadow JSON document. Include the metadata that gets published
 #define MAX_SHADOW_TOPIC_LENGTH_WITHOUT_THINGNAME 60 ///< All shadow actions have to be published or subscribed to a topic which is of the format $aws/things/{thingName}/shadow/update/accepted. This refers to the size of the topic without the Thing Name
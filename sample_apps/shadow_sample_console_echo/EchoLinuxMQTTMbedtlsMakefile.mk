@@ -26,6 +26,7 @@ SHADOW_SRC_DIR= $(IOT_CLIENT_DIR)/shadow
 IOT_SRC_FILES += $(IOT_CLIENT_DIR)/protocol/mqtt/aws_iot_embedded_client_wrapper/aws_iot_mqtt_embedded_client_wrapper.c
 IOT_SRC_FILES += $(IOT_CLIENT_DIR)/utils/jsmn.c
 IOT_SRC_FILES += $(IOT_CLIENT_DIR)/utils/aws_iot_json_utils.c
+IOT_SRC_FILES += $(IOT_CLIENT_DIR)/utils/aws_iot_timer_wheel.c
 IOT_SRC_FILES += $(shell find $(PLATFORM_DIR)/ -name '*.c')
 IOT_SRC_FILES += $(shell find $(SHADOW_SRC_DIR)/ -name '*.c')
 IOT_SRC_FILES += $(shell find $(PLATFORM_COMMON_DIR)/ -name '*.c')
@@ -40,6 +41,9 @@ MQTT_INCLUDE_DIR += -I $(MQTT_C_DIR)
 
 MQTT_SRC_FILES += $(shell find $(MQTT_EMB_DIR)/ -name '*.c')
 MQTT_SRC_FILES += $(MQTT_C_DIR)/MQTTClient.c
+MQTT_SRC_FILES += $(MQTT_C_DIR)/MQTTTopicTrie.c
+MQTT_SRC_FILES += $(MQTT_C_DIR)/MQTTOfflineQueue.c
+MQTT_SRC_FILES += $(MQTT_C_DIR)/MQTTReconnectPolicy.c
 
 
 #TLS - mbedtls
@@ -73,6 +77,11 @@ COMPILER_FLAGS += $(LOG_FLAGS)
 #If the processor is big endian uncomment the compiler flag
 #COMPILER_FLAGS += -DREVERSED
 
+#To yield from one thread while other threads publish, subscribe and unsubscribe
+#uncomment the thread support flag and link with pthreads
+#COMPILER_FLAGS += -D_ENABLE_THREAD_SUPPORT_
+#LD_FLAG += -lpthread
+
 MBED_TLS_MAKE_CMD = cd $(MBEDTLS_DIR) && make
 
 PRE_MAKE_CMD = $(MBED_TLS_MAKE_CMD)
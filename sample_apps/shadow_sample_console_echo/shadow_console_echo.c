@@ -130,7 +130,7 @@ int main(int argc, char** argv) {
 	 *  #AWS_IOT_MQTT_MIN_RECONNECT_WAIT_INTERVAL
 	 *  #AWS_IOT_MQTT_MAX_RECONNECT_WAIT_INTERVAL
 	 */
-	rc = mqttClient.setAutoReconnectStatus(true);
+	rc = mqttClient.setAutoReconnectStatus(&mqttClient, true);
 	if(NONE_ERROR != rc){
 		ERROR("Unable to set Auto Reconnect to true - %d", rc);
 		return rc;
@@ -0,0 +1,42 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file aws_iot_config.h
+ * @brief AWS IoT specific configuration file for the silent socket benchmark
+ *
+ * The benchmark only opens a TLS connection, only the values the network wrappers need are defined.
+ */
+
+#ifndef SRC_SILENT_SOCKET_BENCHMARK_CONFIG_H_
+#define SRC_SILENT_SOCKET_BENCHMARK_CONFIG_H_
+
+// Get from console
+// =================================================
+#define AWS_IOT_MQTT_HOST              "localhost" ///< Endpoint to connect to, any TLS server that does not send anything before it is sent something
+#define AWS_IOT_MQTT_PORT              8883 ///< default port for MQTT/S
+#define AWS_IOT_ROOT_CA_FILENAME       "rootCA.crt" ///< Root CA file name
+#define AWS_IOT_CERTIFICATE_FILENAME   "cert.pem" ///< device signed certificate file name
+#define AWS_IOT_PRIVATE_KEY_FILENAME   "privkey.pem" ///< Device private key filename
+// =================================================
+
+// TLS
+#define AWS_IOT_TLS_SESSION_CACHE_LEN 4 ///< Number of endpoints whose last TLS session each connection keeps, so that a reconnect resumes it with an abbreviated handshake instead of a full one
+#define AWS_IOT_TLS_KTLS 0 ///< 1 to let the kernel do the TLS encryption after the handshake, with OpenSSL 3 and a kernel with TLS support. Ignored by the other TLS wrappers
+#define AWS_IOT_DNS_CACHE_LEN 4 ///< Number of endpoints whose addresses are kept, so that a reconnect does not wait for a DNS lookup
+#define AWS_IOT_DNS_CACHE_TTL_SEC 60 ///< Seconds after which the addresses of an endpoint are looked up again. They are used meanwhile, and dropped if none of them can be reached
+#define AWS_IOT_CONNECT_ATTEMPT_DELAY_MS 250 ///< Milliseconds a TCP connect to one address of the endpoint gets before the next address, alternately IPv6 and IPv4, is tried alongside it
+
+#endif /* SRC_SILENT_SOCKET_BENCHMARK_CONFIG_H_ */
@@ -0,0 +1,200 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file silent_socket_benchmark.c
+ * @brief Measures the CPU time the TLS network spends waiting on a connection that sends nothing
+ *
+ * The benchmark opens a TLS connection with the network wrapper it is built with, OpenSSL or
+ * mbedTLS, and sends nothing over it.  An MQTT broker such as AWS IoT then stays silent until
+ * it gets a CONNECT, and so does a plain TLS server, for example
+ *
+ *     sleep 3600 | openssl s_server -accept 8883 -cert server.pem -key server.key -CAfile rootCA.crt -Verify 1
+ *
+ * where the sleep keeps s_server from hanging up when its standard input ends.
+ *
+ * The benchmark then times
+ *  - iot_tls_read of a few bytes, which must wait for its whole timeout
+ *  - iot_tls_read_some, the same
+ *  - iot_tls_read_some with a timeout of 0, which must return at once
+ *
+ * and reports the wall and CPU time of each.  A wait that polls the socket uses next to no
+ * CPU, one that spins uses as much CPU as wall time.  The exit code is 0 if every wait timed
+ * out on time and used less than MAX_CPU_PERCENT of it in CPU.
+ */
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "aws_iot_config.h"
+#include "aws_iot_error.h"
+#include "aws_iot_log.h"
+#include "network_interface.h"
+
+#define MAX_CPU_PERCENT 2.0
+#define LATE_MS 100 ///< A wait that ends later than this after its timeout counts as a failure
+
+/**
+ * @brief Default cert location
+ */
+char certDirectory[PATH_MAX + 1] = "../../certs";
+
+/**
+ * @brief Default MQTT HOST URL is pulled from the aws_iot_config.h
+ */
+char HostAddress[255] = AWS_IOT_MQTT_HOST;
+
+/**
+ * @brief Default MQTT port is pulled from the aws_iot_config.h
+ */
+uint16_t port = AWS_IOT_MQTT_PORT;
+
+/**
+ * @brief Timeout of each read on the silent connection
+ */
+uint32_t waitMs = 2000;
+
+static void parseInputArgs(int argc, char** argv) {
+	int opt;
+
+	while (-1 != (opt = getopt(argc, argv, "h:p:c:w:"))) {
+		switch (opt) {
+		case 'h':
+			strncpy(HostAddress, optarg, sizeof(HostAddress) - 1);
+			break;
+		case 'p':
+			port = (uint16_t)atoi(optarg);
+			break;
+		case 'c':
+			strncpy(certDirectory, optarg, sizeof(certDirectory) - 1);
+			break;
+		case 'w':
+			waitMs = (uint32_t)atoi(optarg);
+			break;
+		case '?':
+			if (isprint(optopt)) {
+				WARN("Unknown option `-%c'.", optopt);
+			} else {
+				WARN("Unknown option character `\\x%x'.", optopt);
+			}
+			break;
+		default:
+			ERROR("Error in command line argument parsing");
+			break;
+		}
+	}
+}
+
+static double wallNowMs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec * 1e3 + (double) ts.tv_nsec / 1e6;
+}
+
+static double cpuNowMs(void) {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return (double) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3
+			+ (double) (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+}
+
+/* Runs one read that must time out after timeoutMs, prints what it cost. Returns 0 if it
+ * timed out on time without spinning */
+static int measureWait(const char *pName, Network *pNetwork,
+		int (*read)(Network *, unsigned char *, int, int), uint32_t timeoutMs) {
+	unsigned char buf[4];
+	double startWallMs, startCpuMs, wallMs, cpuMs;
+	int rc;
+
+	startWallMs = wallNowMs();
+	startCpuMs = cpuNowMs();
+	rc = read(pNetwork, buf, sizeof(buf), (int) timeoutMs);
+	cpuMs = cpuNowMs() - startCpuMs;
+	wallMs = wallNowMs() - startWallMs;
+
+	printf("%-30s timeout %5u ms | waited %8.1f ms | CPU %6.2f ms (%5.2f%%) | rc %d\n", pName,
+			timeoutMs, wallMs, cpuMs, (0 < wallMs) ? 100.0 * cpuMs / wallMs : 0.0, rc);
+
+	if (SSL_READ_TIMEOUT_ERROR != rc) {
+		printf("  expected SSL_READ_TIMEOUT_ERROR, the connection is not silent\n");
+		return -1;
+	}
+	if (wallMs < timeoutMs || wallMs > timeoutMs + LATE_MS) {
+		printf("  the read did not end at its timeout\n");
+		return -1;
+	}
+	if (0 < timeoutMs && cpuMs > wallMs * MAX_CPU_PERCENT / 100.0) {
+		printf("  the wait used more than %.0f%% CPU\n", MAX_CPU_PERCENT);
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	Network network;
+	TLSConnectParams tlsParams;
+	char rootCA[2 * PATH_MAX];
+	char clientCRT[2 * PATH_MAX];
+	char clientKey[2 * PATH_MAX];
+	int failures = 0;
+	int rc;
+
+	parseInputArgs(argc, argv);
+
+	snprintf(rootCA, sizeof(rootCA), "%s/%s", certDirectory, AWS_IOT_ROOT_CA_FILENAME);
+	snprintf(clientCRT, sizeof(clientCRT), "%s/%s", certDirectory, AWS_IOT_CERTIFICATE_FILENAME);
+	snprintf(clientKey, sizeof(clientKey), "%s/%s", certDirectory, AWS_IOT_PRIVATE_KEY_FILENAME);
+
+	memset(&tlsParams, 0, sizeof(tlsParams));
+	tlsParams.pRootCALocation = rootCA;
+	tlsParams.pDeviceCertLocation = clientCRT;
+	tlsParams.pDevicePrivateKeyLocation = clientKey;
+	tlsParams.pDestinationURL = HostAddress;
+	tlsParams.DestinationPort = port;
+	tlsParams.timeout_ms = 5000;
+	tlsParams.ServerVerificationFlag = 1;
+
+	/* Zeroed, as the network needs it before the first iot_tls_init */
+	memset(&network, 0, sizeof(network));
+	rc = iot_tls_init(&network);
+	if (NONE_ERROR != rc) {
+		printf("network init failed %d\n", rc);
+		return -1;
+	}
+	rc = network.connect(&network, tlsParams);
+	if (NONE_ERROR != rc) {
+		printf("connect to %s:%u failed %d\n", HostAddress, port, rc);
+		return -1;
+	}
+
+	printf("Waiting on a silent TLS connection to %s:%u\n", HostAddress, port);
+	failures += (0 != measureWait("iot_tls_read", &network, network.mqttread, waitMs));
+	if (NULL != network.mqttreadsome) {
+		failures += (0 != measureWait("iot_tls_read_some", &network, network.mqttreadsome, waitMs));
+		failures += (0 != measureWait("iot_tls_read_some, no wait", &network, network.mqttreadsome, 0));
+	}
+
+	network.disconnect(&network);
+	network.destroy(&network);
+
+	printf("%s\n", (0 == failures) ? "PASS" : "FAIL");
+	return (0 == failures) ? 0 : -1;
+}
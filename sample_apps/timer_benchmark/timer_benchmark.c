@@ -0,0 +1,359 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file timer_benchmark.c
+ * @brief Counts the clock reads the MQTT client makes for each message
+ *
+ * The client is connected to an in-memory broker that acknowledges everything at once, so
+ * no time is spent on the network and the clock reads stand out. The benchmark is linked
+ * with -Wl,--wrap for clock_gettime and gettimeofday and counts every call the client and
+ * the timer layer make while it
+ *  - publishes QoS0 messages with MQTTPublish
+ *  - publishes QoS1 messages with MQTTPublish, which reads the PUBACK before returning
+ *  - publishes QoS1 messages with MQTTPublishAsync and reads the PUBACKs with MQTTProcessReadable
+ *  - receives QoS0 messages with MQTTYield
+ *
+ * No connection to AWS IoT is made.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+
+#include "aws_iot_error.h"
+#include "MQTTClient.h"
+
+#define NUM_MESSAGES 20000
+#define BENCH_TOPIC "bench/timer"
+#define BENCH_PAYLOAD "{\"state\":{\"reported\":{\"temperature\":21}}}"
+#define BROKER_BUF_LEN (4 * 1024 * 1024)
+
+int __real_clock_gettime(clockid_t clockId, struct timespec *pTs);
+int __real_gettimeofday(struct timeval *pTv, void *pTz);
+
+static unsigned long clockReads = 0;
+static unsigned long timeOfDayReads = 0;
+
+int __wrap_clock_gettime(clockid_t clockId, struct timespec *pTs) {
+	clockReads++;
+	return __real_clock_gettime(clockId, pTs);
+}
+
+int __wrap_gettimeofday(struct timeval *pTv, void *pTz) {
+	timeOfDayReads++;
+	return __real_gettimeofday(pTv, pTz);
+}
+
+/* The broker: what the client wrote and what it will read */
+static unsigned char toBroker[BROKER_BUF_LEN];
+static size_t toBrokerLen = 0;
+static unsigned char toClient[BROKER_BUF_LEN];
+static size_t toClientHead = 0;
+static size_t toClientTail = 0;
+static unsigned long receivedCount = 0;
+
+static void brokerSend(const unsigned char *pData, size_t len) {
+	if (toClientHead == toClientTail) {
+		toClientHead = 0;
+		toClientTail = 0;
+	}
+	memcpy(toClient + toClientTail, pData, len);
+	toClientTail += len;
+}
+
+static void brokerAck(unsigned char header, const unsigned char *pPacketId) {
+	unsigned char ack[4];
+
+	ack[0] = header;
+	ack[1] = 2;
+	ack[2] = pPacketId[0];
+	ack[3] = pPacketId[1];
+	brokerSend(ack, sizeof(ack));
+}
+
+static void brokerHandle(const unsigned char *pPacket, const unsigned char *pVariable) {
+	static const unsigned char connack[] = { 0x20, 2, 0, 0 };
+	static const unsigned char pingresp[] = { 0xd0, 0 };
+	unsigned char suback[] = { 0x90, 3, 0, 0, 0 };
+	uint16_t topicLen;
+
+	switch (pPacket[0] >> 4) {
+	case CONNECT:
+		brokerSend(connack, sizeof(connack));
+		break;
+	case PUBLISH:
+		if (QOS1 == ((pPacket[0] >> 1) & 3)) {
+			topicLen = (uint16_t) ((pVariable[0] << 8) | pVariable[1]);
+			brokerAck(PUBACK << 4, pVariable + 2 + topicLen);
+		}
+		break;
+	case SUBSCRIBE:
+		/* the one topic filter is granted QoS0 */
+		suback[2] = pVariable[0];
+		suback[3] = pVariable[1];
+		brokerSend(suback, sizeof(suback));
+		break;
+	case PINGREQ:
+		brokerSend(pingresp, sizeof(pingresp));
+		break;
+	default:
+		break;
+	}
+}
+
+/* Handles every complete packet written so far, the client may write one in pieces */
+static void brokerParse(void) {
+	size_t offset = 0;
+	size_t pos;
+	uint32_t remLen;
+	uint32_t multiplier;
+
+	for (;;) {
+		pos = offset + 1;
+		remLen = 0;
+		multiplier = 1;
+		do {
+			if (pos >= toBrokerLen) {
+				goto done;
+			}
+			remLen += (toBroker[pos] & 127u) * multiplier;
+			multiplier *= 128;
+		} while (toBroker[pos++] & 128u);
+
+		if (toBrokerLen < pos + remLen) {
+			break;
+		}
+		brokerHandle(toBroker + offset, toBroker + pos);
+		offset = pos + remLen;
+	}
+
+done:
+	memmove(toBroker, toBroker + offset, toBrokerLen - offset);
+	toBrokerLen -= offset;
+}
+
+static int benchConnect(Network *pNetwork, TLSConnectParams params) {
+	return 0;
+}
+
+static int benchWrite(Network *pNetwork, unsigned char *pMsg, int len, int timeout_ms) {
+	memcpy(toBroker + toBrokerLen, pMsg, (size_t) len);
+	toBrokerLen += (size_t) len;
+	brokerParse();
+	return len;
+}
+
+/* Like a socket, waits out the timeout when the broker has nothing to send */
+static int benchRead(Network *pNetwork, unsigned char *pMsg, int len, int timeout_ms) {
+	struct timespec wait;
+
+	if (toClientTail - toClientHead < (size_t) len) {
+		if (0 < timeout_ms) {
+			wait.tv_sec = timeout_ms / 1000;
+			wait.tv_nsec = (timeout_ms % 1000) * 1000000L;
+			nanosleep(&wait, NULL);
+		}
+		return SSL_READ_TIMEOUT_ERROR;
+	}
+
+	memcpy(pMsg, toClient + toClientHead, (size_t) len);
+	toClientHead += (size_t) len;
+	return len;
+}
+
+static void benchDisconnect(Network *pNetwork) {
+}
+
+static int benchIsConnected(Network *pNetwork) {
+	return 1;
+}
+
+static int benchDestroy(Network *pNetwork) {
+	return 0;
+}
+
+static int benchNetworkInit(Network *pNetwork) {
+	memset(pNetwork, 0, sizeof(Network));
+	pNetwork->my_socket = -1;
+	pNetwork->connect = benchConnect;
+	pNetwork->mqttread = benchRead;
+	pNetwork->mqttwrite = benchWrite;
+	pNetwork->disconnect = benchDisconnect;
+	pNetwork->isConnected = benchIsConnected;
+	pNetwork->destroy = benchDestroy;
+	return 0;
+}
+
+static void messageReceived(MessageData *pData) {
+	receivedCount++;
+}
+
+/* The client requires one, messageReceived does not use it */
+static void unusedApplicationHandler(void) {
+}
+
+static double nowNs(void) {
+	struct timespec ts;
+	__real_clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+static unsigned long startClockReads;
+static unsigned long startTimeOfDayReads;
+static double startNs;
+
+static void beginRun(void) {
+	startClockReads = clockReads;
+	startTimeOfDayReads = timeOfDayReads;
+	startNs = nowNs();
+}
+
+static void endRun(const char *pName) {
+	double elapsedNs = nowNs() - startNs;
+
+	printf("%-40s | %5.2f clock_gettime | %5.2f gettimeofday | %7.1f ns\n", pName,
+			(double) (clockReads - startClockReads) / NUM_MESSAGES,
+			(double) (timeOfDayReads - startTimeOfDayReads) / NUM_MESSAGES, elapsedNs / NUM_MESSAGES);
+}
+
+static unsigned char writeBuf[AWS_IOT_MQTT_TX_BUF_LEN];
+static unsigned char readBuf[AWS_IOT_MQTT_RX_BUF_LEN];
+static struct MessageHandlers handlers[AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS];
+static MQTTTopicTrieNode trieNodes[16];
+static MQTTSubscriptionPool pool = { handlers, AWS_IOT_MQTT_NUM_SUBSCRIBE_HANDLERS, trieNodes, 16 };
+static Client client;
+
+static int publishBlocking(QoS qos) {
+	MQTTMessage msg;
+	uint32_t i;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.qos = qos;
+	msg.payload = BENCH_PAYLOAD;
+	msg.payloadlen = strlen(BENCH_PAYLOAD);
+
+	for (i = 0; i < NUM_MESSAGES; i++) {
+		if (SUCCESS != MQTTPublish(&client, BENCH_TOPIC, &msg)) {
+			printf("publish %u failed\n", i);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int publishAsync(void) {
+	MQTTMessage msg;
+	uint32_t i = 0;
+	MQTTReturnCode rc;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.qos = QOS1;
+	msg.payload = BENCH_PAYLOAD;
+	msg.payloadlen = strlen(BENCH_PAYLOAD);
+
+	/* Fill the publish window, then read the acks that make room in it */
+	while (i < NUM_MESSAGES) {
+		rc = MQTTPublishAsync(&client, BENCH_TOPIC, &msg, NULL, NULL, NULL);
+		if (SUCCESS == rc) {
+			i++;
+		} else if (MQTT_PUBLISH_WINDOW_FULL_ERROR == rc) {
+			MQTTProcessReadable(&client);
+		} else {
+			printf("async publish %u failed\n", i);
+			return -1;
+		}
+	}
+	MQTTProcessReadable(&client);
+
+	return 0;
+}
+
+static int receive(void) {
+	unsigned char packet[128];
+	uint32_t packetLen = 0;
+	MQTTString topic = MQTTString_initializer;
+	uint32_t i;
+
+	topic.cstring = BENCH_TOPIC;
+	if (SUCCESS != MQTTSerialize_publish(packet, sizeof(packet), 0, QOS0, 0, 0, topic,
+			(unsigned char *) BENCH_PAYLOAD, strlen(BENCH_PAYLOAD), &packetLen)) {
+		return -1;
+	}
+	for (i = 0; i < NUM_MESSAGES; i++) {
+		brokerSend(packet, packetLen);
+	}
+
+	receivedCount = 0;
+	while (receivedCount < NUM_MESSAGES) {
+		MQTTYield(&client, 10);
+	}
+
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	TLSConnectParams tlsParams;
+	MQTTPacket_connectData options = MQTTPacket_connectData_initializer;
+
+	memset(&tlsParams, 0, sizeof(tlsParams));
+	if (SUCCESS != MQTTClient(&client, 2000, writeBuf, sizeof(writeBuf), readBuf, sizeof(readBuf),
+			&pool, 0, benchNetworkInit, &tlsParams)) {
+		printf("client init failed\n");
+		return -1;
+	}
+
+	options.clientID.cstring = "timer_benchmark";
+	options.keepAliveInterval = 600;
+	if (SUCCESS != MQTTConnect(&client, &options)) {
+		printf("connect failed\n");
+		return -1;
+	}
+	if (SUCCESS != MQTTSubscribe(&client, BENCH_TOPIC, QOS0, messageReceived, unusedApplicationHandler)) {
+		printf("subscribe failed\n");
+		return -1;
+	}
+
+	printf("Clock reads per message over %d messages\n", NUM_MESSAGES);
+
+	beginRun();
+	if (0 != publishBlocking(QOS0)) {
+		return -1;
+	}
+	endRun("MQTTPublish QoS0");
+
+	beginRun();
+	if (0 != publishBlocking(QOS1)) {
+		return -1;
+	}
+	endRun("MQTTPublish QoS1");
+
+	beginRun();
+	if (0 != publishAsync()) {
+		return -1;
+	}
+	endRun("MQTTPublishAsync QoS1 + ProcessReadable");
+
+	beginRun();
+	if (0 != receive()) {
+		return -1;
+	}
+	endRun("MQTTYield receiving QoS0");
+
+	MQTTDisconnect(&client);
+
+	return 0;
+}
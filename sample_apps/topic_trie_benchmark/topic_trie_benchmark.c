@@ -0,0 +1,193 @@
+/*
+ * Copyright 2010-2015 Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License").
+ * You may not use this file except in compliance with the License.
+ * A copy of the License is located at
+ *
+ *  http://aws.amazon.com/apache2.0
+ *
+ * or in the "license" file accompanying this file. This file is distributed
+ * on an "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either
+ * express or implied. See the License for the specific language governing
+ * permissions and limitations under the License.
+ */
+
+/**
+ * @file topic_trie_benchmark.c
+ * @brief Compares topic dispatch through the subscription trie with a linear scan of the filters
+ *
+ * For 1000 and 10000 subscribed filters the benchmark looks up the same set of topics twice:
+ * once the way deliverMessage used to, by testing every filter in turn, and once through
+ * MQTTTopicTrie_match followed by the single confirmation deliverMessage does now. Both must
+ * pick the same handler for every topic. The filters are a mix of exact shadow topics and
+ * telemetry/command filters ending in '+' and '#'.
+ *
+ * No network connection is made.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "MQTTClient.h"
+#include "MQTTTopicTrie.h"
+
+/**
+ * @brief The matcher deliverMessage used for every filter before the trie, defined in MQTTClient.c
+ */
+char isTopicMatched(char *topicFilter, MQTTString *topicName);
+
+#define MAX_FILTERS 10000
+#define MAX_FILTER_LEN 64
+#define NUM_TOPICS 1024
+#define TRIE_NODES 60000
+
+static char filters[MAX_FILTERS][MAX_FILTER_LEN];
+static char topics[NUM_TOPICS][MAX_FILTER_LEN];
+static MQTTTopicTrieNode trieNodes[TRIE_NODES];
+
+static double nowNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec * 1e9 + (double) ts.tv_nsec;
+}
+
+static void buildFilters(uint32_t filterCount) {
+	uint32_t i;
+
+	for (i = 0; i < filterCount; i++) {
+		switch (i % 3) {
+		case 0:
+			sprintf(filters[i], "$aws/things/device%u/shadow/update/delta", i);
+			break;
+		case 1:
+			sprintf(filters[i], "fleet/region%u/device%u/telemetry/+", i % 16, i);
+			break;
+		default:
+			sprintf(filters[i], "fleet/region%u/device%u/cmd/#", i % 16, i);
+			break;
+		}
+	}
+}
+
+static void buildTopics(uint32_t filterCount) {
+	uint32_t i;
+	uint32_t device;
+
+	srand(1);
+	for (i = 0; i < NUM_TOPICS; i++) {
+		device = (uint32_t) rand() % filterCount;
+		if (0 == i % 10) {
+			/* a topic nobody subscribed to */
+			sprintf(topics[i], "fleet/region%u/device%u/status", device % 16, device);
+		} else if (0 == device % 3) {
+			sprintf(topics[i], "$aws/things/device%u/shadow/update/delta", device);
+		} else if (1 == device % 3) {
+			sprintf(topics[i], "fleet/region%u/device%u/telemetry/temperature", device % 16, device);
+		} else {
+			sprintf(topics[i], "fleet/region%u/device%u/cmd/reboot/now", device % 16, device);
+		}
+	}
+}
+
+static int32_t linearLookup(uint32_t filterCount, MQTTString *pTopic) {
+	uint32_t i;
+
+	for (i = 0; i < filterCount; i++) {
+		if (MQTTPacket_equals(pTopic, filters[i]) || isTopicMatched(filters[i], pTopic)) {
+			return (int32_t) i;
+		}
+	}
+
+	return -1;
+}
+
+static int32_t trieLookup(MQTTTopicTrie *pTrie, MQTTString *pTopic) {
+	uint16_t i = MQTTTopicTrie_match(pTrie, pTopic->lenstring.data, (size_t) pTopic->lenstring.len);
+
+	if (MQTT_TOPIC_TRIE_NIL == i) {
+		return -1;
+	}
+
+	/* deliverMessage confirms the candidate against its filter before using it */
+	if (MQTTPacket_equals(pTopic, filters[i]) || isTopicMatched(filters[i], pTopic)) {
+		return (int32_t) i;
+	}
+
+	return -2;
+}
+
+static int runBenchmark(uint32_t filterCount, uint32_t linearRounds, uint32_t trieRounds) {
+	MQTTTopicTrie trie;
+	MQTTString topicStrings[NUM_TOPICS];
+	int32_t expected[NUM_TOPICS];
+	volatile int32_t sink = 0;
+	double start;
+	double linearNs;
+	double trieNs;
+	uint32_t round;
+	uint32_t i;
+
+	buildFilters(filterCount);
+	buildTopics(filterCount);
+
+	if (SUCCESS != MQTTTopicTrie_init(&trie, trieNodes, TRIE_NODES)) {
+		printf("trie init failed\n");
+		return -1;
+	}
+	for (i = 0; i < filterCount; i++) {
+		if (SUCCESS != MQTTTopicTrie_insert(&trie, filters[i], (uint16_t) i)) {
+			printf("ran out of trie nodes at filter %u\n", i);
+			return -1;
+		}
+	}
+
+	for (i = 0; i < NUM_TOPICS; i++) {
+		topicStrings[i].cstring = NULL;
+		topicStrings[i].lenstring.data = topics[i];
+		topicStrings[i].lenstring.len = (int) strlen(topics[i]);
+	}
+
+	start = nowNs();
+	for (round = 0; round < linearRounds; round++) {
+		for (i = 0; i < NUM_TOPICS; i++) {
+			expected[i] = linearLookup(filterCount, &topicStrings[i]);
+			sink += expected[i];
+		}
+	}
+	linearNs = (nowNs() - start) / ((double) linearRounds * NUM_TOPICS);
+
+	for (i = 0; i < NUM_TOPICS; i++) {
+		if (trieLookup(&trie, &topicStrings[i]) != expected[i]) {
+			printf("MISMATCH for %s: linear %d trie %d\n", topics[i], expected[i], trieLookup(&trie, &topicStrings[i]));
+			return -1;
+		}
+	}
+
+	start = nowNs();
+	for (round = 0; round < trieRounds; round++) {
+		for (i = 0; i < NUM_TOPICS; i++) {
+			sink += trieLookup(&trie, &topicStrings[i]);
+		}
+	}
+	trieNs = (nowNs() - start) / ((double) trieRounds * NUM_TOPICS);
+
+	printf("%6u filters | linear scan %10.1f ns/topic | trie %7.1f ns/topic | %7.1fx | %u trie nodes\n",
+			filterCount, linearNs, trieNs, linearNs / trieNs, (unsigned) (trie.nodeCount - trie.freeCount));
+
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	printf("Topic dispatch for %d topics, 10%% of which match no filter\n", NUM_TOPICS);
+
+	if (0 != runBenchmark(1000, 20, 2000)) {
+		return -1;
+	}
+	if (0 != runBenchmark(10000, 2, 2000)) {
+		return -1;
+	}
+
+	return 0;
+}